@@ -0,0 +1,136 @@
+/*============================================================================
+
+  klib
+
+  kresample_bench.c
+
+  Times each resampling implementation the CPU supports against the
+  scalar one, on synthetic images of typical photo and screen sizes,
+  and checks that they all give the same output. Build and run with
+  'make bench' in the klib directory.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <klib/klib.h>
+
+#define BENCH_RUNS 5
+
+static const char *impls[] = { "scalar", "sse2", "avx2", "neon" };
+static const char *filters[] = { "box", "bilinear", "lanczos3" };
+
+typedef struct _BenchCase
+  {
+  int src_width;
+  int src_height;
+  int dst_width;
+  int dst_height;
+  } BenchCase;
+
+static const BenchCase cases[] =
+  {
+  // A camera image that libjpeg couldn't reduce
+  { 4000, 3000, 1920, 1080 },
+  // What libjpeg leaves after reducing an 8-megapixel image by 2
+  { 1632, 1224, 1920, 1080 },
+  // A portrait image on a small screen
+  { 2000, 3000, 1366, 768 },
+  };
+
+/*============================================================================
+
+  bench_make_image
+
+  Smooth gradients with some noise, so that neither the weights nor the
+  clamping are trivial.
+
+  ==========================================================================*/
+static uint8_t *bench_make_image (int width, int height)
+  {
+  uint8_t *image = malloc ((size_t)width * height * 3);
+  uint32_t seed = 12345;
+  for (int y = 0; y < height; y++)
+    {
+    uint8_t *p = image + (size_t)y * width * 3;
+    for (int x = 0; x < width; x++, p += 3)
+      {
+      seed = seed * 1103515245 + 12345;
+      int noise = (seed >> 16) & 0x3f;
+      p[0] = (uint8_t)((x * 255 / width + noise) & 0xff);
+      p[1] = (uint8_t)((y * 255 / height + noise) & 0xff);
+      p[2] = (uint8_t)(((x ^ y) + noise) & 0xff);
+      }
+    }
+  return image;
+  }
+
+/*============================================================================
+
+  bench_run
+
+  Returns the best time, in microseconds, of BENCH_RUNS runs.
+
+  ==========================================================================*/
+static int64_t bench_run (const BenchCase *c, const uint8_t *src,
+    uint8_t *dst, KResampleFilter filter)
+  {
+  int64_t best = -1;
+  for (int i = 0; i < BENCH_RUNS; i++)
+    {
+    int64_t start = ktrace_now ();
+    kresample_scale (src, c->src_width, c->src_height, dst, c->dst_width,
+      c->dst_height, KRESAMPLE_FILL, filter);
+    int64_t t = ktrace_now () - start;
+    if (best < 0 || t < best) best = t;
+    }
+  return best;
+  }
+
+/*============================================================================
+
+  main
+
+  ==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int failures = 0;
+  (void)argc; (void)argv;
+  for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+    {
+    const BenchCase *c = &cases[i];
+    size_t dst_size = (size_t)c->dst_width * c->dst_height * 3;
+    uint8_t *src = bench_make_image (c->src_width, c->src_height);
+    uint8_t *reference = malloc (dst_size);
+    uint8_t *dst = malloc (dst_size);
+    printf ("%dx%d -> %dx%d\n", c->src_width, c->src_height,
+      c->dst_width, c->dst_height);
+
+    for (int f = KRESAMPLE_BOX; f <= KRESAMPLE_LANCZOS3; f++)
+      {
+      kresample_set_impl ("scalar");
+      int64_t scalar = bench_run (c, src, reference, f);
+      printf ("  %-9s scalar %7.1f msec\n", filters[f], scalar / 1000.0);
+      for (size_t j = 1; j < sizeof (impls) / sizeof (impls[0]); j++)
+        {
+        if (!kresample_set_impl (impls[j])) continue;
+        int64_t t = bench_run (c, src, dst, f);
+        BOOL same = memcmp (dst, reference, dst_size) == 0;
+        if (!same) failures++;
+        printf ("  %-9s %-6s %7.1f msec  x%.1f%s\n", filters[f], impls[j],
+          t / 1000.0, (double)scalar / t, same ? "" : "  OUTPUT DIFFERS");
+        }
+      }
+
+    free (dst);
+    free (reference);
+    free (src);
+    }
+  return failures ? 1 : 0;
+  }
+
@@ -14,15 +14,50 @@
 
 #include <stdint.h>
 #include <klib/defs.h>
+#include <klib/kresample.h>
 
 
 BEGIN_DECLS
 
 void     jpegreader_file_to_mem (const char *filename, int *jpeg_height, 
             int *jpeg_width, int *bytespp, char **buffer, char **error);
+/** As jpegreader_file_to_mem, but let libjpeg reduce the image by 1/2,
+    1/4 or 1/8 while decoding, as far as it can without making it 
+    smaller than min_width by min_height. Zero for either means full 
+    size. */
+void     jpegreader_file_to_mem_scaled (const char *filename, 
+            int min_width, int min_height, int *jpeg_height, 
+            int *jpeg_width, int *bytespp, char **buffer, char **error);
+/** Decode an image straight to width x height, placed according to
+    mode, without ever holding the full-size image in memory. libjpeg
+    reduces it as far as it can while decoding, and the rows are then
+    fed through a KResampler a few at a time; with libjpeg-turbo, rows
+    and columns outside the crop are not decoded at all. On success,
+    *buffer is an RGB image with rows of exactly 3*width bytes. 
+    Large images with restart markers at every MCU row are split at
+    the markers, and the parts decoded on several threads. Grayscale
+    and CMYK images are converted to RGB. */
+BOOL     jpegreader_file_to_mem_resampled (const char *filename, 
+            int width, int height, KResampleMode mode, 
+            KResampleFilter filter, uint8_t **buffer, char **error);
+/** As jpegreader_file_to_mem_resampled, but decode into a buffer of
+    at least 3*width*height bytes supplied by the caller -- typically
+    one from a KPool. Its contents are undefined if this fails. */
+BOOL     jpegreader_file_to_buffer_resampled (const char *filename, 
+            int width, int height, KResampleMode mode, 
+            KResampleFilter filter, uint8_t *buffer, char **error);
+/** Set the number of threads used to decode large images, for testing.
+    Zero, the default, means one per CPU (up to 8); one means that the
+    serial decoder is always used. */
+void     jpegreader_set_threads (int threads);
 BOOL     jpegreader_check (const char *filename, char **error);
 BOOL     jpegreader_get_image_size (const char *filename, int *height, 
             int *width, int *components);
+/** As jpegreader_get_image_size, reading no more of the file than it
+    needs to, and leaving none of it in the page cache. If bytes_read
+    is not NULL, it is set to the number of bytes read from the file. */
+BOOL     jpegreader_probe (const char *filename, int *height, 
+            int *width, int *components, int64_t *bytes_read);
 
 END_DECLS
 
@@ -0,0 +1,29 @@
+/*============================================================================
+
+  klib
+
+  jpegwriter.h
+
+  Functions for simplifying the use of libjpeg to write files
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/defs.h>
+
+
+BEGIN_DECLS
+
+/** Write an RGB image, with rows that are exactly 3*width bytes, to
+    a JPEG file. quality is 0-100. Returns FALSE, and sets *error, if
+    the file can't be written. */
+BOOL     jpegwriter_mem_to_file (const char *filename, int width,
+            int height, const uint8_t *buffer, int quality, char **error);
+
+END_DECLS
+
+
@@ -0,0 +1,64 @@
+/*============================================================================
+
+  klib
+
+  keventloop.h
+
+  A minimal epoll-based event loop. Any number of file descriptors can be
+  registered, each with its own handler; the loop sleeps until one of
+  them is ready. Signals and timers are handled by registering signalfd
+  and timerfd descriptors like any other.
+
+  Handlers may add or remove descriptors (including their own) while the
+  loop is running.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+struct _KEventLoop;
+typedef struct _KEventLoop KEventLoop;
+
+/** Called when fd is ready. 'events' is the set of EPOLLxxx flags
+    reported by epoll_wait(). */
+typedef void (*KEventFn) (int fd, uint32_t events, void *user_data);
+
+BEGIN_DECLS
+
+/** Returns NULL, with errno set, if the epoll instance can't be created. */
+extern KEventLoop *keventloop_new (void);
+
+/** Destroy the loop. The registered file descriptors are not closed --
+    they belong to whoever registered them. */
+extern void        keventloop_destroy (KEventLoop *self);
+
+/** Start watching fd for the specified EPOLLxxx events. Returns FALSE,
+    with errno set, if epoll won't accept the descriptor. */
+extern BOOL        keventloop_add (KEventLoop *self, int fd,
+                     uint32_t events, KEventFn fn, void *user_data);
+
+/** Stop watching fd. This must be done before fd is closed. */
+extern void        keventloop_remove (KEventLoop *self, int fd);
+
+/** Dispatch events until keventloop_quit() is called. */
+extern void        keventloop_run (KEventLoop *self);
+
+/** Make keventloop_run() return, after the current batch of events
+    has been dispatched. */
+extern void        keventloop_quit (KEventLoop *self);
+
+/** Arm (or re-arm) a timerfd to expire once, after the specified number
+    of milliseconds, and then every interval_msec milliseconds. An
+    interval of zero makes a one-shot timer; an initial value of zero
+    disarms the timer. */
+extern void        keventloop_set_timer (int timer_fd, int64_t msec,
+                     int64_t interval_msec);
+
+END_DECLS
+
@@ -0,0 +1,28 @@
+/*============================================================================
+
+  klib
+
+  kjson.h
+
+  Helpers for writing JSON. There is no JSON parser in klib; these are
+  for the few places that produce JSON for something else to read --
+  the trace file, for example.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdio.h>
+#include <klib/defs.h>
+#include <klib/types.h>
+
+BEGIN_DECLS
+
+/** Write s to f as a JSON string literal, in quotes. Quotes, 
+    backslashes and control characters are escaped; anything else, 
+    including UTF-8 sequences, is written as it is. */
+extern void kjson_write_string (FILE *f, const char *s);
+
+END_DECLS
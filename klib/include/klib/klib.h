@@ -28,4 +28,13 @@
 #include <klib/datetimeconv.h>
 #include <klib/mathutil.h>
 #include <klib/jpegreader.h>
+#include <klib/jpegwriter.h>
+#include <klib/ktrace.h>
+#include <klib/kjson.h>
+#include <klib/kprobe.h>
+#include <klib/keventloop.h>
+#include <klib/kspawn.h>
+#include <klib/kresample.h>
+#include <klib/kpixconv.h>
+#include <klib/kpool.h>
 
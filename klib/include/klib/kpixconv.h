@@ -0,0 +1,52 @@
+/*============================================================================
+
+  klib
+
+  kpixconv.h
+
+  Conversion of rows of RGB pixels, as produced by jpegreader_file_to_mem,
+  into the pixel formats used by framebuffers and X servers, and of the
+  grayscale and CMYK rows that libjpeg produces into RGB. The 
+  conversions use SIMD instructions where the CPU has them (SSSE3 on x86,
+  NEON on ARM), chosen at run time, with a plain C fallback.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+BEGIN_DECLS
+
+/** Convert n RGB pixels to 32-bit values 0xFFRRGGBB, in host byte order. */
+extern void kpixconv_rgb_to_xrgb8888 (const uint8_t *src, uint32_t *dst,
+              int n);
+
+/** Convert n RGB pixels to 16-bit RGB565 values, in host byte order. */
+extern void kpixconv_rgb_to_rgb565 (const uint8_t *src, uint16_t *dst,
+              int n);
+
+/** Convert n gray values to RGB pixels. */
+extern void kpixconv_gray_to_rgb (const uint8_t *src, uint8_t *dst, int n);
+
+/** Convert n CMYK pixels to RGB. If inverted is TRUE, zero means full
+    ink, as in the files written by Adobe applications (which libjpeg
+    passes on unchanged). */
+extern void kpixconv_cmyk_to_rgb (const uint8_t *src, uint8_t *dst, int n,
+              BOOL inverted);
+
+/** Get the name of the implementation in use: "scalar", "ssse3", or
+    "neon". */
+extern const char *kpixconv_get_impl (void);
+
+/** Disable (or re-enable) the SIMD implementations, for testing and
+    benchmarking. This is not thread-safe, and should be called before
+    any conversions are done. */
+extern void kpixconv_set_simd (BOOL enable);
+
+END_DECLS
+
@@ -0,0 +1,52 @@
+/*============================================================================
+
+  klib
+
+  kpool.h
+
+  A pool of equal-sized buffers, for work that needs a large buffer
+  for each of a long series of items -- decoded images, for example.
+  Returning a buffer to the pool, rather than freeing it, means that
+  the steady state needs no large allocations at all, and does not
+  fragment the heap. The pool is thread-safe.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stddef.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+struct _KPool;
+typedef struct _KPool KPool;
+
+BEGIN_DECLS
+
+/** Create a pool of buffers of buffer_size bytes. Up to max_idle 
+    buffers are kept for re-use; any more than that are freed when they
+    are returned. */
+extern KPool  *kpool_new (size_t buffer_size, int max_idle);
+
+/** Free the pool and its idle buffers. Buffers that are still in use
+    are not affected, and must be freed with free(). */
+extern void    kpool_destroy (KPool *self);
+
+/** Get a buffer from the pool, allocating one if there are none idle.
+    Its contents are undefined. */
+extern void   *kpool_get (KPool *self);
+
+/** Return a buffer got from kpool_get. NULL is ignored. */
+extern void    kpool_put (KPool *self, void *buffer);
+
+/** Free the idle buffers, to give memory back when it is short. Buffers
+    in use are kept, and the pool goes on working as before. Returns the
+    number of bytes freed. */
+extern size_t  kpool_trim (KPool *self);
+
+extern size_t  kpool_get_buffer_size (const KPool *self);
+
+END_DECLS
+
@@ -0,0 +1,80 @@
+/*============================================================================
+
+  klib
+
+  kprobe.h
+
+  Static (USDT) tracepoints. If the systemtap <sys/sdt.h> header is
+  available at build time, the KPROBEn macros expand to SDT probes, which
+  are a single NOP in the code until a tracer (bpftrace, perf, systemtap)
+  attaches to them. Otherwise they expand to nothing. Define
+  KPROBE_DISABLE to leave the probes out even when the header exists.
+
+  Each probe has a semaphore, which the tracer increments while it is
+  attached, so that arguments that cost something to work out need 
+  only be worked out when someone is listening:
+
+  if (KPROBE_ENABLED (lbc, entry_visit)) ...
+
+  The semaphores must be defined, once for each probe, with 
+  KPROBE_DEFINE in the file that fires it.
+
+  To list the probes in the binary:
+
+  bpftrace -l 'usdt:/usr/bin/lbc:*'
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#if !defined(KPROBE_DISABLE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define KPROBE_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef KPROBE_HAVE_SDT
+
+#define KPROBE_DEFINE(provider,name) \
+  __extension__ unsigned short provider##_##name##_semaphore \
+    __attribute__ ((unused)) __attribute__ ((section (".probes")));
+#define KPROBE_ENABLED(provider,name) \
+  __builtin_expect (provider##_##name##_semaphore, 0)
+
+#define KPROBE0(provider,name) DTRACE_PROBE(provider,name)
+#define KPROBE1(provider,name,a1) DTRACE_PROBE1(provider,name,a1)
+#define KPROBE2(provider,name,a1,a2) DTRACE_PROBE2(provider,name,a1,a2)
+#define KPROBE3(provider,name,a1,a2,a3) \
+  DTRACE_PROBE3(provider,name,a1,a2,a3)
+#define KPROBE4(provider,name,a1,a2,a3,a4) \
+  DTRACE_PROBE4(provider,name,a1,a2,a3,a4)
+#define KPROBE5(provider,name,a1,a2,a3,a4,a5) \
+  DTRACE_PROBE5(provider,name,a1,a2,a3,a4,a5)
+
+#else
+
+#define KPROBE_DEFINE(provider,name)
+#define KPROBE_ENABLED(provider,name) 0
+
+// The arguments are mentioned only inside sizeof, so that they are never
+//   evaluated, but variables that exist only to be passed to a probe do
+//   not draw 'unused' warnings.
+#define KPROBE0(provider,name)
+#define KPROBE1(provider,name,a1) do { (void)sizeof (a1); } while (0)
+#define KPROBE2(provider,name,a1,a2) \
+  do { (void)sizeof (a1); (void)sizeof (a2); } while (0)
+#define KPROBE3(provider,name,a1,a2,a3) \
+  do { (void)sizeof (a1); (void)sizeof (a2); (void)sizeof (a3); } while (0)
+#define KPROBE4(provider,name,a1,a2,a3,a4) \
+  do { (void)sizeof (a1); (void)sizeof (a2); (void)sizeof (a3); \
+  (void)sizeof (a4); } while (0)
+#define KPROBE5(provider,name,a1,a2,a3,a4,a5) \
+  do { (void)sizeof (a1); (void)sizeof (a2); (void)sizeof (a3); \
+  (void)sizeof (a4); (void)sizeof (a5); } while (0)
+
+#endif
+
@@ -0,0 +1,96 @@
+/*============================================================================
+
+  klib
+
+  kresample.h
+
+  Resampling of RGB images, as produced by jpegreader_file_to_mem, to a
+  screen size. The scaling is separable -- each source row is resampled
+  horizontally, and then each output row is made from a few of those
+  -- using box, bilinear, or Lanczos-3 filters with precomputed
+  fixed-point weights. The inner loops use SIMD instructions where the
+  CPU has them (SSE2 or AVX2 on x86, NEON on ARM), chosen at run time.
+  All the implementations give exactly the same results.
+
+  A KResampler takes source rows one at a time, and keeps only as many
+  horizontally-resampled rows as the vertical filter needs, so an
+  image can be scaled while it is being decoded, without ever holding
+  the whole source in memory.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+typedef enum
+  {
+  KRESAMPLE_BOX = 0, KRESAMPLE_BILINEAR = 1, KRESAMPLE_LANCZOS3 = 2
+  } KResampleFilter;
+
+/** How an image is fitted to a screen of a different shape. FILL
+    covers the whole screen, cropping equally from both sides in
+    whichever direction the image overflows -- the same as
+    'feh --bg-fill'. FIT shows the whole image, centred, with black
+    borders. */
+typedef enum
+  {
+  KRESAMPLE_FILL = 0, KRESAMPLE_FIT = 1
+  } KResampleMode;
+
+struct _KResampler;
+typedef struct _KResampler KResampler;
+
+BEGIN_DECLS
+
+/** Create a resampler that scales the crop_width x crop_height region
+    at (crop_x, crop_y) of a src_width x src_height image to
+    dst_width x dst_height. Output rows are written to dst, dst_stride
+    bytes apart, as they are completed. */
+extern KResampler *kresampler_new (int src_width, int src_height,
+                     int crop_x, int crop_y, int crop_width,
+                     int crop_height, uint8_t *dst, int dst_width,
+                     int dst_height, int dst_stride,
+                     KResampleFilter filter);
+
+extern void        kresampler_destroy (KResampler *self);
+
+/** Supply the next source row, of 3*src_width bytes. Rows must be
+    supplied in order, starting from row 0. Returns the number of
+    output rows completed so far; when this is dst_height, the rest
+    of the source is not needed. */
+extern int         kresampler_push_row (KResampler *self,
+                     const uint8_t *row);
+
+/** Work out how mode places a src_width x src_height image on a
+    dst_width x dst_height screen: the region of the source that is
+    used, and the rectangle of the screen it covers. */
+extern void        kresample_get_geometry (int src_width, int src_height,
+                     int dst_width, int dst_height, KResampleMode mode,
+                     int *crop_x, int *crop_y, int *crop_width,
+                     int *crop_height, int *out_x, int *out_y,
+                     int *out_width, int *out_height);
+
+/** Scale the whole of src to dst, whose rows are exactly 3*dst_width
+    bytes, according to mode. */
+extern void        kresample_scale (const uint8_t *src, int src_width,
+                     int src_height, uint8_t *dst, int dst_width,
+                     int dst_height, KResampleMode mode,
+                     KResampleFilter filter);
+
+/** Get the name of the implementation in use: "scalar", "sse2", "avx2",
+    or "neon". */
+extern const char *kresample_get_impl (void);
+
+/** Select an implementation by name, or the best one the CPU supports
+    if name is NULL. Returns FALSE if the named implementation is not
+    available. This is for testing and benchmarking; it is not
+    thread-safe, and should be called before any resampling is done. */
+extern BOOL        kresample_set_impl (const char *name);
+
+END_DECLS
+
@@ -0,0 +1,80 @@
+/*============================================================================
+
+  klib
+
+  kspawn.h
+
+  Functions for running programs without a shell. Programs are started
+  with posix_spawn() (which glibc implements using vfork semantics) from
+  an argument vector, so arguments are never re-parsed, and filenames
+  containing quotes, spaces, or dollar signs need no special treatment.
+  All file descriptors above stderr are closed in the child.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <sys/types.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+typedef void (*KSpawnSetupFn) (void);
+
+BEGIN_DECLS
+
+/** Find an executable on $PATH. If name contains a '/', it is checked
+    but not searched for. Returns a string that the caller must free, or
+    NULL if no executable was found. This is intended to be called once,
+    at start-up, so that spawning the program later does not repeat the
+    search. */
+extern char   *kspawn_resolve (const char *name);
+
+/** Start a program. argv[0] must be the full pathname of the executable,
+    usually from kspawn_resolve(). envp may be NULL, to pass the current
+    environment. in_fd and out_fd become the child's stdin and stdout;
+    -1 means that the child inherits the parent's. If new_group is TRUE,
+    the child is made the leader of a new process group, so that it can
+    be signalled along with any processes it starts. The child starts with
+    no signals blocked. Returns the child's PID or, if the program could
+    not be started, -1 with errno set. */
+extern pid_t   kspawn_start (char *const argv[], char *const envp[],
+                 int in_fd, int out_fd, BOOL new_group);
+
+/** Set a function to run in each child that kspawn_start() starts from
+    now on, after fork() and before exec() -- to lower the child's 
+    priority, for example, without lowering the caller's. It must only
+    make async-signal-safe calls. Programs are then started with fork()
+    rather than posix_spawn(). NULL, the default, means no function. */
+extern void    kspawn_set_child_setup (KSpawnSetupFn fn);
+
+/** Stop a child that was started with new_group TRUE: send its process
+    group SIGTERM, wait up to timeout_msec for the child to exit, and 
+    then send the group SIGKILL. The child is reaped either way. */
+extern void    kspawn_stop (pid_t pid, int timeout_msec);
+
+/** Run a program to completion, and collect its standard output as a
+    string, which the caller must free. Returns the exit status, or -1 if
+    the program could not be run, or its status could not be collected,
+    in which case *output is NULL. */
+extern int     kspawn_run_capture (char *const argv[], char *const envp[],
+                 char **output);
+
+/** Make a copy of the current environment, with NAME=VALUE added or
+    replaced. Free it with kspawn_free_argv(). */
+extern char  **kspawn_env_with (const char *assignment);
+
+/** Make a NULL-terminated copy of a list of strings, which must itself
+    be terminated by NULL. Free it with kspawn_free_argv(). */
+extern char  **kspawn_argv_new (const char *arg0, ...);
+
+/** Free a NULL-terminated vector of strings and the strings themselves. */
+extern void    kspawn_free_argv (char **argv);
+
+/** Join the elements of a vector with spaces, for logging. The caller
+    must free the result. */
+extern char   *kspawn_argv_to_string (char *const argv[]);
+
+END_DECLS
+
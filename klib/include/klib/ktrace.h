@@ -0,0 +1,68 @@
+/*============================================================================
+
+  klib
+
+  ktrace.h
+
+  Timeline tracing. When a trace file is open, begin/end/instant events
+  are written to it in Chrome trace-event JSON format, which can be
+  loaded into Perfetto (ui.perfetto.dev) or chrome://tracing. When no
+  trace file is open, all the ktrace_xxx calls return immediately.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <klib/types.h>
+#include <klib/defs.h>
+
+/** Convenience macros, to be placed alongside KLOG_IN/KLOG_OUT. The
+    event category is the KLOG_CLASS of the calling module, and the
+    event name is the function name. */
+#define KTRACE_IN(detail) ktrace_begin (KLOG_CLASS, __func__, detail);
+#define KTRACE_OUT ktrace_end (KLOG_CLASS, __func__);
+
+BEGIN_DECLS
+
+/** Open the trace file, overwriting any existing file. Returns FALSE,
+    and sets errno, if the file cannot be opened. */
+extern BOOL     ktrace_open (const char *filename);
+
+/** Finish the JSON array and close the trace file. */
+extern void     ktrace_close (void);
+
+extern BOOL     ktrace_enabled (void);
+
+/** Get the current time, in microseconds, on the same monotonic clock
+    that is used for the event timestamps. */
+extern int64_t  ktrace_now (void);
+
+/** Record the start of a duration event. 'detail' is optional, and will
+    be stored as an argument of the event if supplied. */
+extern void     ktrace_begin (const char *cat, const char *name,
+                  const char *detail);
+
+/** Record the end of a duration event. Begin and end events must nest
+    correctly within each thread. */
+extern void     ktrace_end (const char *cat, const char *name);
+
+/** Record a duration event whose start and end are already known. This is
+    used for things, like child processes, that don't begin and end in
+    the same place in the code. */
+extern void     ktrace_complete (const char *cat, const char *name,
+                  int64_t start, int64_t duration, const char *detail);
+
+/** Record a zero-duration event, such as a filter decision. */
+extern void     ktrace_instant (const char *cat, const char *name,
+                  const char *detail);
+
+/** Flush buffered events to the file. The trace file remains loadable
+    (Perfetto does not require the closing bracket) if the program is
+    killed after a flush. */
+extern void     ktrace_flush (void);
+
+END_DECLS
+
@@ -0,0 +1,62 @@
+/*==========================================================================
+
+  klib
+
+  jpegerror.c
+
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+==========================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <klib/klog.h>
+#include "jpegerror.h"
+
+#define KLOG_CLASS "klib.jpegerror"
+
+/*==========================================================================
+
+  jpegerror_error_exit
+
+==========================================================================*/
+static void jpegerror_error_exit (j_common_ptr cinfo)
+  {
+  JpegError *self = (JpegError *)cinfo->err;
+  (*cinfo->err->format_message) (cinfo, self->message);
+  longjmp (self->jump, 1);
+  }
+
+/*==========================================================================
+
+  jpegerror_output_message
+
+  Warnings -- "premature end of data", for example -- go to the log,
+  rather than to stderr, which nobody may be reading.
+
+==========================================================================*/
+static void jpegerror_output_message (j_common_ptr cinfo)
+  {
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message) (cinfo, message);
+  klog_warn (KLOG_CLASS, "libjpeg: %s", message);
+  }
+
+/*==========================================================================
+
+  jpegerror_init
+
+==========================================================================*/
+struct jpeg_error_mgr *jpegerror_init (JpegError *self)
+  {
+  KLOG_IN
+  struct jpeg_error_mgr *ret = jpeg_std_error (&self->pub);
+  self->pub.error_exit = jpegerror_error_exit;
+  self->pub.output_message = jpegerror_output_message;
+  self->message[0] = 0;
+  KLOG_OUT
+  return ret;
+  }
+
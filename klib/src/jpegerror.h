@@ -0,0 +1,51 @@
+/*==========================================================================
+
+  klib
+
+  jpegerror.h
+
+  A libjpeg error manager that returns to the caller, rather than
+  exiting. libjpeg's own error manager calls exit() on any error in
+  the data -- an undefined table, say -- that the header checks don't
+  find. To use it:
+
+    JpegError jerr;
+    cinfo.err = jpegerror_init (&jerr);
+    if (setjmp (jerr.jump) == 0)
+      {
+      jpeg_create_decompress (&cinfo);
+      ...
+      }
+    else
+      ... jerr.message says what went wrong
+    jpeg_destroy_decompress (&cinfo);
+
+  Any local variable that is changed after setjmp(), and used after
+  the error, must be volatile.
+
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+==========================================================================*/
+
+#pragma once
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <klib/defs.h>
+
+typedef struct _JpegError
+  {
+  // Must be first: libjpeg only knows about this part
+  struct jpeg_error_mgr pub;
+  jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+  } JpegError;
+
+BEGIN_DECLS
+
+struct jpeg_error_mgr *jpegerror_init (JpegError *self);
+
+END_DECLS
+
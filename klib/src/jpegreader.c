@@ -19,51 +19,282 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <klib/klog.h> 
 #include <klib/jpegreader.h> 
+#include <klib/kprobe.h> 
+#include <klib/kpixconv.h> 
+#include "jpegerror.h"
 
 #define KLOG_CLASS "klib.jpegreader"
 
+KPROBE_DEFINE (klib, probe_start)
+KPROBE_DEFINE (klib, probe_end)
+KPROBE_DEFINE (klib, decode_start)
+KPROBE_DEFINE (klib, decode_end)
+
+// The parallel decoder is only used when at least this many pixels
+//   have to be decoded; below that, starting the threads and copying 
+//   the headers cost more than they save
+#define JPEGREADER_PARALLEL_MIN_PIXELS (4 * 1024 * 1024)
+#define JPEGREADER_MAX_THREADS 8
+
+// The parallel decoder works on segments of about this size, and no 
+//   more than two per thread are held at once. A segment may have to be
+//   decoded with an extra MCU row above and below, so there is a lower
+//   limit on the number of rows, too
+#define JPEGREADER_SEGMENT_BYTES (4 * 1024 * 1024)
+#define JPEGREADER_SEGMENT_MIN_MCU_ROWS 4
+
+// A header probe reads the file in chunks of this size. Most headers
+//   fit in the first one; EXIF data can push the frame header into a
+//   later one
+#define JPEGREADER_PROBE_CHUNK 4096
+
+// Zero means one per CPU
+static int jpegreader_threads = 0;
+
 /*==========================================================================
 
-  jpegreader_get_image_size
+  JpegLayout 
+
+  What the parallel decoder needs to know about the structure of a
+  baseline JPEG file with restart markers. 
 
 ==========================================================================*/
-BOOL jpegreader_get_image_size (const char *filename, int *height, 
-       int *width, int *components)
+typedef struct _JpegLayout
   {
-  KLOG_IN
-  BOOL ret = FALSE;
-  klog_debug (KLOG_CLASS, "get_image_size: file=%s", filename);
-  if (jpegreader_check (filename, NULL)) 
-    {
-    FILE *fin = fopen (filename, "r");
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
+  const uint8_t *data;
+  size_t size;
+  // Everything before the entropy-coded data, which is copied to the
+  //   start of each segment, and the offset of the image height in it
+  size_t header_len;
+  size_t height_pos;
+  int image_height;
+  int mcu_height;
+  int mcu_rows;
+  // Chroma is subsampled vertically, so upsampling an MCU row needs the
+  //   rows on either side of it
+  BOOL needs_context;
+  int intervals_per_row;
+  // Offsets of the RSTn markers, and of the marker that ends the scan
+  int n_markers;
+  size_t *markers;
+  size_t end;
+  } JpegLayout;
+
+/*==========================================================================
+
+  JpegSegment
+
+==========================================================================*/
+typedef struct _JpegSegment
+  {
+  // MCU rows [first_mcu_row, last_mcu_row) are wanted
+  int first_mcu_row;
+  int last_mcu_row;
+  uint8_t *rows;
+  int n_rows;
+  // The columns actually decoded, which may be more than were asked for
+  int xoffset;
+  int width;
+  BOOL done;
+  // Set, with the message, if libjpeg gave up on the segment
+  BOOL failed;
+  char message[JMSG_LENGTH_MAX];
+  } JpegSegment;
+
+/*==========================================================================
+
+  JpegParallel
+
+  State shared by the decoding threads. Segments are handed out in
+  order, and consumed in order; a thread does not start a segment more
+  than 'window' ahead of the one being consumed, which limits the 
+  memory used to a few segments, however large the image.
+
+==========================================================================*/
+typedef struct _JpegParallel
+  {
+  const JpegLayout *layout;
+  int scale_denom;
+  int rows_per_mcu;
+  int output_height;
+  int crop_x;
+  int crop_width;
+  int n_segments;
+  JpegSegment *segments;
+  int window;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int next;
+  int consumed;
+  BOOL quit;
+  } JpegParallel;
+
+/*==========================================================================
+
+  jpegreader_get_u16
+
+==========================================================================*/
+static inline int jpegreader_get_u16 (const uint8_t *p)
+  {
+  return (p[0] << 8) | p[1];
+  }
+
+/*==========================================================================
+
+  jpegreader_probe_fill
 
-    cinfo.err = jpeg_std_error (&jerr);
-    jpeg_create_decompress(&cinfo);
+  Make sure that the bytes [pos, pos + need) of the file are in buf,
+  reading a chunk starting at pos if they aren't. buf holds the bytes
+  from *base, and *len of them are valid. Returns FALSE if the file
+  ends too soon.
 
-    jpeg_stdio_src (&cinfo, fin);
+==========================================================================*/
+static BOOL jpegreader_probe_fill (int fd, uint8_t *buf, off_t *base,
+    size_t *len, off_t pos, size_t need, int64_t *bytes_read)
+  {
+  if (pos >= *base && pos + (off_t)need <= *base + (off_t)*len) 
+    return TRUE;
+  ssize_t n;
+  do
+    n = pread (fd, buf, JPEGREADER_PROBE_CHUNK, pos);
+  while (n < 0 && errno == EINTR);
+  if (n < 0) n = 0;
+  *base = pos;
+  *len = (size_t)n;
+  *bytes_read += n;
+  return (size_t)n >= need;
+  }
+
+/*==========================================================================
 
-    int rc = jpeg_read_header(&cinfo, TRUE);
-    if (rc == 1) 
+  jpegreader_probe
+
+  Walk the marker segments as far as the frame header, reading only the
+  chunks that the segment headers are in. Large segments, such as EXIF
+  data with a thumbnail, are skipped over without being read. Readahead
+  is turned off for the file, and the pages that were read are dropped
+  from the page cache afterwards, so that scanning a large collection
+  doesn't push everything else out of memory.
+
+==========================================================================*/
+BOOL jpegreader_probe (const char *filename, int *height, int *width, 
+       int *components, int64_t *bytes_read)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  int64_t nread = 0;
+  klog_debug (KLOG_CLASS, "probe: file=%s", filename);
+  KPROBE1 (klib, probe_start, filename);
+  int fd = open (filename, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+    posix_fadvise (fd, 0, 0, POSIX_FADV_RANDOM);
+    uint8_t buf[JPEGREADER_PROBE_CHUNK];
+    off_t base = 0;
+    size_t len = 0;
+    off_t pos = 2;
+    BOOL ok = jpegreader_probe_fill (fd, buf, &base, &len, 0, 2, &nread)
+      && buf[0] == 0xFF && buf[1] == 0xD8;
+    while (ok && !ret)
       {
-      jpeg_start_decompress (&cinfo);
-      *width = cinfo.output_width;
-      *height = cinfo.output_height;
-      *components = cinfo.output_components;
-      //jpeg_finish_decompress(&cinfo);
-      jpeg_destroy_decompress(&cinfo);
-      ret = TRUE;
+      ok = jpegreader_probe_fill (fd, buf, &base, &len, pos, 2, &nread);
+      if (!ok) break;
+      const uint8_t *p = buf + (pos - base);
+      int marker = p[1];
+      if (p[0] != 0xFF) { ok = FALSE; break; }
+      // Fill bytes, and markers that have no segment
+      if (marker == 0xFF) { pos++; continue; }
+      if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+        { pos += 2; continue; }
+      // A scan, or the end, before the frame header
+      if (marker == 0xDA || marker == 0xD9) { ok = FALSE; break; }
+
+      ok = jpegreader_probe_fill (fd, buf, &base, &len, pos, 4, &nread);
+      if (!ok) break;
+      p = buf + (pos - base);
+      int seglen = jpegreader_get_u16 (p + 2);
+      if (seglen < 2) { ok = FALSE; break; }
+      if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 
+           && marker != 0xC8 && marker != 0xCC)
+        {
+        ok = seglen >= 8 && jpegreader_probe_fill (fd, buf, &base, &len, 
+          pos, 10, &nread);
+        if (!ok) break;
+        p = buf + (pos - base) + 4;
+        *height = jpegreader_get_u16 (p + 1);
+        *width = jpegreader_get_u16 (p + 3);
+        *components = p[5];
+        // A height of zero means that it is given after the first scan,
+        //   which is too rare to be worth reading that far for
+        if (*height == 0 || *width == 0 || *components == 0) 
+          { ok = FALSE; break; }
+        ret = TRUE;
+        }
+      pos += 2 + seglen;
       }
-    fclose (fin);
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+    close (fd);
     }
+  if (bytes_read) *bytes_read = nread;
+  KPROBE4 (klib, probe_end, filename, (long)nread, ret ? *width : -1, 
+    ret ? *height : -1);
+  KLOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  jpegreader_get_image_size
+
+==========================================================================*/
+BOOL jpegreader_get_image_size (const char *filename, int *height, 
+       int *width, int *components)
+  {
+  KLOG_IN
+  BOOL ret = jpegreader_probe (filename, height, width, components, NULL);
   KLOG_OUT
   return ret;
   }
 
 
+/*==========================================================================
+
+  jpegreader_is_supported
+
+  libjpeg converts YCbCr to RGB itself, and leaves grayscale and CMYK
+  (including YCCK, which it converts to CMYK) to us.
+
+==========================================================================*/
+static BOOL jpegreader_is_supported (const struct jpeg_decompress_struct 
+      *cinfo)
+  {
+  int n = cinfo->output_components;
+  return n == 3 || (n == 1 && cinfo->out_color_space == JCS_GRAYSCALE)
+    || (n == 4 && cinfo->out_color_space == JCS_CMYK);
+  }
+
+/*==========================================================================
+
+  jpegreader_convert_row
+
+  Convert a row of width pixels, as decoded, to RGB. Adobe applications
+  write CMYK inverted, and say so with an APP14 marker; other CMYK files
+  are rare enough that the marker is taken as the only sign.
+
+==========================================================================*/
+static void jpegreader_convert_row (const struct jpeg_decompress_struct 
+      *cinfo, const uint8_t *src, uint8_t *dst, int width)
+  {
+  if (cinfo->output_components == 1)
+    kpixconv_gray_to_rgb (src, dst, width);
+  else
+    kpixconv_cmyk_to_rgb (src, dst, width, cinfo->saw_Adobe_marker);
+  }
+
 /*==========================================================================
 
   jpegreader_file_to_mem
@@ -73,67 +304,819 @@ void jpegreader_file_to_mem (const char *filename, int *jpeg_height,
       int *jpeg_width, int *bytespp, char **buffer, char **error)
   {
   KLOG_IN
+  jpegreader_file_to_mem_scaled (filename, 0, 0, jpeg_height, jpeg_width,
+    bytespp, buffer, error);
+  KLOG_OUT
+  }
+
+/*==========================================================================
+
+  jpegreader_set_scale
+
+  Choose the largest DCT scaling reduction (1/8, 1/4 or 1/2) that
+  still leaves the image at least min_width by min_height. Every
+  libjpeg supports these three; decoding at 1/8 size is several times
+  faster than a full decode, as well as needing 1/64 of the memory.
+
+==========================================================================*/
+static void jpegreader_set_scale (struct jpeg_decompress_struct *cinfo,
+      int min_width, int min_height)
+  {
+  KLOG_IN
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = 1;
+  if (min_width > 0 && min_height > 0)
+    {
+    for (int denom = 8; denom > 1; denom /= 2)
+      {
+      cinfo->scale_denom = denom;
+      jpeg_calc_output_dimensions (cinfo);
+      if ((int)cinfo->output_width >= min_width 
+           && (int)cinfo->output_height >= min_height)
+        break;
+      cinfo->scale_denom = 1;
+      }
+    }
+  KLOG_OUT
+  }
+
+/*==========================================================================
+
+  jpegreader_file_to_mem_scaled
+
+==========================================================================*/
+void jpegreader_file_to_mem_scaled (const char *filename, int min_width,
+      int min_height, int *jpeg_height, int *jpeg_width, int *bytespp, 
+      char **buffer, char **error)
+  {
+  KLOG_IN
   klog_debug (KLOG_CLASS, "read_jpeg: file=%s", filename);
+  KPROBE1 (klib, decode_start, filename);
+  BOOL decoded = FALSE;
   if (jpegreader_check (filename, error)) 
     {
     FILE *fin = fopen (filename, "r");
     struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
+    JpegError jerr;
+    // These are freed if libjpeg gives up part way through
+    char *volatile bmp_buffer = NULL;
+    uint8_t *volatile decoded_row = NULL;
 
-    cinfo.err = jpeg_std_error (&jerr);
-    jpeg_create_decompress(&cinfo);
+    cinfo.err = jpegerror_init (&jerr);
+    if (setjmp (jerr.jump) == 0)
+      {
+      jpeg_create_decompress(&cinfo);
+      jpeg_stdio_src (&cinfo, fin);
+
+      int rc = jpeg_read_header(&cinfo, TRUE);
+      if (rc == 1) 
+        {
+        jpegreader_set_scale (&cinfo, min_width, min_height);
+        jpeg_start_decompress(&cinfo);
+	    
+        int width = cinfo.output_width;
+        int height = cinfo.output_height;
+        int pixel_size = 3;
+        if (jpegreader_is_supported (&cinfo))
+          {
+          klog_debug (KLOG_CLASS, 
+	      "read_jpeg: image is %d by %d with %d components", 
+	      width, height, pixel_size);
 
-    jpeg_stdio_src (&cinfo, fin);
+	  bmp_buffer = malloc ((size_t)width * height * pixel_size);
 
-    int rc = jpeg_read_header(&cinfo, TRUE);
-    if (rc == 1) 
+	  int row_stride = width * pixel_size;
+          // Rows that need converting are decoded here first
+          if (cinfo.output_components != 3)
+            decoded_row = malloc ((size_t)width * cinfo.output_components);
+
+	  while (cinfo.output_scanline < cinfo.output_height) 
+	    {
+	    char *buffer_array[1];
+            char *row = bmp_buffer 
+              + (size_t)cinfo.output_scanline * row_stride;
+	    buffer_array[0] = decoded_row ? (char *)decoded_row : row;
+	    jpeg_read_scanlines (&cinfo, (unsigned char **)buffer_array, 1);
+            if (decoded_row)
+              jpegreader_convert_row (&cinfo, decoded_row, (uint8_t *)row, 
+                width);
+	    }
+          jpeg_finish_decompress(&cinfo);
+	  *jpeg_width = width;
+	  *jpeg_height = height;
+	  *bytespp = pixel_size;
+          *buffer = bmp_buffer;
+          bmp_buffer = NULL;
+          decoded = TRUE;
+          } 
+        else
+          {
+          asprintf (error, "JPEG file '%s' has an unsupported colour space", 
+            filename); 
+          }
+        }
+      else
+        {
+        asprintf (error, "Invalid JPEG file '%s'", filename); 
+        }
+      }
+    else
       {
-      jpeg_start_decompress(&cinfo);
-	    
-      int width = cinfo.output_width;
-      int height = cinfo.output_height;
-      int pixel_size = cinfo.output_components;
-      if (pixel_size == 3)
+      decoded = FALSE;
+      asprintf (error, "Can't decode '%s': %s", filename, jerr.message); 
+      }
+    free (bmp_buffer);
+    free (decoded_row);
+    jpeg_destroy_decompress(&cinfo);
+    fclose (fin);
+    }
+  KPROBE2 (klib, decode_end, filename, decoded);
+  KLOG_OUT
+  }
+
+
+/*==========================================================================
+
+  jpegreader_set_threads
+
+==========================================================================*/
+void jpegreader_set_threads (int threads)
+  {
+  KLOG_IN
+  jpegreader_threads = threads;
+  KLOG_OUT
+  }
+
+/*==========================================================================
+
+  jpegreader_parse_layout
+
+  Walk the marker segments up to the start of scan, then find the 
+  restart markers with a byte scan of the entropy-coded data. In that 
+  data, 0xFF is always followed by a stuffed zero, a restart marker, or 
+  the marker that ends the scan. Returns FALSE if the file is not one
+  that the parallel decoder can handle: it must be sequential and 
+  Huffman-coded, with three components in a single scan, and with 
+  restart markers at (at least) the start of every MCU row.
+
+==========================================================================*/
+static BOOL jpegreader_parse_layout (JpegLayout *layout)
+  {
+  KLOG_IN
+  const uint8_t *data = layout->data;
+  size_t size = layout->size;
+  size_t pos = 2;
+  int restart_interval = 0;
+  int width = 0, components = 0, max_h = 1, max_v = 1;
+  BOOL have_sof = FALSE, have_sos = FALSE, ok = TRUE;
+  layout->markers = NULL;
+
+  while (ok && !have_sos && pos + 4 <= size)
+    {
+    if (data[pos] != 0xFF) { ok = FALSE; break; }
+    int marker = data[pos + 1];
+    if (marker == 0xFF) { pos++; continue; }
+    size_t len = jpegreader_get_u16 (data + pos + 2);
+    if (len < 2 || pos + 2 + len > size) { ok = FALSE; break; }
+    const uint8_t *p = data + pos + 4;
+    switch (marker)
+      {
+      case 0xC0: case 0xC1: // Baseline and extended sequential
+        if (len < 8) { ok = FALSE; break; }
+        layout->height_pos = pos + 5;
+        layout->image_height = jpegreader_get_u16 (p + 1);
+        width = jpegreader_get_u16 (p + 3);
+        components = p[5];
+        if (components != 3 || len < 8 + 3 * (size_t)components) 
+          { ok = FALSE; break; }
+        for (int i = 0; i < components; i++)
+          {
+          int h = p[7 + i * 3] >> 4, v = p[7 + i * 3] & 0x0F;
+          if (h > max_h) max_h = h;
+          if (v > max_v) max_v = v;
+          }
+        have_sof = TRUE;
+        break;
+      case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7: 
+      case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+        // Progressive, lossless, hierarchical or arithmetic-coded
+        ok = FALSE;
+        break;
+      case 0xDD:
+        restart_interval = jpegreader_get_u16 (p);
+        break;
+      case 0xDA:
+        if (p[0] != components) ok = FALSE;
+        have_sos = TRUE;
+        break;
+      }
+    pos += 2 + len;
+    }
+
+  int mcus_x = 0;
+  if (ok && have_sof && have_sos && restart_interval > 0 && width > 0
+       && layout->image_height > 0)
+    {
+    mcus_x = (width + max_h * 8 - 1) / (max_h * 8);
+    layout->mcu_height = max_v * 8;
+    layout->needs_context = max_v > 1;
+    layout->mcu_rows = (layout->image_height + layout->mcu_height - 1) 
+      / layout->mcu_height;
+    if (mcus_x % restart_interval != 0) ok = FALSE;
+    }
+  else
+    ok = FALSE;
+
+  if (ok)
+    {
+    layout->header_len = pos;
+    layout->intervals_per_row = mcus_x / restart_interval;
+    int expected = layout->mcu_rows * layout->intervals_per_row;
+    layout->markers = malloc (expected * sizeof (size_t));
+    layout->n_markers = 0;
+    layout->end = 0;
+    const uint8_t *p = data + pos;
+    const uint8_t *limit = data + size - 1;
+    while (p < limit && !layout->end)
+      {
+      p = memchr (p, 0xFF, limit - p);
+      if (!p) break;
+      int m = p[1];
+      if (m >= 0xD0 && m <= 0xD7)
         {
-	*jpeg_width = width;
-	*jpeg_height = height;
-	*bytespp = pixel_size;
-
-        klog_debug (KLOG_CLASS, 
-	    "read_jpeg: image is %d by %d with %d components", 
-	    width, height, pixel_size);
-	unsigned long bmp_size;
-	char *bmp_buffer;
-
-	bmp_size = width * height * pixel_size;
-	bmp_buffer = (char*) malloc(bmp_size);
-
-	int row_stride = width * pixel_size;
-
-	while (cinfo.output_scanline < cinfo.output_height) 
-	  {
-	  char *buffer_array[1];
-	  buffer_array[0] = bmp_buffer + cinfo.output_scanline * row_stride;
-	  jpeg_read_scanlines (&cinfo, (unsigned char **)buffer_array, 1);
-	  }
-        *buffer = bmp_buffer;
-        } 
+        if (layout->n_markers == expected - 1) break; // Too many
+        layout->markers[layout->n_markers++] = p - data;
+        p += 2;
+        }
+      else if (m == 0x00 || m == 0xFF)
+        p++;
       else
+        layout->end = p - data;
+      }
+    // Anything but EOI means more scans, or a DNL marker
+    if (!layout->end || data[layout->end + 1] != 0xD9
+         || layout->n_markers != expected - 1)
+      ok = FALSE;
+    }
+
+  if (!ok)
+    {
+    free (layout->markers);
+    layout->markers = NULL;
+    }
+  KLOG_OUT
+  return ok;
+  }
+
+/*==========================================================================
+
+  jpegreader_make_segment_stream
+
+  Make a complete JPEG stream holding MCU rows [first, last) of the 
+  image: the original headers, with the height changed, followed by the 
+  restart intervals for those rows. Each segment starts with a fresh
+  scan, so its restart markers have to be renumbered from RST0. 
+
+==========================================================================*/
+static uint8_t *jpegreader_make_segment_stream (const JpegLayout *layout,
+      int first, int last, size_t *len)
+  {
+  KLOG_IN
+  int first_interval = first * layout->intervals_per_row;
+  int last_interval = last * layout->intervals_per_row - 1;
+  size_t start = first_interval == 0 ? layout->header_len 
+    : layout->markers[first_interval - 1] + 2;
+  size_t end = last_interval == layout->n_markers ? layout->end 
+    : layout->markers[last_interval];
+  int height = last == layout->mcu_rows 
+    ? layout->image_height - first * layout->mcu_height 
+    : (last - first) * layout->mcu_height;
+
+  *len = layout->header_len + (end - start) + 2;
+  uint8_t *stream = malloc (*len);
+  memcpy (stream, layout->data, layout->header_len);
+  stream[layout->height_pos] = height >> 8;
+  stream[layout->height_pos + 1] = height & 0xFF;
+  uint8_t *entropy = stream + layout->header_len;
+  memcpy (entropy, layout->data + start, end - start);
+  for (int i = first_interval; i < last_interval; i++)
+    entropy[layout->markers[i] - start + 1] 
+      = 0xD0 + ((i - first_interval) & 7);
+  stream[*len - 2] = 0xFF;
+  stream[*len - 1] = 0xD9;
+  KLOG_OUT
+  return stream;
+  }
+
+/*==========================================================================
+
+  jpegreader_decode_segment
+
+  If chroma upsampling needs context, the segment is decoded with one
+  extra MCU row above and below it, where there are any, so that it 
+  sees the same neighbouring rows as it would in a serial decode, and
+  the result is exactly the same.
+
+==========================================================================*/
+static void jpegreader_decode_segment (const JpegParallel *par,
+      JpegSegment *segment)
+  {
+  KLOG_IN
+  const JpegLayout *layout = par->layout;
+  int first = segment->first_mcu_row;
+  int last = segment->last_mcu_row;
+  if (layout->needs_context)
+    {
+    if (first > 0) first--;
+    if (last < layout->mcu_rows) last++;
+    }
+  size_t len;
+  uint8_t *stream = jpegreader_make_segment_stream (layout, first, last, 
+    &len);
+
+  struct jpeg_decompress_struct cinfo;
+  JpegError jerr;
+  cinfo.err = jpegerror_init (&jerr);
+  if (setjmp (jerr.jump) == 0)
+    {
+    jpeg_create_decompress (&cinfo);
+    jpeg_mem_src (&cinfo, stream, len);
+    jpeg_read_header (&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = par->scale_denom;
+    jpeg_start_decompress (&cinfo);
+    JDIMENSION xoffset = 0;
+    JDIMENSION xwidth = cinfo.output_width;
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && \
+      LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+    if (par->crop_width < (int)cinfo.output_width)
+      {
+      xoffset = par->crop_x;
+      xwidth = par->crop_width;
+      jpeg_crop_scanline (&cinfo, &xoffset, &xwidth);
+      }
+#endif
+    segment->xoffset = xoffset;
+    segment->width = xwidth;
+
+    int top = (segment->first_mcu_row - first) * par->rows_per_mcu;
+    int end = segment->last_mcu_row * par->rows_per_mcu;
+    if (end > par->output_height) end = par->output_height;
+    segment->n_rows = end - segment->first_mcu_row * par->rows_per_mcu;
+    size_t row_bytes = (size_t)xwidth * 3;
+    segment->rows = malloc (row_bytes * (top + segment->n_rows));
+    while ((int)cinfo.output_scanline < top + segment->n_rows)
+      {
+      JSAMPROW row = segment->rows + row_bytes * cinfo.output_scanline;
+      if (jpeg_read_scanlines (&cinfo, &row, 1) != 1) break;
+      }
+    // Drop the rows that were only decoded for context
+    memmove (segment->rows, segment->rows + row_bytes * top, 
+      row_bytes * segment->n_rows);
+    jpeg_abort_decompress (&cinfo);
+    }
+  else
+    {
+    // The consumer reports the failure
+    free (segment->rows);
+    segment->rows = NULL;
+    segment->n_rows = 0;
+    segment->failed = TRUE;
+    memcpy (segment->message, jerr.message, sizeof (segment->message));
+    }
+
+  jpeg_destroy_decompress (&cinfo);
+  free (stream);
+  KLOG_OUT
+  }
+
+/*==========================================================================
+
+  jpegreader_parallel_worker
+
+==========================================================================*/
+static void *jpegreader_parallel_worker (void *user_data)
+  {
+  KLOG_IN
+  JpegParallel *par = user_data;
+  pthread_mutex_lock (&par->lock);
+  while (!par->quit && par->next < par->n_segments)
+    {
+    if (par->next - par->consumed >= par->window)
+      {
+      pthread_cond_wait (&par->cond, &par->lock);
+      continue;
+      }
+    JpegSegment *segment = &par->segments[par->next++];
+    pthread_mutex_unlock (&par->lock);
+    jpegreader_decode_segment (par, segment);
+    pthread_mutex_lock (&par->lock);
+    segment->done = TRUE;
+    pthread_cond_broadcast (&par->cond);
+    }
+  pthread_mutex_unlock (&par->lock);
+  KLOG_OUT
+  return NULL;
+  }
+
+/*==========================================================================
+
+  jpegreader_get_thread_count
+
+==========================================================================*/
+static int jpegreader_get_thread_count (void)
+  {
+  KLOG_IN
+  int ret = jpegreader_threads;
+  if (ret <= 0) ret = (int)sysconf (_SC_NPROCESSORS_ONLN);
+  if (ret > JPEGREADER_MAX_THREADS) ret = JPEGREADER_MAX_THREADS;
+  KLOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  jpegreader_parallel_get_size
+
+  Read the header that is copied to each segment, to find how far 
+  libjpeg can reduce the image, and the size it decodes it to. Returns
+  FALSE if libjpeg can't make sense of the header.
+
+==========================================================================*/
+static BOOL jpegreader_parallel_get_size (const JpegLayout *layout, 
+      int width, int height, KResampleMode mode, int *scale_denom, 
+      int *image_width, int *image_height)
+  {
+  KLOG_IN
+  BOOL ret;
+  struct jpeg_decompress_struct cinfo;
+  JpegError jerr;
+  cinfo.err = jpegerror_init (&jerr);
+  if (setjmp (jerr.jump) == 0)
+    {
+    jpeg_create_decompress (&cinfo);
+    jpeg_mem_src (&cinfo, layout->data, layout->header_len);
+    jpeg_read_header (&cinfo, FALSE);
+
+    int crop_x, crop_y, crop_width, crop_height;
+    int out_x, out_y, out_width, out_height;
+    kresample_get_geometry (cinfo.image_width, cinfo.image_height,
+      width, height, mode, &crop_x, &crop_y, &crop_width, &crop_height,
+      &out_x, &out_y, &out_width, &out_height);
+    jpegreader_set_scale (&cinfo, out_width, out_height);
+    jpeg_calc_output_dimensions (&cinfo);
+    *image_width = cinfo.output_width;
+    *image_height = cinfo.output_height;
+    *scale_denom = cinfo.scale_denom;
+    ret = TRUE;
+    }
+  else
+    {
+    klog_debug (KLOG_CLASS, "read_jpeg_parallel: %s", jerr.message);
+    ret = FALSE;
+    }
+  jpeg_destroy_decompress (&cinfo);
+  KLOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  jpegreader_resample_parallel
+
+  Decode the rows of the crop in segments, on several threads, and feed
+  the segments to a KResampler in order as they are completed. Sets 
+  *handled to FALSE, without decoding anything, if the image is not 
+  suitable, so that the caller can use the serial decoder.
+
+==========================================================================*/
+static BOOL jpegreader_resample_parallel (const char *filename, int width,
+      int height, KResampleMode mode, KResampleFilter filter,
+      uint8_t *out, BOOL *handled, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  *handled = FALSE;
+  int threads = jpegreader_get_thread_count ();
+  int fd = threads > 1 ? open (filename, O_RDONLY | O_CLOEXEC) : -1;
+  struct stat sb;
+  if (fd >= 0 && fstat (fd, &sb) == 0 && sb.st_size > 4)
+    {
+    JpegLayout layout;
+    layout.size = sb.st_size;
+    layout.data = mmap (NULL, layout.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (layout.data != MAP_FAILED && jpegreader_parse_layout (&layout))
+      {
+      JpegParallel par;
+      int image_width, image_height;
+      if (jpegreader_parallel_get_size (&layout, width, height, mode,
+           &par.scale_denom, &image_width, &image_height))
         {
-        asprintf (error, "JPEG file '%s' is not RGB", filename); 
+        int crop_x, crop_y, crop_width, crop_height;
+        int out_x, out_y, out_width, out_height;
+        kresample_get_geometry (image_width, image_height, width, height,
+          mode, &crop_x, &crop_y, &crop_width, &crop_height, &out_x, &out_y,
+          &out_width, &out_height);
+        par.layout = &layout;
+        par.rows_per_mcu = layout.mcu_height / par.scale_denom;
+        par.output_height = image_height;
+        int first_mcu_row = crop_y / par.rows_per_mcu;
+        int last_mcu_row = (crop_y + crop_height + par.rows_per_mcu - 1) 
+          / par.rows_per_mcu;
+        if (last_mcu_row > layout.mcu_rows) last_mcu_row = layout.mcu_rows;
+        int mcu_rows = last_mcu_row - first_mcu_row;
+
+        if ((int64_t)crop_width * crop_height 
+               >= JPEGREADER_PARALLEL_MIN_PIXELS && mcu_rows >= threads)
+          {
+          *handled = TRUE;
+          par.crop_x = crop_x;
+          par.crop_width = crop_width;
+          // Enough segments to share the work evenly, but small enough to
+          //   keep the memory bounded
+          int64_t mcu_row_bytes = (int64_t)crop_width * 3 
+            * par.rows_per_mcu;
+          int segment_rows = (mcu_rows + threads * 4 - 1) / (threads * 4);
+          if (segment_rows * mcu_row_bytes > JPEGREADER_SEGMENT_BYTES)
+            segment_rows = JPEGREADER_SEGMENT_BYTES / mcu_row_bytes;
+          if (segment_rows < JPEGREADER_SEGMENT_MIN_MCU_ROWS)
+            segment_rows = JPEGREADER_SEGMENT_MIN_MCU_ROWS;
+          par.n_segments = (mcu_rows + segment_rows - 1) / segment_rows;
+          klog_debug (KLOG_CLASS, 
+            "read_jpeg_parallel: %s, %d MCU rows in %d segments on %d threads",
+            filename, mcu_rows, par.n_segments, threads);
+          par.segments = calloc (par.n_segments, sizeof (JpegSegment));
+          for (int i = 0; i < par.n_segments; i++)
+            {
+            par.segments[i].first_mcu_row = first_mcu_row 
+              + (int)((int64_t)mcu_rows * i / par.n_segments);
+            par.segments[i].last_mcu_row = first_mcu_row 
+              + (int)((int64_t)mcu_rows * (i + 1) / par.n_segments);
+            }
+          par.window = threads * 2;
+          par.next = 0;
+          par.consumed = 0;
+          par.quit = FALSE;
+          pthread_mutex_init (&par.lock, NULL);
+          pthread_cond_init (&par.cond, NULL);
+          pthread_t tids[JPEGREADER_MAX_THREADS];
+          int started = 0;
+          for (int i = 0; i < threads; i++)
+            {
+            if (pthread_create (&tids[started], NULL, 
+                 jpegreader_parallel_worker, &par) == 0)
+              started++;
+            }
+
+          int stride = width * 3;
+          if (out_width != width || out_height != height)
+            memset (out, 0, (size_t)stride * height);
+          int first_row = first_mcu_row * par.rows_per_mcu;
+          KResampler *resampler = NULL;
+          int done = 0;
+          BOOL failed = FALSE;
+          for (int i = 0; i < par.n_segments && started > 0; i++)
+            {
+            JpegSegment *segment = &par.segments[i];
+            pthread_mutex_lock (&par.lock);
+            while (!segment->done)
+              pthread_cond_wait (&par.cond, &par.lock);
+            pthread_mutex_unlock (&par.lock);
+            if (segment->failed)
+              {
+              asprintf (error, "Can't decode '%s': %s", filename, 
+                segment->message);
+              failed = TRUE;
+              break;
+              }
+
+            if (!resampler)
+              {
+              // The columns actually decoded are only known now
+              resampler = kresampler_new (segment->width, 
+                image_height - first_row, crop_x - segment->xoffset, 
+                crop_y - first_row, 
+                crop_width, crop_height, 
+                out + (size_t)out_y * stride + out_x * 3,
+                out_width, out_height, stride, filter);
+              }
+            size_t row_bytes = (size_t)segment->width * 3;
+            for (int r = 0; r < segment->n_rows && done < out_height; r++)
+              done = kresampler_push_row (resampler, 
+                segment->rows + r * row_bytes);
+            free (segment->rows);
+            segment->rows = NULL;
+
+            pthread_mutex_lock (&par.lock);
+            par.consumed++;
+            if (done == out_height) par.quit = TRUE;
+            pthread_cond_broadcast (&par.cond);
+            pthread_mutex_unlock (&par.lock);
+            if (done == out_height) break;
+            }
+
+          pthread_mutex_lock (&par.lock);
+          par.quit = TRUE;
+          pthread_cond_broadcast (&par.cond);
+          pthread_mutex_unlock (&par.lock);
+          for (int i = 0; i < started; i++)
+            pthread_join (tids[i], NULL);
+          for (int i = 0; i < par.n_segments; i++)
+            free (par.segments[i].rows);
+          free (par.segments);
+          kresampler_destroy (resampler);
+          pthread_cond_destroy (&par.cond);
+          pthread_mutex_destroy (&par.lock);
+
+          if (done == out_height)
+            ret = TRUE;
+          else if (!failed)
+            {
+            if (started == 0)
+              asprintf (error, "Can't start decoding threads");
+            else
+              asprintf (error, "JPEG file '%s' is truncated", filename); 
+            }
+          }
         }
-      jpeg_finish_decompress(&cinfo);
-      jpeg_destroy_decompress(&cinfo);
+      free (layout.markers);
+      }
+    if (layout.data != MAP_FAILED)
+      munmap ((void *)layout.data, layout.size);
+    }
+  if (fd >= 0) close (fd);
+  KLOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  jpegreader_file_to_buffer_resampled
+
+  The geometry is worked out twice: once at full size, to find how far
+  libjpeg can reduce the image, and again at the reduced size, which is
+  not always an exact fraction of the original.
+
+==========================================================================*/
+BOOL jpegreader_file_to_buffer_resampled (const char *filename, int width,
+      int height, KResampleMode mode, KResampleFilter filter,
+      uint8_t *buffer, char **error)
+  {
+  KLOG_IN
+  klog_debug (KLOG_CLASS, "read_jpeg_resampled: file=%s", filename);
+  KPROBE1 (klib, decode_start, filename);
+  BOOL decoded = FALSE;
+  BOOL handled = FALSE;
+  BOOL valid = jpegreader_check (filename, error);
+  if (valid) 
+    decoded = jpegreader_resample_parallel (filename, width, height, mode,
+      filter, buffer, &handled, error);
+  if (valid && !handled) 
+    {
+    FILE *fin = fopen (filename, "r");
+    struct jpeg_decompress_struct cinfo;
+    JpegError jerr;
+    // These are freed if libjpeg gives up part way through
+    KResampler *volatile resampler = NULL;
+    uint8_t *volatile band = NULL;
+    uint8_t *volatile rgb_row = NULL;
+
+    cinfo.err = jpegerror_init (&jerr);
+    if (setjmp (jerr.jump) == 0)
+      {
+      jpeg_create_decompress (&cinfo);
+      jpeg_stdio_src (&cinfo, fin);
+
+      if (jpeg_read_header (&cinfo, TRUE) == 1)
+        {
+        int crop_x, crop_y, crop_width, crop_height;
+        int out_x, out_y, out_width, out_height;
+        kresample_get_geometry (cinfo.image_width, cinfo.image_height,
+          width, height, mode, &crop_x, &crop_y, &crop_width, &crop_height,
+          &out_x, &out_y, &out_width, &out_height);
+        // In fill mode, the crop covers the screen whenever the whole 
+        //   image does
+        jpegreader_set_scale (&cinfo, out_width, out_height);
+        jpeg_start_decompress (&cinfo);
+
+        if (jpegreader_is_supported (&cinfo))
+          {
+          int image_width = cinfo.output_width;
+          int image_height = cinfo.output_height;
+          kresample_get_geometry (image_width, image_height, width, height,
+            mode, &crop_x, &crop_y, &crop_width, &crop_height, &out_x, &out_y,
+            &out_width, &out_height);
+          klog_debug (KLOG_CLASS, 
+            "read_jpeg_resampled: decoding %dx%d, using %dx%d at %d,%d", 
+            image_width, image_height, crop_width, crop_height, 
+            crop_x, crop_y);
+
+          int stride = width * 3;
+          if (out_width != width || out_height != height)
+            memset (buffer, 0, (size_t)stride * height);
+
+          int first_row = 0;
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && \
+      LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+          // libjpeg-turbo can leave out whole iMCU columns, and skip rows
+          //   without colour-converting or upsampling them. The columns
+          //   it leaves out may be fewer than asked for
+          JDIMENSION xoffset = crop_x;
+          JDIMENSION xwidth = crop_width;
+          if (crop_width < image_width)
+            jpeg_crop_scanline (&cinfo, &xoffset, &xwidth);
+          crop_x -= xoffset;
+          image_width = xwidth;
+          if (crop_y > 0)
+            first_row = jpeg_skip_scanlines (&cinfo, crop_y);
+#endif
+
+          resampler = kresampler_new (image_width, 
+            image_height - first_row, crop_x, crop_y - first_row, 
+            crop_width, crop_height, 
+            buffer + (size_t)out_y * stride + out_x * 3,
+            out_width, out_height, stride, filter);
+
+          // libjpeg works most efficiently when given as many rows as it
+          //   decodes at once
+          int band_rows = cinfo.rec_outbuf_height;
+          size_t row_bytes = (size_t)image_width * cinfo.output_components;
+          band = malloc (row_bytes * band_rows);
+          if (cinfo.output_components != 3)
+            rgb_row = malloc ((size_t)image_width * 3);
+          JSAMPROW rows[band_rows];
+          for (int i = 0; i < band_rows; i++)
+            rows[i] = band + i * row_bytes;
+
+          int done = 0;
+          while (done < out_height 
+              && cinfo.output_scanline < cinfo.output_height)
+            {
+            int n = jpeg_read_scanlines (&cinfo, rows, band_rows);
+            if (n == 0) break; // Suspended -- can't happen with stdio
+            for (int i = 0; i < n; i++)
+              {
+              if (rgb_row)
+                {
+                jpegreader_convert_row (&cinfo, rows[i], rgb_row, image_width);
+                done = kresampler_push_row (resampler, rgb_row);
+                }
+              else
+                done = kresampler_push_row (resampler, rows[i]);
+              }
+            }
+
+          if (done == out_height)
+            decoded = TRUE;
+          else
+            asprintf (error, "JPEG file '%s' is truncated", filename); 
+          }
+        else
+          asprintf (error, "JPEG file '%s' has an unsupported colour space", 
+            filename); 
+        // Rows below the crop may not have been read, which 
+        //   jpeg_finish_decompress() would object to
+        jpeg_abort_decompress (&cinfo);
+        }
+      else
+        asprintf (error, "Invalid JPEG file '%s'", filename); 
       }
     else
       {
-      asprintf (error, "Invalid JPEG file '%s'", filename); 
+      decoded = FALSE;
+      asprintf (error, "Can't decode '%s': %s", filename, jerr.message); 
       }
+    free (rgb_row);
+    free (band);
+    kresampler_destroy (resampler);
+    jpeg_destroy_decompress (&cinfo);
     fclose (fin);
     }
+  KPROBE2 (klib, decode_end, filename, decoded);
   KLOG_OUT
+  return decoded;
   }
 
+/*==========================================================================
+
+  jpegreader_file_to_mem_resampled
+
+==========================================================================*/
+BOOL jpegreader_file_to_mem_resampled (const char *filename, int width,
+      int height, KResampleMode mode, KResampleFilter filter,
+      uint8_t **buffer, char **error)
+  {
+  KLOG_IN
+  uint8_t *out = malloc ((size_t)width * height * 3);
+  BOOL ret = jpegreader_file_to_buffer_resampled (filename, width, height,
+    mode, filter, out, error);
+  if (ret)
+    *buffer = out;
+  else
+    free (out);
+  KLOG_OUT
+  return ret;
+  }
 
 /*==========================================================================
 
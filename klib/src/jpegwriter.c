@@ -0,0 +1,85 @@
+/*==========================================================================
+
+  klib
+
+  jpegwriter.c
+
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <jpeglib.h>
+#include <errno.h>
+#include <string.h>
+#include <klib/klog.h>
+#include <klib/jpegwriter.h>
+#include "jpegerror.h"
+
+#define KLOG_CLASS "klib.jpegwriter"
+
+/*==========================================================================
+
+  jpegwriter_mem_to_file
+
+==========================================================================*/
+BOOL jpegwriter_mem_to_file (const char *filename, int width, int height,
+      const uint8_t *buffer, int quality, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  klog_debug (KLOG_CLASS, "write_jpeg: file=%s, %dx%d", filename,
+    width, height);
+  FILE *fout = fopen (filename, "w");
+  if (fout)
+    {
+    struct jpeg_compress_struct cinfo;
+    JpegError jerr;
+
+    cinfo.err = jpegerror_init (&jerr);
+    if (setjmp (jerr.jump) == 0)
+      {
+      jpeg_create_compress (&cinfo);
+      jpeg_stdio_dest (&cinfo, fout);
+
+      cinfo.image_width = width;
+      cinfo.image_height = height;
+      cinfo.input_components = 3;
+      cinfo.in_color_space = JCS_RGB;
+      jpeg_set_defaults (&cinfo);
+      jpeg_set_quality (&cinfo, quality, TRUE);
+      jpeg_start_compress (&cinfo, TRUE);
+
+      int row_stride = width * 3;
+      while (cinfo.next_scanline < cinfo.image_height)
+        {
+        JSAMPROW row = (JSAMPROW)buffer + cinfo.next_scanline * row_stride;
+        jpeg_write_scanlines (&cinfo, &row, 1);
+        }
+
+      jpeg_finish_compress (&cinfo);
+      jpeg_destroy_compress (&cinfo);
+      // Errors writing the data (a full disk, for example) only show up
+      //   when the stream is flushed
+      if (ferror (fout) | fclose (fout))
+        asprintf (error, "Can't write '%s': %s", filename, strerror (errno));
+      else
+        ret = TRUE;
+      }
+    else
+      {
+      // libjpeg gives up if it can't write the data
+      ret = FALSE;
+      jpeg_destroy_compress (&cinfo);
+      fclose (fout);
+      asprintf (error, "Can't write '%s': %s", filename, jerr.message);
+      }
+    }
+  else
+    asprintf (error, "Can't write '%s': %s", filename, strerror (errno));
+  KLOG_OUT
+  return ret;
+  }
+
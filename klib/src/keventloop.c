@@ -0,0 +1,239 @@
+/*============================================================================
+
+  klib
+
+  keventloop.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <klib/klog.h>
+#include <klib/keventloop.h>
+
+#define KLOG_CLASS "klib.keventloop"
+
+#define KEVENTLOOP_MAX_EVENTS 16
+
+/*============================================================================
+
+  KEventHandler
+
+  ==========================================================================*/
+typedef struct _KEventHandler KEventHandler;
+struct _KEventHandler
+  {
+  int fd;
+  KEventFn fn;
+  void *user_data;
+  KEventHandler *next;
+  };
+
+/*============================================================================
+
+  KEventLoop
+
+  ==========================================================================*/
+struct _KEventLoop
+  {
+  int epoll_fd;
+  BOOL quit;
+  KEventHandler *handlers;
+  // Handlers removed while a batch of events is being dispatched can't
+  //   be freed until the batch is finished, because later events in
+  //   the batch might still refer to them
+  KEventHandler *dead;
+  };
+
+/*============================================================================
+
+  keventloop_new
+
+  ==========================================================================*/
+KEventLoop *keventloop_new (void)
+  {
+  KLOG_IN
+  KEventLoop *self = NULL;
+  int epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (epoll_fd >= 0)
+    {
+    self = malloc (sizeof (KEventLoop));
+    memset (self, 0, sizeof (KEventLoop));
+    self->epoll_fd = epoll_fd;
+    }
+  else
+    klog_error (KLOG_CLASS, "Can't create epoll instance: %s",
+      strerror (errno));
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  keventloop_free_list
+
+  ==========================================================================*/
+static void keventloop_free_list (KEventHandler *h)
+  {
+  while (h)
+    {
+    KEventHandler *next = h->next;
+    free (h);
+    h = next;
+    }
+  }
+
+/*============================================================================
+
+  keventloop_destroy
+
+  ==========================================================================*/
+void keventloop_destroy (KEventLoop *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    keventloop_free_list (self->handlers);
+    keventloop_free_list (self->dead);
+    close (self->epoll_fd);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  keventloop_add
+
+  ==========================================================================*/
+BOOL keventloop_add (KEventLoop *self, int fd, uint32_t events,
+       KEventFn fn, void *user_data)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  assert (fn != NULL);
+  BOOL ret = FALSE;
+  KEventHandler *h = malloc (sizeof (KEventHandler));
+  h->fd = fd;
+  h->fn = fn;
+  h->user_data = user_data;
+
+  struct epoll_event ev;
+  memset (&ev, 0, sizeof (ev));
+  ev.events = events;
+  ev.data.ptr = h;
+  if (epoll_ctl (self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    {
+    h->next = self->handlers;
+    self->handlers = h;
+    ret = TRUE;
+    }
+  else
+    {
+    klog_error (KLOG_CLASS, "Can't watch fd %d: %s", fd, strerror (errno));
+    free (h);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  keventloop_remove
+
+  ==========================================================================*/
+void keventloop_remove (KEventLoop *self, int fd)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  KEventHandler **p = &self->handlers;
+  while (*p)
+    {
+    KEventHandler *h = *p;
+    if (h->fd == fd)
+      {
+      epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      *p = h->next;
+      h->fn = NULL;
+      h->next = self->dead;
+      self->dead = h;
+      break;
+      }
+    p = &h->next;
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  keventloop_run
+
+  ==========================================================================*/
+void keventloop_run (KEventLoop *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  self->quit = FALSE;
+  while (!self->quit)
+    {
+    struct epoll_event events[KEVENTLOOP_MAX_EVENTS];
+    int n = epoll_wait (self->epoll_fd, events, KEVENTLOOP_MAX_EVENTS, -1);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      klog_error (KLOG_CLASS, "epoll_wait failed: %s", strerror (errno));
+      break;
+      }
+    for (int i = 0; i < n; i++)
+      {
+      KEventHandler *h = events[i].data.ptr;
+      if (h->fn)
+        h->fn (h->fd, events[i].events, h->user_data);
+      }
+    keventloop_free_list (self->dead);
+    self->dead = NULL;
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  keventloop_quit
+
+  ==========================================================================*/
+void keventloop_quit (KEventLoop *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  self->quit = TRUE;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  keventloop_set_timer
+
+  ==========================================================================*/
+void keventloop_set_timer (int timer_fd, int64_t msec, int64_t interval_msec)
+  {
+  KLOG_IN
+  struct itimerspec its;
+  its.it_value.tv_sec = msec / 1000;
+  its.it_value.tv_nsec = (msec % 1000) * 1000000;
+  its.it_interval.tv_sec = interval_msec / 1000;
+  its.it_interval.tv_nsec = (interval_msec % 1000) * 1000000;
+  if (timerfd_settime (timer_fd, 0, &its, NULL) != 0)
+    klog_error (KLOG_CLASS, "Can't set timer: %s", strerror (errno));
+  KLOG_OUT
+  }
+
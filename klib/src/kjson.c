@@ -0,0 +1,37 @@
+/*============================================================================
+
+  klib
+
+  kjson.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <klib/kjson.h>
+
+/*============================================================================
+
+  kjson_write_string
+
+  ==========================================================================*/
+void kjson_write_string (FILE *f, const char *s)
+  {
+  fputc ('"', f);
+  for (const unsigned char *p = (const unsigned char *)s; *p; p++)
+    {
+    if (*p == '"' || *p == '\\')
+      {
+      fputc ('\\', f);
+      fputc (*p, f);
+      }
+    else if (*p < 0x20)
+      fprintf (f, "\\u%04x", *p);
+    else
+      fputc (*p, f);
+    }
+  fputc ('"', f);
+  }
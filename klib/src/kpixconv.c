@@ -0,0 +1,499 @@
+/*============================================================================
+
+  klib
+
+  kpixconv.c
+
+  Each SIMD implementation handles blocks of 16 pixels, and leaves any
+  remainder to the scalar code. The x86 versions are compiled with
+  function-level target attributes, so the rest of the library does not
+  need -mssse3, and are only called if the CPU reports SSSE3.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <klib/klog.h>
+#include <klib/kpixconv.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KPIXCONV_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define KPIXCONV_NEON
+#include <arm_neon.h>
+#endif
+
+#define KLOG_CLASS "klib.kpixconv"
+
+typedef void (*KPixconvXrgbFn) (const uint8_t *src, uint32_t *dst, int n);
+typedef void (*KPixconv565Fn) (const uint8_t *src, uint16_t *dst, int n);
+typedef void (*KPixconvGrayFn) (const uint8_t *src, uint8_t *dst, int n);
+typedef void (*KPixconvCmykFn) (const uint8_t *src, uint8_t *dst, int n,
+  BOOL inverted);
+
+static pthread_once_t kpixconv_once = PTHREAD_ONCE_INIT;
+static BOOL kpixconv_simd = TRUE;
+static const char *kpixconv_impl = "scalar";
+static KPixconvXrgbFn kpixconv_xrgb_fn;
+static KPixconv565Fn kpixconv_565_fn;
+static KPixconvGrayFn kpixconv_gray_fn;
+static KPixconvCmykFn kpixconv_cmyk_fn;
+
+/*============================================================================
+
+  kpixconv_xrgb_scalar
+
+  ==========================================================================*/
+static void kpixconv_xrgb_scalar (const uint8_t *src, uint32_t *dst, int n)
+  {
+  for (int i = 0; i < n; i++, src += 3)
+    dst[i] = 0xFF000000 | ((uint32_t)src[0] << 16) 
+      | ((uint32_t)src[1] << 8) | src[2];
+  }
+
+/*============================================================================
+
+  kpixconv_565_scalar
+
+  ==========================================================================*/
+static void kpixconv_565_scalar (const uint8_t *src, uint16_t *dst, int n)
+  {
+  for (int i = 0; i < n; i++, src += 3)
+    dst[i] = (uint16_t)(((src[0] & 0xF8) << 8) | ((src[1] & 0xFC) << 3) 
+      | (src[2] >> 3));
+  }
+
+/*============================================================================
+
+  kpixconv_gray_scalar
+
+  ==========================================================================*/
+static void kpixconv_gray_scalar (const uint8_t *src, uint8_t *dst, int n)
+  {
+  for (int i = 0; i < n; i++, dst += 3)
+    dst[0] = dst[1] = dst[2] = src[i];
+  }
+
+/*============================================================================
+
+  kpixconv_cmyk_scalar
+
+  Each of R, G, and B is the product of the complements of one ink and
+  of black, divided by 255 with exact rounding. Inverted data already
+  holds the complements.
+
+  ==========================================================================*/
+static void kpixconv_cmyk_scalar (const uint8_t *src, uint8_t *dst, int n,
+    BOOL inverted)
+  {
+  uint8_t flip = inverted ? 0 : 0xFF;
+  for (int i = 0; i < n; i++, src += 4, dst += 3)
+    {
+    uint32_t k = src[3] ^ flip;
+    for (int j = 0; j < 3; j++)
+      {
+      uint32_t t = (src[j] ^ flip) * k + 128;
+      dst[j] = (uint8_t)((t + (t >> 8)) >> 8);
+      }
+    }
+  }
+
+#ifdef KPIXCONV_X86
+
+/*============================================================================
+
+  kpixconv_load4_ssse3
+
+  Expand four RGB pixels, starting 'skip' bytes into a 16-byte load, to
+  four xRGB values. The last block of each 16 pixels is loaded from 
+  byte 32 with skip=4, so that no load reads past the 48 bytes of the
+  block.
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static inline __m128i kpixconv_load4_ssse3 (const uint8_t *src, int skip)
+  {
+  __m128i shuffle = _mm_setr_epi8 
+    (2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  shuffle = _mm_add_epi8 (shuffle, _mm_set1_epi32 (skip * 0x00010101));
+  __m128i v = _mm_loadu_si128 ((const __m128i *)src);
+  return _mm_or_si128 (_mm_shuffle_epi8 (v, shuffle),
+    _mm_set1_epi32 ((int)0xFF000000));
+  }
+
+/*============================================================================
+
+  kpixconv_xrgb_ssse3
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static void kpixconv_xrgb_ssse3 (const uint8_t *src, uint32_t *dst, int n)
+  {
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 48, dst += 16)
+    {
+    _mm_storeu_si128 ((__m128i *)dst, kpixconv_load4_ssse3 (src, 0));
+    _mm_storeu_si128 ((__m128i *)(dst + 4), kpixconv_load4_ssse3 (src + 12, 0));
+    _mm_storeu_si128 ((__m128i *)(dst + 8), kpixconv_load4_ssse3 (src + 24, 0));
+    _mm_storeu_si128 ((__m128i *)(dst + 12), kpixconv_load4_ssse3 (src + 32, 4));
+    }
+  kpixconv_xrgb_scalar (src, dst, n - blocks * 16);
+  }
+
+/*============================================================================
+
+  kpixconv_pack565_ssse3
+
+  Reduce eight xRGB values to RGB565. The 32-bit results are at most
+  0xFFFF, so they are offset into the signed range for the saturating
+  pack, and the offset removed again afterwards.
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static inline __m128i kpixconv_pack565_ssse3 (__m128i a, __m128i b)
+  {
+  const __m128i red = _mm_set1_epi32 (0xF800);
+  const __m128i green = _mm_set1_epi32 (0x07E0);
+  const __m128i blue = _mm_set1_epi32 (0x001F);
+  const __m128i bias32 = _mm_set1_epi32 (0x8000);
+  const __m128i bias16 = _mm_set1_epi16 ((short)0x8000);
+  a = _mm_or_si128 (_mm_or_si128 
+    (_mm_and_si128 (_mm_srli_epi32 (a, 8), red),
+     _mm_and_si128 (_mm_srli_epi32 (a, 5), green)),
+     _mm_and_si128 (_mm_srli_epi32 (a, 3), blue));
+  b = _mm_or_si128 (_mm_or_si128 
+    (_mm_and_si128 (_mm_srli_epi32 (b, 8), red),
+     _mm_and_si128 (_mm_srli_epi32 (b, 5), green)),
+     _mm_and_si128 (_mm_srli_epi32 (b, 3), blue));
+  __m128i packed = _mm_packs_epi32 (_mm_sub_epi32 (a, bias32), 
+    _mm_sub_epi32 (b, bias32));
+  return _mm_xor_si128 (packed, bias16);
+  }
+
+/*============================================================================
+
+  kpixconv_565_ssse3
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static void kpixconv_565_ssse3 (const uint8_t *src, uint16_t *dst, int n)
+  {
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 48, dst += 16)
+    {
+    __m128i p0 = kpixconv_load4_ssse3 (src, 0);
+    __m128i p1 = kpixconv_load4_ssse3 (src + 12, 0);
+    __m128i p2 = kpixconv_load4_ssse3 (src + 24, 0);
+    __m128i p3 = kpixconv_load4_ssse3 (src + 32, 4);
+    _mm_storeu_si128 ((__m128i *)dst, kpixconv_pack565_ssse3 (p0, p1));
+    _mm_storeu_si128 ((__m128i *)(dst + 8), kpixconv_pack565_ssse3 (p2, p3));
+    }
+  kpixconv_565_scalar (src, dst, n - blocks * 16);
+  }
+
+/*============================================================================
+
+  kpixconv_gray_ssse3
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static void kpixconv_gray_ssse3 (const uint8_t *src, uint8_t *dst, int n)
+  {
+  const __m128i s0 = _mm_setr_epi8 
+    (0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+  const __m128i s1 = _mm_setr_epi8 
+    (5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+  const __m128i s2 = _mm_setr_epi8 
+    (10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 16, dst += 48)
+    {
+    __m128i v = _mm_loadu_si128 ((const __m128i *)src);
+    _mm_storeu_si128 ((__m128i *)dst, _mm_shuffle_epi8 (v, s0));
+    _mm_storeu_si128 ((__m128i *)(dst + 16), _mm_shuffle_epi8 (v, s1));
+    _mm_storeu_si128 ((__m128i *)(dst + 32), _mm_shuffle_epi8 (v, s2));
+    }
+  kpixconv_gray_scalar (src, dst, n - blocks * 16);
+  }
+
+/*============================================================================
+
+  kpixconv_cmyk2_ssse3
+
+  Convert two CMYK pixels, as 16-bit values, to 16-bit R, G, B, and a
+  junk value, with the same rounding as the scalar code.
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static inline __m128i kpixconv_cmyk2_ssse3 (__m128i v)
+  {
+  __m128i k = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, 0xFF), 0xFF);
+  __m128i t = _mm_add_epi16 (_mm_mullo_epi16 (v, k), _mm_set1_epi16 (128));
+  return _mm_srli_epi16 (_mm_add_epi16 (t, _mm_srli_epi16 (t, 8)), 8);
+  }
+
+/*============================================================================
+
+  kpixconv_cmyk_ssse3
+
+  Four pixels at a time; the twelve bytes of output are written as
+  eight and four, so that nothing is written beyond the end of dst.
+
+  ==========================================================================*/
+__attribute__((target("ssse3")))
+static void kpixconv_cmyk_ssse3 (const uint8_t *src, uint8_t *dst, int n,
+    BOOL inverted)
+  {
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i flip = _mm_set1_epi8 (inverted ? 0 : (char)0xFF);
+  const __m128i drop = _mm_setr_epi8 
+    (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  int blocks = n / 4;
+  for (int i = 0; i < blocks; i++, src += 16, dst += 12)
+    {
+    __m128i v = _mm_xor_si128 
+      (_mm_loadu_si128 ((const __m128i *)src), flip);
+    __m128i lo = kpixconv_cmyk2_ssse3 (_mm_unpacklo_epi8 (v, zero));
+    __m128i hi = kpixconv_cmyk2_ssse3 (_mm_unpackhi_epi8 (v, zero));
+    __m128i rgb = _mm_shuffle_epi8 (_mm_packus_epi16 (lo, hi), drop);
+    _mm_storel_epi64 ((__m128i *)dst, rgb);
+    uint32_t last = (uint32_t)_mm_cvtsi128_si32 (_mm_srli_si128 (rgb, 8));
+    memcpy (dst + 8, &last, 4);
+    }
+  kpixconv_cmyk_scalar (src, dst, n - blocks * 4, inverted);
+  }
+
+#endif
+
+#ifdef KPIXCONV_NEON
+
+/*============================================================================
+
+  kpixconv_xrgb_neon
+
+  ==========================================================================*/
+static void kpixconv_xrgb_neon (const uint8_t *src, uint32_t *dst, int n)
+  {
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 48, dst += 16)
+    {
+    uint8x16x3_t rgb = vld3q_u8 (src);
+    uint8x16x4_t bgrx;
+    bgrx.val[0] = rgb.val[2];
+    bgrx.val[1] = rgb.val[1];
+    bgrx.val[2] = rgb.val[0];
+    bgrx.val[3] = vdupq_n_u8 (0xFF);
+    vst4q_u8 ((uint8_t *)dst, bgrx);
+    }
+  kpixconv_xrgb_scalar (src, dst, n - blocks * 16);
+  }
+
+/*============================================================================
+
+  kpixconv_565_neon
+
+  ==========================================================================*/
+static void kpixconv_565_neon (const uint8_t *src, uint16_t *dst, int n)
+  {
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 48, dst += 16)
+    {
+    uint8x16x3_t rgb = vld3q_u8 (src);
+    uint16x8_t lo = vshll_n_u8 (vget_low_u8 (rgb.val[0]), 8);
+    lo = vsriq_n_u16 (lo, vshll_n_u8 (vget_low_u8 (rgb.val[1]), 8), 5);
+    lo = vsriq_n_u16 (lo, vshll_n_u8 (vget_low_u8 (rgb.val[2]), 8), 11);
+    uint16x8_t hi = vshll_n_u8 (vget_high_u8 (rgb.val[0]), 8);
+    hi = vsriq_n_u16 (hi, vshll_n_u8 (vget_high_u8 (rgb.val[1]), 8), 5);
+    hi = vsriq_n_u16 (hi, vshll_n_u8 (vget_high_u8 (rgb.val[2]), 8), 11);
+    vst1q_u16 (dst, lo);
+    vst1q_u16 (dst + 8, hi);
+    }
+  kpixconv_565_scalar (src, dst, n - blocks * 16);
+  }
+
+/*============================================================================
+
+  kpixconv_gray_neon
+
+  ==========================================================================*/
+static void kpixconv_gray_neon (const uint8_t *src, uint8_t *dst, int n)
+  {
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 16, dst += 48)
+    {
+    uint8x16x3_t rgb;
+    rgb.val[0] = rgb.val[1] = rgb.val[2] = vld1q_u8 (src);
+    vst3q_u8 (dst, rgb);
+    }
+  kpixconv_gray_scalar (src, dst, n - blocks * 16);
+  }
+
+/*============================================================================
+
+  kpixconv_mul255_neon
+
+  x * k / 255, rounded as in the scalar code: vraddhn adds 128 before
+  taking the high byte.
+
+  ==========================================================================*/
+static inline uint8x16_t kpixconv_mul255_neon (uint8x16_t x, uint8x16_t k)
+  {
+  uint16x8_t lo = vmull_u8 (vget_low_u8 (x), vget_low_u8 (k));
+  uint16x8_t hi = vmull_u8 (vget_high_u8 (x), vget_high_u8 (k));
+  return vcombine_u8 (vraddhn_u16 (lo, vrshrq_n_u16 (lo, 8)),
+    vraddhn_u16 (hi, vrshrq_n_u16 (hi, 8)));
+  }
+
+/*============================================================================
+
+  kpixconv_cmyk_neon
+
+  ==========================================================================*/
+static void kpixconv_cmyk_neon (const uint8_t *src, uint8_t *dst, int n,
+    BOOL inverted)
+  {
+  int blocks = n / 16;
+  for (int i = 0; i < blocks; i++, src += 64, dst += 48)
+    {
+    uint8x16x4_t cmyk = vld4q_u8 (src);
+    if (!inverted)
+      {
+      for (int j = 0; j < 4; j++)
+        cmyk.val[j] = vmvnq_u8 (cmyk.val[j]);
+      }
+    uint8x16x3_t rgb;
+    for (int j = 0; j < 3; j++)
+      rgb.val[j] = kpixconv_mul255_neon (cmyk.val[j], cmyk.val[3]);
+    vst3q_u8 (dst, rgb);
+    }
+  kpixconv_cmyk_scalar (src, dst, n - blocks * 16, inverted);
+  }
+
+#endif
+
+/*============================================================================
+
+  kpixconv_init
+
+  ==========================================================================*/
+static void kpixconv_init (void)
+  {
+  KLOG_IN
+  kpixconv_xrgb_fn = kpixconv_xrgb_scalar;
+  kpixconv_565_fn = kpixconv_565_scalar;
+  kpixconv_gray_fn = kpixconv_gray_scalar;
+  kpixconv_cmyk_fn = kpixconv_cmyk_scalar;
+  kpixconv_impl = "scalar";
+  if (kpixconv_simd)
+    {
+#if defined(KPIXCONV_X86)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("ssse3"))
+      {
+      kpixconv_xrgb_fn = kpixconv_xrgb_ssse3;
+      kpixconv_565_fn = kpixconv_565_ssse3;
+      kpixconv_gray_fn = kpixconv_gray_ssse3;
+      kpixconv_cmyk_fn = kpixconv_cmyk_ssse3;
+      kpixconv_impl = "ssse3";
+      }
+#elif defined(KPIXCONV_NEON)
+    kpixconv_xrgb_fn = kpixconv_xrgb_neon;
+    kpixconv_565_fn = kpixconv_565_neon;
+    kpixconv_gray_fn = kpixconv_gray_neon;
+    kpixconv_cmyk_fn = kpixconv_cmyk_neon;
+    kpixconv_impl = "neon";
+#endif
+    }
+  klog_debug (KLOG_CLASS, "Pixel conversion uses %s code", kpixconv_impl);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpixconv_set_simd
+
+  ==========================================================================*/
+void kpixconv_set_simd (BOOL enable)
+  {
+  KLOG_IN
+  pthread_once (&kpixconv_once, kpixconv_init);
+  kpixconv_simd = enable;
+  kpixconv_init ();
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpixconv_get_impl
+
+  ==========================================================================*/
+const char *kpixconv_get_impl (void)
+  {
+  KLOG_IN
+  pthread_once (&kpixconv_once, kpixconv_init);
+  KLOG_OUT
+  return kpixconv_impl;
+  }
+
+/*============================================================================
+
+  kpixconv_rgb_to_xrgb8888
+
+  ==========================================================================*/
+void kpixconv_rgb_to_xrgb8888 (const uint8_t *src, uint32_t *dst, int n)
+  {
+  KLOG_IN
+  pthread_once (&kpixconv_once, kpixconv_init);
+  kpixconv_xrgb_fn (src, dst, n);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpixconv_rgb_to_rgb565
+
+  ==========================================================================*/
+void kpixconv_rgb_to_rgb565 (const uint8_t *src, uint16_t *dst, int n)
+  {
+  KLOG_IN
+  pthread_once (&kpixconv_once, kpixconv_init);
+  kpixconv_565_fn (src, dst, n);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpixconv_gray_to_rgb
+
+  ==========================================================================*/
+void kpixconv_gray_to_rgb (const uint8_t *src, uint8_t *dst, int n)
+  {
+  KLOG_IN
+  pthread_once (&kpixconv_once, kpixconv_init);
+  kpixconv_gray_fn (src, dst, n);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpixconv_cmyk_to_rgb
+
+  ==========================================================================*/
+void kpixconv_cmyk_to_rgb (const uint8_t *src, uint8_t *dst, int n,
+    BOOL inverted)
+  {
+  KLOG_IN
+  pthread_once (&kpixconv_once, kpixconv_init);
+  kpixconv_cmyk_fn (src, dst, n, inverted);
+  KLOG_OUT
+  }
+
@@ -0,0 +1,159 @@
+/*============================================================================
+
+  klib
+
+  kpool.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <klib/klog.h>
+#include <klib/kpool.h>
+
+#define KLOG_CLASS "klib.kpool"
+
+/*============================================================================
+
+  KPool
+
+  ==========================================================================*/
+struct _KPool
+  {
+  size_t buffer_size;
+  int max_idle;
+  pthread_mutex_t lock;
+  // The idle buffers; the first n_idle entries are valid
+  void **idle;
+  int n_idle;
+  // Buffers allocated and not yet freed, for logging
+  int n_allocated;
+  };
+
+/*============================================================================
+
+  kpool_new
+
+  ==========================================================================*/
+KPool *kpool_new (size_t buffer_size, int max_idle)
+  {
+  KLOG_IN
+  KPool *self = malloc (sizeof (KPool));
+  self->buffer_size = buffer_size;
+  self->max_idle = max_idle;
+  pthread_mutex_init (&self->lock, NULL);
+  self->idle = malloc ((max_idle > 0 ? max_idle : 1) * sizeof (void *));
+  self->n_idle = 0;
+  self->n_allocated = 0;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  kpool_destroy
+
+  ==========================================================================*/
+void kpool_destroy (KPool *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    for (int i = 0; i < self->n_idle; i++)
+      free (self->idle[i]);
+    free (self->idle);
+    pthread_mutex_destroy (&self->lock);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpool_get
+
+  ==========================================================================*/
+void *kpool_get (KPool *self)
+  {
+  KLOG_IN
+  void *ret = NULL;
+  pthread_mutex_lock (&self->lock);
+  if (self->n_idle > 0)
+    ret = self->idle[--self->n_idle];
+  else
+    {
+    ret = malloc (self->buffer_size);
+    self->n_allocated++;
+    klog_debug (KLOG_CLASS, "Allocated buffer of %zu bytes, %d in total",
+      self->buffer_size, self->n_allocated);
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kpool_put
+
+  ==========================================================================*/
+void kpool_put (KPool *self, void *buffer)
+  {
+  KLOG_IN
+  if (buffer)
+    {
+    pthread_mutex_lock (&self->lock);
+    if (self->n_idle < self->max_idle)
+      {
+      self->idle[self->n_idle++] = buffer;
+      buffer = NULL;
+      }
+    else
+      self->n_allocated--;
+    pthread_mutex_unlock (&self->lock);
+    free (buffer);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kpool_trim
+
+  ==========================================================================*/
+size_t kpool_trim (KPool *self)
+  {
+  KLOG_IN
+  pthread_mutex_lock (&self->lock);
+  int n = self->n_idle;
+  for (int i = 0; i < n; i++)
+    free (self->idle[i]);
+  self->n_idle = 0;
+  self->n_allocated -= n;
+  pthread_mutex_unlock (&self->lock);
+  if (n > 0)
+    klog_debug (KLOG_CLASS, "Freed %d idle buffer(s) of %zu bytes", n,
+      self->buffer_size);
+  KLOG_OUT
+  return (size_t)n * self->buffer_size;
+  }
+
+/*============================================================================
+
+  kpool_get_buffer_size
+
+  ==========================================================================*/
+size_t kpool_get_buffer_size (const KPool *self)
+  {
+  KLOG_IN
+  size_t ret = self->buffer_size;
+  KLOG_OUT
+  return ret;
+  }
+
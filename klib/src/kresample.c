@@ -0,0 +1,769 @@
+/*============================================================================
+
+  klib
+
+  kresample.c
+
+  The weights for each output pixel are computed once per image, for
+  each axis, and scaled to 14-bit fixed point so that they sum to
+  exactly 1 << KRESAMPLE_BITS. Every output pixel on an axis uses the
+  same number of taps, starting at a per-pixel offset; taps that fall
+  outside the filter's support just have zero weights. Near the edges
+  of the image, the window is shifted inwards rather than clamped, so
+  no kernel ever has to check its bounds.
+
+  The horizontal pass produces 8-bit rows, and the vertical pass
+  combines those. Both round, and saturate, the same way in every
+  implementation, so the SIMD code is bit-for-bit identical to the
+  scalar code. The x86 versions are compiled with function-level target
+  attributes, as in kpixconv.c.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <klib/klog.h>
+#include <klib/kresample.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KRESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define KRESAMPLE_NEON
+#include <arm_neon.h>
+#endif
+
+#define KLOG_CLASS "klib.kresample"
+
+#define KRESAMPLE_BITS 14
+#define KRESAMPLE_ONE (1 << KRESAMPLE_BITS)
+#define KRESAMPLE_ROUND (1 << (KRESAMPLE_BITS - 1))
+
+/*============================================================================
+
+  KResampleAxis
+
+  ==========================================================================*/
+typedef struct _KResampleAxis
+  {
+  int in_len;
+  int out_len;
+  int taps;
+  // Index of the first input pixel for each output pixel
+  int *start;
+  // out_len * taps weights
+  int16_t *weights;
+  // Output pixels before this one can be done with the horizontal SIMD
+  //   kernels, which need an even number of taps, and read one byte
+  //   beyond the last pixel of the window
+  int simd_end;
+  } KResampleAxis;
+
+typedef void (*KResampleHFn) (const uint8_t *src, uint8_t *dst,
+  const KResampleAxis *axis);
+typedef void (*KResampleVFn) (const uint8_t *const *rows,
+  const int16_t *weights, int taps, uint8_t *dst, int n);
+
+/*============================================================================
+
+  KResampler
+
+  ==========================================================================*/
+struct _KResampler
+  {
+  int crop_x;
+  int crop_y;
+  int crop_height;
+  uint8_t *dst;
+  int dst_width;
+  int dst_height;
+  int dst_stride;
+  KResampleAxis *h;
+  KResampleAxis *v;
+  // The last v->taps horizontally-resampled rows; source row r (counted
+  //   from crop_y) is in slot r % v->taps
+  uint8_t *ring;
+  const uint8_t **rows;
+  int next_src_row;
+  int next_dst_row;
+  };
+
+static pthread_once_t kresample_once = PTHREAD_ONCE_INIT;
+static const char *kresample_impl = "scalar";
+static KResampleHFn kresample_h_fn;
+static KResampleVFn kresample_v_fn;
+
+/*============================================================================
+
+  kresample_clamp
+
+  ==========================================================================*/
+static inline uint8_t kresample_clamp (int32_t v)
+  {
+  v >>= KRESAMPLE_BITS;
+  return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+  }
+
+/*============================================================================
+
+  kresample_h_scalar
+
+  ==========================================================================*/
+static void kresample_h_scalar_range (const uint8_t *src, uint8_t *dst,
+    const KResampleAxis *axis, int from)
+  {
+  int taps = axis->taps;
+  for (int x = from; x < axis->out_len; x++)
+    {
+    const uint8_t *p = src + axis->start[x] * 3;
+    const int16_t *w = axis->weights + x * taps;
+    int32_t r = KRESAMPLE_ROUND, g = KRESAMPLE_ROUND, b = KRESAMPLE_ROUND;
+    for (int k = 0; k < taps; k++, p += 3)
+      {
+      r += w[k] * p[0];
+      g += w[k] * p[1];
+      b += w[k] * p[2];
+      }
+    dst[x * 3] = kresample_clamp (r);
+    dst[x * 3 + 1] = kresample_clamp (g);
+    dst[x * 3 + 2] = kresample_clamp (b);
+    }
+  }
+
+static void kresample_h_scalar (const uint8_t *src, uint8_t *dst,
+    const KResampleAxis *axis)
+  {
+  kresample_h_scalar_range (src, dst, axis, 0);
+  }
+
+/*============================================================================
+
+  kresample_v_scalar
+
+  ==========================================================================*/
+static void kresample_v_scalar_range (const uint8_t *const *rows,
+    const int16_t *weights, int taps, uint8_t *dst, int from, int n)
+  {
+  for (int i = from; i < n; i++)
+    {
+    int32_t v = KRESAMPLE_ROUND;
+    for (int k = 0; k < taps; k++)
+      v += weights[k] * rows[k][i];
+    dst[i] = kresample_clamp (v);
+    }
+  }
+
+static void kresample_v_scalar (const uint8_t *const *rows,
+    const int16_t *weights, int taps, uint8_t *dst, int n)
+  {
+  kresample_v_scalar_range (rows, weights, taps, dst, 0, n);
+  }
+
+#ifdef KRESAMPLE_X86
+
+/*============================================================================
+
+  kresample_h_sse2
+
+  One output pixel at a time, two taps at a time: the R, G, and B of
+  two neighbouring source pixels are interleaved as 16-bit values, so
+  that one pmaddwd multiplies both by their weights and adds them.
+
+  ==========================================================================*/
+__attribute__((target("sse2")))
+static void kresample_h_sse2 (const uint8_t *src, uint8_t *dst,
+    const KResampleAxis *axis)
+  {
+  const __m128i zero = _mm_setzero_si128 ();
+  int taps = axis->taps;
+  for (int x = 0; x < axis->simd_end; x++)
+    {
+    const uint8_t *p = src + axis->start[x] * 3;
+    const int16_t *w = axis->weights + x * taps;
+    __m128i acc = _mm_set1_epi32 (KRESAMPLE_ROUND);
+    for (int k = 0; k < taps; k += 2, p += 6)
+      {
+      uint32_t a, b;
+      memcpy (&a, p, 4);
+      memcpy (&b, p + 3, 4);
+      __m128i pa = _mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((int)a), zero);
+      __m128i pb = _mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((int)b), zero);
+      __m128i wab = _mm_set1_epi32 ((int)((uint16_t)w[k]
+        | ((uint32_t)(uint16_t)w[k + 1] << 16)));
+      acc = _mm_add_epi32 (acc,
+        _mm_madd_epi16 (_mm_unpacklo_epi16 (pa, pb), wab));
+      }
+    acc = _mm_srai_epi32 (acc, KRESAMPLE_BITS);
+    acc = _mm_packs_epi32 (acc, acc);
+    acc = _mm_packus_epi16 (acc, acc);
+    uint32_t rgbx = (uint32_t)_mm_cvtsi128_si32 (acc);
+    memcpy (dst + x * 3, &rgbx, 3);
+    }
+  kresample_h_scalar_range (src, dst, axis, axis->simd_end);
+  }
+
+/*============================================================================
+
+  kresample_v_sse2
+
+  Sixteen bytes at a time, two rows at a time, in the same way as the
+  horizontal kernel.
+
+  ==========================================================================*/
+__attribute__((target("sse2")))
+static void kresample_v_sse2 (const uint8_t *const *rows,
+    const int16_t *weights, int taps, uint8_t *dst, int n)
+  {
+  const __m128i zero = _mm_setzero_si128 ();
+  int i = 0;
+  for (; i + 16 <= n; i += 16)
+    {
+    __m128i a0 = _mm_set1_epi32 (KRESAMPLE_ROUND);
+    __m128i a1 = a0, a2 = a0, a3 = a0;
+    for (int k = 0; k < taps; k += 2)
+      {
+      __m128i r0 = _mm_loadu_si128 ((const __m128i *)(rows[k] + i));
+      __m128i r1 = zero;
+      uint32_t pair = (uint16_t)weights[k];
+      if (k + 1 < taps)
+        {
+        r1 = _mm_loadu_si128 ((const __m128i *)(rows[k + 1] + i));
+        pair |= (uint32_t)(uint16_t)weights[k + 1] << 16;
+        }
+      __m128i w = _mm_set1_epi32 ((int)pair);
+      __m128i lo0 = _mm_unpacklo_epi8 (r0, zero);
+      __m128i lo1 = _mm_unpacklo_epi8 (r1, zero);
+      __m128i hi0 = _mm_unpackhi_epi8 (r0, zero);
+      __m128i hi1 = _mm_unpackhi_epi8 (r1, zero);
+      a0 = _mm_add_epi32 (a0, _mm_madd_epi16 (_mm_unpacklo_epi16 (lo0, lo1), w));
+      a1 = _mm_add_epi32 (a1, _mm_madd_epi16 (_mm_unpackhi_epi16 (lo0, lo1), w));
+      a2 = _mm_add_epi32 (a2, _mm_madd_epi16 (_mm_unpacklo_epi16 (hi0, hi1), w));
+      a3 = _mm_add_epi32 (a3, _mm_madd_epi16 (_mm_unpackhi_epi16 (hi0, hi1), w));
+      }
+    __m128i lo = _mm_packs_epi32 (_mm_srai_epi32 (a0, KRESAMPLE_BITS),
+      _mm_srai_epi32 (a1, KRESAMPLE_BITS));
+    __m128i hi = _mm_packs_epi32 (_mm_srai_epi32 (a2, KRESAMPLE_BITS),
+      _mm_srai_epi32 (a3, KRESAMPLE_BITS));
+    _mm_storeu_si128 ((__m128i *)(dst + i), _mm_packus_epi16 (lo, hi));
+    }
+  kresample_v_scalar_range (rows, weights, taps, dst, i, n);
+  }
+
+/*============================================================================
+
+  kresample_v_avx2
+
+  The same as the SSE2 version, 32 bytes at a time. The unpacks and
+  packs all work within 128-bit lanes, so the bytes come out in the
+  order they went in.
+
+  ==========================================================================*/
+__attribute__((target("avx2")))
+static void kresample_v_avx2 (const uint8_t *const *rows,
+    const int16_t *weights, int taps, uint8_t *dst, int n)
+  {
+  const __m256i zero = _mm256_setzero_si256 ();
+  int i = 0;
+  for (; i + 32 <= n; i += 32)
+    {
+    __m256i a0 = _mm256_set1_epi32 (KRESAMPLE_ROUND);
+    __m256i a1 = a0, a2 = a0, a3 = a0;
+    for (int k = 0; k < taps; k += 2)
+      {
+      __m256i r0 = _mm256_loadu_si256 ((const __m256i *)(rows[k] + i));
+      __m256i r1 = zero;
+      uint32_t pair = (uint16_t)weights[k];
+      if (k + 1 < taps)
+        {
+        r1 = _mm256_loadu_si256 ((const __m256i *)(rows[k + 1] + i));
+        pair |= (uint32_t)(uint16_t)weights[k + 1] << 16;
+        }
+      __m256i w = _mm256_set1_epi32 ((int)pair);
+      __m256i lo0 = _mm256_unpacklo_epi8 (r0, zero);
+      __m256i lo1 = _mm256_unpacklo_epi8 (r1, zero);
+      __m256i hi0 = _mm256_unpackhi_epi8 (r0, zero);
+      __m256i hi1 = _mm256_unpackhi_epi8 (r1, zero);
+      a0 = _mm256_add_epi32 (a0,
+        _mm256_madd_epi16 (_mm256_unpacklo_epi16 (lo0, lo1), w));
+      a1 = _mm256_add_epi32 (a1,
+        _mm256_madd_epi16 (_mm256_unpackhi_epi16 (lo0, lo1), w));
+      a2 = _mm256_add_epi32 (a2,
+        _mm256_madd_epi16 (_mm256_unpacklo_epi16 (hi0, hi1), w));
+      a3 = _mm256_add_epi32 (a3,
+        _mm256_madd_epi16 (_mm256_unpackhi_epi16 (hi0, hi1), w));
+      }
+    __m256i lo = _mm256_packs_epi32 (_mm256_srai_epi32 (a0, KRESAMPLE_BITS),
+      _mm256_srai_epi32 (a1, KRESAMPLE_BITS));
+    __m256i hi = _mm256_packs_epi32 (_mm256_srai_epi32 (a2, KRESAMPLE_BITS),
+      _mm256_srai_epi32 (a3, KRESAMPLE_BITS));
+    _mm256_storeu_si256 ((__m256i *)(dst + i), _mm256_packus_epi16 (lo, hi));
+    }
+  kresample_v_scalar_range (rows, weights, taps, dst, i, n);
+  }
+
+#endif
+
+#ifdef KRESAMPLE_NEON
+
+/*============================================================================
+
+  kresample_h_neon
+
+  ==========================================================================*/
+static void kresample_h_neon (const uint8_t *src, uint8_t *dst,
+    const KResampleAxis *axis)
+  {
+  int taps = axis->taps;
+  for (int x = 0; x < axis->simd_end; x++)
+    {
+    const uint8_t *p = src + axis->start[x] * 3;
+    const int16_t *w = axis->weights + x * taps;
+    int32x4_t acc = vdupq_n_s32 (0);
+    for (int k = 0; k < taps; k++, p += 3)
+      {
+      uint32_t a;
+      memcpy (&a, p, 4);
+      int16x4_t pa = vget_low_s16 (vreinterpretq_s16_u16
+        (vmovl_u8 (vcreate_u8 (a))));
+      acc = vmlal_n_s16 (acc, pa, w[k]);
+      }
+    // vqrshrn adds the rounding constant itself
+    int16x4_t s = vqrshrn_n_s32 (acc, KRESAMPLE_BITS);
+    uint8x8_t u = vqmovun_s16 (vcombine_s16 (s, s));
+    uint32_t rgbx = vget_lane_u32 (vreinterpret_u32_u8 (u), 0);
+    memcpy (dst + x * 3, &rgbx, 3);
+    }
+  kresample_h_scalar_range (src, dst, axis, axis->simd_end);
+  }
+
+/*============================================================================
+
+  kresample_v_neon
+
+  ==========================================================================*/
+static void kresample_v_neon (const uint8_t *const *rows,
+    const int16_t *weights, int taps, uint8_t *dst, int n)
+  {
+  int i = 0;
+  for (; i + 16 <= n; i += 16)
+    {
+    int32x4_t a0 = vdupq_n_s32 (0);
+    int32x4_t a1 = a0, a2 = a0, a3 = a0;
+    for (int k = 0; k < taps; k++)
+      {
+      uint8x16_t r = vld1q_u8 (rows[k] + i);
+      int16x8_t lo = vreinterpretq_s16_u16 (vmovl_u8 (vget_low_u8 (r)));
+      int16x8_t hi = vreinterpretq_s16_u16 (vmovl_u8 (vget_high_u8 (r)));
+      a0 = vmlal_n_s16 (a0, vget_low_s16 (lo), weights[k]);
+      a1 = vmlal_n_s16 (a1, vget_high_s16 (lo), weights[k]);
+      a2 = vmlal_n_s16 (a2, vget_low_s16 (hi), weights[k]);
+      a3 = vmlal_n_s16 (a3, vget_high_s16 (hi), weights[k]);
+      }
+    int16x8_t lo = vcombine_s16 (vqrshrn_n_s32 (a0, KRESAMPLE_BITS),
+      vqrshrn_n_s32 (a1, KRESAMPLE_BITS));
+    int16x8_t hi = vcombine_s16 (vqrshrn_n_s32 (a2, KRESAMPLE_BITS),
+      vqrshrn_n_s32 (a3, KRESAMPLE_BITS));
+    vst1q_u8 (dst + i, vcombine_u8 (vqmovun_s16 (lo), vqmovun_s16 (hi)));
+    }
+  kresample_v_scalar_range (rows, weights, taps, dst, i, n);
+  }
+
+#endif
+
+/*============================================================================
+
+  kresample_select
+
+  ==========================================================================*/
+static BOOL kresample_select (const char *name)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  if (!name || strcmp (name, "scalar") == 0)
+    {
+    kresample_h_fn = kresample_h_scalar;
+    kresample_v_fn = kresample_v_scalar;
+    kresample_impl = "scalar";
+    ret = TRUE;
+    }
+#if defined(KRESAMPLE_X86)
+  __builtin_cpu_init ();
+  if ((!name || strcmp (name, "sse2") == 0)
+       && __builtin_cpu_supports ("sse2"))
+    {
+    kresample_h_fn = kresample_h_sse2;
+    kresample_v_fn = kresample_v_sse2;
+    kresample_impl = "sse2";
+    ret = TRUE;
+    }
+  if ((!name || strcmp (name, "avx2") == 0)
+       && __builtin_cpu_supports ("avx2"))
+    {
+    // The horizontal pass works one pixel at a time, and gains nothing
+    //   from wider registers
+    kresample_h_fn = kresample_h_sse2;
+    kresample_v_fn = kresample_v_avx2;
+    kresample_impl = "avx2";
+    ret = TRUE;
+    }
+#elif defined(KRESAMPLE_NEON)
+  if (!name || strcmp (name, "neon") == 0)
+    {
+    kresample_h_fn = kresample_h_neon;
+    kresample_v_fn = kresample_v_neon;
+    kresample_impl = "neon";
+    ret = TRUE;
+    }
+#endif
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kresample_init
+
+  ==========================================================================*/
+static void kresample_init (void)
+  {
+  KLOG_IN
+  kresample_select (NULL);
+  klog_debug (KLOG_CLASS, "Resampling uses %s code", kresample_impl);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kresample_set_impl
+
+  ==========================================================================*/
+BOOL kresample_set_impl (const char *name)
+  {
+  KLOG_IN
+  pthread_once (&kresample_once, kresample_init);
+  BOOL ret = kresample_select (name);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kresample_get_impl
+
+  ==========================================================================*/
+const char *kresample_get_impl (void)
+  {
+  KLOG_IN
+  pthread_once (&kresample_once, kresample_init);
+  KLOG_OUT
+  return kresample_impl;
+  }
+
+/*============================================================================
+
+  kresample_filter
+
+  ==========================================================================*/
+static double kresample_filter (KResampleFilter filter, double x)
+  {
+  if (x < 0) x = -x;
+  switch (filter)
+    {
+    case KRESAMPLE_BOX:
+      return x <= 0.5 ? 1.0 : 0.0;
+    case KRESAMPLE_BILINEAR:
+      return x < 1.0 ? 1.0 - x : 0.0;
+    case KRESAMPLE_LANCZOS3:
+      if (x == 0.0) return 1.0;
+      if (x >= 3.0) return 0.0;
+      return 3.0 * sin (M_PI * x) * sin (M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+    }
+  return 0.0;
+  }
+
+/*============================================================================
+
+  kresample_support
+
+  ==========================================================================*/
+static double kresample_support (KResampleFilter filter)
+  {
+  switch (filter)
+    {
+    case KRESAMPLE_BOX: return 0.5;
+    case KRESAMPLE_BILINEAR: return 1.0;
+    case KRESAMPLE_LANCZOS3: return 3.0;
+    }
+  return 1.0;
+  }
+
+/*============================================================================
+
+  kresample_axis_destroy
+
+  ==========================================================================*/
+static void kresample_axis_destroy (KResampleAxis *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    free (self->start);
+    free (self->weights);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kresample_axis_new
+
+  When reducing, the filter is stretched by the reduction factor, so
+  that every input pixel contributes to the output.
+
+  ==========================================================================*/
+static KResampleAxis *kresample_axis_new (int in_len, int out_len,
+    KResampleFilter filter)
+  {
+  KLOG_IN
+  KResampleAxis *self = malloc (sizeof (KResampleAxis));
+  self->in_len = in_len;
+  self->out_len = out_len;
+  double scale = (double)in_len / out_len;
+  double fscale = scale > 1.0 ? scale : 1.0;
+  double support = kresample_support (filter) * fscale;
+  int taps;
+  if (in_len == out_len)
+    taps = 1;
+  else
+    {
+    taps = 2 * (int)ceil (support) + 1;
+    taps += taps & 1;
+    }
+  if (taps > in_len) taps = in_len;
+  self->taps = taps;
+  self->start = malloc (out_len * sizeof (int));
+  self->weights = calloc ((size_t)out_len * taps, sizeof (int16_t));
+  self->simd_end = 0;
+  double *w = malloc (taps * sizeof (double));
+
+  for (int i = 0; i < out_len; i++)
+    {
+    double center = (i + 0.5) * scale;
+    int xmin = (int)floor (center - support);
+    int xmax = (int)ceil (center + support);
+    if (xmin < 0) xmin = 0;
+    if (xmax > in_len) xmax = in_len;
+    if (xmax - xmin > taps) xmax = xmin + taps;
+    int start = xmin;
+    if (start + taps > in_len) start = in_len - taps;
+    self->start[i] = start;
+
+    double sum = 0.0;
+    for (int k = 0; k < taps; k++)
+      {
+      int x = start + k;
+      w[k] = (taps == 1 || x < xmin || x >= xmax) ? (taps == 1)
+        : kresample_filter (filter, (x + 0.5 - center) / fscale);
+      sum += w[k];
+      }
+    int16_t *fixed = self->weights + (size_t)i * taps;
+    if (sum == 0.0)
+      {
+      // Can happen with the box filter, when enlarging; use the
+      //   nearest pixel
+      int x = (int)center - start;
+      fixed[x < 0 ? 0 : x >= taps ? taps - 1 : x] = KRESAMPLE_ONE;
+      }
+    else
+      {
+      // Rounding each weight separately may leave the total slightly
+      //   out; make the difference up on the largest
+      int total = 0, largest = 0;
+      for (int k = 0; k < taps; k++)
+        {
+        fixed[k] = (int16_t)lround (w[k] / sum * KRESAMPLE_ONE);
+        total += fixed[k];
+        if (fixed[k] > fixed[largest]) largest = k;
+        }
+      fixed[largest] += KRESAMPLE_ONE - total;
+      }
+    if (taps % 2 == 0 && start + taps < in_len) self->simd_end = i + 1;
+    }
+  free (w);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  kresampler_new
+
+  ==========================================================================*/
+KResampler *kresampler_new (int src_width, int src_height, int crop_x,
+    int crop_y, int crop_width, int crop_height, uint8_t *dst,
+    int dst_width, int dst_height, int dst_stride, KResampleFilter filter)
+  {
+  KLOG_IN
+  pthread_once (&kresample_once, kresample_init);
+  KResampler *self = malloc (sizeof (KResampler));
+  self->crop_x = crop_x;
+  self->crop_y = crop_y;
+  self->crop_height = crop_height;
+  self->dst = dst;
+  self->dst_width = dst_width;
+  self->dst_height = dst_height;
+  self->dst_stride = dst_stride;
+  self->h = kresample_axis_new (crop_width, dst_width, filter);
+  self->v = kresample_axis_new (crop_height, dst_height, filter);
+  self->ring = malloc ((size_t)self->v->taps * dst_width * 3);
+  self->rows = malloc (self->v->taps * sizeof (uint8_t *));
+  self->next_src_row = 0;
+  self->next_dst_row = 0;
+  klog_debug (KLOG_CLASS, "Resample %dx%d (of %dx%d) to %dx%d, %dx%d taps",
+    crop_width, crop_height, src_width, src_height, dst_width, dst_height,
+    self->h->taps, self->v->taps);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  kresampler_destroy
+
+  ==========================================================================*/
+void kresampler_destroy (KResampler *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    kresample_axis_destroy (self->h);
+    kresample_axis_destroy (self->v);
+    free (self->ring);
+    free (self->rows);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kresampler_push_row
+
+  Output rows are made as soon as the last source row they need has
+  arrived. Source rows that come before the window of the next output
+  row will never be needed, so they are not resampled at all.
+
+  ==========================================================================*/
+int kresampler_push_row (KResampler *self, const uint8_t *row)
+  {
+  int r = self->next_src_row++ - self->crop_y;
+  const KResampleAxis *v = self->v;
+  if (r >= 0 && r < self->crop_height && self->next_dst_row < self->dst_height
+       && r >= v->start[self->next_dst_row])
+    {
+    int taps = v->taps;
+    size_t row_bytes = (size_t)self->dst_width * 3;
+    kresample_h_fn (row + self->crop_x * 3, self->ring + (r % taps) * row_bytes,
+      self->h);
+    while (self->next_dst_row < self->dst_height
+         && v->start[self->next_dst_row] + taps - 1 <= r)
+      {
+      int y = self->next_dst_row++;
+      int start = v->start[y];
+      for (int k = 0; k < taps; k++)
+        self->rows[k] = self->ring + ((start + k) % taps) * row_bytes;
+      kresample_v_fn (self->rows, v->weights + (size_t)y * taps, taps,
+        self->dst + (size_t)y * self->dst_stride, (int)row_bytes);
+      }
+    }
+  return self->next_dst_row;
+  }
+
+/*============================================================================
+
+  kresample_get_geometry
+
+  ==========================================================================*/
+void kresample_get_geometry (int src_width, int src_height, int dst_width,
+    int dst_height, KResampleMode mode, int *crop_x, int *crop_y,
+    int *crop_width, int *crop_height, int *out_x, int *out_y,
+    int *out_width, int *out_height)
+  {
+  KLOG_IN
+  // Compare the aspect ratios without dividing
+  BOOL wider = (int64_t)src_width * dst_height
+    > (int64_t)src_height * dst_width;
+  *crop_width = src_width;
+  *crop_height = src_height;
+  *out_width = dst_width;
+  *out_height = dst_height;
+  if (mode == KRESAMPLE_FILL)
+    {
+    if (wider)
+      *crop_width = (int)(((int64_t)src_height * dst_width
+        + dst_height / 2) / dst_height);
+    else
+      *crop_height = (int)(((int64_t)src_width * dst_height
+        + dst_width / 2) / dst_width);
+    }
+  else
+    {
+    if (wider)
+      *out_height = (int)(((int64_t)src_height * dst_width
+        + src_width / 2) / src_width);
+    else
+      *out_width = (int)(((int64_t)src_width * dst_height
+        + src_height / 2) / src_height);
+    }
+  if (*crop_width < 1) *crop_width = 1;
+  if (*crop_height < 1) *crop_height = 1;
+  if (*out_width < 1) *out_width = 1;
+  if (*out_height < 1) *out_height = 1;
+  *crop_x = (src_width - *crop_width) / 2;
+  *crop_y = (src_height - *crop_height) / 2;
+  *out_x = (dst_width - *out_width) / 2;
+  *out_y = (dst_height - *out_height) / 2;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kresample_scale
+
+  ==========================================================================*/
+void kresample_scale (const uint8_t *src, int src_width, int src_height,
+    uint8_t *dst, int dst_width, int dst_height, KResampleMode mode,
+    KResampleFilter filter)
+  {
+  KLOG_IN
+  int crop_x, crop_y, crop_width, crop_height;
+  int out_x, out_y, out_width, out_height;
+  kresample_get_geometry (src_width, src_height, dst_width, dst_height,
+    mode, &crop_x, &crop_y, &crop_width, &crop_height, &out_x, &out_y,
+    &out_width, &out_height);
+  int stride = dst_width * 3;
+  if (out_width != dst_width || out_height != dst_height)
+    memset (dst, 0, (size_t)stride * dst_height);
+  KResampler *r = kresampler_new (src_width, src_height, crop_x, crop_y,
+    crop_width, crop_height, dst + (size_t)out_y * stride + out_x * 3,
+    out_width, out_height, stride, filter);
+  for (int y = 0; y < src_height; y++)
+    {
+    if (kresampler_push_row (r, src + (size_t)y * src_width * 3)
+         == out_height)
+      break;
+    }
+  kresampler_destroy (r);
+  KLOG_OUT
+  }
+
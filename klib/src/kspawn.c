@@ -0,0 +1,404 @@
+/*============================================================================
+
+  klib
+
+  kspawn.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <klib/klog.h>
+#include <klib/kspawn.h>
+
+#define KLOG_CLASS "klib.kspawn"
+
+extern char **environ;
+
+// How often kspawn_stop() checks whether the child has gone
+#define KSPAWN_STOP_POLL_MSEC 10
+
+// Run in each child before exec, if set
+static KSpawnSetupFn kspawn_child_setup = NULL;
+
+/*============================================================================
+
+  kspawn_set_child_setup
+
+  ==========================================================================*/
+void kspawn_set_child_setup (KSpawnSetupFn fn)
+  {
+  kspawn_child_setup = fn;
+  }
+
+/*============================================================================
+
+  kspawn_close_from
+
+  Close every descriptor from first upwards, except keep, in a child.
+
+  ==========================================================================*/
+static void kspawn_close_from (int first, int keep)
+  {
+#ifdef SYS_close_range
+  if (syscall (SYS_close_range, first, keep - 1, 0) == 0
+       && syscall (SYS_close_range, keep + 1, ~0U, 0) == 0)
+    return;
+#endif
+  long max = sysconf (_SC_OPEN_MAX);
+  for (int fd = first; fd < max; fd++)
+    if (fd != keep) close (fd);
+  }
+
+/*============================================================================
+
+  kspawn_start_setup
+
+  As kspawn_start(), but with fork() and exec(), so that the child setup
+  function can run in between -- posix_spawn() has no place for it. If
+  exec() fails, the child sends errno back on a close-on-exec pipe, so
+  that the failure is reported as posix_spawn() would report it. The
+  child only makes async-signal-safe calls.
+
+  ==========================================================================*/
+static pid_t kspawn_start_setup (char *const argv[], char *const envp[],
+        int in_fd, int out_fd, BOOL new_group)
+  {
+  KLOG_IN
+  int fds[2];
+  if (pipe2 (fds, O_CLOEXEC) != 0)
+    {
+    KLOG_OUT
+    return -1;
+    }
+
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+    sigset_t mask;
+    sigemptyset (&mask);
+    sigprocmask (SIG_SETMASK, &mask, NULL);
+    signal (SIGPIPE, SIG_DFL);
+    signal (SIGCHLD, SIG_DFL);
+    if (new_group) setpgid (0, 0);
+    if (in_fd >= 0) dup2 (in_fd, 0);
+    if (out_fd >= 0) dup2 (out_fd, 1);
+    kspawn_close_from (3, fds[1]);
+    kspawn_child_setup ();
+    execve (argv[0], argv, envp ? envp : environ);
+    int err = errno;
+    while (write (fds[1], &err, sizeof (err)) < 0 && errno == EINTR);
+    _exit (127);
+    }
+
+  int err = pid < 0 ? errno : 0;
+  close (fds[1]);
+  if (pid > 0)
+    {
+    ssize_t n;
+    while ((n = read (fds[0], &err, sizeof (err))) < 0 && errno == EINTR);
+    if (n == sizeof (err))
+      {
+      while (waitpid (pid, NULL, 0) < 0 && errno == EINTR);
+      pid = -1;
+      }
+    else
+      err = 0;
+    }
+  close (fds[0]);
+  if (err != 0)
+    {
+    klog_debug (KLOG_CLASS, "Can't start %s: %s", argv[0], strerror (err));
+    pid = -1;
+    errno = err;
+    }
+  KLOG_OUT
+  return pid;
+  }
+
+/*============================================================================
+
+  kspawn_argv_new
+
+  ==========================================================================*/
+char **kspawn_argv_new (const char *arg0, ...)
+  {
+  KLOG_IN
+  int n = 0;
+  va_list ap;
+  va_start (ap, arg0);
+  for (const char *a = arg0; a; a = va_arg (ap, const char *)) n++;
+  va_end (ap);
+
+  char **ret = malloc ((n + 1) * sizeof (char *));
+  int i = 0;
+  va_start (ap, arg0);
+  for (const char *a = arg0; a; a = va_arg (ap, const char *))
+    ret[i++] = strdup (a);
+  va_end (ap);
+  ret[i] = NULL;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kspawn_argv_to_string
+
+  ==========================================================================*/
+char *kspawn_argv_to_string (char *const argv[])
+  {
+  KLOG_IN
+  size_t len = 1;
+  for (int i = 0; argv[i]; i++) len += strlen (argv[i]) + 1;
+  char *ret = malloc (len);
+  ret[0] = 0;
+  for (int i = 0; argv[i]; i++)
+    {
+    if (i > 0) strcat (ret, " ");
+    strcat (ret, argv[i]);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kspawn_env_with
+
+  ==========================================================================*/
+char **kspawn_env_with (const char *assignment)
+  {
+  KLOG_IN
+  const char *eq = strchr (assignment, '=');
+  size_t namelen = eq ? (size_t)(eq - assignment + 1) : strlen (assignment);
+  int n = 0;
+  while (environ[n]) n++;
+  char **ret = malloc ((n + 2) * sizeof (char *));
+  int j = 0;
+  for (int i = 0; i < n; i++)
+    {
+    if (strncmp (environ[i], assignment, namelen) != 0)
+      ret[j++] = strdup (environ[i]);
+    }
+  ret[j++] = strdup (assignment);
+  ret[j] = NULL;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kspawn_free_argv
+
+  ==========================================================================*/
+void kspawn_free_argv (char **argv)
+  {
+  KLOG_IN
+  if (argv)
+    {
+    for (int i = 0; argv[i]; i++) free (argv[i]);
+    free (argv);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kspawn_resolve
+
+  ==========================================================================*/
+char *kspawn_resolve (const char *name)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  if (strchr (name, '/'))
+    {
+    if (access (name, X_OK) == 0) ret = strdup (name);
+    }
+  else
+    {
+    const char *path = getenv ("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+    char *copy = strdup (path);
+    char *saveptr = NULL;
+    for (char *dir = strtok_r (copy, ":", &saveptr); dir && !ret;
+          dir = strtok_r (NULL, ":", &saveptr))
+      {
+      char *candidate;
+      asprintf (&candidate, "%s/%s", *dir ? dir : ".", name);
+      if (access (candidate, X_OK) == 0)
+        ret = candidate;
+      else
+        free (candidate);
+      }
+    free (copy);
+    }
+  klog_debug (KLOG_CLASS, "Resolved '%s' to '%s'", name,
+    ret ? ret : "(nothing)");
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  kspawn_start
+
+  ==========================================================================*/
+pid_t kspawn_start (char *const argv[], char *const envp[], int in_fd,
+        int out_fd, BOOL new_group)
+  {
+  if (kspawn_child_setup)
+    return kspawn_start_setup (argv, envp, in_fd, out_fd, new_group);
+
+  KLOG_IN
+  pid_t pid = -1;
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+
+  posix_spawnattr_init (&attr);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  sigset_t mask;
+  sigemptyset (&mask);
+  posix_spawnattr_setsigmask (&attr, &mask);
+  // Signals that the parent ignores stay ignored in the child, unless
+  //   they are reset here
+  sigset_t def;
+  sigemptyset (&def);
+  sigaddset (&def, SIGPIPE);
+  sigaddset (&def, SIGCHLD);
+  posix_spawnattr_setsigdefault (&attr, &def);
+  if (new_group)
+    {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup (&attr, 0);
+    }
+  posix_spawnattr_setflags (&attr, flags);
+
+  posix_spawn_file_actions_init (&actions);
+  if (in_fd >= 0) posix_spawn_file_actions_adddup2 (&actions, in_fd, 0);
+  if (out_fd >= 0) posix_spawn_file_actions_adddup2 (&actions, out_fd, 1);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+  // Uses close_range() in the child
+  posix_spawn_file_actions_addclosefrom_np (&actions, 3);
+#endif
+
+  int err = posix_spawn (&pid, argv[0], &actions, &attr, argv,
+    envp ? envp : environ);
+  if (err != 0)
+    {
+    klog_debug (KLOG_CLASS, "posix_spawn %s failed: %s", argv[0],
+      strerror (err));
+    pid = -1;
+    errno = err;
+    }
+
+  posix_spawn_file_actions_destroy (&actions);
+  posix_spawnattr_destroy (&attr);
+  KLOG_OUT
+  return pid;
+  }
+
+/*============================================================================
+
+  kspawn_stop
+
+  ==========================================================================*/
+void kspawn_stop (pid_t pid, int timeout_msec)
+  {
+  KLOG_IN
+  kill (-pid, SIGTERM);
+  // Poll, rather than block, so that a child that ignores SIGTERM can't
+  //   hold us up for longer than the timeout
+  const struct timespec nap = { 0, KSPAWN_STOP_POLL_MSEC * 1000000L };
+  pid_t waited;
+  int elapsed = 0;
+  while ((waited = waitpid (pid, NULL, WNOHANG)) == 0 
+       && elapsed < timeout_msec)
+    {
+    nanosleep (&nap, NULL);
+    elapsed += KSPAWN_STOP_POLL_MSEC;
+    }
+  if (waited == 0)
+    {
+    klog_warn (KLOG_CLASS, "Process %d ignored SIGTERM; killing it", 
+      (int)pid);
+    kill (-pid, SIGKILL);
+    while (waitpid (pid, NULL, 0) < 0 && errno == EINTR);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  kspawn_run_capture
+
+  ==========================================================================*/
+int kspawn_run_capture (char *const argv[], char *const envp[],
+       char **output)
+  {
+  KLOG_IN
+  int ret = -1;
+  *output = NULL;
+  int fds[2];
+  if (pipe2 (fds, O_CLOEXEC) == 0)
+    {
+    pid_t pid = kspawn_start (argv, envp, -1, fds[1], FALSE);
+    close (fds[1]);
+    if (pid > 0)
+      {
+      size_t len = 0, size = 4096;
+      char *buff = malloc (size);
+      ssize_t n;
+      while ((n = read (fds[0], buff + len, size - len - 1)) != 0)
+        {
+        if (n < 0)
+          {
+          if (errno == EINTR) continue;
+          break;
+          }
+        len += n;
+        if (size - len < 2)
+          {
+          size *= 2;
+          buff = realloc (buff, size);
+          }
+        }
+      buff[len] = 0;
+      int status = 0;
+      pid_t waited;
+      while ((waited = waitpid (pid, &status, 0)) < 0 && errno == EINTR);
+      if (waited == pid)
+        {
+        *output = buff;
+        ret = WIFEXITED (status) ? WEXITSTATUS (status) : 128;
+        }
+      else
+        {
+        // Someone else reaped it (SIGCHLD ignored, perhaps), so there is
+        //   no status to report
+        klog_warn (KLOG_CLASS, "Can't wait for %s: %s", argv[0],
+          strerror (errno));
+        free (buff);
+        }
+      }
+    close (fds[0]);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,199 @@
+/*============================================================================
+
+  klib
+
+  ktrace.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <klib/klog.h>
+#include <klib/kjson.h>
+#include <klib/ktrace.h>
+
+#define KLOG_CLASS "klib.ktrace"
+
+static FILE *trace_file = NULL;
+static BOOL trace_first = TRUE;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*============================================================================
+
+  ktrace_write_event
+
+  Caller must hold the mutex, and have checked that the file is open.
+  'duration' is only written for complete ('X') events.
+
+  ==========================================================================*/
+static void ktrace_write_event (char ph, const char *cat, const char *name,
+       int64_t ts, int64_t duration, const char *detail)
+  {
+  if (!trace_first) fputs (",\n", trace_file);
+  trace_first = FALSE;
+  fputs ("{\"name\":", trace_file);
+  kjson_write_string (trace_file, name);
+  fputs (",\"cat\":", trace_file);
+  kjson_write_string (trace_file, cat);
+  fprintf (trace_file, ",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%ld",
+    ph, (long long)ts, (int)getpid(), (long)syscall (SYS_gettid));
+  if (ph == 'X')
+    fprintf (trace_file, ",\"dur\":%lld", (long long)duration);
+  if (ph == 'i')
+    fputs (",\"s\":\"t\"", trace_file);
+  if (detail)
+    {
+    fputs (",\"args\":{\"detail\":", trace_file);
+    kjson_write_string (trace_file, detail);
+    fputc ('}', trace_file);
+    }
+  fputc ('}', trace_file);
+  }
+
+/*============================================================================
+
+  ktrace_begin
+
+  ==========================================================================*/
+void ktrace_begin (const char *cat, const char *name, const char *detail)
+  {
+  if (!trace_file) return;
+  int64_t now = ktrace_now();
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file)
+    ktrace_write_event ('B', cat, name, now, 0, detail);
+  pthread_mutex_unlock (&trace_mutex);
+  }
+
+/*============================================================================
+
+  ktrace_close
+
+  ==========================================================================*/
+void ktrace_close (void)
+  {
+  KLOG_IN
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file)
+    {
+    fputs ("\n]\n", trace_file);
+    fclose (trace_file);
+    trace_file = NULL;
+    }
+  pthread_mutex_unlock (&trace_mutex);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  ktrace_complete
+
+  ==========================================================================*/
+void ktrace_complete (const char *cat, const char *name, int64_t start,
+       int64_t duration, const char *detail)
+  {
+  if (!trace_file) return;
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file)
+    ktrace_write_event ('X', cat, name, start, duration, detail);
+  pthread_mutex_unlock (&trace_mutex);
+  }
+
+/*============================================================================
+
+  ktrace_enabled
+
+  ==========================================================================*/
+BOOL ktrace_enabled (void)
+  {
+  return trace_file != NULL;
+  }
+
+/*============================================================================
+
+  ktrace_end
+
+  ==========================================================================*/
+void ktrace_end (const char *cat, const char *name)
+  {
+  if (!trace_file) return;
+  int64_t now = ktrace_now();
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file)
+    ktrace_write_event ('E', cat, name, now, 0, NULL);
+  pthread_mutex_unlock (&trace_mutex);
+  }
+
+/*============================================================================
+
+  ktrace_flush
+
+  ==========================================================================*/
+void ktrace_flush (void)
+  {
+  if (!trace_file) return;
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file) fflush (trace_file);
+  pthread_mutex_unlock (&trace_mutex);
+  }
+
+/*============================================================================
+
+  ktrace_instant
+
+  ==========================================================================*/
+void ktrace_instant (const char *cat, const char *name, const char *detail)
+  {
+  if (!trace_file) return;
+  int64_t now = ktrace_now();
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file)
+    ktrace_write_event ('i', cat, name, now, 0, detail);
+  pthread_mutex_unlock (&trace_mutex);
+  }
+
+/*============================================================================
+
+  ktrace_now
+
+  ==========================================================================*/
+int64_t ktrace_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+/*============================================================================
+
+  ktrace_open
+
+  ==========================================================================*/
+BOOL ktrace_open (const char *filename)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  klog_debug (KLOG_CLASS, "Opening trace file %s", filename);
+  pthread_mutex_lock (&trace_mutex);
+  if (trace_file) fclose (trace_file);
+  trace_file = fopen (filename, "w");
+  if (trace_file)
+    {
+    fputs ("[\n", trace_file);
+    trace_first = TRUE;
+    ret = TRUE;
+    }
+  pthread_mutex_unlock (&trace_mutex);
+  KLOG_OUT
+  return ret;
+  }
+
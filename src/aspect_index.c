@@ -0,0 +1,457 @@
+/*============================================================================
+
+  lbc
+
+  aspect_index.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <klib/klib.h>
+#include "aspect_index.h"
+
+#define KLOG_CLASS "lbc.aspect_index"
+
+// Width of an aspect ratio bucket, in natural log units: about 5%. This
+//   is enough to separate 16:9, 16:10, 3:2 and 4:3
+#define ASPECT_INDEX_STEP 0.05
+
+// Images within this many steps of the monitor's aspect ratio -- about
+//   35% -- are drawn biggest first. Beyond it, the nearest shape is
+//   drawn first, whatever the size; that keeps a 16:9 monitor on 4:3 
+//   and 3:2 images for as long as there are any
+#define ASPECT_INDEX_TOLERANCE 6
+
+// The number of drawn images that are remembered, so that going back
+//   and forth gives the same ones. It is far more than --prev or 
+//   --prerender ever reach back or ahead
+#define ASPECT_INDEX_HISTORY 256
+
+// Resolution classes, in the order they are drawn from: images at least
+//   as big as the monitor, smaller images, and images whose size wasn't
+//   found during the scan
+#define ASPECT_INDEX_COVERS 0
+#define ASPECT_INDEX_SMALLER 1
+#define ASPECT_INDEX_UNKNOWN 2
+#define ASPECT_INDEX_CLASSES 3
+
+/*============================================================================
+
+  AspectBucket
+
+  The images of one resolution class whose aspect ratios round to the
+  same key. The first 'remaining' images have not been drawn yet.
+
+  ==========================================================================*/
+typedef struct _AspectBucket
+  {
+  int cls;
+  int key;
+  const ImageInfo **images;
+  int count;
+  int remaining;
+  } AspectBucket;
+
+/*============================================================================
+
+  AspectIndex
+
+  ==========================================================================*/
+struct _AspectIndex
+  {
+  // Buckets of each resolution class, in order of key
+  AspectBucket *buckets[ASPECT_INDEX_CLASSES];
+  int nbuckets[ASPECT_INDEX_CLASSES];
+  // For each bucket, the nearest open one at or above it (nbuckets if
+  //   there isn't one), and at or below it (-1 if there isn't one). An
+  //   open bucket points to itself. Like the links of a disjoint-set 
+  //   forest, these are shortened as they are followed
+  int *next[ASPECT_INDEX_CLASSES];
+  int *prev[ASPECT_INDEX_CLASSES];
+  // All the image pointers, which the buckets point into
+  const ImageInfo **images;
+  int count;
+  int remaining;
+  // The monitor's aspect ratio, as a log, in units of ASPECT_INDEX_STEP
+  double target;
+  // Whether images of the other orientation may be drawn: only if 
+  //   there are no others
+  BOOL any_orientation;
+  // The images drawn most recently, in a ring: image 'first' is at
+  //   drawn[head], and there are 'ndrawn' of them
+  const ImageInfo *drawn[ASPECT_INDEX_HISTORY];
+  int first;
+  int head;
+  int ndrawn;
+  };
+
+/*============================================================================
+
+  AspectIndexEntry
+
+  Used only while the index is built.
+
+  ==========================================================================*/
+typedef struct _AspectIndexEntry
+  {
+  int cls;
+  int key;
+  const ImageInfo *info;
+  } AspectIndexEntry;
+
+/*============================================================================
+
+  aspect_index_compare
+
+  ==========================================================================*/
+static int aspect_index_compare (const void *p1, const void *p2)
+  {
+  const AspectIndexEntry *e1 = p1;
+  const AspectIndexEntry *e2 = p2;
+  if (e1->cls != e2->cls) return e1->cls < e2->cls ? -1 : 1;
+  if (e1->key != e2->key) return e1->key < e2->key ? -1 : 1;
+  return 0;
+  }
+
+/*============================================================================
+
+  aspect_index_log_aspect
+
+  ==========================================================================*/
+static double aspect_index_log_aspect (int width, int height)
+  {
+  return log ((double)width / (double)height) / ASPECT_INDEX_STEP;
+  }
+
+/*============================================================================
+
+  aspect_index_is_open
+
+  Whether images may still be drawn from a bucket. Keys have the sign
+  of the orientation, and zero (square) suits either.
+
+  ==========================================================================*/
+static BOOL aspect_index_is_open (const AspectIndex *self, 
+    const AspectBucket *bucket)
+  {
+  return bucket->remaining > 0 && (self->any_orientation 
+    || (bucket->key >= 0) == (self->target >= 0) || bucket->key == 0);
+  }
+
+/*============================================================================
+
+  aspect_index_close
+
+  Make the search skip a bucket, until the index is refilled.
+
+  ==========================================================================*/
+static void aspect_index_close (AspectIndex *self, const AspectBucket *bucket)
+  {
+  int i = bucket - self->buckets[bucket->cls];
+  self->next[bucket->cls][i] = i + 1;
+  self->prev[bucket->cls][i] = i - 1;
+  }
+
+/*============================================================================
+
+  aspect_index_skip
+
+  Follow the links from bucket i to the open bucket they lead to, or to
+  'end' if there isn't one, and point the buckets on the way straight
+  at it.
+
+  ==========================================================================*/
+static int aspect_index_skip (int *links, int i, int end)
+  {
+  int ret = i;
+  while (ret != end && links[ret] != ret) ret = links[ret];
+  while (i != ret)
+    {
+    int next = links[i];
+    links[i] = ret;
+    i = next;
+    }
+  return ret;
+  }
+
+/*============================================================================
+
+  aspect_index_refill
+
+  Make every image available again, and open every bucket that suits
+  the monitor.
+
+  ==========================================================================*/
+static void aspect_index_refill (AspectIndex *self)
+  {
+  KLOG_IN
+  for (int c = 0; c < ASPECT_INDEX_CLASSES; c++)
+    {
+    int n = self->nbuckets[c];
+    for (int i = 0; i < n; i++)
+      {
+      AspectBucket *bucket = &self->buckets[c][i];
+      bucket->remaining = bucket->count;
+      self->next[c][i] = i;
+      self->prev[c][i] = i;
+      if (!aspect_index_is_open (self, bucket))
+        aspect_index_close (self, bucket);
+      }
+    }
+  self->remaining = self->count;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  aspect_index_new
+
+  ==========================================================================*/
+AspectIndex *aspect_index_new (const KList *images, int width, int height)
+  {
+  KLOG_IN
+  AspectIndex *self = malloc (sizeof (AspectIndex));
+  int l = klist_length (images);
+  self->target = aspect_index_log_aspect (width, height);
+  self->first = 0;
+  self->head = 0;
+  self->ndrawn = 0;
+
+  AspectIndexEntry *entries = malloc ((l + 1) * sizeof (AspectIndexEntry));
+  for (int i = 0; i < l; i++)
+    {
+    const ImageInfo *info = klist_get (images, i);
+    int w = image_info_get_width (info);
+    int h = image_info_get_height (info);
+    AspectIndexEntry *e = &entries[i];
+    e->info = info;
+    if (w > 0 && h > 0)
+      {
+      e->cls = (w >= width && h >= height) ?
+        ASPECT_INDEX_COVERS : ASPECT_INDEX_SMALLER;
+      e->key = (int)lround (aspect_index_log_aspect (w, h));
+      }
+    else
+      {
+      e->cls = ASPECT_INDEX_UNKNOWN;
+      e->key = 0;
+      }
+    }
+  qsort (entries, l, sizeof (AspectIndexEntry), aspect_index_compare);
+
+  // The sorted entries are split into runs of the same class and key,
+  //   each of which becomes a bucket
+  self->images = malloc ((l + 1) * sizeof (ImageInfo *));
+  for (int c = 0; c < ASPECT_INDEX_CLASSES; c++)
+    {
+    self->buckets[c] = NULL;
+    self->nbuckets[c] = 0;
+    }
+  for (int i = 0; i < l; )
+    {
+    int j = i;
+    while (j < l && entries[j].cls == entries[i].cls
+         && entries[j].key == entries[i].key)
+      {
+      self->images[j] = entries[j].info;
+      j++;
+      }
+    int c = entries[i].cls;
+    self->buckets[c] = realloc (self->buckets[c],
+      (self->nbuckets[c] + 1) * sizeof (AspectBucket));
+    AspectBucket *b = &self->buckets[c][self->nbuckets[c]++];
+    b->cls = c;
+    b->key = entries[i].key;
+    b->images = &self->images[i];
+    b->count = j - i;
+    b->remaining = j - i;
+    i = j;
+    }
+  free (entries);
+
+  // Only the images that may be drawn count towards a cycle
+  self->any_orientation = FALSE;
+  self->count = 0;
+  for (int c = 0; c < ASPECT_INDEX_CLASSES; c++)
+    for (int i = 0; i < self->nbuckets[c]; i++)
+      if (aspect_index_is_open (self, &self->buckets[c][i]))
+        self->count += self->buckets[c][i].count;
+  if (self->count == 0)
+    {
+    self->any_orientation = TRUE;
+    self->count = l;
+    }
+  for (int c = 0; c < ASPECT_INDEX_CLASSES; c++)
+    {
+    self->next[c] = malloc ((self->nbuckets[c] + 1) * sizeof (int));
+    self->prev[c] = malloc ((self->nbuckets[c] + 1) * sizeof (int));
+    }
+  aspect_index_refill (self);
+
+  klog_debug (KLOG_CLASS, "Indexed %d image(s) for %dx%d in %d+%d+%d "
+    "bucket(s), %d of the right orientation", l, width, height, self->nbuckets[ASPECT_INDEX_COVERS],
+    self->nbuckets[ASPECT_INDEX_SMALLER],
+    self->nbuckets[ASPECT_INDEX_UNKNOWN], 
+    self->any_orientation ? 0 : self->count);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  aspect_index_destroy
+
+  ==========================================================================*/
+void aspect_index_destroy (AspectIndex *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    for (int c = 0; c < ASPECT_INDEX_CLASSES; c++)
+      {
+      free (self->buckets[c]);
+      free (self->next[c]);
+      free (self->prev[c]);
+      }
+    free (self->images);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  aspect_index_find_bucket
+
+  Find the open bucket of a class nearest the target, or NULL if there
+  isn't one within max_distance. The buckets either side of the target
+  are found by binary search, and the links skip any closed ones, so
+  this stays quick however many buckets have run dry.
+
+  ==========================================================================*/
+static AspectBucket *aspect_index_find_bucket (AspectIndex *self,
+    int cls, double max_distance)
+  {
+  KLOG_IN
+  AspectBucket *buckets = self->buckets[cls];
+  int n = self->nbuckets[cls];
+  int lo = 0, hi = n;
+  while (lo < hi)
+    {
+    int mid = (lo + hi) / 2;
+    if (buckets[mid].key < self->target)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+
+  // Buckets [0, below] are below the target, and [above, n) above it
+  int below = lo > 0 ? aspect_index_skip (self->prev[cls], lo - 1, -1) : -1;
+  int above = aspect_index_skip (self->next[cls], lo, n);
+  AspectBucket *ret = NULL;
+  if (below >= 0 && above < n)
+    {
+    if (self->target - buckets[below].key
+         <= buckets[above].key - self->target)
+      ret = &buckets[below];
+    else
+      ret = &buckets[above];
+    }
+  else if (below >= 0)
+    ret = &buckets[below];
+  else if (above < n)
+    ret = &buckets[above];
+  if (ret && fabs (ret->key - self->target) > max_distance)
+    ret = NULL;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  aspect_index_draw
+
+  Take a random image from the best bucket: the biggest images of about
+  the right shape, then the nearest shape of any known size, then 
+  images of unknown size. The image is swapped with the last one that
+  is left in the bucket, so that the ones left stay at the start.
+
+  ==========================================================================*/
+static const ImageInfo *aspect_index_draw (AspectIndex *self)
+  {
+  KLOG_IN
+  if (self->remaining == 0) aspect_index_refill (self);
+  AspectBucket *bucket = NULL;
+  for (int c = ASPECT_INDEX_COVERS; c <= ASPECT_INDEX_SMALLER && !bucket;
+       c++)
+    bucket = aspect_index_find_bucket (self, c, ASPECT_INDEX_TOLERANCE);
+  if (!bucket)
+    {
+    AspectBucket *covers = aspect_index_find_bucket (self, 
+      ASPECT_INDEX_COVERS, HUGE_VAL);
+    AspectBucket *smaller = aspect_index_find_bucket (self, 
+      ASPECT_INDEX_SMALLER, HUGE_VAL);
+    if (covers && smaller)
+      bucket = fabs (covers->key - self->target) 
+        <= fabs (smaller->key - self->target) ? covers : smaller;
+    else
+      bucket = covers ? covers : smaller;
+    }
+  if (!bucket)
+    bucket = aspect_index_find_bucket (self, ASPECT_INDEX_UNKNOWN, 
+      HUGE_VAL);
+
+  int r = rand () % bucket->remaining;
+  const ImageInfo *ret = bucket->images[r];
+  bucket->images[r] = bucket->images[bucket->remaining - 1];
+  bucket->images[bucket->remaining - 1] = ret;
+  bucket->remaining--;
+  if (bucket->remaining == 0) aspect_index_close (self, bucket);
+  self->remaining--;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  aspect_index_get_nth
+
+  The ring of drawn images is extended at whichever end n is beyond,
+  and the image at the other end is forgotten if it is full.
+
+  ==========================================================================*/
+const ImageInfo *aspect_index_get_nth (AspectIndex *self, int n)
+  {
+  KLOG_IN
+  assert (self->count > 0);
+  while (n >= self->first + self->ndrawn)
+    {
+    if (self->ndrawn == ASPECT_INDEX_HISTORY)
+      {
+      self->head = (self->head + 1) % ASPECT_INDEX_HISTORY;
+      self->first++;
+      self->ndrawn--;
+      }
+    self->drawn[(self->head + self->ndrawn) % ASPECT_INDEX_HISTORY] 
+      = aspect_index_draw (self);
+    self->ndrawn++;
+    }
+  while (n < self->first)
+    {
+    if (self->ndrawn == ASPECT_INDEX_HISTORY) self->ndrawn--;
+    self->head = (self->head + ASPECT_INDEX_HISTORY - 1) 
+      % ASPECT_INDEX_HISTORY;
+    self->first--;
+    self->drawn[self->head] = aspect_index_draw (self);
+    self->ndrawn++;
+    }
+  KLOG_OUT
+  return self->drawn[(self->head + n - self->first) % ASPECT_INDEX_HISTORY];
+  }
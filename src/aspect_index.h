@@ -0,0 +1,47 @@
+/*============================================================================
+
+  lbc
+
+  aspect_index.h
+
+  The images that suit one monitor best, for --fit=best. The images
+  are grouped into buckets by aspect ratio, and by whether they are
+  big enough to cover the monitor without being enlarged. Each image is
+  drawn at random from the bucket nearest the monitor's aspect ratio,
+  of the biggest images that are left; when that bucket runs dry, the
+  next nearest is used, and so on. Images of a very different shape
+  are drawn nearest first, whatever their size, and images of the
+  other orientation only if there are no others. Once every image has
+  been drawn, they all become available again.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+#include "image_info.h"
+
+struct _AspectIndex;
+typedef struct _AspectIndex AspectIndex;
+
+BEGIN_DECLS
+
+/** Index the images in a list of ImageInfo for a monitor of width x
+    height. The list is not copied, and must outlive the index. */
+extern AspectIndex     *aspect_index_new (const KList *images, int width,
+                          int height);
+
+extern void             aspect_index_destroy (AspectIndex *self);
+
+/** Get the nth image that the monitor shows. n may be negative, for
+    images shown before the first one. Images are drawn as they are
+    first asked for, and the last few hundred are remembered, so the
+    same n gives the same image unless it is far from the last one
+    asked for. The index must not be empty. */
+extern const ImageInfo *aspect_index_get_nth (AspectIndex *self, int n);
+
+END_DECLS
+
@@ -10,25 +10,96 @@
   ==========================================================================*/
 #define _GNU_SOURCE
 #include <stdio.h> 
+#include <stdarg.h> 
 #include <time.h> 
 #include <stdlib.h> 
 #include <string.h> 
 #include <errno.h> 
 #include <unistd.h> 
+#include <fcntl.h> 
 #include <signal.h> 
 #include <assert.h> 
+#include <malloc.h> 
+#include <sys/epoll.h> 
+#include <sys/signalfd.h> 
+#include <sys/timerfd.h> 
+#include <sys/wait.h> 
 #include <klib/klib.h> 
 #include "changer.h" 
+#include "image_info.h"
+#include "gnome_settings.h" 
+#include "xfconf.h"
+#include "x11_root.h"
+#include "framebuffer.h"
+#include "decoder.h"
+#include "gio.h"
+#include "coprocess.h"
+#include "scaled_cache.h"
+#include "prerender.h"
+#include "monitors.h"
+#include "aspect_index.h"
+#include "stage.h"
+#include "pressure.h"
 
 #define KLOG_CLASS "lbc.changer"
 
+KPROBE_DEFINE (lbc, method_exec_start)
+KPROBE_DEFINE (lbc, method_exec_end)
+
+// Memory is taken to be short when some task has been stalled waiting
+//   for it for this long, in any window of this length (both in msec)
+#define CHANGER_PRESSURE_STALL 150
+#define CHANGER_PRESSURE_WINDOW 2000
+
+// Memory is taken to be plentiful again when it has not been short for
+//   this many seconds
+#define CHANGER_PRESSURE_RELIEF 30
+
+// If xfconf-query can't list the background properties, it isn't asked
+//   again for this many seconds, doubling each time it fails, up to the
+//   maximum
+#define CHANGER_XFCE4_RETRY_MIN 30
+#define CHANGER_XFCE4_RETRY_MAX 3600
+
 static void changer_show_current_images (Changer *self); // FWD
-static void changer_method_gnome2 (const Changer *self); //FWD
-static void changer_method_gnome_shell (const Changer *self); //FWD
-static void changer_method_xfce4 (const Changer *self); //FWD
-static void changer_method_xview (const Changer *self); //FWD
-static void changer_method_feh (const Changer *self); //FWD
-static void changer_method_cmd (const Changer *self); //FWD
+static void changer_method_gnome2 (Changer *self); //FWD
+static void changer_method_gnome_shell (Changer *self); //FWD
+static void changer_method_xfce4 (Changer *self); //FWD
+static void changer_method_xview (Changer *self); //FWD
+static void changer_method_feh (Changer *self); //FWD
+static void changer_method_cmd (Changer *self); //FWD
+static void changer_method_x11 (Changer *self); //FWD
+static void changer_method_fb (Changer *self); //FWD
+static void changer_free_screens (Changer *self); //FWD
+static void changer_build_screens (Changer *self, Fit fit); //FWD
+static void changer_update_stage (Changer *self, BOOL keep_previous); //FWD
+
+// Given the standard output of a command that was started with 
+//   changer_start_capture(), when it finishes. ok is TRUE if it exited
+//   with status zero
+typedef void (*ChangerCaptureFn) (Changer *self, BOOL ok, char *output);
+
+/*============================================================================
+  
+  ChangerScreen
+
+  Where the images for one monitor come from. Monitors that would draw
+  from the same images share a pool, or an index, and take turns: on 
+  each change, a group of 'stride' monitors shows the next 'stride' 
+  images, and this one shows the image at 'offset' among them.
+
+  ==========================================================================*/
+typedef struct _ChangerScreen
+  {
+  // The monitor, or NULL if it isn't known
+  const Monitor *monitor;
+  // The images to choose from, in order; NULL means the whole file list
+  KList *pool;
+  // Or, with --fit=best, the index to draw them from
+  AspectIndex *index;
+  int stride;
+  int offset;
+  } ChangerScreen;
 
 /*============================================================================
   
@@ -40,11 +111,111 @@ struct _Changer
   // Note that Changer never owns the file list, and should not
   //  modify it free it
   const KList *file_list;
+  // The monitors, as Monitor, if they are known (not owned either)
+  const KList *monitors;
+  // What is shown: a different image on each monitor with --dual, or
+  //   one image for the whole desktop. The pools and indexes that the
+  //   screens draw from are owned here, as there may be fewer of them
+  //   than screens
+  ChangerScreen *screens;
+  int nscreens;
+  KList *pools;
+  KList *indexes;
+  // The number of changes made, forward, from the start. It isn't kept
+  //   in range, because the pools have different lengths
   int pos;
   int interval;
   SetBackgroundMethod method;
   BOOL dual;
   const char *cmd;
+  KEventLoop *loop;
+  int signal_fd;
+  int timer_fd;
+  // Fires prefetch_lead seconds before the change timer, to get the
+  //   next images read into the page cache before the desktop wants
+  //   them. Zero lead means no prefetching
+  int prefetch_fd;
+  int prefetch_lead;
+  // The memory pressure trigger, if the kernel supports it, and a timer
+  //   that fires when there has been no pressure for a while. While 
+  //   memory is short, buffers are freed and background work stops
+  int pressure_fd;
+  int relief_fd;
+  BOOL memory_short;
+  // Full pathname of the program that the method runs, and the 
+  //   environment to run it with (NULL for our own environment)
+  char *exe_path;
+  char **envp;
+  // In-process GSettings connection, for the gnome-shell method
+  GnomeSettings *gnome_settings;
+  // In-process xfconf connection, for the xfce4 method
+  XfconfDesktop *xfconf;
+  // X display connection, for the x11 method
+  X11Root *x11_root;
+  // Framebuffer, for the fb method, and where to find it
+  Framebuffer *framebuffer;
+  char *fb_device;
+  char *fb_geometry;
+  // The worker that decodes images for the x11 and fb methods, and the
+  //   number of the request that the current job is waiting for
+  Decoder *decoder;
+  int decode_seq;
+  // xfconf 'last-image' properties, found the first time they are needed,
+  //   when xfconf-query is used, and when it can be asked again if it
+  //   couldn't list them (ktrace_now() time, and the delay after that)
+  KList *xfce4_properties;
+  int64_t xfce4_retry_at;
+  int xfce4_retry_secs;
+  // The persistent helper for the cmd method, with --cmd-mode=persistent,
+  //   and whether we're waiting for it to acknowledge a request
+  BOOL cmd_persistent;
+  Coprocess *coprocess;
+  BOOL coprocess_busy;
+  int64_t coprocess_sent;
+  // Background preparation of upcoming images, with --prerender: how
+  //   many images ahead to prepare, the screen size to prepare them 
+  //   at (NULL to use the size of each monitor), and the size limit 
+  //   of the cache. prerender_width and height are the size used when
+  //   the monitor isn't known
+  int prerender_count;
+  char *screen_size;
+  int cache_size_mb;
+  Prerender *prerender;
+  int prerender_width;
+  int prerender_height;
+  // Set when a method that can only set one image was given the first
+  //   monitor's image, because the spanned image wasn't ready. The 
+  //   images are applied again when it is
+  BOOL span_pending;
+  // Local copies of the images, with --stage, and the size limit of
+  //   the copies (zero for no staging)
+  int stage_size_mb;
+  Stage *stage;
+  // Commands queued by the change method, still to be run. Each is an
+  //   argument vector, whose first element is exe_path
+  KList *commands;
+  // The command currently running, if any
+  pid_t child_pid;
+  char *child_cmd;
+  int64_t child_start;
+  // The running command's standard output, if it is being collected:
+  //   the read end of its pipe (-1 once closed), what has been read,
+  //   and the function to give it to when the command finishes
+  int child_out_fd;
+  char *child_output;
+  size_t child_output_len;
+  ChangerCaptureFn child_capture_fn;
+  // Set while an in-process method is waiting for something -- a
+  //   decoded image, or the reply from xfconfd -- to finish the job
+  BOOL method_busy;
+  int deadline_fd;
+  int method_timeout;
+  // Start time and first image of the current change job, for tracing
+  int64_t job_start;
+  char *job_filename;
+  // Set when the user navigates while a change job is running. The 
+  //   images are applied again, once, when the job finishes
+  BOOL apply_pending;
   };
 
 /*============================================================================
@@ -52,7 +223,7 @@ struct _Changer
   Change methods 
 
   ==========================================================================*/
-typedef void (*ChangerFn) (const Changer *self);
+typedef void (*ChangerFn) (Changer *self);
 
 typedef struct _ChangeMethod ChangeMethod;
 struct _ChangeMethod
@@ -60,6 +231,12 @@ struct _ChangeMethod
   const char *name;
   const char *desc;
   ChangerFn fn;
+  // The program that the method runs, found on $PATH at start-up; NULL
+  //   for the 'cmd' method, whose program comes from --cmd, and for
+  //   methods that don't run a program
+  const char *exe;
+  // An environment variable to set for the program, or NULL
+  const char *env;
   };
 
 // NOTE NOTE NOTE
@@ -67,16 +244,51 @@ struct _ChangeMethod
 //   constants
 static ChangeMethod methods[] =
   {
-  {"feh",         "set image on X root window using feh", changer_method_feh},
-  {"gnome-shell", "Gnome 3 gsettings method", changer_method_gnome_shell},
-  {"gnome2",      "Gnome 2 gconftool-2 method", changer_method_gnome2},
-  {"xfce4",       "Xfce4 desktop method", changer_method_xfce4},
-  {"xview",       "set image on X root window using xview", changer_method_xview},
-  {"cmd",         "User-defined command", changer_method_cmd},
-  {NULL, NULL, NULL}
+  {"feh",         "set image on X root window using feh", 
+      changer_method_feh, "feh", NULL},
+  {"gnome-shell", "Gnome 3 GSettings method", 
+      changer_method_gnome_shell, "gsettings", "GSETTINGS_BACKEND=dconf"},
+  {"gnome2",      "Gnome 2 gconftool-2 method", 
+      changer_method_gnome2, "gconftool-2", NULL},
+  {"xfce4",       "Xfce4 desktop method", 
+      changer_method_xfce4, "xfconf-query", NULL},
+  {"xview",       "set image on X root window using xview", 
+      changer_method_xview, "xview", NULL},
+  {"cmd",         "User-defined command", 
+      changer_method_cmd, NULL, NULL},
+  {"gnome-shell-cmd", "Gnome 3 method using the gsettings program", 
+      changer_method_gnome_shell, "gsettings", "GSETTINGS_BACKEND=dconf"},
+  {"xfce4-cmd",   "Xfce4 method using the xfconf-query program", 
+      changer_method_xfce4, "xfconf-query", NULL},
+  {"x11",         "set image on X root window directly", 
+      changer_method_x11, NULL, NULL},
+  {"fb",          "draw image on the Linux framebuffer", 
+      changer_method_fb, NULL, NULL},
+  {NULL, NULL, NULL, NULL, NULL}
   };
 
 
+/*============================================================================
+  
+  changer_resolve_exe
+
+  Find the full path of the method's program (or the --cmd program),
+  and store it in exe_path.
+
+  ==========================================================================*/
+static void changer_resolve_exe (Changer *self)
+  {
+  KLOG_IN
+  const char *exe = methods[self->method].exe;
+  if (self->method == SBM_CMD) exe = self->cmd;
+  if (self->exe_path) free (self->exe_path);
+  self->exe_path = exe ? kspawn_resolve (exe) : NULL;
+  if (exe && !self->exe_path)
+    klog_error (KLOG_CLASS, "Can't find program '%s'", exe);
+  KLOG_OUT
+  }
+
+
 /*============================================================================
   
   changer_new
@@ -89,11 +301,64 @@ Changer *changer_new (const KList *file_list, int interval,
 
   Changer *self = malloc (sizeof (Changer));
   self->file_list = file_list;
+  self->monitors = NULL;
+  self->screens = NULL;
+  self->pools = NULL;
+  self->indexes = NULL;
   self->pos = 0;
   self->interval = interval;
   self->method = method;
   self->dual = dual;
   self->cmd = cmd;
+  self->loop = NULL;
+  self->signal_fd = -1;
+  self->timer_fd = -1;
+  self->prefetch_fd = -1;
+  self->prefetch_lead = CHANGER_DEFAULT_PREFETCH_LEAD;
+  self->pressure_fd = -1;
+  self->relief_fd = -1;
+  self->memory_short = FALSE;
+  self->commands = klist_new_empty ((KListFreeFn)kspawn_free_argv);
+  self->xfce4_properties = NULL;
+  self->xfce4_retry_at = 0;
+  self->xfce4_retry_secs = CHANGER_XFCE4_RETRY_MIN;
+  self->gnome_settings = NULL;
+  self->xfconf = NULL;
+  self->x11_root = NULL;
+  self->framebuffer = NULL;
+  self->fb_device = NULL;
+  self->decoder = NULL;
+  self->decode_seq = 0;
+  self->method_busy = FALSE;
+  self->fb_geometry = NULL;
+  self->cmd_persistent = FALSE;
+  self->coprocess = NULL;
+  self->coprocess_busy = FALSE;
+  self->prerender_count = 0;
+  self->screen_size = NULL;
+  self->cache_size_mb = SCALED_CACHE_DEFAULT_SIZE_MB;
+  self->prerender = NULL;
+  self->span_pending = FALSE;
+  self->stage_size_mb = 0;
+  self->stage = NULL;
+  // The gnome-shell and xfce4 methods only need their programs if the
+  //   in-process connection can't be made, which changer_run() finds out
+  self->exe_path = NULL;
+  if (method != SBM_GNOMESHELL && method != SBM_XFCE4)
+    changer_resolve_exe (self);
+  self->envp = methods[method].env ? 
+    kspawn_env_with (methods[method].env) : NULL;
+  self->child_pid = -1;
+  self->child_cmd = NULL;
+  self->child_out_fd = -1;
+  self->child_output = NULL;
+  self->child_output_len = 0;
+  self->child_capture_fn = NULL;
+  self->deadline_fd = -1;
+  self->method_timeout = CHANGER_DEFAULT_METHOD_TIMEOUT;
+  self->job_filename = NULL;
+  self->apply_pending = FALSE;
+  changer_build_screens (self, FIT_ORIENTATION);
 
   KLOG_OUT
   return self;
@@ -109,6 +374,16 @@ void changer_destroy (Changer *self)
   KLOG_IN
   if (self)
     {
+    klist_destroy (self->commands);
+    if (self->xfce4_properties) klist_destroy (self->xfce4_properties);
+    if (self->exe_path) free (self->exe_path);
+    kspawn_free_argv (self->envp);
+    if (self->child_cmd) free (self->child_cmd);
+    if (self->job_filename) free (self->job_filename);
+    if (self->fb_device) free (self->fb_device);
+    if (self->fb_geometry) free (self->fb_geometry);
+    if (self->screen_size) free (self->screen_size);
+    changer_free_screens (self);
     free (self);
     }
   KLOG_OUT
@@ -144,19 +419,6 @@ void changer_dump_methods (FILE *f)
   }
 
 
-/*============================================================================
-  
-  changer_get_images_per_cycle
-
-  ==========================================================================*/
-static int changer_get_images_per_cycle (Changer *self)
-  {
-  KLOG_IN
-  int ret = 1;
-  KLOG_OUT
-  return ret;
-  }
-
 /*============================================================================
   
   changer_get_method
@@ -181,401 +443,2175 @@ extern SetBackgroundMethod changer_get_method (const char *method)
 
 /*============================================================================
   
-  changer_get_nth_image_pos
+  changer_get_nth_info
+
+  Get the image that is shown on a screen n changes from now. 
 
   ==========================================================================*/
-static int changer_get_nth_image_pos (const Changer *self, int n)
+static const ImageInfo *changer_get_nth_info (const Changer *self, 
+    int screen, int n)
   {
   KLOG_IN
-  int ret = (self->pos + n) % klist_length (self->file_list);
+  assert (self != NULL);
+  const ChangerScreen *s = &self->screens[screen];
+  const ImageInfo *ret;
+  // n can be negative, for images before the current one
+  int i = (self->pos + n) * s->stride + s->offset;
+  if (s->index)
+    ret = aspect_index_get_nth (s->index, i);
+  else
+    {
+    const KList *pool = s->pool ? s->pool : self->file_list;
+    int l = klist_length (pool);
+    ret = klist_get (pool, (i % l + l) % l);
+    }
   KLOG_OUT
   return ret;
   }
 
 /*============================================================================
   
-  changer_get_nth_image
+  changer_get_render_size
+
+  The size to prepare images for a screen at: --screen-size if it was
+  given, otherwise the monitor's own size, if we know it.
 
   ==========================================================================*/
-static const KPath *changer_get_nth_image (const Changer *self, int n)
+static void changer_get_render_size (const Changer *self, int screen,
+    int *width, int *height)
   {
   KLOG_IN
-  assert (self != NULL);
-  int index = changer_get_nth_image_pos (self, n);
-  const KPath *ret = klist_get (self->file_list, index);
+  const Monitor *m = self->screens[screen].monitor;
+  *width = self->prerender_width;
+  *height = self->prerender_height;
+  if (!self->screen_size && m)
+    {
+    *width = monitor_get_width (m);
+    *height = monitor_get_height (m);
+    }
   KLOG_OUT
-  return ret;
   }
 
 /*============================================================================
   
-  changer_method_cmd
+  changer_get_nth_filename
+
+  Get the file to give the desktop for the image on a screen n changes
+  from now: the prepared copy if there is one, or the staged copy, or
+  the original if neither is ready. The caller must free the result.
 
   ==========================================================================*/
-void changer_method_cmd (const Changer *self)
+static char *changer_get_nth_filename (const Changer *self, int screen,
+    int n)
   {
   KLOG_IN
-  assert (self != NULL);
-  klog_debug (KLOG_CLASS, "Change using user command");
- 
-  char *command;
-  if (self->dual)
-    {
-    const KPath *img_path1 = changer_get_nth_image (self, 0); 
-    const KPath *img_path2 = changer_get_nth_image (self, 1); 
-    char *filename1 = (char *)kpath_to_utf8 (img_path1);
-    char *filename2 = (char *)kpath_to_utf8 (img_path2);
-    asprintf (&command, "\"%s\" \"%s\" \"%s\"", self->cmd, filename1, 
-          filename2);
-    free (filename2);
-    free (filename1);
+  char *ret = (char *)kpath_to_utf8 (image_info_get_path 
+    (changer_get_nth_info (self, screen, n)));
+  char *prepared = NULL;
+  if (self->prerender)
+    {
+    int width, height;
+    changer_get_render_size (self, screen, &width, &height);
+    prepared = prerender_get (self->prerender, ret, width, height);
     }
-  else
+  // A prepared copy is already local, so it needn't be staged
+  if (!prepared && self->stage)
+    prepared = stage_get (self->stage, ret);
+  if (prepared)
     {
-    const KPath *img_path = changer_get_nth_image (self, 0); 
-    char *filename = (char *)kpath_to_utf8 (img_path);
-    asprintf (&command, "\"%s\" \"%s\"", self->cmd, filename);
-    free (filename);
+    klog_debug (KLOG_CLASS, "Using '%s' for '%s'", prepared, ret);
+    free (ret);
+    ret = prepared;
     }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
   
-  klog_debug (KLOG_CLASS, "Command='%s'", command);
-  system (command);
-  free (command);
+  changer_can_span
+
+  Whether the images for the screens should be put together into one,
+  because the method can only set one image. This needs the layout of
+  the monitors.
 
+  ==========================================================================*/
+static BOOL changer_can_span (const Changer *self)
+  {
+  KLOG_IN
+  SetBackgroundMethod m = self->method;
+  BOOL ret = self->nscreens > 1 && (m == SBM_GNOMESHELL 
+    || m == SBM_GNOMESHELL_CMD || m == SBM_FEH || m == SBM_XVIEW 
+    || m == SBM_X11);
+  for (int i = 0; i < self->nscreens && ret; i++)
+    if (!self->screens[i].monitor) ret = FALSE;
   KLOG_OUT
+  return ret;
   }
 
 /*============================================================================
   
-  changer_method_gnome2
+  changer_get_span_images
+
+  Get the original images on each screen n changes from now, and the
+  monitors, for a spanned image. The caller must free both.
 
   ==========================================================================*/
-void changer_method_gnome2 (const Changer *self)
+static void changer_get_span_images (const Changer *self, int n, 
+    char ***filenames, const Monitor ***monitors)
   {
   KLOG_IN
-  assert (self != NULL);
-  klog_debug (KLOG_CLASS, "Change using gnome2 method");
- 
-  const KPath *img_path = changer_get_nth_image (self, 0); 
+  int l = self->nscreens;
+  *filenames = malloc ((l + 1) * sizeof (char *));
+  *monitors = malloc (l * sizeof (Monitor *));
+  for (int i = 0; i < l; i++)
+    {
+    (*filenames)[i] = (char *)kpath_to_utf8 (image_info_get_path 
+      (changer_get_nth_info (self, i, n)));
+    (*monitors)[i] = self->screens[i].monitor;
+    }
+  (*filenames)[l] = NULL;
+  KLOG_OUT
+  }
 
-  char *filename = (char *)kpath_to_utf8 (img_path);
+/*============================================================================
+  
+  changer_get_span
 
-  char *cmd;
-  asprintf (&cmd, "gconftool-2 --set --type=string /desktop/gnome/background/picture_filename \"%s\"",
-       filename);
+  Get the spanned image for the current screens, if the prerender 
+  worker has made it; making it takes too long to do here. Returns NULL
+  if it isn't ready. The caller must free the result.
 
-  if (system (cmd) != 0)
+  ==========================================================================*/
+static char *changer_get_span (Changer *self)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  if (self->prerender)
     {
-    klog_error (KLOG_CLASS, "Error executing command '%s'", cmd);
+    char **filenames;
+    const Monitor **monitors;
+    changer_get_span_images (self, 0, &filenames, &monitors);
+    ret = prerender_get_span (self->prerender, 
+      (const char *const *)filenames, monitors, self->nscreens);
+    free (monitors);
+    kspawn_free_argv (filenames);
     }
-
-  free (cmd);
-  free (filename);
   KLOG_OUT
+  return ret;
   }
 
 /*============================================================================
   
-  changer_method_gnome-shell
+  changer_get_desktop_filename
+
+  Get the file to give a method that sets one image for the whole 
+  desktop: a spanned image, if there is more than one screen, or the
+  image for the first one -- which is also used until the spanned 
+  image is ready. *spanned is set to show which. The caller must free
+  the result.
 
   ==========================================================================*/
-void changer_method_gnome_shell (const Changer *self)
+static char *changer_get_desktop_filename (Changer *self, BOOL *spanned)
   {
   KLOG_IN
-  assert (self != NULL);
-  klog_debug (KLOG_CLASS, "Change using gnome-shell method");
-
-  const KPath *img_path = changer_get_nth_image (self, 0); 
+  BOOL can_span = changer_can_span (self);
+  char *ret = can_span ? changer_get_span (self) : NULL;
+  *spanned = ret != NULL;
+  self->span_pending = can_span && !ret;
+  if (!ret) ret = changer_get_nth_filename (self, 0, 0);
+  KLOG_OUT
+  return ret;
+  }
 
-  char *filename = (char *)kpath_to_utf8 (img_path);
+/*============================================================================
+  
+  changer_queue_command_argv
 
-  char *cmd1;
-  asprintf (&cmd1, "GSETTINGS_BACKEND=dconf gsettings"
-        " set org.gnome.desktop.background picture-uri \"file://%s\"",
-       filename);
+  Add a command to the current change job: the method's program, with
+  the specified arguments (terminated by NULL). The command runs
+  asynchronously, after any commands queued before it.
 
-  if (system (cmd1) != 0)
+  ==========================================================================*/
+static void changer_queue_command_argv (Changer *self, 
+    const char *const *args)
+  {
+  KLOG_IN
+  if (self->exe_path)
     {
-    klog_error (KLOG_CLASS, "Error executing command '%s'", cmd1);
-    }
-
-  free (cmd1);
+    int n = 1;
+    for (const char *const *a = args; *a; a++) n++;
 
-  char *cmd2;
-  asprintf (&cmd2, "GSETTINGS_BACKEND=dconf gsettings"
-        " set org.gnome.desktop.background picture-uri-dark \"file://%s\"",
-       filename);
+    char **argv = malloc ((n + 1) * sizeof (char *));
+    argv[0] = strdup (self->exe_path);
+    int i = 1;
+    for (const char *const *a = args; *a; a++)
+      argv[i++] = strdup (*a);
+    argv[i] = NULL;
 
-  if (system (cmd2) != 0)
-    {
-    klog_error (KLOG_CLASS, "Error executing command '%s'", cmd2);
+    klist_append (self->commands, argv);
     }
-
-  free (cmd2);
-  free (filename);
- 
   KLOG_OUT
   }
 
 /*============================================================================
   
-  changer_method_xfce4
+  changer_queue_command
+
+  As changer_queue_command_argv, with the arguments listed in the call.
 
   ==========================================================================*/
-void changer_method_xfce4 (const Changer *self)
+static void changer_queue_command (Changer *self, const char *arg1, ...)
   {
   KLOG_IN
-  assert (self != NULL);
-  klog_debug (KLOG_CLASS, "Change using xfce4 method");
- 
-  char *cmd;
-  if (self->dual)
-    {
-    const KPath *img_path1 = changer_get_nth_image (self, 0); 
-    const KPath *img_path2 = changer_get_nth_image (self, 1); 
-
-    char *filename1 = (char *)kpath_to_utf8 (img_path1);
-    char *filename2 = (char *)kpath_to_utf8 (img_path2);
-
-    asprintf (&cmd, "xfconf-query -c xfce4-desktop --list | grep last-image|grep screen0|while read path; do xfconf-query -c xfce4-desktop -p $path --set \"%s\"; done; xfconf-query -c xfce4-desktop --list | grep last-image|grep screen0|while read path; do xfconf-query -c xfce4-desktop -p $path --set \"%s\"; done", 
-       filename1, filename2);
+  int n = 1;
+  va_list ap;
+  va_start (ap, arg1);
+  for (const char *a = arg1; a; a = va_arg (ap, const char *)) n++;
+  va_end (ap);
 
-    free (filename1);
-    free (filename2);
-    }
-  else
-    {
-    const KPath *img_path1 = changer_get_nth_image (self, 0); 
+  const char **args = malloc (n * sizeof (char *));
+  int i = 0;
+  va_start (ap, arg1);
+  for (const char *a = arg1; a; a = va_arg (ap, const char *))
+    args[i++] = a;
+  va_end (ap);
+  args[i] = NULL;
+
+  changer_queue_command_argv (self, args);
+  free (args);
+  KLOG_OUT
+  }
 
-    char *filename1 = (char *)kpath_to_utf8 (img_path1);
+/*============================================================================
+  
+  changer_job_finished
 
-    asprintf (&cmd, "xfconf-query -c xfce4-desktop --list | grep last-image|grep screen0|while read path; do xfconf-query -c xfce4-desktop -p $path --set \"%s\"; done", 
-      filename1);
+  Called when the last command of a change job has finished. If the user
+  navigated while the job was running, apply the images selected now.
 
-    free (filename1);
+  ==========================================================================*/
+static void changer_job_finished (Changer *self)
+  {
+  KLOG_IN
+  const char *name = methods[self->method].name;
+  KPROBE2 (lbc, method_exec_end, name, self->job_filename);
+  ktrace_complete (KLOG_CLASS, name, self->job_start, 
+    ktrace_now() - self->job_start, self->job_filename);
+  ktrace_flush ();
+  free (self->job_filename);
+  self->job_filename = NULL;
+  if (self->apply_pending)
+    {
+    klog_debug (KLOG_CLASS, "Applying images selected while busy");
+    self->apply_pending = FALSE;
+    changer_show_current_images (self);
     }
-
-  if (system (cmd) != 0)
+  else
     {
-    klog_error (KLOG_CLASS, "Error executing command '%s'", cmd);
+    // The desktop has finished with the previous images
+    changer_update_stage (self, FALSE);
     }
-
-  free (cmd);
   KLOG_OUT
   }
 
-
 /*============================================================================
   
-  changer_method_feh
+  changer_watch_child
+
+  Note that a command has started, and start the method timeout. cmd
+  is the command, for logging; it is taken over.
 
   ==========================================================================*/
-void changer_method_feh (const Changer *self)
+static void changer_watch_child (Changer *self, pid_t pid, char *cmd)
   {
   KLOG_IN
-  assert (self != NULL);
-  klog_debug (KLOG_CLASS, "Change using xview method");
- 
-  const KPath *img_path = changer_get_nth_image (self, 0); 
+  self->child_pid = pid;
+  self->child_cmd = cmd;
+  self->child_start = ktrace_now();
+  if (self->deadline_fd >= 0 && self->method_timeout > 0)
+    keventloop_set_timer (self->deadline_fd, 
+      (int64_t)self->method_timeout * 1000, 0);
+  KLOG_OUT
+  }
 
-  char *filename = (char *)kpath_to_utf8 (img_path);
+/*============================================================================
+  
+  changer_start_next_command
 
-  char *cmd;
-  asprintf (&cmd, "feh --bg-fill \"%s\"",  filename);
+  Start the next queued command, if there is one, as a child process in
+  its own process group, so that the whole group can be killed if it
+  overruns. No shell is involved. If the queue is empty, and no command 
+  is running, the job is finished.
 
-  if (system (cmd) != 0)
+  ==========================================================================*/
+static void changer_start_next_command (Changer *self)
+  {
+  KLOG_IN
+  BOOL started = self->child_pid > 0;
+  while (!started && klist_length (self->commands) > 0)
     {
-    klog_error (KLOG_CLASS, "Error executing command '%s'", cmd);
+    char **argv = klist_get (self->commands, 0);
+    klist_remove_ref (self->commands, argv, FALSE);
+    char *cmd = kspawn_argv_to_string (argv);
+    klog_debug (KLOG_CLASS, "Command='%s'", cmd);
+    pid_t pid = kspawn_start (argv, self->envp, -1, -1, TRUE);
+    if (pid > 0)
+      {
+      changer_watch_child (self, pid, cmd);
+      started = TRUE;
+      }
+    else
+      {
+      klog_error (KLOG_CLASS, "Can't start command '%s': %s", cmd, 
+        strerror (errno));
+      free (cmd);
+      }
+    kspawn_free_argv (argv);
     }
-
-  free (cmd);
-  free (filename);
+  if (!started && !self->coprocess_busy && !self->method_busy) 
+    changer_job_finished (self);
   KLOG_OUT
   }
 
-
 /*============================================================================
   
-  changer_method_xview
+  changer_start_method
+
+  Note that an in-process method has started something that will finish
+  the job later, and start the method timeout.
 
   ==========================================================================*/
-void changer_method_xview (const Changer *self)
+static void changer_start_method (Changer *self)
   {
   KLOG_IN
-  assert (self != NULL);
-  klog_debug (KLOG_CLASS, "Change using xview method");
- 
-  const KPath *img_path = changer_get_nth_image (self, 0); 
+  self->method_busy = TRUE;
+  if (self->deadline_fd >= 0 && self->method_timeout > 0)
+    keventloop_set_timer (self->deadline_fd, 
+      (int64_t)self->method_timeout * 1000, 0);
+  KLOG_OUT
+  }
 
-  char *filename = (char *)kpath_to_utf8 (img_path);
+/*============================================================================
+  
+  changer_method_done
 
-  char *cmd;
-  asprintf (&cmd, "xview -onroot -fullscreen -quiet \"%s\"",  filename);
+  An in-process method has finished, or been given up on. Anything that
+  finishes after it has been given up on is ignored.
 
-  if (system (cmd) != 0)
+  ==========================================================================*/
+static void changer_method_done (Changer *self)
+  {
+  KLOG_IN
+  if (self->method_busy)
     {
-    klog_error (KLOG_CLASS, "Error executing command '%s'", cmd);
+    self->method_busy = FALSE;
+    if (self->deadline_fd >= 0)
+      keventloop_set_timer (self->deadline_fd, 0, 0);
+    changer_start_next_command (self);
     }
-
-  free (cmd);
-  free (filename);
   KLOG_OUT
   }
 
-
 /*============================================================================
   
-  changer_move_forward
+  changer_read_child_output
+
+  Read what the running command has written, without blocking, and 
+  stop watching its output at end of file.
 
   ==========================================================================*/
-static void changer_move_forward (Changer *self)
+static void changer_read_child_output (Changer *self)
   {
   KLOG_IN
-
-  self->pos += changer_get_images_per_cycle (self);
-  self->pos %= klist_length (self->file_list);
-
+  char buff[4096];
+  ssize_t n;
+  while ((n = read (self->child_out_fd, buff, sizeof (buff))) > 0)
+    {
+    self->child_output = realloc (self->child_output, 
+      self->child_output_len + n + 1);
+    memcpy (self->child_output + self->child_output_len, buff, n);
+    self->child_output_len += n;
+    self->child_output[self->child_output_len] = 0;
+    }
+  if (n == 0 || (errno != EAGAIN && errno != EINTR))
+    {
+    keventloop_remove (self->loop, self->child_out_fd);
+    close (self->child_out_fd);
+    self->child_out_fd = -1;
+    }
   KLOG_OUT
   }
 
-
 /*============================================================================
   
-  changer_move_back
+  changer_on_child_output
 
   ==========================================================================*/
-static void changer_move_back (Changer *self)
+static void changer_on_child_output (int fd, uint32_t events, 
+    void *user_data)
   {
   KLOG_IN
-
-  self->pos -= changer_get_images_per_cycle (self);
-  if (self->pos < 0) 
-     self->pos = klist_length (self->file_list) 
-       + self->pos; 
-
+  changer_read_child_output (user_data);
   KLOG_OUT
   }
 
-
 /*============================================================================
   
-  changer_next
+  changer_end_capture
+
+  Stop collecting the running command's output. If fn is given, the 
+  output is passed to it, after reading whatever is left in the pipe.
 
   ==========================================================================*/
-void changer_next (Changer *self)
+static void changer_end_capture (Changer *self, ChangerCaptureFn fn, 
+    BOOL ok)
   {
   KLOG_IN
-  klog_info (KLOG_CLASS, "Selecting next image(s)");
-  changer_move_forward (self);
-  changer_show_current_images (self);
+  if (fn && self->child_out_fd >= 0) changer_read_child_output (self);
+  if (self->child_out_fd >= 0)
+    {
+    keventloop_remove (self->loop, self->child_out_fd);
+    close (self->child_out_fd);
+    self->child_out_fd = -1;
+    }
+  char *output = self->child_output;
+  self->child_output = NULL;
+  self->child_output_len = 0;
+  self->child_capture_fn = NULL;
+  if (fn) fn (self, ok, output ? output : "");
+  free (output);
   KLOG_OUT
   }
 
 /*============================================================================
   
-  changer_prev
+  changer_start_capture
+
+  Run a command as part of the current job, as 
+  changer_start_next_command() does, but collect its standard output
+  from the event loop, and give it to fn when the command finishes. The
+  method timeout applies. No command may be running already.
 
   ==========================================================================*/
-void changer_prev (Changer *self)
+static BOOL changer_start_capture (Changer *self, char *const argv[], 
+    ChangerCaptureFn fn)
   {
   KLOG_IN
-  klog_info (KLOG_CLASS, "Selecting previous image(s)");
-  changer_move_back (self);
-  changer_show_current_images (self);
+  BOOL ret = FALSE;
+  int fds[2];
+  char *cmd = kspawn_argv_to_string (argv);
+  klog_debug (KLOG_CLASS, "Command='%s'", cmd);
+  if (pipe2 (fds, O_CLOEXEC) == 0)
+    {
+    pid_t pid = kspawn_start (argv, self->envp, -1, fds[1], TRUE);
+    close (fds[1]);
+    if (pid > 0)
+      {
+      fcntl (fds[0], F_SETFL, O_NONBLOCK);
+      self->child_out_fd = fds[0];
+      self->child_capture_fn = fn;
+      keventloop_add (self->loop, fds[0], EPOLLIN, changer_on_child_output,
+        self);
+      changer_watch_child (self, pid, cmd);
+      cmd = NULL;
+      ret = TRUE;
+      }
+    else
+      close (fds[0]);
+    }
+  if (!ret)
+    {
+    klog_error (KLOG_CLASS, "Can't start command '%s': %s", cmd, 
+      strerror (errno));
+    free (cmd);
+    }
   KLOG_OUT
+  return ret;
   }
 
 /*============================================================================
   
-  changer_run 
+  changer_reap_child
+
+  Called on SIGCHLD. Collect the exit status of any finished children and, 
+  if the current command has finished, move on to the next one.
 
   ==========================================================================*/
-void changer_run (Changer *self)
+static void changer_reap_child (Changer *self)
   {
   KLOG_IN
+  int status;
+  pid_t pid;
+  while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    {
+    if (self->coprocess && coprocess_child_exited (self->coprocess, pid, 
+         status)) continue;
+    if (pid != self->child_pid) continue;
+    ktrace_complete (KLOG_CLASS, "child", self->child_start, 
+      ktrace_now() - self->child_start, self->child_cmd);
+    if (WIFSIGNALED (status))
+      klog_error (KLOG_CLASS, "Command '%s' killed by signal %d", 
+        self->child_cmd, WTERMSIG (status));
+    else if (WEXITSTATUS (status) != 0)
+      klog_error (KLOG_CLASS, "Error executing command '%s'", 
+        self->child_cmd);
+    free (self->child_cmd);
+    self->child_cmd = NULL;
+    self->child_pid = -1;
+    if (self->deadline_fd >= 0)
+      keventloop_set_timer (self->deadline_fd, 0, 0);
+    // The capture function may queue more commands for this job
+    if (self->child_capture_fn)
+      changer_end_capture (self, self->child_capture_fn, 
+        WIFEXITED (status) && WEXITSTATUS (status) == 0);
+    changer_start_next_command (self);
+    }
+  KLOG_OUT
+  }
 
-  sigset_t base_mask, waiting_mask;
-
-  sigemptyset (&base_mask);
-  sigaddset (&base_mask, SIGINT);
-  sigaddset (&base_mask, SIGHUP);
-  sigaddset (&base_mask, SIGUSR1);
-  sigaddset (&base_mask, SIGUSR2);
-  sigprocmask (SIG_SETMASK, &base_mask, NULL);
+/*============================================================================
+  
+  changer_on_deadline
 
-  changer_show_current_images (self);
+  The current command has run for longer than the method timeout. Kill its
+  process group; the SIGCHLD that follows moves the job along. An 
+  in-process method can't be stopped, but the job needn't wait for it.
 
-  BOOL quit = FALSE;
-  int ticks = 0;
-  while (!quit)
-    {
-    // Note that some Unix-like systems don't handle usleep() with
-    //   very large values, hence the loop
-    for (int i = 0; i < 10; i++)
-      usleep(100000);
-    sigpending (&waiting_mask);
-    if (sigismember (&waiting_mask, SIGINT) ||
-        sigismember (&waiting_mask, SIGUSR1) ||
-        sigismember (&waiting_mask, SIGUSR2) ||
-        sigismember (&waiting_mask, SIGHUP))
+  ==========================================================================*/
+static void changer_on_deadline (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  uint64_t expirations;
+  if (read (fd, &expirations, sizeof (expirations)) == sizeof (expirations))
+    {
+    if (self->child_pid > 0)
       {
-      int sig;
-      sigwait (&waiting_mask, &sig);
-      switch (sig)
-        {
-	case SIGINT:
-	  klog_info (KLOG_CLASS, "Caught interrupt signal");
-	  quit = TRUE;
-	  break;
-	case SIGUSR1:
-	  klog_debug (KLOG_CLASS, "Caught USR1 signal");
-          changer_next (self);
-	  ticks = 0;
-	  break;
-	case SIGUSR2:
-	  klog_debug (KLOG_CLASS, "Caught USR2 signal");
-          changer_prev (self);
-	  ticks = 0;
-	  break;
-	}
+      klog_warn (KLOG_CLASS, 
+        "Command '%s' took more than %d seconds; killing it",
+        self->child_cmd, self->method_timeout);
+      kill (-self->child_pid, SIGKILL);
       }
-    else
+    else if (self->coprocess_busy)
       {
-      // usleep actually terminated normally, without a signal --
-      //  check the timeout and advance if necessary
-      if (ticks >= self->interval) 
-        {
-        changer_next (self);
-	ticks = 0;
-	}
+      // The helper will be started again for the next change
+      klog_warn (KLOG_CLASS, 
+        "Helper did not answer within %d seconds; killing it",
+        self->method_timeout);
+      coprocess_kill (self->coprocess);
+      }
+    else if (self->method_busy)
+      {
+      klog_warn (KLOG_CLASS, 
+        "The %s method took more than %d seconds; not waiting for it",
+        methods[self->method].name, self->method_timeout);
+      changer_method_done (self);
       }
-    ticks++;
     }
-
   KLOG_OUT
   }
 
-
 /*============================================================================
   
-  changer_show_current_images
+  changer_stop_child
+
+  Used at shutdown: terminate any running command, and discard the
+  rest of the job. A command that ignores SIGTERM gets as long as the
+  method timeout before it is killed.
 
   ==========================================================================*/
-static void changer_show_current_images (Changer *self)
+static void changer_stop_child (Changer *self)
   {
   KLOG_IN
+  klist_clear (self->commands);
+  if (self->child_pid > 0)
+    {
+    changer_end_capture (self, NULL, FALSE);
+    kspawn_stop (self->child_pid, 1000 * (self->method_timeout > 0 
+      ? self->method_timeout : CHANGER_DEFAULT_METHOD_TIMEOUT));
+    free (self->child_cmd);
+    self->child_cmd = NULL;
+    self->child_pid = -1;
+    }
+  KLOG_OUT
+  }
 
-  ChangerFn fn = methods[self->method].fn;
-  assert (fn != NULL);
-
-  fn (self);
+/*============================================================================
+  
+  changer_set_method_timeout
 
+  ==========================================================================*/
+void changer_set_method_timeout (Changer *self, int seconds)
+  {
+  KLOG_IN
+  self->method_timeout = seconds;
   KLOG_OUT
   }
 
+/*============================================================================
+  
+  changer_set_prefetch_lead
 
+  ==========================================================================*/
+void changer_set_prefetch_lead (Changer *self, int seconds)
+  {
+  KLOG_IN
+  self->prefetch_lead = seconds;
+  KLOG_OUT
+  }
 
+/*============================================================================
+  
+  changer_set_cmd_persistent
 
+  ==========================================================================*/
+void changer_set_cmd_persistent (Changer *self, BOOL persistent)
+  {
+  KLOG_IN
+  self->cmd_persistent = persistent;
+  KLOG_OUT
+  }
 
+/*============================================================================
+  
+  changer_set_framebuffer
 
+  ==========================================================================*/
+void changer_set_framebuffer (Changer *self, const char *device, 
+    const char *geometry)
+  {
+  KLOG_IN
+  if (self->fb_device) free (self->fb_device);
+  if (self->fb_geometry) free (self->fb_geometry);
+  self->fb_device = device ? strdup (device) : NULL;
+  self->fb_geometry = geometry ? strdup (geometry) : NULL;
+  KLOG_OUT
+  }
 
+/*============================================================================
+  
+  changer_set_prerender
+
+  ==========================================================================*/
+void changer_set_prerender (Changer *self, int count, 
+    const char *screen_size, int cache_size_mb)
+  {
+  KLOG_IN
+  self->prerender_count = count;
+  self->cache_size_mb = cache_size_mb;
+  if (self->screen_size) free (self->screen_size);
+  self->screen_size = screen_size ? strdup (screen_size) : NULL;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_set_stage
+
+  ==========================================================================*/
+void changer_set_stage (Changer *self, int size_mb)
+  {
+  KLOG_IN
+  self->stage_size_mb = size_mb;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_free_screens
+
+  ==========================================================================*/
+static void changer_free_screens (Changer *self)
+  {
+  KLOG_IN
+  if (self->screens) free (self->screens);
+  if (self->pools) klist_destroy (self->pools);
+  if (self->indexes) klist_destroy (self->indexes);
+  self->screens = NULL;
+  self->pools = NULL;
+  self->indexes = NULL;
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_image_suits_monitor
+
+  An image suits a monitor if it has the same orientation; square images
+  suit both. Images whose size wasn't found during the scan are given 
+  the benefit of the doubt.
+
+  ==========================================================================*/
+static BOOL changer_image_suits_monitor (const ImageInfo *info, 
+    const Monitor *monitor)
+  {
+  KLOG_IN
+  BOOL ret = TRUE;
+  int width = image_info_get_width (info);
+  int height = image_info_get_height (info);
+  if (width > 0 && height > 0 && width != height)
+    ret = (height > width) == monitor_is_portrait (monitor);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_make_pool
+
+  The images that suit a monitor, in the order of the file list, or all
+  of them if none does. 
+
+  ==========================================================================*/
+static KList *changer_make_pool (const Changer *self, 
+    const Monitor *monitor, int screen)
+  {
+  KLOG_IN
+  KList *ret = klist_new_empty (NULL);
+  int l = klist_length (self->file_list);
+  for (int i = 0; i < l; i++)
+    {
+    ImageInfo *info = klist_get (self->file_list, i);
+    if (changer_image_suits_monitor (info, monitor))
+      klist_append (ret, info);
+    }
+  if (klist_length (ret) == 0)
+    {
+    klog_warn (KLOG_CLASS, "No images suit monitor %d, "
+      "so it will get any image", screen);
+    for (int i = 0; i < l; i++)
+      klist_append (ret, klist_get (self->file_list, i));
+    }
+  klog_info (KLOG_CLASS, "%d image(s) for monitor %d", 
+    (int)klist_length (ret), screen);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_monitors_share
+
+  Whether two monitors would draw from the same images: with --fit=best,
+  if they are the same size, and otherwise if they have the same 
+  orientation. Unknown (NULL) monitors get all the images.
+
+  ==========================================================================*/
+static BOOL changer_monitors_share (const Monitor *m1, const Monitor *m2,
+    Fit fit)
+  {
+  KLOG_IN
+  BOOL ret;
+  if (!m1 || !m2)
+    ret = m1 == m2;
+  else if (fit == FIT_BEST)
+    ret = monitor_get_width (m1) == monitor_get_width (m2)
+      && monitor_get_height (m1) == monitor_get_height (m2);
+  else
+    ret = monitor_is_portrait (m1) == monitor_is_portrait (m2);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_build_screens
+
+  With --dual, there is a screen for each monitor, or two if we don't
+  know how many there are. Otherwise there is one, for the first 
+  monitor. 
+
+  ==========================================================================*/
+static void changer_build_screens (Changer *self, Fit fit)
+  {
+  KLOG_IN
+  changer_free_screens (self);
+  int nmonitors = self->monitors ? klist_length (self->monitors) : 0;
+  int n = 1;
+  if (self->dual) n = nmonitors >= 2 ? nmonitors : 2;
+  self->nscreens = n;
+  self->screens = malloc (n * sizeof (ChangerScreen));
+  self->pools = klist_new_empty ((KListFreeFn)klist_destroy);
+  self->indexes = klist_new_empty ((KListFreeFn)aspect_index_destroy);
+
+  for (int i = 0; i < n; i++)
+    {
+    ChangerScreen *s = &self->screens[i];
+    s->monitor = i < nmonitors ? klist_get (self->monitors, i) : NULL;
+    s->pool = NULL;
+    s->index = NULL;
+    s->stride = 1;
+    s->offset = 0;
+
+    const ChangerScreen *same = NULL;
+    for (int j = 0; j < i && !same; j++)
+      if (changer_monitors_share (self->screens[j].monitor, s->monitor, fit))
+        same = &self->screens[j];
+
+    if (same)
+      {
+      s->pool = same->pool;
+      s->index = same->index;
+      }
+    else if (s->monitor && fit == FIT_BEST)
+      {
+      s->index = aspect_index_new (self->file_list, 
+        monitor_get_width (s->monitor), monitor_get_height (s->monitor));
+      klist_append (self->indexes, s->index);
+      }
+    else if (s->monitor)
+      {
+      s->pool = changer_make_pool (self, s->monitor, i);
+      klist_append (self->pools, s->pool);
+      }
+    }
+
+  // Screens that share images take turns, so that no image is shown on
+  //   two monitors, or twice in one cycle
+  for (int i = 0; i < n; i++)
+    {
+    ChangerScreen *s = &self->screens[i];
+    s->stride = 0;
+    for (int j = 0; j < n; j++)
+      {
+      const ChangerScreen *t = &self->screens[j];
+      if (t->pool == s->pool && t->index == s->index)
+        {
+        if (j < i) s->offset++;
+        s->stride++;
+        }
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_set_monitors
+
+  ==========================================================================*/
+void changer_set_monitors (Changer *self, const KList *monitors, Fit fit)
+  {
+  KLOG_IN
+  self->monitors = monitors;
+  changer_build_screens (self, fit);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_start_prerender
+
+  The screen size comes from --screen-size if it was given. If not, each
+  monitor's images are prepared at its own size, and the size of the
+  first monitor, or of the X display, is used for anything else.
+
+  ==========================================================================*/
+static void changer_start_prerender (Changer *self)
+  {
+  KLOG_IN
+  int width = 0, height = 0;
+  // The largest size that will be asked for, by area
+  int max_width = 0, max_height = 0;
+  BOOL have_size;
+  int n = self->monitors ? klist_length (self->monitors) : 0;
+  if (self->screen_size)
+    have_size = sscanf (self->screen_size, "%dx%d", &width, &height) == 2;
+  else if (n > 0)
+    {
+    const Monitor *first = klist_get (self->monitors, 0);
+    width = monitor_get_width (first);
+    height = monitor_get_height (first);
+    for (int i = 1; i < n; i++)
+      {
+      const Monitor *m = klist_get (self->monitors, i);
+      if ((int64_t)monitor_get_width (m) * monitor_get_height (m)
+           > (int64_t)max_width * max_height)
+        {
+        max_width = monitor_get_width (m);
+        max_height = monitor_get_height (m);
+        }
+      }
+    have_size = TRUE;
+    }
+  else
+    have_size = x11_root_get_screen_size (&width, &height);
+
+  if ((int64_t)width * height > (int64_t)max_width * max_height)
+    {
+    max_width = width;
+    max_height = height;
+    }
+
+  if (have_size && width > 0 && height > 0)
+    {
+    char *dir = scaled_cache_get_default_dir ();
+    char *error = NULL;
+    self->prerender = prerender_new (dir, 
+      (int64_t)self->cache_size_mb * 1024 * 1024, max_width, max_height, 
+      &error);
+    if (self->prerender)
+      {
+      self->prerender_width = width;
+      self->prerender_height = height;
+      }
+    else
+      {
+      klog_error (KLOG_CLASS, "%s", error);
+      free (error);
+      }
+    free (dir);
+    }
+  else
+    klog_warn (KLOG_CLASS, "Can't find the screen size, so images won't "
+      "be prepared in advance; use --screen-size");
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_update_prerender
+
+  Ask for the images that will be shown next on each monitor to be 
+  prepared at that monitor's size, along with the current ones, and the
+  ones before them, which the desktop may still be showing. Only JPEG 
+  files larger than the monitor are worth preparing; the others are 
+  given to the desktop as they are. If the images have to be spanned,
+  the spanned images are asked for too, at least for the current and 
+  next changes, even without --prerender.
+
+  ==========================================================================*/
+static void changer_update_prerender (Changer *self)
+  {
+  KLOG_IN
+  if (self->prerender)
+    {
+    BOOL span = changer_can_span (self);
+    int last = self->prerender_count > 0 ? self->prerender_count : 1;
+    int max = (last + 2) * (self->nscreens + 1);
+    PrerenderRequest *requests = malloc (max * sizeof (PrerenderRequest));
+    // The spanned images' file names and monitors, to free afterwards
+    KList *spans = klist_new_empty (free);
+    int n = 0;
+    for (int i = 0; i <= last + 1; i++)
+      {
+      // Most urgent first: current and upcoming, then previous
+      int offset = i <= last ? i : last - i;
+      for (int m = 0; m < self->nscreens && self->prerender_count > 0; m++)
+        {
+        const ImageInfo *info = changer_get_nth_info (self, m, offset);
+        const char *format = image_info_get_format (info);
+        int width, height;
+        changer_get_render_size (self, m, &width, &height);
+        if (format && strcmp (format, "jpeg") == 0 
+             && (image_info_get_width (info) > width
+             || image_info_get_height (info) > height))
+          {
+          PrerenderRequest *r = &requests[n++];
+          r->filename = (char *)kpath_to_utf8 (image_info_get_path (info));
+          r->width = width;
+          r->height = height;
+          r->n = 0;
+          }
+        }
+      if (span)
+        {
+        char **filenames;
+        const Monitor **monitors;
+        changer_get_span_images (self, offset, &filenames, &monitors);
+        klist_append (spans, monitors);
+        PrerenderRequest *r = &requests[n++];
+        r->filename = NULL;
+        r->n = self->nscreens;
+        r->filenames = (const char *const *)filenames;
+        r->monitors = monitors;
+        }
+      }
+    prerender_request (self->prerender, requests, n);
+    for (int i = 0; i < n; i++) 
+      {
+      if (requests[i].n > 0)
+        kspawn_free_argv ((char **)requests[i].filenames);
+      else
+        free ((char *)requests[i].filename);
+      }
+    klist_destroy (spans);
+    free (requests);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_update_stage
+
+  Ask for the current and next image on each monitor to be staged, and
+  the previous ones too while the desktop may still be showing them. 
+  The copies of any other images are removed.
+
+  ==========================================================================*/
+static void changer_update_stage (Changer *self, BOOL keep_previous)
+  {
+  KLOG_IN
+  if (self->stage)
+    {
+    // Most urgent first
+    static const int offsets[] = { 0, 1, -1 };
+    int noffsets = keep_previous ? 3 : 2;
+    char **filenames = malloc (noffsets * self->nscreens * sizeof (char *));
+    int n = 0;
+    for (int i = 0; i < noffsets; i++)
+      for (int m = 0; m < self->nscreens; m++)
+        filenames[n++] = (char *)kpath_to_utf8 (image_info_get_path 
+          (changer_get_nth_info (self, m, offsets[i])));
+    stage_request (self->stage, (const char *const *)filenames, n);
+    for (int i = 0; i < n; i++) free (filenames[i]);
+    free (filenames);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_make_helper_request
+
+  Build the JSON request for the persistent helper: one entry per 
+  monitor, with what we know about the image. The path is the file to
+  show, which may be a prepared or staged copy, as for other methods;
+  the original is given too. Width and height are the original's, and
+  are null if it was not probed during the scan. The caller must free
+  the result.
+
+  ==========================================================================*/
+static char *changer_make_helper_request (const Changer *self)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  size_t size = 0;
+  FILE *f = open_memstream (&ret, &size);
+  fputs ("{\"images\":[", f);
+  for (int i = 0; i < self->nscreens; i++)
+    {
+    const ImageInfo *info = changer_get_nth_info (self, i, 0);
+    char *original = (char *)kpath_to_utf8 (image_info_get_path (info));
+    char *filename = changer_get_nth_filename (self, i, 0);
+    int width = image_info_get_width (info);
+    int height = image_info_get_height (info);
+    const char *format = image_info_get_format (info);
+    if (i > 0) fputc (',', f);
+    fprintf (f, "{\"monitor\":%d,\"path\":", i);
+    kjson_write_string (f, filename);
+    fputs (",\"original\":", f);
+    kjson_write_string (f, original);
+    if (width > 0 && height > 0)
+      fprintf (f, ",\"width\":%d,\"height\":%d", width, height);
+    else
+      fputs (",\"width\":null,\"height\":null", f);
+    fputs (",\"format\":", f);
+    if (format)
+      kjson_write_string (f, format);
+    else
+      fputs ("null", f);
+    fputc ('}', f);
+    free (filename);
+    free (original);
+    }
+  fputs ("]}", f);
+  fclose (f);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_on_helper_reply
+
+  Called with each line that the persistent helper writes, or NULL if it
+  has gone away. Any line acknowledges the outstanding request; a line
+  that starts with "error" is logged as a failure.
+
+  ==========================================================================*/
+static void changer_on_helper_reply (const char *reply, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  if (self->coprocess_busy)
+    {
+    self->coprocess_busy = FALSE;
+    if (self->deadline_fd >= 0)
+      keventloop_set_timer (self->deadline_fd, 0, 0);
+    ktrace_complete (KLOG_CLASS, "helper", self->coprocess_sent, 
+      ktrace_now() - self->coprocess_sent, reply);
+    if (!reply)
+      klog_error (KLOG_CLASS, "Helper exited without answering");
+    else if (strncmp (reply, "error", 5) == 0)
+      klog_error (KLOG_CLASS, "Helper reported: %s", reply);
+    changer_job_finished (self);
+    }
+  else if (reply)
+    klog_debug (KLOG_CLASS, "Ignoring unexpected reply '%s'", reply);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_send_to_helper
+
+  ==========================================================================*/
+static void changer_send_to_helper (Changer *self)
+  {
+  KLOG_IN
+  if (!self->coprocess)
+    self->coprocess = coprocess_new (self->loop, self->exe_path, self->envp,
+      changer_on_helper_reply, self);
+  char *request = changer_make_helper_request (self);
+  char *error = NULL;
+  if (coprocess_send (self->coprocess, request, &error))
+    {
+    self->coprocess_busy = TRUE;
+    self->coprocess_sent = ktrace_now();
+    if (self->deadline_fd >= 0 && self->method_timeout > 0)
+      keventloop_set_timer (self->deadline_fd, 
+        (int64_t)self->method_timeout * 1000, 0);
+    }
+  else
+    {
+    klog_error (KLOG_CLASS, "%s", error);
+    free (error);
+    }
+  free (request);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_method_cmd
+
+  ==========================================================================*/
+void changer_method_cmd (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using user command");
+ 
+  if (self->cmd_persistent)
+    {
+    changer_send_to_helper (self);
+    }
+  else
+    {
+    char **filenames = malloc ((self->nscreens + 1) * sizeof (char *));
+    for (int i = 0; i < self->nscreens; i++)
+      filenames[i] = changer_get_nth_filename (self, i, 0);
+    filenames[self->nscreens] = NULL;
+    changer_queue_command_argv (self, (const char *const *)filenames);
+    kspawn_free_argv (filenames);
+    }
+  
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_method_gnome2
+
+  ==========================================================================*/
+void changer_method_gnome2 (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using gnome2 method");
+ 
+  char *filename = changer_get_nth_filename (self, 0, 0);
+  changer_queue_command (self, "--set", "--type=string", 
+    "/desktop/gnome/background/picture_filename", filename, NULL);
+  free (filename);
+
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_method_gnome-shell
+
+  Sets the light and dark background images in one GSettings change if
+  the in-process connection is available; otherwise runs gsettings
+  twice.
+
+  ==========================================================================*/
+void changer_method_gnome_shell (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using gnome-shell method");
+
+  BOOL spanned;
+  char *filename = changer_get_desktop_filename (self, &spanned);
+  char *uri;
+  asprintf (&uri, "file://%s", filename);
+  // The picture options are only touched with --dual, when the image 
+  //   should span the monitors; if the spanned image can't be made, 
+  //   the first screen's image is zoomed across them all
+  const char *options = NULL;
+  if (changer_can_span (self)) options = spanned ? "spanned" : "zoom";
+
+  if (self->gnome_settings)
+    {
+    gnome_settings_set_background (self->gnome_settings, uri, options);
+    }
+  else
+    {
+    changer_queue_command (self, "set", "org.gnome.desktop.background", 
+      "picture-uri", uri, NULL);
+    changer_queue_command (self, "set", "org.gnome.desktop.background", 
+      "picture-uri-dark", uri, NULL);
+    if (options)
+      changer_queue_command (self, "set", "org.gnome.desktop.background", 
+        "picture-options", options, NULL);
+    }
+
+  free (uri);
+  free (filename);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_xfce4_on_properties
+
+  Called with the output of xfconf-query --list. If the properties were
+  found, the method is run again to set them; this is still part of the
+  same change job. If not, xfconf-query isn't asked again until a delay
+  that grows each time it fails, so that a broken xfconfd doesn't cost
+  a command on every change.
+
+  ==========================================================================*/
+static void changer_xfce4_on_properties (Changer *self, BOOL ok, 
+    char *output)
+  {
+  KLOG_IN
+  KList *properties = klist_new_empty (free);
+  char *saveptr = NULL;
+  for (char *line = strtok_r (output, "\n", &saveptr); ok && line; 
+        line = strtok_r (NULL, "\n", &saveptr))
+    {
+    if (strstr (line, "last-image") && strstr (line, "screen0"))
+      klist_append (properties, strdup (line));
+    }
+  klog_debug (KLOG_CLASS, "Found %d xfconf last-image properties", 
+    (int)klist_length (properties));
+
+  if (klist_length (properties) > 0)
+    {
+    self->xfce4_properties = properties;
+    self->xfce4_retry_secs = CHANGER_XFCE4_RETRY_MIN;
+    changer_method_xfce4 (self);
+    }
+  else
+    {
+    klog_error (KLOG_CLASS, "Can't list xfconf properties; trying again "
+      "in %d seconds", self->xfce4_retry_secs);
+    self->xfce4_retry_at = ktrace_now() 
+      + (int64_t)self->xfce4_retry_secs * 1000000;
+    self->xfce4_retry_secs *= 2;
+    if (self->xfce4_retry_secs > CHANGER_XFCE4_RETRY_MAX)
+      self->xfce4_retry_secs = CHANGER_XFCE4_RETRY_MAX;
+    klist_destroy (properties);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_xfce4_find_properties
+
+  Start finding the xfconf properties that hold the background image for
+  each monitor and workspace on screen 0. These are remarkably variable
+  between Xfce4 releases, so we search for them rather than assuming 
+  them. xfconf-query is run like any other command of the change job,
+  under the method timeout, and its output is read from the event loop.
+  Returns TRUE if it was started.
+
+  ==========================================================================*/
+static BOOL changer_xfce4_find_properties (Changer *self)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  if (self->exe_path && ktrace_now() >= self->xfce4_retry_at)
+    {
+    char **argv = kspawn_argv_new (self->exe_path, "-c", "xfce4-desktop", 
+      "--list", NULL);
+    ret = changer_start_capture (self, argv, changer_xfce4_on_properties);
+    kspawn_free_argv (argv);
+    }
+  else
+    klog_debug (KLOG_CLASS, "Not listing xfconf properties yet");
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_xfce4_get_monitor
+
+  Get the monitor component of a property name like
+  /backdrop/screen0/monitorHDMI-1/workspace0/last-image. The caller must
+  free the result.
+
+  ==========================================================================*/
+static char *changer_xfce4_get_monitor (const char *property)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  const char *p = strstr (property, "/monitor");
+  if (p)
+    {
+    p++;
+    const char *end = strchr (p, '/');
+    ret = end ? strndup (p, end - p) : strdup (p);
+    }
+  else
+    ret = strdup ("");
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_xfce4_get_screen
+
+  Get the screen whose image a monitor in the xfconf property list 
+  should show. xfconf names monitors by their output names, which XRandR
+  gives us too; a monitor that can't be matched by name gets the screens
+  in turn, in the order that the monitors first appear in the list. 
+  'seen' holds the names of those monitors so far.
+
+  ==========================================================================*/
+static int changer_xfce4_get_screen (const Changer *self, 
+    const char *monitor, KList *seen)
+  {
+  KLOG_IN
+  int ret = -1;
+  const char *name = monitor;
+  if (strncmp (name, "monitor", 7) == 0) name += 7;
+  for (int i = 0; i < self->nscreens && ret < 0 && name[0]; i++)
+    {
+    const Monitor *m = self->screens[i].monitor;
+    if (m && strcmp (monitor_get_name (m), name) == 0) ret = i;
+    }
+  if (ret < 0)
+    {
+    int l = klist_length (seen);
+    for (int i = 0; i < l && ret < 0; i++)
+      if (strcmp (klist_get (seen, i), monitor) == 0) ret = i;
+    if (ret < 0)
+      {
+      klist_append (seen, strdup (monitor));
+      ret = l;
+      }
+    ret %= self->nscreens;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_xfce4_get_values
+
+  Get the image file for each monitor in the xfconf property list. The
+  result is freed with kspawn_free_argv().
+
+  ==========================================================================*/
+static char **changer_xfce4_get_values (const KList *properties, 
+    void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  char **filenames = malloc ((self->nscreens + 1) * sizeof (char *));
+  for (int i = 0; i < self->nscreens; i++)
+    filenames[i] = changer_get_nth_filename (self, i, 0);
+  filenames[self->nscreens] = NULL;
+  KList *seen = klist_new_empty (free);
+
+  int l = klist_length (properties);
+  char **ret = malloc ((l + 1) * sizeof (char *));
+  for (int i = 0; i < l; i++)
+    {
+    char *monitor = changer_xfce4_get_monitor (klist_get (properties, i));
+    ret[i] = strdup (filenames[changer_xfce4_get_screen (self, monitor, 
+      seen)]);
+    free (monitor);
+    }
+  ret[l] = NULL;
+
+  klist_destroy (seen);
+  kspawn_free_argv (filenames);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  changer_xfce4_on_set
+
+  Called when xfconfd has answered. Any failure has been logged.
+
+  ==========================================================================*/
+static void changer_xfce4_on_set (BOOL ok, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  (void)ok;
+  changer_method_done (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_method_xfce4
+
+  Each monitor in the xfconf property list is given the image for its 
+  screen. The properties are set in-process, all at once, if we have an
+  xfconf connection, or by running xfconf-query for each one if not --
+  once xfconf-query has listed them.
+
+  ==========================================================================*/
+void changer_method_xfce4 (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using xfce4 method");
+ 
+  if (self->xfconf)
+    {
+    if (xfconf_desktop_set_images (self->xfconf, changer_xfce4_get_values,
+         changer_xfce4_on_set, self))
+      changer_start_method (self);
+    }
+  else if (self->xfce4_properties)
+    {
+    char **values = changer_xfce4_get_values (self->xfce4_properties, self);
+    for (int i = 0; values[i]; i++)
+      changer_queue_command (self, "-c", "xfce4-desktop", "-p", 
+        klist_get (self->xfce4_properties, i), "--set", values[i], NULL);
+    kspawn_free_argv (values);
+    }
+  else
+    {
+    // This method runs again when they have been found
+    changer_xfce4_find_properties (self);
+    }
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_method_feh
+
+  ==========================================================================*/
+void changer_method_feh (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using feh method");
+ 
+  // Without Xinerama, feh treats the monitors as one screen, which is
+  //   what a spanned image is made for
+  BOOL spanned;
+  char *filename = changer_get_desktop_filename (self, &spanned);
+  if (spanned)
+    changer_queue_command (self, "--bg-fill", "--no-xinerama", filename, 
+      NULL);
+  else
+    changer_queue_command (self, "--bg-fill", filename, NULL);
+  free (filename);
+
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_method_xview
+
+  ==========================================================================*/
+void changer_method_xview (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using xview method");
+ 
+  BOOL spanned;
+  char *filename = changer_get_desktop_filename (self, &spanned);
+  changer_queue_command (self, "-onroot", "-fullscreen", "-quiet", 
+    filename, NULL);
+  free (filename);
+
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_method_x11
+
+  ==========================================================================*/
+void changer_method_x11 (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using x11 method");
+  if (self->x11_root && self->decoder)
+    {
+    BOOL spanned;
+    char *filename = changer_get_desktop_filename (self, &spanned);
+    self->decode_seq = decoder_request (self->decoder, filename);
+    changer_start_method (self);
+    free (filename);
+    }
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_method_fb
+
+  ==========================================================================*/
+void changer_method_fb (Changer *self)
+  {
+  KLOG_IN
+  assert (self != NULL);
+  klog_debug (KLOG_CLASS, "Change using fb method");
+  if (self->framebuffer && self->decoder)
+    {
+    char *filename = changer_get_nth_filename (self, 0, 0);
+    self->decode_seq = decoder_request (self->decoder, filename);
+    changer_start_method (self);
+    free (filename);
+    }
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_on_decoded
+
+  Called when the decoder has an image for the x11 or fb method. An 
+  image for a job that has been given up on is dropped.
+
+  ==========================================================================*/
+static void changer_on_decoded (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  uint64_t count;
+  int seq;
+  uint8_t *buffer;
+  char *error;
+  if (read (fd, &count, sizeof (count)) == sizeof (count)
+       && decoder_take (self->decoder, &seq, &buffer, &error))
+    {
+    if (self->method_busy && seq == self->decode_seq)
+      {
+      if (!buffer)
+        klog_error (KLOG_CLASS, "%s", error);
+      else if (self->x11_root)
+        x11_root_set_rgb (self->x11_root, buffer);
+      else if (self->framebuffer)
+        framebuffer_set_rgb (self->framebuffer, buffer);
+      changer_method_done (self);
+      }
+    decoder_put (self->decoder, buffer);
+    free (error);
+    }
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_move_forward
+
+  ==========================================================================*/
+static void changer_move_forward (Changer *self)
+  {
+  KLOG_IN
+
+  self->pos++;
+
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_move_back
+
+  ==========================================================================*/
+static void changer_move_back (Changer *self)
+  {
+  KLOG_IN
+
+  self->pos--;
+
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_next
+
+  ==========================================================================*/
+void changer_next (Changer *self)
+  {
+  KLOG_IN
+  klog_info (KLOG_CLASS, "Selecting next image(s)");
+  changer_move_forward (self);
+  changer_show_current_images (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_prev
+
+  ==========================================================================*/
+void changer_prev (Changer *self)
+  {
+  KLOG_IN
+  klog_info (KLOG_CLASS, "Selecting previous image(s)");
+  changer_move_back (self);
+  changer_show_current_images (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_prefetch_file
+
+  Ask the kernel to start reading a file into the page cache. This 
+  doesn't wait for the read, so a slow disk or server doesn't hold up
+  the event loop.
+
+  ==========================================================================*/
+static void changer_prefetch_file (const char *filename)
+  {
+  KLOG_IN
+  int fd = open (filename, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+    int err = posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+    if (err)
+      klog_debug (KLOG_CLASS, "Can't prefetch '%s': %s", filename,
+        strerror (err));
+    close (fd);
+    }
+  else
+    klog_debug (KLOG_CLASS, "Can't open '%s' to prefetch: %s", filename,
+      strerror (errno));
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_schedule_prefetch
+
+  Arm the prefetch timer for prefetch_lead seconds before the next 
+  change, or straight away if the interval is shorter than that. Since
+  re-arming a timerfd replaces its old setting, a prefetch that hasn't
+  happened yet, for images the user has navigated away from, is 
+  cancelled.
+
+  ==========================================================================*/
+static void changer_schedule_prefetch (Changer *self)
+  {
+  KLOG_IN
+  if (self->prefetch_fd >= 0)
+    {
+    int64_t msec = (int64_t)(self->interval - self->prefetch_lead) * 1000;
+    // Zero would disarm the timer
+    if (msec <= 0) msec = 1;
+    keventloop_set_timer (self->prefetch_fd, msec, 0);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_on_prefetch
+
+  Prefetch the files that the desktop will be given at the next change.
+
+  ==========================================================================*/
+static void changer_on_prefetch (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  uint64_t expirations;
+  // Reading ahead would only push something else out of memory
+  if (read (fd, &expirations, sizeof (expirations)) == sizeof (expirations)
+       && !self->memory_short)
+    {
+    for (int i = 0; i < self->nscreens; i++)
+      {
+      char *filename = changer_get_nth_filename (self, i, 1);
+      klog_debug (KLOG_CLASS, "Prefetching '%s'", filename);
+      changer_prefetch_file (filename);
+      free (filename);
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_restart_timer
+
+  Schedule the next automatic change for a full interval from now. This
+  is done after every change, so that a next/prev request gets the 
+  whole interval before the image changes again.
+
+  ==========================================================================*/
+static void changer_restart_timer (Changer *self)
+  {
+  KLOG_IN
+  int64_t msec = (int64_t)self->interval * 1000;
+  if (msec <= 0) msec = 1000;
+  keventloop_set_timer (self->timer_fd, msec, msec);
+  changer_schedule_prefetch (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_on_signal
+
+  Called by the event loop when the signalfd is readable. All the queued
+  signals are drained in one go.
+
+  ==========================================================================*/
+static void changer_on_signal (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  struct signalfd_siginfo si;
+  while (read (fd, &si, sizeof (si)) == sizeof (si))
+    {
+    switch (si.ssi_signo)
+      {
+      case SIGINT:
+        klog_info (KLOG_CLASS, "Caught interrupt signal");
+        keventloop_quit (self->loop);
+        break;
+      case SIGUSR1:
+        klog_debug (KLOG_CLASS, "Caught USR1 signal");
+        changer_next (self);
+        changer_restart_timer (self);
+        break;
+      case SIGUSR2:
+        klog_debug (KLOG_CLASS, "Caught USR2 signal");
+        changer_prev (self);
+        changer_restart_timer (self);
+        break;
+      case SIGCHLD:
+        changer_reap_child (self);
+        break;
+      default:
+        klog_debug (KLOG_CLASS, "Ignoring signal %d", si.ssi_signo);
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_on_timer
+
+  ==========================================================================*/
+static void changer_on_timer (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  uint64_t expirations;
+  if (read (fd, &expirations, sizeof (expirations)) == sizeof (expirations))
+    {
+    changer_next (self);
+    changer_schedule_prefetch (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_on_pressure
+
+  Called when memory is short. Everything that can be made again later
+  is freed, and the threads that prepare and stage images stop taking
+  on new work. The images still change, using whatever files are ready.
+
+  ==========================================================================*/
+static void changer_on_pressure (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  if (events & EPOLLERR)
+    {
+    klog_warn (KLOG_CLASS, "Memory pressure trigger has gone away");
+    keventloop_remove (self->loop, fd);
+    close (fd);
+    self->pressure_fd = -1;
+    }
+  else if (events & EPOLLPRI)
+    {
+    if (!self->memory_short)
+      {
+      size_t freed = 0;
+      self->memory_short = TRUE;
+      if (self->prerender) prerender_set_paused (self->prerender, TRUE);
+      if (self->stage) stage_set_paused (self->stage, TRUE);
+      if (self->decoder) freed += decoder_trim (self->decoder);
+      malloc_trim (0);
+      klog_info (KLOG_CLASS, "Memory is short: freed %zu bytes of buffers, "
+        "and paused background work", freed);
+      }
+    keventloop_set_timer (self->relief_fd, 
+      (int64_t)CHANGER_PRESSURE_RELIEF * 1000, 0);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_on_relief
+
+  Called when memory has not been short for CHANGER_PRESSURE_RELIEF
+  seconds. The buffers that were freed are allocated again when they
+  are next needed.
+
+  ==========================================================================*/
+static void changer_on_relief (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  uint64_t expirations;
+  if (read (fd, &expirations, sizeof (expirations)) == sizeof (expirations))
+    {
+    klog_info (KLOG_CLASS, "Memory is no longer short: resuming");
+    self->memory_short = FALSE;
+    if (self->prerender) prerender_set_paused (self->prerender, FALSE);
+    if (self->stage) stage_set_paused (self->stage, FALSE);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_on_span_ready
+
+  Called when the prerender worker has made a spanned image. If the 
+  desktop was given the first monitor's image for want of it, the 
+  images are applied again.
+
+  ==========================================================================*/
+static void changer_on_span_ready (int fd, uint32_t events, 
+    void *user_data)
+  {
+  KLOG_IN
+  Changer *self = user_data;
+  uint64_t count;
+  if (read (fd, &count, sizeof (count)) == sizeof (count) 
+       && self->span_pending)
+    {
+    char *span = changer_get_span (self);
+    if (span)
+      {
+      klog_debug (KLOG_CLASS, "Spanned image is ready: '%s'", span);
+      free (span);
+      changer_show_current_images (self);
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+  
+  changer_run 
+
+  The loop sleeps in epoll_wait() until either a signal arrives (via
+  a signalfd) or the change timer (a timerfd) expires. Nothing wakes
+  the process up in between.
+
+  ==========================================================================*/
+void changer_run (Changer *self)
+  {
+  KLOG_IN
+
+  sigset_t base_mask;
+
+  sigemptyset (&base_mask);
+  sigaddset (&base_mask, SIGINT);
+  sigaddset (&base_mask, SIGHUP);
+  sigaddset (&base_mask, SIGUSR1);
+  sigaddset (&base_mask, SIGUSR2);
+  sigaddset (&base_mask, SIGCHLD);
+  sigprocmask (SIG_SETMASK, &base_mask, NULL);
+  // A helper that exits must not take us with it when we next write to
+  //   it. Spawned programs get the default action back
+  signal (SIGPIPE, SIG_IGN);
+
+  self->loop = keventloop_new ();
+  self->signal_fd = signalfd (-1, &base_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  self->timer_fd = timerfd_create (CLOCK_MONOTONIC, 
+    TFD_NONBLOCK | TFD_CLOEXEC);
+  self->deadline_fd = timerfd_create (CLOCK_MONOTONIC, 
+    TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (self->loop && self->signal_fd >= 0 && self->timer_fd >= 0
+       && self->deadline_fd >= 0)
+    {
+    keventloop_add (self->loop, self->signal_fd, EPOLLIN, 
+      changer_on_signal, self);
+    keventloop_add (self->loop, self->timer_fd, EPOLLIN, 
+      changer_on_timer, self);
+    keventloop_add (self->loop, self->deadline_fd, EPOLLIN, 
+      changer_on_deadline, self);
+
+    char *error = NULL;
+    self->pressure_fd = pressure_open_trigger (CHANGER_PRESSURE_STALL,
+      CHANGER_PRESSURE_WINDOW, &error);
+    if (self->pressure_fd >= 0)
+      self->relief_fd = timerfd_create (CLOCK_MONOTONIC, 
+        TFD_NONBLOCK | TFD_CLOEXEC);
+    if (self->pressure_fd >= 0 && self->relief_fd >= 0)
+      {
+      keventloop_add (self->loop, self->pressure_fd, EPOLLPRI, 
+        changer_on_pressure, self);
+      keventloop_add (self->loop, self->relief_fd, EPOLLIN, 
+        changer_on_relief, self);
+      }
+    else
+      {
+      klog_info (KLOG_CLASS, "Not watching memory pressure: %s", 
+        error ? error : strerror (errno));
+      if (self->pressure_fd >= 0) close (self->pressure_fd);
+      self->pressure_fd = -1;
+      }
+    free (error);
+
+    if (self->prefetch_lead > 0)
+      {
+      self->prefetch_fd = timerfd_create (CLOCK_MONOTONIC, 
+        TFD_NONBLOCK | TFD_CLOEXEC);
+      if (self->prefetch_fd >= 0)
+        keventloop_add (self->loop, self->prefetch_fd, EPOLLIN, 
+          changer_on_prefetch, self);
+      else
+        klog_warn (KLOG_CLASS, "Can't create prefetch timer: %s", 
+          strerror (errno));
+      }
+
+    if (self->method == SBM_GNOMESHELL)
+      {
+      self->gnome_settings = gnome_settings_new ();
+      if (!self->gnome_settings)
+        {
+        klog_info (KLOG_CLASS, "Using the gsettings program instead of GIO");
+        changer_resolve_exe (self);
+        }
+      }
+    else if (self->method == SBM_XFCE4)
+      {
+      self->xfconf = xfconf_desktop_new ();
+      if (!self->xfconf)
+        {
+        klog_info (KLOG_CLASS, 
+          "Using the xfconf-query program instead of D-Bus");
+        changer_resolve_exe (self);
+        }
+      }
+    else if (self->method == SBM_X11)
+      {
+      char *error = NULL;
+      self->x11_root = x11_root_new (&error);
+      if (!self->x11_root)
+        {
+        klog_error (KLOG_CLASS, "%s", error);
+        free (error);
+        }
+      }
+    else if (self->method == SBM_FB)
+      {
+      char *error = NULL;
+      self->framebuffer = framebuffer_new (self->fb_device ? 
+        self->fb_device : FRAMEBUFFER_DEFAULT_DEVICE, self->fb_geometry, 
+        &error);
+      if (!self->framebuffer)
+        {
+        klog_error (KLOG_CLASS, "%s", error);
+        free (error);
+        }
+      }
+
+    if (self->x11_root || self->framebuffer)
+      {
+      char *error = NULL;
+      int width, height;
+      if (self->x11_root)
+        x11_root_get_size (self->x11_root, &width, &height);
+      else
+        framebuffer_get_size (self->framebuffer, &width, &height);
+      self->decoder = decoder_new (width, height, &error);
+      if (self->decoder)
+        keventloop_add (self->loop, decoder_get_fd (self->decoder), 
+          EPOLLIN, changer_on_decoded, self);
+      else
+        {
+        klog_error (KLOG_CLASS, "%s", error);
+        free (error);
+        }
+      }
+    // The replies from xfconfd, and GSettings' notifications, are
+    //   delivered on the GLib main context
+    if (self->gnome_settings || self->xfconf)
+      gio_add_to_loop (gio_get_api (), self->loop);
+
+    // Spanned images are made by the prerender worker, too
+    if (self->prerender_count > 0 || changer_can_span (self))
+      changer_start_prerender (self);
+    if (self->prerender)
+      keventloop_add (self->loop, prerender_get_span_fd (self->prerender),
+        EPOLLIN, changer_on_span_ready, self);
+
+    if (self->stage_size_mb > 0)
+      {
+      char *dir = stage_get_default_dir ();
+      char *error = NULL;
+      self->stage = stage_new (dir, 
+        (int64_t)self->stage_size_mb * 1024 * 1024, &error);
+      if (!self->stage)
+        {
+        klog_error (KLOG_CLASS, "%s", error);
+        free (error);
+        }
+      free (dir);
+      }
+
+    changer_show_current_images (self);
+    changer_restart_timer (self);
+
+    keventloop_run (self->loop);
+
+    if (self->prerender)
+      keventloop_remove (self->loop, 
+        prerender_get_span_fd (self->prerender));
+    prerender_destroy (self->prerender);
+    self->prerender = NULL;
+    self->span_pending = FALSE;
+    stage_destroy (self->stage);
+    self->stage = NULL;
+
+    if (self->gnome_settings || self->xfconf)
+      gio_remove_from_loop (gio_get_api (), self->loop);
+    gnome_settings_destroy (self->gnome_settings);
+    self->gnome_settings = NULL;
+    xfconf_desktop_destroy (self->xfconf);
+    self->xfconf = NULL;
+    if (self->decoder)
+      keventloop_remove (self->loop, decoder_get_fd (self->decoder));
+    decoder_destroy (self->decoder);
+    self->decoder = NULL;
+    self->method_busy = FALSE;
+    x11_root_destroy (self->x11_root);
+    self->x11_root = NULL;
+    framebuffer_destroy (self->framebuffer);
+    self->framebuffer = NULL;
+
+    changer_stop_child (self);
+    coprocess_destroy (self->coprocess);
+    self->coprocess = NULL;
+    self->coprocess_busy = FALSE;
+    if (self->prefetch_fd >= 0)
+      keventloop_remove (self->loop, self->prefetch_fd);
+    if (self->pressure_fd >= 0)
+      keventloop_remove (self->loop, self->pressure_fd);
+    if (self->relief_fd >= 0)
+      keventloop_remove (self->loop, self->relief_fd);
+    keventloop_remove (self->loop, self->deadline_fd);
+    keventloop_remove (self->loop, self->timer_fd);
+    keventloop_remove (self->loop, self->signal_fd);
+    }
+  else
+    klog_error (KLOG_CLASS, "Can't set up event loop: %s", strerror (errno));
+
+  if (self->prefetch_fd >= 0) close (self->prefetch_fd);
+  if (self->pressure_fd >= 0) close (self->pressure_fd);
+  if (self->relief_fd >= 0) close (self->relief_fd);
+  if (self->deadline_fd >= 0) close (self->deadline_fd);
+  if (self->timer_fd >= 0) close (self->timer_fd);
+  if (self->signal_fd >= 0) close (self->signal_fd);
+  self->prefetch_fd = -1;
+  self->pressure_fd = -1;
+  self->relief_fd = -1;
+  self->memory_short = FALSE;
+  self->deadline_fd = -1;
+  self->timer_fd = -1;
+  self->signal_fd = -1;
+  keventloop_destroy (self->loop);
+  self->loop = NULL;
+
+  KLOG_OUT
+  }
+
+
+/*============================================================================
+  
+  changer_show_current_images
+
+  ==========================================================================*/
+static void changer_show_current_images (Changer *self)
+  {
+  KLOG_IN
+
+  if (self->child_pid > 0 || klist_length (self->commands) > 0
+       || self->coprocess_busy || self->method_busy)
+    {
+    // A change is still in progress. Don't pile up another one behind
+    //   it -- just note that the images have to be applied again when
+    //   it finishes. However many times the user navigates in the
+    //   meantime, only the final images are applied.
+    klog_debug (KLOG_CLASS, "Change in progress; deferring");
+    self->apply_pending = TRUE;
+    }
+  else
+    {
+    ChangerFn fn = methods[self->method].fn;
+    assert (fn != NULL);
+
+    // Not while a change is in progress, as that might remove the copy
+    //   that the desktop is being given
+    changer_update_stage (self, TRUE);
+
+    const char *name = methods[self->method].name;
+    // The file name is only for tracing
+    if (ktrace_enabled () || KPROBE_ENABLED (lbc, method_exec_start)
+         || KPROBE_ENABLED (lbc, method_exec_end))
+      self->job_filename = (char *)kpath_to_utf8 (image_info_get_path
+        (changer_get_nth_info (self, 0, 0)));
+    self->job_start = ktrace_now();
+    KPROBE2 (lbc, method_exec_start, name, self->job_filename);
+    fn (self);
+    changer_start_next_command (self);
+    }
+
+  // Whether or not the change could be made yet, the images it needs,
+  //   and the ones after them, can be prepared
+  changer_update_prerender (self);
+
+  KLOG_OUT
+  }
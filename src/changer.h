@@ -13,10 +13,14 @@
 
 #include <klib/klib.h>
 
-/** Define the numeric values of the specific changer methods. */
+/** Define the numeric values of the specific changer methods. These are
+    indices into the method table in changer.c, and must be kept in the
+    same order. */
 typedef enum
   {
-  SBM_XVIEW = 0, SBM_GNOME2 = 1, SBM_GNOMESHELL = 2, SBM_XFCE4 = 3, SBM_CMD = 4
+  SBM_FEH = 0, SBM_GNOMESHELL = 1, SBM_GNOME2 = 2, SBM_XFCE4 = 3, 
+  SBM_XVIEW = 4, SBM_CMD = 5, SBM_GNOMESHELL_CMD = 6, SBM_XFCE4_CMD = 7,
+  SBM_X11 = 8, SBM_FB = 9
   } SetBackgroundMethod;
 
 /** Define the numeric values of the aspect ratio filters. */
@@ -25,14 +29,75 @@ typedef enum
   ASPECT_ANY = 0, ASPECT_LANDSCAPE = 1, ASPECT_PORTRAIT = 2 
   } Aspect;
 
+/** How images are matched to monitors: by orientation, or with the
+    aspect ratio and size nearest the monitor's first. */
+typedef enum
+  {
+  FIT_ORIENTATION = 0, FIT_BEST = 1
+  } Fit;
+
+/** How long, in seconds, a change method's command may run before it
+    is killed. */
+#define CHANGER_DEFAULT_METHOD_TIMEOUT 30
+
+/** The default number of seconds before a change that the next images
+    are read into memory. */
+#define CHANGER_DEFAULT_PREFETCH_LEAD 5
+
+/** The default limit, in megabytes, of the copies made by --stage. */
+#define CHANGER_DEFAULT_STAGE_SIZE_MB 100
+
 struct _Changer;
 typedef struct _Changer Changer;
 
+/** Create a changer for file_list, which is a list of ImageInfo. The 
+    list is not copied, and must outlive the changer. */
 extern Changer   *changer_new (const KList *file_list, int interval,
                     SetBackgroundMethod method, BOOL dual, const char *cmd);
 
 extern void       changer_destroy (Changer *self);
 
+/** Set the time limit for change commands; zero means no limit. */
+extern void       changer_set_method_timeout (Changer *self, int seconds);
+
+/** Read the next images into the page cache this many seconds before
+    each timed change, so the desktop doesn't wait for the disk; zero
+    turns this off. */
+extern void       changer_set_prefetch_lead (Changer *self, int seconds);
+
+/** With the cmd method, start the command once and send it a request
+    for each change, rather than running it for each change. */
+extern void       changer_set_cmd_persistent (Changer *self, 
+                    BOOL persistent);
+
+/** Set the framebuffer device or file, and for a file its geometry,
+    for the fb method. Either may be NULL. */
+extern void       changer_set_framebuffer (Changer *self, 
+                    const char *device, const char *geometry);
+
+/** Prepare the next count images in the background, scaled to the
+    screen size, and give the desktop the prepared files. screen_size
+    is WIDTHxHEIGHT, or NULL to use the size of each monitor. Zero count
+    means no preparation. The prepared files are kept in a cache of
+    up to cache_size_mb megabytes. */
+extern void       changer_set_prerender (Changer *self, int count,
+                    const char *screen_size, int cache_size_mb);
+
+/** Copy the current and next images into local memory before they are
+    shown, and give the desktop the copies, so that it doesn't depend on
+    the filesystem the images are on. The copies are limited to size_mb
+    megabytes; zero means no staging. */
+extern void       changer_set_stage (Changer *self, int size_mb);
+
+/** Set the monitors, as a list of Monitor, in the order that the 
+    desktop's images are given to them. With FIT_ORIENTATION, each 
+    monitor is only given images of its own orientation, if there are
+    any; with FIT_BEST, it is given the images that fit it best first.
+    Images are prepared at the monitor's size. The list is not copied,
+    and must outlive the changer. */
+extern void       changer_set_monitors (Changer *self, 
+                    const KList *monitors, Fit fit);
+
 /** Print the enabled changer methods to the specified stream, one per line. */
 extern void       changer_dump_methods (FILE *f);
 
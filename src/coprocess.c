@@ -0,0 +1,305 @@
+/*============================================================================
+
+  lbc
+
+  coprocess.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <klib/klib.h>
+#include "coprocess.h"
+
+#define KLOG_CLASS "lbc.coprocess"
+
+// How long the helper has to exit, once its input is closed and it has
+//   been sent SIGTERM, before it is killed
+#define COPROCESS_STOP_MSEC 5000
+
+/*============================================================================
+
+  Coprocess
+
+  ==========================================================================*/
+struct _Coprocess
+  {
+  KEventLoop *loop;
+  char *exe_path;
+  char *const *envp;
+  CoprocessReplyFn fn;
+  void *user_data;
+  pid_t pid;
+  // Our ends of the helper's standard input and output; -1 when the
+  //   helper is not running
+  int in_fd;
+  int out_fd;
+  // Output read from the helper that doesn't yet make a complete line
+  char *partial;
+  size_t partial_len;
+  };
+
+/*============================================================================
+
+  coprocess_new
+
+  ==========================================================================*/
+Coprocess *coprocess_new (KEventLoop *loop, const char *exe_path,
+    char *const envp[], CoprocessReplyFn fn, void *user_data)
+  {
+  KLOG_IN
+  Coprocess *self = malloc (sizeof (Coprocess));
+  self->loop = loop;
+  self->exe_path = strdup (exe_path);
+  self->envp = envp;
+  self->fn = fn;
+  self->user_data = user_data;
+  self->pid = -1;
+  self->in_fd = -1;
+  self->out_fd = -1;
+  self->partial = NULL;
+  self->partial_len = 0;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  coprocess_close_pipes
+
+  ==========================================================================*/
+static void coprocess_close_pipes (Coprocess *self)
+  {
+  KLOG_IN
+  if (self->in_fd >= 0) close (self->in_fd);
+  if (self->out_fd >= 0)
+    {
+    keventloop_remove (self->loop, self->out_fd);
+    close (self->out_fd);
+    }
+  self->in_fd = -1;
+  self->out_fd = -1;
+  free (self->partial);
+  self->partial = NULL;
+  self->partial_len = 0;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  coprocess_destroy
+
+  ==========================================================================*/
+void coprocess_destroy (Coprocess *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    coprocess_close_pipes (self);
+    if (self->pid > 0)
+      {
+      kspawn_stop (self->pid, COPROCESS_STOP_MSEC);
+      }
+    free (self->exe_path);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  coprocess_on_output
+
+  Split what the helper writes into lines, and pass each one on. End of
+  file means that the helper has exited, or at least can't reply any
+  more; it is killed in case it is still running, and will be started
+  again for the next request.
+
+  ==========================================================================*/
+static void coprocess_on_output (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  Coprocess *self = user_data;
+  char buff[4096];
+  ssize_t n = read (fd, buff, sizeof (buff));
+  if (n > 0)
+    {
+    self->partial = realloc (self->partial, self->partial_len + n + 1);
+    memcpy (self->partial + self->partial_len, buff, n);
+    self->partial_len += n;
+    self->partial[self->partial_len] = 0;
+    char *last_nl = strrchr (self->partial, '\n');
+    if (last_nl)
+      {
+      // Take the complete lines out of the buffer before passing them
+      //   on, because the reply function may send another request, 
+      //   and that may restart the helper
+      size_t complete = last_nl - self->partial + 1;
+      char *lines = strndup (self->partial, complete);
+      self->partial_len -= complete;
+      memmove (self->partial, self->partial + complete, 
+        self->partial_len + 1);
+      char *saveptr = NULL;
+      for (char *line = strtok_r (lines, "\n", &saveptr); line;
+            line = strtok_r (NULL, "\n", &saveptr))
+        {
+        klog_debug (KLOG_CLASS, "Helper replied '%s'", line);
+        self->fn (line, self->user_data);
+        }
+      free (lines);
+      }
+    }
+  else if (n == 0 || errno != EAGAIN)
+    {
+    klog_warn (KLOG_CLASS, "Helper '%s' closed its output", self->exe_path);
+    coprocess_close_pipes (self);
+    if (self->pid > 0) kill (-self->pid, SIGKILL);
+    self->fn (NULL, self->user_data);
+    }
+  (void)events;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  coprocess_start
+
+  ==========================================================================*/
+static BOOL coprocess_start (Coprocess *self, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  coprocess_close_pipes (self);
+  int to_child[2], from_child[2];
+  if (pipe2 (to_child, O_CLOEXEC) == 0)
+    {
+    if (pipe2 (from_child, O_CLOEXEC) == 0)
+      {
+      char *argv[] = {self->exe_path, NULL};
+      pid_t pid = kspawn_start (argv, self->envp, to_child[0],
+        from_child[1], TRUE);
+      if (pid > 0)
+        {
+        klog_info (KLOG_CLASS, "Started helper '%s', pid %d",
+          self->exe_path, (int)pid);
+        self->pid = pid;
+        self->in_fd = to_child[1];
+        self->out_fd = from_child[0];
+        // A helper that stops reading must not be able to block us
+        fcntl (self->in_fd, F_SETFL, O_NONBLOCK);
+        fcntl (self->out_fd, F_SETFL, O_NONBLOCK);
+        keventloop_add (self->loop, self->out_fd, EPOLLIN,
+          coprocess_on_output, self);
+        ret = TRUE;
+        }
+      else
+        {
+        asprintf (error, "Can't start helper '%s': %s", self->exe_path,
+          strerror (errno));
+        close (to_child[1]);
+        close (from_child[0]);
+        }
+      close (from_child[1]);
+      }
+    else
+      {
+      asprintf (error, "Can't create pipe: %s", strerror (errno));
+      close (to_child[1]);
+      }
+    close (to_child[0]);
+    }
+  else
+    asprintf (error, "Can't create pipe: %s", strerror (errno));
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  coprocess_send
+
+  ==========================================================================*/
+BOOL coprocess_send (Coprocess *self, const char *request, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  char *line;
+  asprintf (&line, "%s\n", request);
+  size_t len = strlen (line);
+  klog_debug (KLOG_CLASS, "Sending '%s'", request);
+  // If the helper has died, but we haven't seen its output close yet,
+  //   the write fails with EPIPE. In that case, start it again and
+  //   retry, once
+  for (int attempt = 0; attempt < 2 && !ret; attempt++)
+    {
+    if (self->in_fd < 0 && !coprocess_start (self, error))
+      break;
+    ssize_t n = write (self->in_fd, line, len);
+    if (n == (ssize_t)len)
+      ret = TRUE;
+    else
+      {
+      int err = errno;
+      coprocess_close_pipes (self);
+      if (self->pid > 0) kill (-self->pid, SIGKILL);
+      if (n >= 0 || err != EPIPE || attempt > 0)
+        {
+        // A short write means that the pipe is full, so the helper 
+        //   isn't reading. Either way, it is no use any more
+        asprintf (error, "Can't write to helper '%s': %s", self->exe_path,
+          n < 0 ? strerror (err) : "helper is not reading");
+        break;
+        }
+      }
+    }
+  free (line);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  coprocess_kill
+
+  ==========================================================================*/
+void coprocess_kill (Coprocess *self)
+  {
+  KLOG_IN
+  if (self->pid > 0) kill (-self->pid, SIGKILL);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  coprocess_child_exited
+
+  ==========================================================================*/
+BOOL coprocess_child_exited (Coprocess *self, pid_t pid, int status)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  if (pid == self->pid)
+    {
+    if (WIFSIGNALED (status))
+      klog_warn (KLOG_CLASS, "Helper '%s' killed by signal %d",
+        self->exe_path, WTERMSIG (status));
+    else
+      klog_warn (KLOG_CLASS, "Helper '%s' exited with status %d",
+        self->exe_path, WEXITSTATUS (status));
+    self->pid = -1;
+    ret = TRUE;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
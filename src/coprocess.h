@@ -0,0 +1,61 @@
+/*============================================================================
+
+  lbc
+
+  coprocess.h
+
+  A helper program that is started once and kept running, rather than
+  being started for each change. Requests are written to its standard
+  input, one line each, and it answers each one with a line on its
+  standard output. The helper's output is read from the event loop, so
+  nothing blocks while it works.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <sys/types.h>
+#include <klib/klib.h>
+
+struct _Coprocess;
+typedef struct _Coprocess Coprocess;
+
+/** Called with each line (without the newline) that the helper writes,
+    or with NULL if the helper exits or closes its output. */
+typedef void (*CoprocessReplyFn) (const char *reply, void *user_data);
+
+BEGIN_DECLS
+
+/** Create a coprocess that will run the program at exe_path, with the
+    environment envp (NULL for our own). The program is not started
+    until the first request is sent. */
+extern Coprocess *coprocess_new (KEventLoop *loop, const char *exe_path, 
+                    char *const envp[], CoprocessReplyFn fn, 
+                    void *user_data);
+
+/** Close the helper's input, which should make it exit, and make sure
+    that it does. */
+extern void       coprocess_destroy (Coprocess *self);
+
+/** Send a request, which must not contain a newline, starting the 
+    helper first if it is not running (including if it has died since
+    the last request). Returns FALSE, and sets *error, if the helper 
+    can't be started or the request can't be written. */
+extern BOOL       coprocess_send (Coprocess *self, const char *request,
+                    char **error);
+
+/** Kill the helper and its process group, for example because it has 
+    not answered in time. The reply function is called with NULL when
+    its output closes. */
+extern void       coprocess_kill (Coprocess *self);
+
+/** To be called for every child reaped by the program. Returns TRUE if
+    the child was the helper. */
+extern BOOL       coprocess_child_exited (Coprocess *self, pid_t pid, 
+                    int status);
+
+END_DECLS
+
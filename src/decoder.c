@@ -0,0 +1,253 @@
+/*============================================================================
+
+  lbc
+
+  decoder.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <klib/klib.h>
+#include "decoder.h"
+
+#define KLOG_CLASS "lbc.decoder"
+
+/*============================================================================
+
+  Decoder
+
+  ==========================================================================*/
+struct _Decoder
+  {
+  int width;
+  int height;
+  // Buffers for decoded images, at the size of the screen
+  KPool *pool;
+  pthread_t thread;
+  // The lock protects everything below. The worker waits on 'wake'
+  //   when it has nothing to do
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  BOOL quit;
+  // The request the worker hasn't started on, if any, and its number
+  char *filename;
+  int seq;
+  // The result that hasn't been taken, if any: the number of its 
+  //   request, and its pixels, or the reason there are none
+  BOOL ready;
+  int ready_seq;
+  uint8_t *buffer;
+  char *error;
+  // An eventfd that is signalled when a result is ready
+  int fd;
+  };
+
+/*============================================================================
+
+  decoder_worker
+
+  ==========================================================================*/
+static void *decoder_worker (void *user_data)
+  {
+  KLOG_IN
+  // This is the image the user is waiting to see, so, unlike the other
+  //   workers, it runs at normal priority, even with 
+  //   --background-priority
+  Decoder *self = user_data;
+  pthread_mutex_lock (&self->lock);
+  while (!self->quit)
+    {
+    if (self->filename)
+      {
+      char *filename = self->filename;
+      int seq = self->seq;
+      self->filename = NULL;
+      pthread_mutex_unlock (&self->lock);
+
+      KTRACE_IN (filename)
+      char *error = NULL;
+      uint8_t *buffer = kpool_get (self->pool);
+      if (!jpegreader_file_to_buffer_resampled (filename, self->width, 
+           self->height, KRESAMPLE_FILL, KRESAMPLE_BILINEAR, buffer, 
+           &error))
+        {
+        kpool_put (self->pool, buffer);
+        buffer = NULL;
+        }
+      KTRACE_OUT
+      free (filename);
+
+      pthread_mutex_lock (&self->lock);
+      // A result that wasn't taken has been superseded
+      kpool_put (self->pool, self->buffer);
+      free (self->error);
+      self->ready = TRUE;
+      self->ready_seq = seq;
+      self->buffer = buffer;
+      self->error = error;
+      uint64_t one = 1;
+      write (self->fd, &one, sizeof (one));
+      }
+    else
+      pthread_cond_wait (&self->wake, &self->lock);
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return NULL;
+  }
+
+/*============================================================================
+
+  decoder_new
+
+  ==========================================================================*/
+Decoder *decoder_new (int width, int height, char **error)
+  {
+  KLOG_IN
+  Decoder *self = malloc (sizeof (Decoder));
+  self->width = width;
+  self->height = height;
+  self->pool = kpool_new ((size_t)width * height * 3, 1);
+  self->quit = FALSE;
+  self->filename = NULL;
+  self->seq = 0;
+  self->ready = FALSE;
+  self->ready_seq = 0;
+  self->buffer = NULL;
+  self->error = NULL;
+  self->fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->wake, NULL);
+  int err = self->fd < 0 ? errno 
+    : pthread_create (&self->thread, NULL, decoder_worker, self);
+  if (err != 0)
+    {
+    asprintf (error, "Can't start image decoding: %s", strerror (err));
+    pthread_cond_destroy (&self->wake);
+    pthread_mutex_destroy (&self->lock);
+    if (self->fd >= 0) close (self->fd);
+    kpool_destroy (self->pool);
+    free (self);
+    self = NULL;
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  decoder_destroy
+
+  ==========================================================================*/
+void decoder_destroy (Decoder *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->lock);
+    self->quit = TRUE;
+    pthread_cond_signal (&self->wake);
+    pthread_mutex_unlock (&self->lock);
+    pthread_join (self->thread, NULL);
+    pthread_cond_destroy (&self->wake);
+    pthread_mutex_destroy (&self->lock);
+    close (self->fd);
+    free (self->filename);
+    free (self->buffer);
+    free (self->error);
+    kpool_destroy (self->pool);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  decoder_get_fd
+
+  ==========================================================================*/
+int decoder_get_fd (const Decoder *self)
+  {
+  KLOG_IN
+  int ret = self->fd;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  decoder_request
+
+  ==========================================================================*/
+int decoder_request (Decoder *self, const char *filename)
+  {
+  KLOG_IN
+  pthread_mutex_lock (&self->lock);
+  free (self->filename);
+  self->filename = strdup (filename);
+  int ret = ++self->seq;
+  pthread_cond_signal (&self->wake);
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  decoder_take
+
+  ==========================================================================*/
+BOOL decoder_take (Decoder *self, int *seq, uint8_t **buffer, 
+    char **error)
+  {
+  KLOG_IN
+  pthread_mutex_lock (&self->lock);
+  BOOL ret = self->ready;
+  if (ret)
+    {
+    *seq = self->ready_seq;
+    *buffer = self->buffer;
+    *error = self->error;
+    self->ready = FALSE;
+    self->buffer = NULL;
+    self->error = NULL;
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  decoder_put
+
+  ==========================================================================*/
+void decoder_put (Decoder *self, uint8_t *buffer)
+  {
+  KLOG_IN
+  kpool_put (self->pool, buffer);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  decoder_trim
+
+  ==========================================================================*/
+size_t decoder_trim (Decoder *self)
+  {
+  KLOG_IN
+  size_t ret = kpool_trim (self->pool);
+  KLOG_OUT
+  return ret;
+  }
@@ -0,0 +1,58 @@
+/*============================================================================
+
+  lbc
+
+  decoder.h
+
+  Decoding of images for the methods that draw them in-process (x11 and
+  fb), on a worker thread, so that the event loop is never held up by
+  a large JPEG. The image is scaled to cover the screen. Only the
+  latest request matters: one that the worker hasn't started on yet is
+  replaced by the next.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/klib.h>
+
+struct _Decoder;
+typedef struct _Decoder Decoder;
+
+BEGIN_DECLS
+
+/** Start a worker that decodes images at width x height. Returns NULL,
+    and sets *error, if the thread can't be started. */
+extern Decoder *decoder_new (int width, int height, char **error);
+
+/** Stop the worker, waiting for any image it is decoding. */
+extern void     decoder_destroy (Decoder *self);
+
+/** An eventfd that is signalled when a result is ready to be taken. 
+    Its count must be read before decoder_take() is called. */
+extern int      decoder_get_fd (const Decoder *self);
+
+/** Ask for filename to be decoded. Returns a number that identifies
+    the request, which decoder_take() gives back with its result. */
+extern int      decoder_request (Decoder *self, const char *filename);
+
+/** Take the latest result, if there is one. *buffer is set to the
+    pixels, as packed 8-bit RGB, which must be given back with 
+    decoder_put(); or, if the image couldn't be read, to NULL, and 
+    *error is set, which the caller must free. Returns FALSE if there is
+    no result waiting. */
+extern BOOL     decoder_take (Decoder *self, int *seq, uint8_t **buffer,
+                  char **error);
+
+/** Return a buffer given by decoder_take(). */
+extern void     decoder_put (Decoder *self, uint8_t *buffer);
+
+/** Free the idle buffers, until they are next needed. Returns the
+    number of bytes freed. */
+extern size_t   decoder_trim (Decoder *self);
+
+END_DECLS
@@ -0,0 +1,310 @@
+/*============================================================================
+
+  lbc
+
+  framebuffer.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+#include <klib/klib.h>
+#include "framebuffer.h"
+
+#define KLOG_CLASS "lbc.framebuffer"
+
+/*============================================================================
+
+  Framebuffer
+
+  ==========================================================================*/
+struct _Framebuffer
+  {
+  int fd;
+  uint8_t *mem;
+  size_t mem_size;
+  // Offset of the visible area within the mapping (non-zero if the
+  //   driver is panned, or double-buffered)
+  size_t offset;
+  int width;
+  int height;
+  int bits_per_pixel;
+  int line_length;
+  struct fb_bitfield red;
+  struct fb_bitfield green;
+  struct fb_bitfield blue;
+  };
+
+/*============================================================================
+
+  framebuffer_set_bitfield
+
+  ==========================================================================*/
+static void framebuffer_set_bitfield (struct fb_bitfield *field,
+    int offset, int length)
+  {
+  KLOG_IN
+  memset (field, 0, sizeof (struct fb_bitfield));
+  field->offset = offset;
+  field->length = length;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  framebuffer_init_device
+
+  ==========================================================================*/
+static BOOL framebuffer_init_device (Framebuffer *self, const char *path,
+    char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  struct fb_var_screeninfo var;
+  struct fb_fix_screeninfo fix;
+  if (ioctl (self->fd, FBIOGET_VSCREENINFO, &var) == 0
+       && ioctl (self->fd, FBIOGET_FSCREENINFO, &fix) == 0)
+    {
+    if (fix.visual == FB_VISUAL_TRUECOLOR && var.bits_per_pixel % 8 == 0
+         && var.bits_per_pixel <= 32 && var.red.length <= 8 
+         && var.green.length <= 8 && var.blue.length <= 8)
+      {
+      self->width = var.xres;
+      self->height = var.yres;
+      self->bits_per_pixel = var.bits_per_pixel;
+      self->line_length = fix.line_length;
+      self->mem_size = fix.smem_len;
+      self->offset = (size_t)var.yoffset * fix.line_length
+        + (size_t)var.xoffset * var.bits_per_pixel / 8;
+      self->red = var.red;
+      self->green = var.green;
+      self->blue = var.blue;
+      ret = TRUE;
+      }
+    else
+      asprintf (error, "Framebuffer '%s' has an unsupported pixel format "
+        "(%d bpp)", path, var.bits_per_pixel);
+    }
+  else
+    asprintf (error, "Can't get screen information for '%s': %s", path,
+      strerror (errno));
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  framebuffer_init_file
+
+  ==========================================================================*/
+static BOOL framebuffer_init_file (Framebuffer *self, const char *path,
+    const char *geometry, off_t size, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  int width = 0, height = 0, bpp = 32;
+  if (geometry && sscanf (geometry, "%dx%dx%d", &width, &height, &bpp) >= 2
+       && width > 0 && height > 0)
+    {
+    if (bpp == 16 || bpp == 24 || bpp == 32)
+      {
+      self->width = width;
+      self->height = height;
+      self->bits_per_pixel = bpp;
+      self->line_length = width * bpp / 8;
+      self->mem_size = (size_t)self->line_length * height;
+      self->offset = 0;
+      if (bpp == 16)
+        {
+        framebuffer_set_bitfield (&self->red, 11, 5);
+        framebuffer_set_bitfield (&self->green, 5, 6);
+        framebuffer_set_bitfield (&self->blue, 0, 5);
+        }
+      else
+        {
+        framebuffer_set_bitfield (&self->red, 16, 8);
+        framebuffer_set_bitfield (&self->green, 8, 8);
+        framebuffer_set_bitfield (&self->blue, 0, 8);
+        }
+      if (size >= (off_t)self->mem_size
+           || ftruncate (self->fd, self->mem_size) == 0)
+        ret = TRUE;
+      else
+        asprintf (error, "Can't extend '%s': %s", path, strerror (errno));
+      }
+    else
+      asprintf (error, "Unsupported framebuffer depth %d", bpp);
+    }
+  else
+    asprintf (error, "'%s' is not a framebuffer device, so --fb-geometry "
+      "must be given as WIDTHxHEIGHT[xBPP]", path);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  framebuffer_new
+
+  ==========================================================================*/
+Framebuffer *framebuffer_new (const char *path, const char *geometry,
+    char **error)
+  {
+  KLOG_IN
+  Framebuffer *self = malloc (sizeof (Framebuffer));
+  memset (self, 0, sizeof (Framebuffer));
+  BOOL ok = FALSE;
+  // A regular file is created if necessary, but only if a geometry is
+  //   given -- we don't want to create /dev/fb0 by accident
+  self->fd = open (path, O_RDWR | O_CLOEXEC | (geometry ? O_CREAT : 0), 
+    0644);
+  struct stat sb;
+  if (self->fd >= 0 && fstat (self->fd, &sb) == 0)
+    {
+    if (S_ISCHR (sb.st_mode))
+      ok = framebuffer_init_device (self, path, error);
+    else
+      ok = framebuffer_init_file (self, path, geometry, sb.st_size, error);
+    }
+  else
+    asprintf (error, "Can't open '%s': %s", path, strerror (errno));
+
+  if (ok)
+    {
+    self->mem = mmap (NULL, self->mem_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, self->fd, 0);
+    if (self->mem == MAP_FAILED)
+      {
+      asprintf (error, "Can't map '%s': %s", path, strerror (errno));
+      self->mem = NULL;
+      ok = FALSE;
+      }
+    }
+
+  if (ok)
+    {
+    klog_debug (KLOG_CLASS, "Framebuffer %s is %dx%d, %d bpp, "
+      "RGB offsets %d/%d/%d", path, self->width, self->height,
+      self->bits_per_pixel, self->red.offset, self->green.offset,
+      self->blue.offset);
+    }
+  else
+    {
+    if (self->fd >= 0) close (self->fd);
+    free (self);
+    self = NULL;
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  framebuffer_destroy
+
+  ==========================================================================*/
+void framebuffer_destroy (Framebuffer *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    munmap (self->mem, self->mem_size);
+    close (self->fd);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  framebuffer_get_size
+
+  ==========================================================================*/
+void framebuffer_get_size (const Framebuffer *self, int *width, int *height)
+  {
+  KLOG_IN
+  *width = self->width;
+  *height = self->height;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  framebuffer_is_format
+
+  ==========================================================================*/
+static BOOL framebuffer_is_format (const Framebuffer *self, int bpp,
+    int roff, int rlen, int goff, int glen, int boff, int blen)
+  {
+  KLOG_IN
+  BOOL ret = self->bits_per_pixel == bpp
+    && self->red.offset == roff && self->red.length == rlen
+    && self->green.offset == goff && self->green.length == glen
+    && self->blue.offset == boff && self->blue.length == blen;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  framebuffer_convert_row_generic
+
+  For the pixel layouts that kpixconv doesn't handle (BGR ordering,
+  24-bit, RGB555, and so on). Framebuffer pixels are little-endian.
+
+  ==========================================================================*/
+static void framebuffer_convert_row_generic (const Framebuffer *self,
+    const uint8_t *rgb, uint8_t *dst)
+  {
+  KLOG_IN
+  int bytespp = self->bits_per_pixel / 8;
+  for (int x = 0; x < self->width; x++, rgb += 3)
+    {
+    uint32_t pixel =
+        ((uint32_t)(rgb[0] >> (8 - self->red.length)) << self->red.offset)
+      | ((uint32_t)(rgb[1] >> (8 - self->green.length)) << self->green.offset)
+      | ((uint32_t)(rgb[2] >> (8 - self->blue.length)) << self->blue.offset);
+    for (int i = 0; i < bytespp; i++)
+      *dst++ = (uint8_t)(pixel >> (8 * i));
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  framebuffer_set_rgb
+
+  ==========================================================================*/
+void framebuffer_set_rgb (Framebuffer *self, const uint8_t *rgb)
+  {
+  KLOG_IN
+  int width = self->width;
+  int height = self->height;
+  BOOL xrgb = framebuffer_is_format (self, 32, 16, 8, 8, 8, 0, 8);
+  BOOL rgb565 = framebuffer_is_format (self, 16, 11, 5, 5, 6, 0, 5);
+  for (int y = 0; y < height; y++)
+    {
+    const uint8_t *src = rgb + (size_t)y * width * 3;
+    uint8_t *dst = self->mem + self->offset
+      + (size_t)y * self->line_length;
+    if (xrgb)
+      kpixconv_rgb_to_xrgb8888 (src, (uint32_t *)dst, width);
+    else if (rgb565)
+      kpixconv_rgb_to_rgb565 (src, (uint16_t *)dst, width);
+    else
+      framebuffer_convert_row_generic (self, src, dst);
+    }
+  KLOG_OUT
+  }
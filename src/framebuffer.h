@@ -0,0 +1,52 @@
+/*============================================================================
+
+  lbc
+
+  framebuffer.h
+
+  Display of images directly on a Linux framebuffer device, for systems
+  that don't run X at all. A regular file can be used in place of the
+  device, for testing, in which case its geometry has to be given
+  explicitly.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/klib.h>
+
+#define FRAMEBUFFER_DEFAULT_DEVICE "/dev/fb0"
+
+struct _Framebuffer;
+typedef struct _Framebuffer Framebuffer;
+
+BEGIN_DECLS
+
+/** Open and map the framebuffer. For a device, the geometry and pixel
+    format come from the driver, and 'geometry' is ignored. For a 
+    regular file, 'geometry' must be "WIDTHxHEIGHT" or 
+    "WIDTHxHEIGHTxBPP", where BPP is 16 (RGB565), 24 or 32 (xRGB); the
+    file is extended if it is too small. Returns NULL, and sets *error,
+    on failure. The caller must free the error. */
+extern Framebuffer *framebuffer_new (const char *path, 
+                      const char *geometry, char **error);
+
+extern void         framebuffer_destroy (Framebuffer *self);
+
+/** Get the size of the screen, which is the size of image that 
+    framebuffer_set_rgb() takes. */
+extern void         framebuffer_get_size (const Framebuffer *self, 
+                      int *width, int *height);
+
+/** Draw an image of the screen's size, given as packed 8-bit RGB, 
+    converting it to the framebuffer's pixel format. The image is 
+    decoded and scaled elsewhere (see decoder.h). */
+extern void         framebuffer_set_rgb (Framebuffer *self, 
+                      const uint8_t *rgb);
+
+END_DECLS
+
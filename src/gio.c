@@ -0,0 +1,218 @@
+/*============================================================================
+
+  lbc
+
+  gio.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <sys/epoll.h>
+#include <klib/klib.h>
+#include "gio.h"
+
+#define KLOG_CLASS "lbc.gio"
+
+#define GIO_LIBRARY "libgio-2.0.so.0"
+
+// The most descriptors of the default main context that are watched. In
+//   practice there is only one: the context's own wake-up eventfd
+#define GIO_MAX_FDS 8
+
+static GioApi gio_api;
+static BOOL gio_tried = FALSE;
+static BOOL gio_loaded = FALSE;
+// The default main context's descriptors, while they are in an event
+//   loop
+static int gio_fds[GIO_MAX_FDS];
+static int gio_nfds = 0;
+
+/*============================================================================
+
+  gio_load_symbol
+
+  ==========================================================================*/
+static BOOL gio_load_symbol (void *handle, const char *name, void **fn)
+  {
+  KLOG_IN
+  *fn = dlsym (handle, name);
+  if (!*fn)
+    klog_warn (KLOG_CLASS, "Can't find %s in %s", name, GIO_LIBRARY);
+  KLOG_OUT
+  return *fn != NULL;
+  }
+
+#define GIO_LOAD(name) ok = ok && gio_load_symbol (handle, #name, \
+  (void **)&gio_api.name);
+
+/*============================================================================
+
+  gio_get_api
+
+  ==========================================================================*/
+const GioApi *gio_get_api (void)
+  {
+  KLOG_IN
+  if (!gio_tried)
+    {
+    gio_tried = TRUE;
+    void *handle = dlopen (GIO_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    if (handle)
+      {
+      BOOL ok = TRUE;
+      GIO_LOAD (g_main_context_iteration)
+      GIO_LOAD (g_main_context_pending)
+      GIO_LOAD (g_main_context_default)
+      GIO_LOAD (g_main_context_acquire)
+      GIO_LOAD (g_main_context_release)
+      GIO_LOAD (g_main_context_query)
+      GIO_LOAD (g_object_unref)
+      GIO_LOAD (g_type_name)
+      GIO_LOAD (g_settings_schema_source_get_default)
+      GIO_LOAD (g_settings_schema_source_lookup)
+      GIO_LOAD (g_settings_schema_has_key)
+      GIO_LOAD (g_settings_schema_unref)
+      GIO_LOAD (g_settings_new)
+      GIO_LOAD (g_settings_delay)
+      GIO_LOAD (g_settings_apply)
+      GIO_LOAD (g_settings_set_string)
+      GIO_LOAD (g_settings_sync)
+      GIO_LOAD (g_settings_backend_get_default)
+      GIO_LOAD (g_bus_get_sync)
+      GIO_LOAD (g_dbus_connection_set_exit_on_close)
+      GIO_LOAD (g_dbus_connection_call_sync)
+      GIO_LOAD (g_dbus_connection_call)
+      GIO_LOAD (g_dbus_connection_call_finish)
+      GIO_LOAD (g_dbus_connection_signal_subscribe)
+      GIO_LOAD (g_dbus_connection_signal_unsubscribe)
+      GIO_LOAD (g_variant_new)
+      GIO_LOAD (g_variant_get)
+      GIO_LOAD (g_variant_get_child)
+      GIO_LOAD (g_variant_iter_next)
+      GIO_LOAD (g_variant_iter_free)
+      GIO_LOAD (g_variant_unref)
+      GIO_LOAD (g_error_free)
+      GIO_LOAD (g_free)
+      // The library stays loaded for the life of the program, even if
+      //   it's unusable: GLib can't safely be unloaded
+      gio_loaded = ok;
+      }
+    else
+      klog_info (KLOG_CLASS, "GIO not available: %s", dlerror());
+    }
+  KLOG_OUT
+  return gio_loaded ? &gio_api : NULL;
+  }
+
+/*============================================================================
+
+  gio_drain_main_context
+
+  ==========================================================================*/
+void gio_drain_main_context (const GioApi *gio)
+  {
+  KLOG_IN
+  while (gio->g_main_context_pending (NULL))
+    gio->g_main_context_iteration (NULL, FALSE);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  gio_on_main_context
+
+  ==========================================================================*/
+static void gio_on_main_context (int fd, uint32_t events, void *user_data)
+  {
+  KLOG_IN
+  gio_drain_main_context (user_data);
+  (void)fd; (void)events;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  gio_add_to_loop
+
+  GLib only signals the context's wake-up descriptor, when a thread of
+  its own queues an event, if some other thread owns the context, so 
+  the context is acquired here and held until gio_remove_from_loop(). 
+  All the descriptors are taken, whatever their priority.
+
+  ==========================================================================*/
+BOOL gio_add_to_loop (const GioApi *gio, KEventLoop *loop)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  if (gio_nfds == 0 && gio->g_main_context_acquire (NULL))
+    {
+    GioPollFD fds[GIO_MAX_FDS];
+    int timeout;
+    // Unlike most of the context functions, this one doesn't take NULL 
+    //   for the default context
+    int n = gio->g_main_context_query (gio->g_main_context_default (), 
+      INT_MAX, &timeout, fds, GIO_MAX_FDS);
+    if (n > GIO_MAX_FDS) n = GIO_MAX_FDS;
+    for (int i = 0; i < n; i++)
+      {
+      uint32_t events = ((fds[i].events & GIO_IO_IN) ? EPOLLIN : 0)
+        | ((fds[i].events & GIO_IO_OUT) ? EPOLLOUT : 0);
+      keventloop_add (loop, fds[i].fd, events, gio_on_main_context, 
+        (void *)gio);
+      gio_fds[gio_nfds++] = fds[i].fd;
+      }
+    ret = gio_nfds > 0;
+    if (ret)
+      klog_debug (KLOG_CLASS, "Watching %d main context descriptor(s)", 
+        gio_nfds);
+    else
+      gio->g_main_context_release (NULL);
+    // Anything that was queued before now won't wake us
+    gio_drain_main_context (gio);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  gio_remove_from_loop
+
+  ==========================================================================*/
+void gio_remove_from_loop (const GioApi *gio, KEventLoop *loop)
+  {
+  KLOG_IN
+  if (gio_nfds > 0)
+    {
+    for (int i = 0; i < gio_nfds; i++)
+      keventloop_remove (loop, gio_fds[i]);
+    gio_nfds = 0;
+    gio->g_main_context_release (NULL);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  gio_get_type_name
+
+  A GObject instance starts with a pointer to its class structure, which
+  starts with the GType. This layout is part of the GLib ABI.
+
+  ==========================================================================*/
+const char *gio_get_type_name (const GioApi *gio, void *object)
+  {
+  KLOG_IN
+  size_t **instance = object;
+  const char *ret = gio->g_type_name (**instance);
+  KLOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,148 @@
+/*============================================================================
+
+  lbc
+
+  gio.h
+
+  Run-time access to GIO. LBC does not link against GLib: the in-process
+  desktop backends load libgio with dlopen() when they are first used,
+  so that the program still runs, using the process-based methods, on
+  systems without GLib. Only the handful of functions that the backends
+  need are declared here, with the GLib types reduced to their C
+  equivalents.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <klib/klib.h>
+
+/** The public part of a GError. */
+typedef struct _GioError GioError;
+struct _GioError
+  {
+  uint32_t domain;
+  int code;
+  char *message;
+  };
+
+/** GAsyncReadyCallback */
+typedef void (*GioAsyncReadyCallback) (void *source, void *result, 
+               void *user_data);
+
+/** GDBusSignalCallback */
+typedef void (*GioSignalCallback) (void *connection, const char *sender,
+               const char *object_path, const char *interface_name,
+               const char *signal_name, void *parameters, void *user_data);
+
+/** GPollFD, on Unix */
+typedef struct _GioPollFD GioPollFD;
+struct _GioPollFD
+  {
+  int fd;
+  unsigned short events;
+  unsigned short revents;
+  };
+
+#define GIO_BUS_TYPE_SESSION 2
+#define GIO_IO_IN 1
+#define GIO_IO_OUT 4
+
+typedef struct _GioApi GioApi;
+struct _GioApi
+  {
+  // GLib
+  int     (*g_main_context_iteration) (void *context, int may_block);
+  int     (*g_main_context_pending) (void *context);
+  void   *(*g_main_context_default) (void);
+  int     (*g_main_context_acquire) (void *context);
+  void    (*g_main_context_release) (void *context);
+  int     (*g_main_context_query) (void *context, int max_priority,
+             int *timeout, GioPollFD *fds, int n_fds);
+  // GObject
+  void    (*g_object_unref) (void *object);
+  const char *(*g_type_name) (size_t type);
+  // GSettings
+  void   *(*g_settings_schema_source_get_default) (void);
+  void   *(*g_settings_schema_source_lookup) (void *source,
+             const char *schema_id, int recursive);
+  int     (*g_settings_schema_has_key) (void *schema, const char *name);
+  void    (*g_settings_schema_unref) (void *schema);
+  void   *(*g_settings_new) (const char *schema_id);
+  void    (*g_settings_delay) (void *settings);
+  void    (*g_settings_apply) (void *settings);
+  int     (*g_settings_set_string) (void *settings, const char *key,
+             const char *value);
+  void    (*g_settings_sync) (void);
+  void   *(*g_settings_backend_get_default) (void);
+  // GDBus
+  void   *(*g_bus_get_sync) (int bus_type, void *cancellable, 
+             GioError **error);
+  void    (*g_dbus_connection_set_exit_on_close) (void *connection,
+             int exit_on_close);
+  void   *(*g_dbus_connection_call_sync) (void *connection, 
+             const char *bus_name, const char *object_path, 
+             const char *interface_name, const char *method_name,
+             void *parameters, const char *reply_type, int flags,
+             int timeout_msec, void *cancellable, GioError **error);
+  void    (*g_dbus_connection_call) (void *connection, 
+             const char *bus_name, const char *object_path, 
+             const char *interface_name, const char *method_name,
+             void *parameters, const char *reply_type, int flags,
+             int timeout_msec, void *cancellable, 
+             GioAsyncReadyCallback callback, void *user_data);
+  void   *(*g_dbus_connection_call_finish) (void *connection, void *result,
+             GioError **error);
+  unsigned (*g_dbus_connection_signal_subscribe) (void *connection,
+             const char *sender, const char *interface_name, 
+             const char *member, const char *object_path, const char *arg0,
+             int flags, GioSignalCallback callback, void *user_data,
+             void (*user_data_free_func) (void *));
+  void    (*g_dbus_connection_signal_unsubscribe) (void *connection,
+             unsigned subscription_id);
+  // GVariant
+  void   *(*g_variant_new) (const char *format, ...);
+  void    (*g_variant_get) (void *value, const char *format, ...);
+  void    (*g_variant_get_child) (void *value, size_t index, 
+             const char *format, ...);
+  int     (*g_variant_iter_next) (void *iter, const char *format, ...);
+  void    (*g_variant_iter_free) (void *iter);
+  void    (*g_variant_unref) (void *value);
+  void    (*g_error_free) (GioError *error);
+  void    (*g_free) (void *mem);
+  };
+
+BEGIN_DECLS
+
+/** Get the GIO functions, loading the library if necessary. Returns
+    NULL if the library, or any of the functions, can't be loaded. The
+    result is cached, so this is cheap to call repeatedly. */
+extern const GioApi *gio_get_api (void);
+
+/** Dispatch any events that GLib has queued on the default main context,
+    without blocking. LBC has no GLib main loop, so this has to be
+    called from time to time to stop them accumulating. */
+extern void gio_drain_main_context (const GioApi *gio);
+
+/** Dispatch the default main context from the event loop, whenever 
+    GLib has something for it -- the reply to an asynchronous D-Bus 
+    call, for example. This thread becomes the owner of the context, so
+    that GLib's own threads wake it up. Returns FALSE if the context's
+    descriptors can't be found. */
+extern BOOL gio_add_to_loop (const GioApi *gio, KEventLoop *loop);
+
+/** Stop dispatching the default main context from the event loop, and
+    give up ownership of it. */
+extern void gio_remove_from_loop (const GioApi *gio, KEventLoop *loop);
+
+/** Get the type name of a GObject instance, without using the GLib
+    macros. */
+extern const char *gio_get_type_name (const GioApi *gio, void *object);
+
+END_DECLS
+
@@ -0,0 +1,130 @@
+/*============================================================================
+
+  lbc
+
+  gnome_settings.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <klib/klib.h>
+#include "gio.h"
+#include "gnome_settings.h"
+
+#define KLOG_CLASS "lbc.gnome_settings"
+
+#define BACKGROUND_SCHEMA "org.gnome.desktop.background"
+
+/*============================================================================
+
+  GnomeSettings
+
+  ==========================================================================*/
+struct _GnomeSettings
+  {
+  const GioApi *gio;
+  void *settings;
+  BOOL has_dark;
+  };
+
+/*============================================================================
+
+  gnome_settings_new
+
+  ==========================================================================*/
+GnomeSettings *gnome_settings_new (void)
+  {
+  KLOG_IN
+  GnomeSettings *self = NULL;
+  // gsettings used to be run with GSETTINGS_BACKEND=dconf. Do the same,
+  //   unless the user has chosen a backend explicitly.
+  setenv ("GSETTINGS_BACKEND", "dconf", 0);
+  const GioApi *gio = gio_get_api ();
+  if (gio)
+    {
+    void *source = gio->g_settings_schema_source_get_default ();
+    void *schema = source ? gio->g_settings_schema_source_lookup
+      (source, BACKGROUND_SCHEMA, TRUE) : NULL;
+    void *backend = gio->g_settings_backend_get_default ();
+    const char *backend_type = gio_get_type_name (gio, backend);
+    klog_debug (KLOG_CLASS, "GSettings backend is %s", backend_type);
+    if (!schema)
+      {
+      klog_info (KLOG_CLASS, "Schema %s is not installed", BACKGROUND_SCHEMA);
+      }
+    else if (strstr (backend_type, "Memory") || strstr (backend_type, "Null"))
+      {
+      klog_info (KLOG_CLASS, "GSettings backend %s does not store settings",
+        backend_type);
+      }
+    else
+      {
+      self = malloc (sizeof (GnomeSettings));
+      self->gio = gio;
+      self->has_dark = gio->g_settings_schema_has_key (schema,
+        "picture-uri-dark");
+      self->settings = gio->g_settings_new (BACKGROUND_SCHEMA);
+      // Changes are batched until g_settings_apply(), so all the keys go
+      //   to dconf as a single change set
+      gio->g_settings_delay (self->settings);
+      }
+    gio->g_object_unref (backend);
+    if (schema) gio->g_settings_schema_unref (schema);
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  gnome_settings_destroy
+
+  ==========================================================================*/
+void gnome_settings_destroy (GnomeSettings *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    // Don't exit before the last change has been written
+    self->gio->g_settings_sync ();
+    self->gio->g_object_unref (self->settings);
+    gio_drain_main_context (self->gio);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  gnome_settings_set_background
+
+  ==========================================================================*/
+BOOL gnome_settings_set_background (GnomeSettings *self, const char *uri,
+    const char *options)
+  {
+  KLOG_IN
+  const GioApi *gio = self->gio;
+  BOOL ret = gio->g_settings_set_string (self->settings, "picture-uri", uri);
+  if (ret && self->has_dark)
+    ret = gio->g_settings_set_string (self->settings, "picture-uri-dark",
+      uri);
+  // picture-options is an enumeration, but GSettings stores those as
+  //   strings, and checks the value
+  if (ret && options)
+    ret = gio->g_settings_set_string (self->settings, "picture-options",
+      options);
+  // The backend writes the change set in the background; the change
+  //   notifications that GLib queues as a result are discarded from the
+  //   event loop (see gio_add_to_loop)
+  gio->g_settings_apply (self->settings);
+  if (!ret)
+    klog_error (KLOG_CLASS, "Can't set background to '%s'", uri);
+  KLOG_OUT
+  return ret;
+  }
+
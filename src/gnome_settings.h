@@ -0,0 +1,45 @@
+/*============================================================================
+
+  lbc
+
+  gnome_settings.h
+
+  In-process setting of the Gnome background, using GSettings (loaded
+  at run-time -- see gio.h) rather than the gsettings program.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+struct _GnomeSettings;
+typedef struct _GnomeSettings GnomeSettings;
+
+BEGIN_DECLS
+
+/** Connect to the settings backend. Returns NULL if GIO is not available,
+    the background schema is not installed, or the backend in use would
+    not actually store anything (GLib falls back to an in-memory backend
+    when dconf is not available). The caller should then use the
+    gsettings program instead.
+
+    This must not be called before the program detaches from the
+    terminal, because the dconf backend starts a thread. */
+extern GnomeSettings *gnome_settings_new (void);
+
+extern void           gnome_settings_destroy (GnomeSettings *self);
+
+/** Set the background image (light and, where the schema supports it,
+    dark) to the specified URI, and, unless it is NULL, the way it is
+    shown ("zoom" or "spanned", for example), as a single change. 
+    This doesn't wait for the change to be written. Returns FALSE if the
+    change was rejected. */
+extern BOOL           gnome_settings_set_background (GnomeSettings *self,
+                        const char *uri, const char *options);
+
+END_DECLS
+
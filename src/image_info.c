@@ -0,0 +1,113 @@
+/*============================================================================
+
+  lbc
+
+  image_info.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <klib/klib.h>
+#include "image_info.h"
+
+#define KLOG_CLASS "lbc.image_info"
+
+/*============================================================================
+
+  ImageInfo
+
+  ==========================================================================*/
+struct _ImageInfo
+  {
+  KPath *path;
+  int width;
+  int height;
+  const char *format;
+  };
+
+/*============================================================================
+
+  image_info_new
+
+  ==========================================================================*/
+ImageInfo *image_info_new (const KPath *path, int width, int height,
+    const char *format)
+  {
+  KLOG_IN
+  ImageInfo *self = malloc (sizeof (ImageInfo));
+  self->path = kpath_clone (path);
+  self->width = width;
+  self->height = height;
+  self->format = format;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  image_info_destroy
+
+  ==========================================================================*/
+void image_info_destroy (ImageInfo *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    kpath_destroy (self->path);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  image_info_get_path
+
+  ==========================================================================*/
+const KPath *image_info_get_path (const ImageInfo *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->path;
+  }
+
+/*============================================================================
+
+  image_info_get_width
+
+  ==========================================================================*/
+int image_info_get_width (const ImageInfo *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->width;
+  }
+
+/*============================================================================
+
+  image_info_get_height
+
+  ==========================================================================*/
+int image_info_get_height (const ImageInfo *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->height;
+  }
+
+/*============================================================================
+
+  image_info_get_format
+
+  ==========================================================================*/
+const char *image_info_get_format (const ImageInfo *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->format;
+  }
+
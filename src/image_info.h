@@ -0,0 +1,42 @@
+/*============================================================================
+
+  lbc
+
+  image_info.h
+
+  An entry in the list of images to show: the path, and whatever was 
+  learned about the image when the directories were scanned, so that
+  it doesn't have to be probed again later.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+struct _ImageInfo;
+typedef struct _ImageInfo ImageInfo;
+
+BEGIN_DECLS
+
+/** Create an entry. The path is copied. width and height are -1 if
+    the image was not probed. format is a static string -- "jpeg", 
+    "png", or "gif" -- and is not copied. */
+extern ImageInfo   *image_info_new (const KPath *path, int width, 
+                      int height, const char *format);
+
+extern void         image_info_destroy (ImageInfo *self);
+
+extern const KPath *image_info_get_path (const ImageInfo *self);
+
+extern int          image_info_get_width (const ImageInfo *self);
+
+extern int          image_info_get_height (const ImageInfo *self);
+
+extern const char  *image_info_get_format (const ImageInfo *self);
+
+END_DECLS
+
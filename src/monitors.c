@@ -0,0 +1,416 @@
+/*============================================================================
+
+  lbc
+
+  monitors.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <glob.h>
+#include <klib/klib.h>
+#include "monitors.h"
+
+#ifdef HAVE_X11
+#include <X11/Xlib.h>
+#endif
+
+#define KLOG_CLASS "lbc.monitors"
+
+#define MONITORS_DRM_GLOB "/sys/class/drm/card*-*"
+
+/*============================================================================
+
+  Monitor
+
+  ==========================================================================*/
+struct _Monitor
+  {
+  char *name;
+  BOOL primary;
+  int x;
+  int y;
+  int width;
+  int height;
+  };
+
+/*============================================================================
+
+  monitor_new
+
+  ==========================================================================*/
+static Monitor *monitor_new (const char *name, BOOL primary, int x, int y,
+    int width, int height)
+  {
+  KLOG_IN
+  Monitor *self = malloc (sizeof (Monitor));
+  self->name = strdup (name ? name : "");
+  self->primary = primary;
+  self->x = x;
+  self->y = y;
+  self->width = width;
+  self->height = height;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  monitor_destroy
+
+  ==========================================================================*/
+void monitor_destroy (Monitor *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    free (self->name);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  monitor_get_name
+
+  ==========================================================================*/
+const char *monitor_get_name (const Monitor *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->name;
+  }
+
+/*============================================================================
+
+  monitor_get_x
+
+  ==========================================================================*/
+int monitor_get_x (const Monitor *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->x;
+  }
+
+/*============================================================================
+
+  monitor_get_y
+
+  ==========================================================================*/
+int monitor_get_y (const Monitor *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->y;
+  }
+
+/*============================================================================
+
+  monitor_get_width
+
+  ==========================================================================*/
+int monitor_get_width (const Monitor *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->width;
+  }
+
+/*============================================================================
+
+  monitor_get_height
+
+  ==========================================================================*/
+int monitor_get_height (const Monitor *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->height;
+  }
+
+/*============================================================================
+
+  monitor_is_portrait
+
+  ==========================================================================*/
+BOOL monitor_is_portrait (const Monitor *self)
+  {
+  KLOG_IN
+  KLOG_OUT
+  return self->height > self->width;
+  }
+
+/*============================================================================
+
+  monitors_sort_fn
+
+  Primary first, then left to right, then top to bottom.
+
+  ==========================================================================*/
+static int monitors_sort_fn (const void *i1, const void *i2,
+    void *user_data)
+  {
+  const Monitor *m1 = *(const Monitor **)i1;
+  const Monitor *m2 = *(const Monitor **)i2;
+  (void)user_data;
+  if (m1->primary != m2->primary) return m1->primary ? -1 : 1;
+  if (m1->x != m2->x) return m1->x < m2->x ? -1 : 1;
+  if (m1->y != m2->y) return m1->y < m2->y ? -1 : 1;
+  return 0;
+  }
+
+#ifdef HAVE_X11
+
+// XRandR is loaded when it is needed, rather than linked, so that LBC
+//   doesn't need it to build or to run. XRRGetMonitors appeared in
+//   RandR 1.5; its result layout is part of the library's ABI
+#define MONITORS_XRANDR_LIBRARY "libXrandr.so.2"
+
+typedef struct _MonitorsXRRMonitorInfo
+  {
+  Atom name;
+  Bool primary;
+  Bool automatic;
+  int noutput;
+  int x;
+  int y;
+  int width;
+  int height;
+  int mwidth;
+  int mheight;
+  XID *outputs;
+  } MonitorsXRRMonitorInfo;
+
+typedef MonitorsXRRMonitorInfo *(*MonitorsGetMonitorsFn) (Display *display,
+  Window window, Bool get_active, int *nmonitors);
+typedef void (*MonitorsFreeMonitorsFn) (MonitorsXRRMonitorInfo *monitors);
+
+/*============================================================================
+
+  monitors_discover_xrandr
+
+  If the display is there but XRandR isn't, the whole screen is taken
+  to be one monitor.
+
+  ==========================================================================*/
+static BOOL monitors_discover_xrandr (KList *monitors)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  Display *display = XOpenDisplay (NULL);
+  if (display)
+    {
+    Window root = DefaultRootWindow (display);
+    void *handle = dlopen (MONITORS_XRANDR_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    if (handle)
+      {
+      MonitorsGetMonitorsFn get_monitors =
+        (MonitorsGetMonitorsFn) dlsym (handle, "XRRGetMonitors");
+      MonitorsFreeMonitorsFn free_monitors =
+        (MonitorsFreeMonitorsFn) dlsym (handle, "XRRFreeMonitors");
+      if (get_monitors && free_monitors)
+        {
+        int n = 0;
+        MonitorsXRRMonitorInfo *info = get_monitors (display, root, True, &n);
+        for (int i = 0; i < n; i++)
+          {
+          char *name = info[i].name != None ?
+            XGetAtomName (display, info[i].name) : NULL;
+          klist_append (monitors, monitor_new (name, info[i].primary,
+            info[i].x, info[i].y, info[i].width, info[i].height));
+          if (name) XFree (name);
+          }
+        if (info) free_monitors (info);
+        }
+      else
+        klog_info (KLOG_CLASS, "XRandR is too old to list monitors");
+      }
+    else
+      klog_info (KLOG_CLASS, "XRandR not available: %s", dlerror());
+
+    if (klist_length (monitors) == 0)
+      {
+      int screen = DefaultScreen (display);
+      klist_append (monitors, monitor_new (NULL, TRUE, 0, 0,
+        DisplayWidth (display, screen), DisplayHeight (display, screen)));
+      }
+
+    // The library has to stay loaded while the display is open,
+    //   because it hooks the display's close
+    XCloseDisplay (display);
+    if (handle) dlclose (handle);
+    ret = klist_length (monitors) > 0;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+#endif
+
+/*============================================================================
+
+  monitors_read_line
+
+  Read the first line of a small sysfs file. Returns NULL if it can't
+  be read. The caller must free the result.
+
+  ==========================================================================*/
+static char *monitors_read_line (const char *dir, const char *file)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  char *path;
+  asprintf (&path, "%s/%s", dir, file);
+  FILE *f = fopen (path, "r");
+  if (f)
+    {
+    size_t size = 0;
+    if (getline (&ret, &size, f) > 0)
+      ret[strcspn (ret, "\n")] = 0;
+    else
+      {
+      free (ret);
+      ret = NULL;
+      }
+    fclose (f);
+    }
+  free (path);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  monitors_discover_drm
+
+  Each connector appears as cardN-NAME. The kernel lists the modes of a
+  connected one with the preferred mode first. There are no positions,
+  so the monitors are taken to be side by side, in connector order.
+  Nor is there any rotation -- that is a property of the connector,
+  which can only be read through the DRM device -- so the size is the
+  panel's own, and a monitor rotated to portrait is reported as
+  landscape. README says to use an explicit --monitors for that.
+
+  ==========================================================================*/
+static BOOL monitors_discover_drm (KList *monitors)
+  {
+  KLOG_IN
+  glob_t g;
+  if (glob (MONITORS_DRM_GLOB, 0, NULL, &g) == 0)
+    {
+    int x = 0;
+    for (size_t i = 0; i < g.gl_pathc; i++)
+      {
+      const char *dir = g.gl_pathv[i];
+      char *status = monitors_read_line (dir, "status");
+      char *mode = monitors_read_line (dir, "modes");
+      int width, height;
+      if (status && strcmp (status, "connected") == 0 && mode
+           && sscanf (mode, "%dx%d", &width, &height) == 2
+           && width > 0 && height > 0)
+        {
+        const char *name = strrchr (dir, '/');
+        name = name ? name + 1 : dir;
+        const char *dash = strchr (name, '-');
+        if (dash) name = dash + 1;
+        klist_append (monitors, monitor_new (name, FALSE, x, 0,
+          width, height));
+        x += width;
+        }
+      if (mode) free (mode);
+      if (status) free (status);
+      }
+    }
+  globfree (&g);
+  BOOL ret = klist_length (monitors) > 0;
+  if (ret)
+    klog_info (KLOG_CLASS, "Monitors found in /sys/class/drm; "
+      "rotation is not known, so use --monitors for rotated ones");
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  monitors_discover
+
+  ==========================================================================*/
+KList *monitors_discover (void)
+  {
+  KLOG_IN
+  KList *ret = klist_new_empty ((KListFreeFn)monitor_destroy);
+  BOOL found = FALSE;
+#ifdef HAVE_X11
+  found = monitors_discover_xrandr (ret);
+#endif
+  if (!found) found = monitors_discover_drm (ret);
+  klist_sort (ret, monitors_sort_fn, NULL);
+
+  int l = klist_length (ret);
+  for (int i = 0; i < l; i++)
+    {
+    const Monitor *m = klist_get (ret, i);
+    klog_info (KLOG_CLASS, "Monitor %d%s%s: %dx%d+%d+%d", i,
+      m->name[0] ? " " : "", m->name, m->width, m->height, m->x, m->y);
+    }
+  if (!found)
+    klog_info (KLOG_CLASS, "Can't find any monitors");
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  monitors_parse
+
+  ==========================================================================*/
+KList *monitors_parse (const char *spec, char **error)
+  {
+  KLOG_IN
+  KList *ret = klist_new_empty ((KListFreeFn)monitor_destroy);
+  char *s = strdup (spec);
+  char *saveptr = NULL;
+  int next_x = 0;
+  for (char *tok = strtok_r (s, ",", &saveptr); tok && ret;
+       tok = strtok_r (NULL, ",", &saveptr))
+    {
+    int width, height, x, y, end = 0;
+    int n = sscanf (tok, "%dx%d%n+%d+%d%n", &width, &height, &end,
+      &x, &y, &end);
+    if ((n == 2 || n == 4) && tok[end] == 0 && width > 0 && height > 0)
+      {
+      if (n == 2)
+        {
+        x = next_x;
+        y = 0;
+        }
+      klist_append (ret, monitor_new (NULL, FALSE, x, y, width, height));
+      next_x = x + width;
+      }
+    else
+      {
+      asprintf (error, "Bad monitor '%s': expected WIDTHxHEIGHT[+X+Y]",
+        tok);
+      klist_destroy (ret);
+      ret = NULL;
+      }
+    }
+  if (ret && klist_length (ret) == 0)
+    {
+    asprintf (error, "No monitors in '%s'", spec);
+    klist_destroy (ret);
+    ret = NULL;
+    }
+  free (s);
+  KLOG_OUT
+  return ret;
+  }
+
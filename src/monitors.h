@@ -0,0 +1,58 @@
+/*============================================================================
+
+  lbc
+
+  monitors.h
+
+  Finding out what monitors are attached, and how big they are. The
+  X display is asked first, through XRandR, so that the positions, and
+  any rotation, are what the desktop uses. Without a display -- on the
+  console, with the fb method -- the connected outputs are read from
+  the DRM entries in /sys/class/drm, which give each output's preferred
+  mode but not its rotation.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+struct _Monitor;
+typedef struct _Monitor Monitor;
+
+BEGIN_DECLS
+
+/** Find the attached monitors. The result is a list of Monitor, with
+    the primary monitor (if the desktop says which one it is) first,
+    and the others from left to right. The list is empty if nothing
+    could be found. The caller must destroy the list. */
+extern KList      *monitors_discover (void);
+
+/** Parse a monitor list given by the user, as comma-separated
+    WIDTHxHEIGHT[+X+Y] entries. Monitors without a position are placed
+    to the right of the one before. Returns NULL, and sets *error, if
+    the list is malformed. The caller must destroy the list, or free
+    the error. */
+extern KList      *monitors_parse (const char *spec, char **error);
+
+extern void        monitor_destroy (Monitor *self);
+
+/** The output's name, such as "HDMI-1", or "" if it has none. */
+extern const char *monitor_get_name (const Monitor *self);
+
+extern int         monitor_get_x (const Monitor *self);
+
+extern int         monitor_get_y (const Monitor *self);
+
+extern int         monitor_get_width (const Monitor *self);
+
+extern int         monitor_get_height (const Monitor *self);
+
+/** TRUE if the monitor is taller than it is wide. */
+extern BOOL        monitor_is_portrait (const Monitor *self);
+
+END_DECLS
+
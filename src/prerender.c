@@ -0,0 +1,575 @@
+/*============================================================================
+
+  lbc
+
+  prerender.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <klib/klib.h>
+#include "scaled_cache.h"
+#include "span.h"
+#include "priority.h"
+#include "prerender.h"
+
+#define KLOG_CLASS "lbc.prerender"
+
+// The scaling modes, as recorded in the cache
+#define PRERENDER_MODE "fill"
+#define PRERENDER_SPAN_MODE "span"
+
+typedef enum
+  {
+  PRERENDER_PENDING = 0, PRERENDER_BUSY = 1, PRERENDER_READY = 2,
+  PRERENDER_FAILED = 3
+  } PrerenderState;
+
+/*============================================================================
+
+  PrerenderEntry
+
+  ==========================================================================*/
+typedef struct _PrerenderEntry
+  {
+  char *source;
+  char *target;
+  int width;
+  int height;
+  // For an image that spans several monitors, the image for each, and
+  //   the monitors; source is then the first of the images
+  int n;
+  char **sources;
+  const Monitor **monitors;
+  PrerenderState state;
+  } PrerenderEntry;
+
+/*============================================================================
+
+  Prerender
+
+  ==========================================================================*/
+struct _Prerender
+  {
+  ScaledCache *cache;
+  // Output buffers, so that the worker does no large allocations once
+  //   it is running
+  KPool *pool;
+  pthread_t thread;
+  // The lock protects everything below. The worker waits on 'wake'
+  //   when it has nothing to do
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  BOOL quit;
+  BOOL paused;
+  // The requested images, as PrerenderEntry, most urgent first
+  KList *entries;
+  // An eventfd that is signalled when a spanned image is ready
+  int span_fd;
+  };
+
+/*============================================================================
+
+  prerender_entry_destroy
+
+  ==========================================================================*/
+static void prerender_entry_destroy (PrerenderEntry *self)
+  {
+  KLOG_IN
+  free (self->source);
+  free (self->target);
+  if (self->sources) kspawn_free_argv (self->sources);
+  free (self->monitors);
+  free (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  prerender_entry_new
+
+  ==========================================================================*/
+static PrerenderEntry *prerender_entry_new (const char *source, 
+    const char *target, int width, int height, int n, 
+    const char *const *sources, const Monitor *const *monitors)
+  {
+  KLOG_IN
+  PrerenderEntry *self = malloc (sizeof (PrerenderEntry));
+  self->source = strdup (source);
+  self->target = strdup (target);
+  self->width = width;
+  self->height = height;
+  self->n = n;
+  self->sources = NULL;
+  self->monitors = NULL;
+  if (n > 0)
+    {
+    self->sources = malloc ((n + 1) * sizeof (char *));
+    self->monitors = malloc (n * sizeof (Monitor *));
+    for (int i = 0; i < n; i++)
+      {
+      self->sources[i] = strdup (sources[i]);
+      self->monitors[i] = monitors[i];
+      }
+    self->sources[n] = NULL;
+    }
+  self->state = PRERENDER_PENDING;
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  prerender_find
+
+  Find the entry for a cache file. Caller must hold the lock.
+
+  ==========================================================================*/
+static PrerenderEntry *prerender_find (const KList *entries,
+    const char *target)
+  {
+  KLOG_IN
+  PrerenderEntry *ret = NULL;
+  int l = klist_length (entries);
+  for (int i = 0; i < l && !ret; i++)
+    {
+    PrerenderEntry *entry = klist_get (entries, i);
+    if (strcmp (entry->target, target) == 0) ret = entry;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_find_source
+
+  Find the entry for a source file at a particular size. Caller must 
+  hold the lock.
+
+  ==========================================================================*/
+static PrerenderEntry *prerender_find_source (const KList *entries,
+    const char *source, int width, int height)
+  {
+  KLOG_IN
+  PrerenderEntry *ret = NULL;
+  int l = klist_length (entries);
+  for (int i = 0; i < l && !ret; i++)
+    {
+    PrerenderEntry *entry = klist_get (entries, i);
+    if (entry->n == 0 && entry->width == width && entry->height == height
+         && strcmp (entry->source, source) == 0) 
+      ret = entry;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_find_span
+
+  Find the entry for a spanned image. Caller must hold the lock.
+
+  ==========================================================================*/
+static PrerenderEntry *prerender_find_span (const KList *entries,
+    const char *const *sources, const Monitor *const *monitors, int n)
+  {
+  KLOG_IN
+  PrerenderEntry *ret = NULL;
+  int l = klist_length (entries);
+  for (int i = 0; i < l && !ret; i++)
+    {
+    PrerenderEntry *entry = klist_get (entries, i);
+    BOOL match = entry->n == n;
+    for (int j = 0; j < n && match; j++)
+      match = entry->monitors[j] == monitors[j] 
+        && strcmp (entry->sources[j], sources[j]) == 0;
+    if (match && n > 0) ret = entry;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_render
+
+  Decode and scale to cover the screen, in one pass, and store the
+  result in the cache.
+
+  ==========================================================================*/
+static BOOL prerender_render (const Prerender *self, const char *source,
+    const char *target, int width, int height, char **error)
+  {
+  KLOG_IN
+  KTRACE_IN (source)
+  BOOL ret = FALSE;
+  uint8_t *scaled = kpool_get (self->pool);
+  if (jpegreader_file_to_buffer_resampled (source, width, height, 
+       KRESAMPLE_FILL, KRESAMPLE_LANCZOS3, scaled, error))
+    {
+    ret = scaled_cache_store (self->cache, target, scaled, width,
+      height, error);
+    }
+  kpool_put (self->pool, scaled);
+  KTRACE_OUT
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_render_span
+
+  Put the images for the monitors together into one, and store it in 
+  the cache. The copies of the images that have been prepared at the
+  size of their monitors are much quicker to read, and are used if 
+  they are ready.
+
+  ==========================================================================*/
+static BOOL prerender_render_span (Prerender *self, 
+    const PrerenderEntry *job, char **error)
+  {
+  KLOG_IN
+  KTRACE_IN (job->source)
+  BOOL ret = FALSE;
+  char **sources = malloc ((job->n + 1) * sizeof (char *));
+  pthread_mutex_lock (&self->lock);
+  for (int i = 0; i < job->n; i++)
+    {
+    const PrerenderEntry *single = prerender_find_source (self->entries,
+      job->sources[i], monitor_get_width (job->monitors[i]),
+      monitor_get_height (job->monitors[i]));
+    sources[i] = strdup (single && single->state == PRERENDER_READY 
+      ? single->target : job->sources[i]);
+    }
+  sources[job->n] = NULL;
+  pthread_mutex_unlock (&self->lock);
+
+  uint8_t *rgb = span_compose ((const char *const *)sources, 
+    job->monitors, job->n, error);
+  if (rgb)
+    ret = scaled_cache_store (self->cache, job->target, rgb, job->width,
+      job->height, error);
+  free (rgb);
+  kspawn_free_argv (sources);
+  KTRACE_OUT
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_worker
+
+  ==========================================================================*/
+static void *prerender_worker (void *user_data)
+  {
+  KLOG_IN
+  priority_lower_thread ();
+  Prerender *self = user_data;
+  pthread_mutex_lock (&self->lock);
+  while (!self->quit)
+    {
+    PrerenderEntry *entry = NULL;
+    int l = self->paused ? 0 : klist_length (self->entries);
+    for (int i = 0; i < l && !entry; i++)
+      {
+      PrerenderEntry *e = klist_get (self->entries, i);
+      if (e->state == PRERENDER_PENDING) entry = e;
+      }
+
+    if (entry)
+      {
+      // The entry may be dropped by a new request while we work on it,
+      //   so work on a copy of it, and look it up again after. If it 
+      //   has been dropped, the file stays in the cache anyway
+      entry->state = PRERENDER_BUSY;
+      PrerenderEntry *job = prerender_entry_new (entry->source, 
+        entry->target, entry->width, entry->height, entry->n, 
+        (const char *const *)entry->sources, 
+        (const Monitor *const *)entry->monitors);
+      pthread_mutex_unlock (&self->lock);
+
+      int64_t start = ktrace_now ();
+      char *error = NULL;
+      BOOL ok;
+      if (job->n > 0)
+        ok = prerender_render_span (self, job, &error);
+      else
+        ok = prerender_render (self, job->source, job->target, job->width,
+          job->height, &error);
+      if (ok)
+        klog_debug (KLOG_CLASS, "Prepared '%s'%s at %dx%d in %lld msec", 
+          job->source, job->n > 0 ? " and others" : "", job->width, 
+          job->height, (long long)(ktrace_now () - start) / 1000);
+      else
+        {
+        klog_warn (KLOG_CLASS, "Can't prepare '%s'%s: %s", job->source,
+          job->n > 0 ? " and others" : "", 
+          error ? error : "unknown error");
+        free (error);
+        }
+
+      pthread_mutex_lock (&self->lock);
+      entry = prerender_find (self->entries, job->target);
+      if (entry)
+        entry->state = ok ? PRERENDER_READY : PRERENDER_FAILED;
+      if (ok && job->n > 0)
+        {
+        uint64_t one = 1;
+        write (self->span_fd, &one, sizeof (one));
+        }
+      prerender_entry_destroy (job);
+      }
+    else
+      {
+      // Nothing is using the buffer now
+      if (self->paused) kpool_trim (self->pool);
+      pthread_cond_wait (&self->wake, &self->lock);
+      }
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return NULL;
+  }
+
+/*============================================================================
+
+  prerender_new
+
+  ==========================================================================*/
+Prerender *prerender_new (const char *dir, int64_t max_bytes, 
+    int max_width, int max_height, char **error)
+  {
+  KLOG_IN
+  Prerender *self = NULL;
+  ScaledCache *cache = scaled_cache_new (dir, max_bytes, error);
+  if (cache)
+    {
+    self = malloc (sizeof (Prerender));
+    self->cache = cache;
+    self->pool = kpool_new ((size_t)max_width * max_height * 3, 1);
+    self->quit = FALSE;
+    self->paused = FALSE;
+    self->entries = klist_new_empty ((KListFreeFn)prerender_entry_destroy);
+    self->span_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_init (&self->lock, NULL);
+    pthread_cond_init (&self->wake, NULL);
+    int err = self->span_fd < 0 ? errno 
+      : pthread_create (&self->thread, NULL, prerender_worker, self);
+    if (err == 0)
+      klog_info (KLOG_CLASS, "Preparing images in %s", dir);
+    else
+      {
+      asprintf (error, "Can't start image preparation: %s",
+        strerror (err));
+      pthread_cond_destroy (&self->wake);
+      pthread_mutex_destroy (&self->lock);
+      if (self->span_fd >= 0) close (self->span_fd);
+      klist_destroy (self->entries);
+      kpool_destroy (self->pool);
+      scaled_cache_destroy (self->cache);
+      free (self);
+      self = NULL;
+      }
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  prerender_destroy
+
+  ==========================================================================*/
+void prerender_destroy (Prerender *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->lock);
+    self->quit = TRUE;
+    pthread_cond_signal (&self->wake);
+    pthread_mutex_unlock (&self->lock);
+    pthread_join (self->thread, NULL);
+    pthread_cond_destroy (&self->wake);
+    pthread_mutex_destroy (&self->lock);
+    close (self->span_fd);
+    klist_destroy (self->entries);
+    kpool_destroy (self->pool);
+    scaled_cache_destroy (self->cache);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  prerender_get_target
+
+  Get the cache file for a request, and the size of the image in it,
+  which, for a spanned image, is the size of the desktop. The caller
+  must free the result.
+
+  ==========================================================================*/
+static char *prerender_get_target (const Prerender *self, 
+    const PrerenderRequest *r, int *width, int *height)
+  {
+  KLOG_IN
+  char *ret;
+  if (r->n > 0)
+    {
+    char *layout = span_get_layout (r->monitors, r->n, width, height);
+    ret = scaled_cache_get_multi_path (self->cache, r->filenames, r->n, 
+      layout, *width, *height, PRERENDER_SPAN_MODE);
+    free (layout);
+    }
+  else
+    ret = scaled_cache_get_path (self->cache, r->filename, *width, 
+      *height, PRERENDER_MODE);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_request
+
+  An entry that is still wanted keeps its state, so an image that is
+  ready, or being worked on, isn't rendered again. A new entry that is
+  already in the cache -- from an earlier request, or an earlier run,
+  or another instance -- is ready straight away.
+
+  ==========================================================================*/
+void prerender_request (Prerender *self, const PrerenderRequest *requests,
+    int n)
+  {
+  KLOG_IN
+  KList *entries = klist_new_empty ((KListFreeFn)prerender_entry_destroy);
+  pthread_mutex_lock (&self->lock);
+  for (int i = 0; i < n; i++)
+    {
+    const PrerenderRequest *r = &requests[i];
+    const char *source = r->n > 0 ? r->filenames[0] : r->filename;
+    int width = r->width, height = r->height;
+    char *target = prerender_get_target (self, r, &width, &height);
+    if (!target || prerender_find (entries, target))
+      {
+      free (target);
+      continue;
+      }
+    PrerenderEntry *entry = prerender_entry_new (source, target, width,
+      height, r->n, r->filenames, r->monitors);
+    free (target);
+    const PrerenderEntry *old = prerender_find (self->entries, 
+      entry->target);
+    if (old)
+      entry->state = old->state;
+    else if (scaled_cache_lookup (self->cache, entry->target))
+      entry->state = PRERENDER_READY;
+    else
+      entry->state = PRERENDER_PENDING;
+    klist_append (entries, entry);
+    }
+  klist_destroy (self->entries);
+  self->entries = entries;
+  pthread_cond_signal (&self->wake);
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  prerender_set_paused
+
+  ==========================================================================*/
+void prerender_set_paused (Prerender *self, BOOL paused)
+  {
+  KLOG_IN
+  pthread_mutex_lock (&self->lock);
+  self->paused = paused;
+  pthread_cond_signal (&self->wake);
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  prerender_get
+
+  The cache file may have been evicted by another instance since it was
+  made, in which case it is made again.
+
+  ==========================================================================*/
+char *prerender_get (Prerender *self, const char *filename, int width,
+    int height)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  pthread_mutex_lock (&self->lock);
+  PrerenderEntry *entry = prerender_find_source (self->entries, filename,
+    width, height);
+  if (entry && entry->state == PRERENDER_READY)
+    {
+    if (scaled_cache_lookup (self->cache, entry->target))
+      ret = strdup (entry->target);
+    else
+      {
+      entry->state = PRERENDER_PENDING;
+      pthread_cond_signal (&self->wake);
+      }
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_get_span
+
+  ==========================================================================*/
+char *prerender_get_span (Prerender *self, const char *const *filenames,
+    const Monitor *const *monitors, int n)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  pthread_mutex_lock (&self->lock);
+  PrerenderEntry *entry = prerender_find_span (self->entries, filenames,
+    monitors, n);
+  if (entry && entry->state == PRERENDER_READY)
+    {
+    if (scaled_cache_lookup (self->cache, entry->target))
+      ret = strdup (entry->target);
+    else
+      {
+      entry->state = PRERENDER_PENDING;
+      pthread_cond_signal (&self->wake);
+      }
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  prerender_get_span_fd
+
+  ==========================================================================*/
+int prerender_get_span_fd (const Prerender *self)
+  {
+  return self->span_fd;
+  }
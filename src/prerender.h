@@ -0,0 +1,86 @@
+/*============================================================================
+
+  lbc
+
+  prerender.h
+
+  Background preparation of upcoming images. A worker thread decodes
+  each image that is due to be shown soon, scales it to the screen
+  size, and stores it in the scaled image cache. The desktop can then
+  be given the prepared file, which is much cheaper for it to load than
+  a multi-megapixel original. The same worker puts together the images
+  that span several monitors, with --dual, so that doing so never holds
+  up the main loop.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+#include "monitors.h"
+
+struct _Prerender;
+typedef struct _Prerender Prerender;
+
+/** An image to prepare, and the size to prepare it at. Or, if n is
+    more than zero, an image that spans n monitors, with filenames[i] 
+    on monitors[i], for a desktop that can only show one image; the 
+    size is then that of the desktop, and filename is not used. The 
+    monitors must outlive the request. */
+typedef struct _PrerenderRequest
+  {
+  const char *filename;
+  int width;
+  int height;
+  int n;
+  const char *const *filenames;
+  const Monitor *const *monitors;
+  } PrerenderRequest;
+
+BEGIN_DECLS
+
+/** Start a worker that renders images into the cache in dir, which is
+    limited to max_bytes. No image will be asked for with more pixels 
+    than max_width x max_height. Returns NULL, and sets *error, if the 
+    cache or the thread can't be created. */
+extern Prerender *prerender_new (const char *dir, int64_t max_bytes,
+                    int max_width, int max_height, char **error);
+
+/** Stop the worker, waiting for any image it is rendering. */
+extern void       prerender_destroy (Prerender *self);
+
+/** Set the images that should be prepared, most urgent first. An image
+    may be asked for at more than one size. Images that were in the 
+    previous set but not this one are no longer needed, but stay in the
+    cache until they are evicted. Returns immediately; the work is done
+    in the background. */
+extern void       prerender_request (Prerender *self,
+                    const PrerenderRequest *requests, int n);
+
+/** Stop starting work on new images, while memory is short, and free
+    the output buffer once the image being prepared, if any, is done. 
+    Requests are still taken, and are worked on when the preparation
+    is resumed. */
+extern void       prerender_set_paused (Prerender *self, BOOL paused);
+
+/** Get the file prepared from filename at width x height, or NULL if
+    it isn't ready (or wasn't requested). The caller must free the 
+    result. */
+extern char      *prerender_get (Prerender *self, const char *filename,
+                    int width, int height);
+
+/** As prerender_get, for the image that spans n monitors, with
+    filenames[i] on monitors[i]. */
+extern char      *prerender_get_span (Prerender *self, 
+                    const char *const *filenames, 
+                    const Monitor *const *monitors, int n);
+
+/** A descriptor that becomes readable when a spanned image is ready.
+    The reader must read the 8-byte eventfd count from it. */
+extern int        prerender_get_span_fd (const Prerender *self);
+
+END_DECLS
+
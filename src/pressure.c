@@ -0,0 +1,59 @@
+/*============================================================================
+
+  lbc
+
+  pressure.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <klib/klib.h>
+#include "pressure.h"
+
+#define KLOG_CLASS "lbc.pressure"
+
+#define PRESSURE_MEMORY_FILE "/proc/pressure/memory"
+
+/*============================================================================
+
+  pressure_open_trigger
+
+  The trigger is written as "some <stall> <window>", both in 
+  microseconds, including the terminating null, as the kernel expects.
+
+  ==========================================================================*/
+int pressure_open_trigger (int stall_msec, int window_msec, char **error)
+  {
+  KLOG_IN
+  int ret = open (PRESSURE_MEMORY_FILE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (ret >= 0)
+    {
+    char *trigger;
+    int len = asprintf (&trigger, "some %lld %lld", 
+      (long long)stall_msec * 1000, (long long)window_msec * 1000);
+    if (write (ret, trigger, len + 1) < 0)
+      {
+      asprintf (error, "Can't set trigger '%s' on %s: %s", trigger, 
+        PRESSURE_MEMORY_FILE, strerror (errno));
+      close (ret);
+      ret = -1;
+      }
+    else
+      klog_debug (KLOG_CLASS, "Set trigger '%s'", trigger);
+    free (trigger);
+    }
+  else
+    asprintf (error, "Can't open %s: %s", PRESSURE_MEMORY_FILE, 
+      strerror (errno));
+  KLOG_OUT
+  return ret;
+  }
+
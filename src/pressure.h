@@ -0,0 +1,36 @@
+/*============================================================================
+
+  lbc
+
+  pressure.h
+
+  Notification of memory pressure, through the kernel's pressure stall
+  information (PSI). A trigger is registered by writing to 
+  /proc/pressure/memory; the file descriptor then polls as ready, with
+  EPOLLPRI, whenever tasks have been stalled waiting for memory for
+  longer than the threshold within the window. If the trigger goes 
+  away -- because the cgroup it was made in is removed, for example --
+  the descriptor polls with EPOLLERR.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+BEGIN_DECLS
+
+/** Open a trigger that fires when some task has been stalled for
+    stall_msec within any window of window_msec. Unprivileged processes
+    may only use windows that are a whole number of seconds, two or
+    more. Returns the file descriptor, to be watched for EPOLLPRI and
+    closed by the caller; or -1, setting *error, if the kernel doesn't
+    support PSI, or won't accept the trigger. */
+extern int pressure_open_trigger (int stall_msec, int window_msec,
+             char **error);
+
+END_DECLS
+
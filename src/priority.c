@@ -0,0 +1,117 @@
+/*============================================================================
+
+  lbc
+
+  priority.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <klib/klib.h>
+#include "priority.h"
+
+#define KLOG_CLASS "lbc.priority"
+
+// From linux/ioprio.h, which not every system has, and which glibc
+//   doesn't wrap. IOPRIO_WHO_PROCESS takes a thread ID, and affects only
+//   that thread
+#define PRIORITY_IOPRIO_WHO_PROCESS 1
+#define PRIORITY_IOPRIO_CLASS_IDLE 3
+#define PRIORITY_IOPRIO_CLASS_SHIFT 13
+
+// The lowest nice value. It only matters if SCHED_IDLE can't be set
+#define PRIORITY_NICE 19
+
+static BOOL priority_background = FALSE;
+
+/*============================================================================
+
+  priority_set_io_class
+
+  ==========================================================================*/
+static BOOL priority_set_io_class (int io_class)
+  {
+#ifdef SYS_ioprio_set
+  return syscall (SYS_ioprio_set, PRIORITY_IOPRIO_WHO_PROCESS, 
+    (int)syscall (SYS_gettid), 
+    io_class << PRIORITY_IOPRIO_CLASS_SHIFT) == 0;
+#else
+  return TRUE;
+#endif
+  }
+
+/*============================================================================
+
+  priority_lower_child
+
+  Run in each child that kspawn starts, between fork() and exec(), so
+  it can only make system calls, and can't report failure.
+
+  ==========================================================================*/
+static void priority_lower_child (void)
+  {
+  priority_set_io_class (PRIORITY_IOPRIO_CLASS_IDLE);
+  struct sched_param param;
+  memset (&param, 0, sizeof (param));
+  sched_setscheduler (0, SCHED_IDLE, &param);
+  setpriority (PRIO_PROCESS, 0, PRIORITY_NICE);
+  }
+
+/*============================================================================
+
+  priority_set_background
+
+  ==========================================================================*/
+void priority_set_background (BOOL background)
+  {
+  KLOG_IN
+  priority_background = background;
+  // Programs are started by the event loop thread, which keeps its 
+  //   normal priority, so the children have to lower their own
+  kspawn_set_child_setup (background ? priority_lower_child : NULL);
+  if (background)
+    klog_info (KLOG_CLASS, "Running workers at background priority");
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  priority_lower_thread
+
+  sched_setscheduler() and setpriority() with a thread ID both act on
+  only one thread, on Linux, despite what POSIX says.
+
+  ==========================================================================*/
+void priority_lower_thread (void)
+  {
+  KLOG_IN
+  if (priority_background)
+    {
+    if (!priority_set_io_class (PRIORITY_IOPRIO_CLASS_IDLE))
+      klog_warn (KLOG_CLASS, "Can't set idle I/O class: %s", 
+        strerror (errno));
+
+    struct sched_param param;
+    memset (&param, 0, sizeof (param));
+    if (sched_setscheduler (0, SCHED_IDLE, &param) != 0)
+      klog_warn (KLOG_CLASS, "Can't set idle scheduling class: %s", 
+        strerror (errno));
+
+    if (setpriority (PRIO_PROCESS, (id_t)syscall (SYS_gettid), 
+         PRIORITY_NICE) != 0)
+      klog_warn (KLOG_CLASS, "Can't set nice %d: %s", PRIORITY_NICE,
+        strerror (errno));
+    }
+  KLOG_OUT
+  }
+
@@ -0,0 +1,38 @@
+/*============================================================================
+
+  lbc
+
+  priority.h
+
+  Running in the background, for --background-priority. The threads
+  that scan, prepare and stage images, and the programs that the change
+  methods run, are put into the idle I/O class, and the idle CPU 
+  scheduling class, so that their disk reads and their decoding only
+  happen when nothing else wants the disk or the CPU. The thread that
+  runs the event loop is left alone, so that --next, signals and 
+  timers are still handled promptly, however busy the system is.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+BEGIN_DECLS
+
+/** Turn background priority on, for the threads that call
+    priority_lower_thread() and the programs that kspawn starts, from
+    now on. The calling thread is not changed. */
+extern void priority_set_background (BOOL background);
+
+/** Lower the priority of the calling thread as far as it will go, if
+    background priority is on. This can't be undone without privileges,
+    so it is for threads that do nothing else. Any setting that can't 
+    be made is logged; the others are still made. */
+extern void priority_lower_thread (void);
+
+END_DECLS
+
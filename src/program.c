@@ -8,6 +8,7 @@
   GNU Public Licence, v3.0
 
   ==========================================================================*/
+#define _GNU_SOURCE
 #include <stdio.h> 
 #include <time.h> 
 #include <stdlib.h> 
@@ -18,10 +19,16 @@
 #include <assert.h> 
 #include <sys/file.h> 
 #include <signal.h> 
+#include <pthread.h>
 #include <klib/klib.h> 
 #include "program_context.h" 
 #include "program.h" 
 #include "changer.h" 
+#include "image_info.h"
+#include "scaled_cache.h"
+#include "monitors.h"
+#include "priority.h"
+#include "rate_limit.h"
 
 /*============================================================================
   
@@ -29,9 +36,21 @@
 
   ==========================================================================*/
 int lock_fd = -1; // Handle of lock file
+// Header probes made during the scan, the bytes they read, and the 
+//   time spent waiting for --probe-rate
+static int probe_count = 0;
+static int64_t probe_bytes = 0;
+static int64_t probe_wait = 0;
+static RateLimit *probe_limit = NULL;
 
 #define KLOG_CLASS "lbc.program"
 
+KPROBE_DEFINE (lbc, entry_visit)
+KPROBE_DEFINE (lbc, dir_open)
+KPROBE_DEFINE (lbc, dir_read)
+KPROBE_DEFINE (lbc, filter_accept)
+KPROBE_DEFINE (lbc, filter_reject)
+
 #define HAS_OPTION(x) program_context_get_boolean(context,x,FALSE)
 #define GET_INTEGER(x,y) program_context_get_integer(context,x,y)
 #define GET(x) program_context_get(context,x)
@@ -54,9 +73,12 @@ static BOOL program_build_file_list (const ProgramContext *context,
          KList *file_list)
   {
   KLOG_IN
+  KTRACE_IN (NULL)
   int ret = TRUE;
   int max_files = GET_INTEGER ("max-files", DEFAULT_MAX_FILES);
   klog_set_handler (program_log_handler);
+  int probe_rate = GET_INTEGER ("probe-rate", 0);
+  if (probe_rate > 0) probe_limit = rate_limit_new (probe_rate, probe_rate);
 
   // First check specific entries in --dirs
   char *c_dirs = GET ("dirs");
@@ -101,9 +123,73 @@ static BOOL program_build_file_list (const ProgramContext *context,
     klog_debug (KLOG_CLASS, 
       "Not checking command-line paths because file list is already full");
 
+  if (probe_count > 0)
+    klog_info (KLOG_CLASS, "Read %lld bytes to probe %d JPEG file(s), "
+      "%lld per file", (long long)probe_bytes, probe_count, 
+      (long long)(probe_bytes / probe_count));
+  if (probe_limit)
+    {
+    klog_info (KLOG_CLASS, "Waited %lld msec for --probe-rate", 
+      (long long)probe_wait / 1000);
+    rate_limit_destroy (probe_limit);
+    probe_limit = NULL;
+    }
+
   srand (time (NULL));
+  ktrace_begin (KLOG_CLASS, "shuffle", NULL);
   klist_shuffle (file_list); // TODO
+  ktrace_end (KLOG_CLASS, "shuffle");
 
+  KTRACE_OUT
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+  
+  program_scan
+
+  Build the file list on a thread of its own, for --background-priority.
+  Its priority can't be raised again afterwards, and the thread that 
+  starts it goes on to run the event loop.
+
+  ==========================================================================*/
+typedef struct _ProgramScan
+  {
+  const ProgramContext *context;
+  KList *file_list;
+  BOOL ret;
+  } ProgramScan;
+
+static void *program_scan_thread (void *user_data)
+  {
+  KLOG_IN
+  ProgramScan *scan = user_data;
+  priority_lower_thread ();
+  scan->ret = program_build_file_list (scan->context, scan->file_list);
+  KLOG_OUT
+  return NULL;
+  }
+
+static BOOL program_scan (const ProgramContext *context, KList *file_list)
+  {
+  KLOG_IN
+  BOOL ret;
+  ProgramScan scan = { context, file_list, FALSE };
+  pthread_t thread;
+  int err = HAS_OPTION ("background-priority") 
+    ? pthread_create (&thread, NULL, program_scan_thread, &scan) : -1;
+  if (err == 0)
+    {
+    pthread_join (thread, NULL);
+    ret = scan.ret;
+    }
+  else
+    {
+    if (err > 0)
+      klog_warn (KLOG_CLASS, "Can't start scan thread: %s", strerror (err));
+    ret = program_build_file_list (context, file_list);
+    }
   KLOG_OUT
   return ret;
   }
@@ -114,11 +200,16 @@ static BOOL program_build_file_list (const ProgramContext *context,
 
   ==========================================================================*/
 static BOOL program_consider_file (const ProgramContext *context, 
-        const KPath *path)
+        const KPath *path, const char *filename, int *out_width,
+        int *out_height, const char **format)
   {
   KLOG_IN
   BOOL ret = FALSE;
-  char *filename = (char *)kstring_to_utf8 ((KString *)path);
+  int width = -1;
+  int height = -1;
+  *format = NULL;
+  KTRACE_IN (filename)
+  const char *reason = NULL;
   if (strstr (filename, "thumbnail") == NULL)
     {
     static UTF32 jpg[] = {'j','p','g',0};
@@ -136,9 +227,6 @@ static BOOL program_consider_file (const ProgramContext *context,
 
     klog_debug (KLOG_CLASS, "Considering file %s", filename); 
 
-    int width = -1;
-    int height = -1;
-
     BOOL is_image = FALSE;
 
     KString *ext = kpath_get_ext (path);
@@ -146,10 +234,28 @@ static BOOL program_consider_file (const ProgramContext *context,
 	|| kstring_strcmp_utf32 (kstring_cstr(ext), JPG) == 0)
       {
       int components;
-      if (jpegreader_get_image_size (filename, &height,
-	   &width, &components))
+      int64_t bytes_read;
+      if (probe_limit) probe_wait += rate_limit_take (probe_limit);
+      int64_t start = ktrace_now ();
+      BOOL probed = jpegreader_probe (filename, &height, &width, 
+           &components, &bytes_read);
+      probe_count++;
+      probe_bytes += bytes_read;
+      klog_debug (KLOG_CLASS, "Read %lld bytes to probe %s", 
+        (long long)bytes_read, filename);
+      if (ktrace_enabled ())
+        {
+        char *detail;
+        asprintf (&detail, "%s (%lld bytes)", filename, 
+          (long long)bytes_read);
+        ktrace_complete (KLOG_CLASS, "probe", start, ktrace_now () - start,
+          detail);
+        free (detail);
+        }
+      if (probed)
 	 {
 	 is_image = TRUE;
+	 *format = "jpeg";
 	 klog_debug (KLOG_CLASS, "width=%d", width);
 	 klog_debug (KLOG_CLASS, "height=%d", height);
 	 }
@@ -158,16 +264,19 @@ static BOOL program_consider_file (const ProgramContext *context,
 	|| kstring_strcmp_utf32 (kstring_cstr(ext), JPEG) == 0)
       {
       is_image = TRUE;
+      *format = "jpeg";
       }
     else if (kstring_strcmp_utf32 (kstring_cstr(ext), png) == 0
 	|| kstring_strcmp_utf32 (kstring_cstr(ext), PNG) == 0)
       {
       is_image = TRUE;
+      *format = "png";
       }
     else if (kstring_strcmp_utf32 (kstring_cstr(ext), gif) == 0
 	|| kstring_strcmp_utf32 (kstring_cstr(ext), GIF) == 0)
       {
       is_image = TRUE;
+      *format = "gif";
       }
 
     if (is_image)
@@ -181,34 +290,53 @@ static BOOL program_consider_file (const ProgramContext *context,
 	  if ((aspect_mode == ASPECT_LANDSCAPE && aspect >= 1.5)
 	       || (aspect_mode == ASPECT_PORTRAIT && aspect < 0.66)
 	       || (aspect_mode == ASPECT_ANY))
-	  //if ((aspect_mode == ASPECT_LANDSCAPE && aspect >= 1)
-	  //     || (aspect_mode == ASPECT_PORTRAIT && aspect < 1)
-	   //    || (aspect_mode == ASPECT_ANY))
 	    {
 	    ret = TRUE;
 	    }
 	  else
 	    {
 	    klog_debug (KLOG_CLASS, "Image %s has wrong aspect ratio", filename); 
+	    reason = "wrong aspect ratio";
 	    }
 	  }
 	else
 	  {
 	  klog_debug (KLOG_CLASS, "Image %s is not tall enough", filename); 
+	  reason = "not tall enough";
 	  }
 	}
       else
 	{
 	klog_debug (KLOG_CLASS, "Image %s is not wide enough", filename); 
+	reason = "not wide enough";
 	}
       }
+    else
+      reason = "not an image";
 
     kstring_destroy (ext);
     }
   else
+    {
     klog_debug (KLOG_CLASS, "Image %s is a thumbnail", filename); 
+    reason = "thumbnail";
+    }
+
+  if (ret)
+    {
+    ktrace_instant (KLOG_CLASS, "accept", filename);
+    KPROBE3 (lbc, filter_accept, filename, width, height);
+    }
+  else
+    {
+    ktrace_instant (KLOG_CLASS, "reject", reason);
+    KPROBE2 (lbc, filter_reject, filename, reason);
+    }
+
+  *out_width = width;
+  *out_height = height;
     
-  free (filename);
+  KTRACE_OUT
   KLOG_OUT
   return ret;
   }
@@ -233,14 +361,29 @@ static BOOL program_consider_path (const ProgramContext *context,
     kstring_cstr ((KString *)path));
   
     KPathType t = kpath_get_type (path);
+    // Files need their UTF-8 names anyway; anything else only for 
+    //   tracing
+    char *filename = t == KPT_REG || ktrace_enabled () 
+        || KPROBE_ENABLED (lbc, entry_visit) || KPROBE_ENABLED (lbc, dir_open)
+        || KPROBE_ENABLED (lbc, dir_read)
+      ? (char *)kpath_to_utf8 (path) : NULL;
+    KPROBE2 (lbc, entry_visit, filename, t);
     if (t == KPT_REG)
       {
-      if (program_consider_file (context, path))
-        klist_append (file_list, kpath_clone (path));
+      int width, height;
+      const char *format;
+      if (program_consider_file (context, path, filename, &width, &height,
+            &format))
+        klist_append (file_list, image_info_new (path, width, height, 
+          format));
       }
     else if (t == KPT_DIR)
       {
+      ktrace_begin (KLOG_CLASS, "readdir", filename);
+      KPROBE1 (lbc, dir_open, filename);
       KList *list = kpath_expand (path, 0);
+      KPROBE2 (lbc, dir_read, filename, list ? (int)klist_length (list) : -1);
+      ktrace_end (KLOG_CLASS, "readdir");
       if (list)
 	{
 	BOOL stop = FALSE;
@@ -265,6 +408,7 @@ static BOOL program_consider_path (const ProgramContext *context,
       klog_error (KLOG_CLASS, "Path is neither a file nor a directory: %S",
 	kstring_cstr ((KString *)path));
       }
+    free (filename);
     }
   else
     {
@@ -463,6 +607,34 @@ static BOOL program_remove_lock (void)
 
 
 
+/*============================================================================
+  
+  program_get_monitors
+
+  --monitors is 'auto' (the default) to find the monitors, 'none' to 
+  treat the desktop as a single screen of unknown size, or a list of
+  monitor sizes. Returns NULL for 'none'.
+
+  ==========================================================================*/
+static KList *program_get_monitors (const ProgramContext *context)
+  {
+  KLOG_IN
+  KList *ret = NULL;
+  char *spec = GET ("monitors");
+  if (!spec || strcmp (spec, "auto") == 0)
+    ret = monitors_discover ();
+  else if (strcmp (spec, "none") != 0)
+    {
+    // Already checked in program_context_check
+    char *error = NULL;
+    ret = monitors_parse (spec, &error);
+    if (error) free (error);
+    }
+  if (spec) free (spec);
+  KLOG_OUT
+  return ret;
+  }
+
 /*============================================================================
   
   program_run 
@@ -496,14 +668,26 @@ int program_run (const ProgramContext *context)
 
   if (cont)
     {
+    char *trace = GET ("trace");
+    if (trace)
+      {
+      if (!ktrace_open (trace))
+        klog_error (KLOG_CLASS, "Can't open trace file '%s': %s", trace,
+          strerror (errno));
+      free (trace);
+      }
+
     if (program_get_lock())
       {
+      // Only the workers' priority is lowered; this thread goes on to 
+      //   run the event loop
+      priority_set_background (HAS_OPTION ("background-priority"));
       int max_files = GET_INTEGER ("max-files", DEFAULT_MAX_FILES);
-      KList *file_list = klist_new_empty ((KListFreeFn) kpath_destroy);
+      KList *file_list = klist_new_empty ((KListFreeFn) image_info_destroy);
       int interval = GET_INTEGER ("interval", DEFAULT_INTERVAL);
       SetBackgroundMethod method = GET_INTEGER ("method-i", SBM_GNOMESHELL);
 
-      if (program_build_file_list (context, file_list))
+      if (program_scan (context, file_list))
 	{
 	int l = klist_length (file_list);
 	if (l >= max_files - 1)
@@ -511,6 +695,34 @@ int program_run (const ProgramContext *context)
 	if (l > 0)
 	  {
 	  klog_info (KLOG_CLASS, "Found %d suitable file(s)", l);
+	  // The changer is created before detaching, so that any problems
+	  //   it finds with the change method are still visible
+	  BOOL dual = HAS_OPTION ("dual");
+          char *cmd = GET ("cmd");
+	  Changer *changer = changer_new (file_list, interval, method, dual, cmd);
+          KList *monitors = program_get_monitors (context);
+          Fit fit = GET_INTEGER ("fit-mode", FIT_ORIENTATION);
+          if (fit == FIT_BEST && (!monitors || klist_length (monitors) == 0))
+            klog_warn (KLOG_CLASS, "--fit=best needs to know the size of "
+              "the monitors; use --monitors");
+          if (monitors) changer_set_monitors (changer, monitors, fit);
+	  changer_set_method_timeout (changer, GET_INTEGER ("method-timeout", 
+	    CHANGER_DEFAULT_METHOD_TIMEOUT));
+          changer_set_prefetch_lead (changer, GET_INTEGER ("prefetch-lead",
+            CHANGER_DEFAULT_PREFETCH_LEAD));
+          changer_set_cmd_persistent (changer, HAS_OPTION ("cmd-persistent"));
+          char *fb_device = GET ("fb-device");
+          char *fb_geometry = GET ("fb-geometry");
+          changer_set_framebuffer (changer, fb_device, fb_geometry);
+          if (fb_device) free (fb_device);
+          if (fb_geometry) free (fb_geometry);
+          char *screen_size = GET ("screen-size");
+          changer_set_prerender (changer, GET_INTEGER ("prerender", 0),
+            screen_size, GET_INTEGER ("cache-size", 
+            SCALED_CACHE_DEFAULT_SIZE_MB));
+          if (screen_size) free (screen_size);
+          changer_set_stage (changer, HAS_OPTION ("stage") ? 
+            GET_INTEGER ("stage-size", CHANGER_DEFAULT_STAGE_SIZE_MB) : 0);
           if (!HAS_OPTION ("foreground"))
             {
             // Note that we need to remove the lock and reacquire it.
@@ -522,12 +734,10 @@ int program_run (const ProgramContext *context)
             daemon (0, 0);
             program_get_lock();
             }
-	  BOOL dual = HAS_OPTION ("dual");
-          char *cmd = GET ("cmd");
-	  Changer *changer = changer_new (file_list, interval, method, dual, cmd);
 	  changer_run (changer);
           if (cmd) free (cmd);
 	  changer_destroy (changer);
+          if (monitors) klist_destroy (monitors);
 	  }
 	else
 	  klog_error (KLOG_CLASS, 
@@ -552,6 +762,8 @@ int program_run (const ProgramContext *context)
 
       free (fname);
       }
+
+    ktrace_close ();
     }
 
   KLOG_OUT
@@ -17,6 +17,7 @@
 #include <getopt.h> 
 #include "program_context.h" 
 #include "changer.h" 
+#include "monitors.h"
 
 #define KLOG_CLASS "lbc.program_context"
 
@@ -145,20 +146,117 @@ BOOL program_context_check_and_resolve (ProgramContext *context)
       PCPI (context, "aspect-mode", ASPECT_ANY);
     }
 
+  if (ret)
+    {
+    char *fit = PCG (context, "fit");
+    if (fit)
+      {
+      if (strcmp (fit, "orientation") == 0)
+        PCPI (context, "fit-mode", FIT_ORIENTATION);
+      else if (strcmp (fit, "best") == 0)
+        PCPI (context, "fit-mode", FIT_BEST);
+      else
+        {
+	klog_error (KLOG_CLASS, "'fit' must be 'orientation' or 'best'");
+        ret = FALSE;
+	}
+      free (fit);
+      }
+    else
+      PCPI (context, "fit-mode", FIT_ORIENTATION);
+    }
+
+  if (ret)
+    {
+    char *cmd_mode = PCG (context, "cmd-mode");
+    if (cmd_mode)
+      {
+      if (strcmp (cmd_mode, "persistent") == 0)
+        PCPB (context, "cmd-persistent", TRUE);
+      else if (strcmp (cmd_mode, "once") == 0)
+        PCPB (context, "cmd-persistent", FALSE);
+      else
+        {
+	klog_error (KLOG_CLASS, "'cmd-mode' must be 'once' or 'persistent'");
+        ret = FALSE;
+	}
+      free (cmd_mode);
+      }
+    }
+
+  if (ret)
+    {
+    char *screen_size = PCG (context, "screen-size");
+    if (screen_size)
+      {
+      int width, height;
+      if (sscanf (screen_size, "%dx%d", &width, &height) != 2 
+           || width <= 0 || height <= 0)
+        {
+	klog_error (KLOG_CLASS, "'screen-size' must be WIDTHxHEIGHT");
+        ret = FALSE;
+	}
+      free (screen_size);
+      }
+    }
+
+  if (ret && PCGI (context, "prefetch-lead", 0) < 0)
+    {
+    klog_error (KLOG_CLASS, "'prefetch-lead' must not be negative");
+    ret = FALSE;
+    }
+
+  if (ret && PCGI (context, "probe-rate", 0) < 0)
+    {
+    klog_error (KLOG_CLASS, "'probe-rate' must not be negative");
+    ret = FALSE;
+    }
+
+  if (ret && PCGI (context, "stage-size", 1) <= 0)
+    {
+    klog_error (KLOG_CLASS, "'stage-size' must be positive");
+    ret = FALSE;
+    }
+
+  if (ret && PCGI (context, "cache-size", 1) <= 0)
+    {
+    klog_error (KLOG_CLASS, "'cache-size' must be positive");
+    ret = FALSE;
+    }
+
+  if (ret)
+    {
+    char *monitors = PCG (context, "monitors");
+    if (monitors && strcmp (monitors, "auto") != 0 
+         && strcmp (monitors, "none") != 0)
+      {
+      char *error = NULL;
+      KList *list = monitors_parse (monitors, &error);
+      if (list)
+        klist_destroy (list);
+      else
+        {
+	klog_error (KLOG_CLASS, "'monitors' must be 'auto', 'none', or a "
+          "list of WIDTHxHEIGHT[+X+Y]: %s", error);
+        free (error);
+        ret = FALSE;
+	}
+      }
+    if (monitors) free (monitors);
+    }
+
   if (PCGB (context, "dual", FALSE))
     {
     char *method = PCG (context, "method");
     if (method)
       {
       SetBackgroundMethod m = changer_get_method (method);
-      if (m != SBM_XFCE4 && m != SBM_CMD)
+      if (m != SBM_XFCE4 && m != SBM_XFCE4_CMD && m != SBM_CMD
+           && m != SBM_GNOMESHELL && m != SBM_GNOMESHELL_CMD 
+           && m != SBM_FEH && m != SBM_XVIEW && m != SBM_X11)
         klog_warn (KLOG_CLASS, 
           "LBC dual-monitor mode is not comaptible with chosen changer method");
-      }
-    else
-      {
-      klog_warn (KLOG_CLASS, 
-        "LBC dual-monitor mode is not comaptible with chosen changer method");
+      free (method);
       }
     }
 
@@ -260,18 +358,33 @@ BOOL program_context_parse_command_line (ProgramContext *self,
     {
       {"aspect", required_argument, NULL, 'a'},
       {"dirs", required_argument, NULL, 'd'},
+      {"cache-size", required_argument, NULL, 0},
       {"cmd", required_argument, NULL, 'c'},
+      {"cmd-mode", required_argument, NULL, 0},
       {"dual", no_argument, NULL, 0},
+      {"background-priority", no_argument, NULL, 0},
+      {"probe-rate", required_argument, NULL, 0},
+      {"fb-device", required_argument, NULL, 0},
+      {"fb-geometry", required_argument, NULL, 0},
+      {"fit", required_argument, NULL, 0},
       {"foreground", no_argument, NULL, 'f'},
       {"help", no_argument, NULL, 0},
       {"log-level", required_argument, NULL, 0},
       {"max-files", required_argument, NULL, 0},
       {"method", required_argument, NULL, 'm'},
+      {"method-timeout", required_argument, NULL, 0},
+      {"monitors", required_argument, NULL, 0},
+      {"prefetch-lead", required_argument, NULL, 0},
+      {"prerender", required_argument, NULL, 0},
+      {"stage", no_argument, NULL, 0},
+      {"stage-size", required_argument, NULL, 0},
+      {"screen-size", required_argument, NULL, 0},
       {"interval", required_argument, NULL, 'i'},
       {"version", no_argument, NULL, 'v'},
       {"prev", no_argument, NULL, 'p'},
       {"next", no_argument, NULL, 'n'},
       {"stop", no_argument, NULL, 's'},
+      {"trace", required_argument, NULL, 0},
       {"width", required_argument, NULL, 'w'},
       {"height", required_argument, NULL, 'h'},
       {0, 0, 0, 0}
@@ -295,8 +408,38 @@ BOOL program_context_parse_command_line (ProgramContext *self,
           PCPB (self, "show-usage", TRUE); 
          else if (strcmp (long_options[option_index].name, "dual") == 0)
           PCPB (self, "dual", TRUE); 
+         else if (strcmp (long_options[option_index].name, "background-priority") == 0)
+          PCPB (self, "background-priority", TRUE); 
+         else if (strcmp (long_options[option_index].name, "probe-rate") == 0)
+          PCPI (self, "probe-rate", atoi(optarg)); 
          else if (strcmp (long_options[option_index].name, "max-files") == 0)
           PCPI (self, "max-files", atoi(optarg)); 
+         else if (strcmp (long_options[option_index].name, "method-timeout") == 0)
+          PCPI (self, "method-timeout", atoi(optarg)); 
+         else if (strcmp (long_options[option_index].name, "trace") == 0)
+          PCP (self, "trace", optarg); 
+         else if (strcmp (long_options[option_index].name, "cmd-mode") == 0)
+          PCP (self, "cmd-mode", optarg); 
+         else if (strcmp (long_options[option_index].name, "fb-device") == 0)
+          PCP (self, "fb-device", optarg); 
+         else if (strcmp (long_options[option_index].name, "fb-geometry") == 0)
+          PCP (self, "fb-geometry", optarg); 
+         else if (strcmp (long_options[option_index].name, "cache-size") == 0)
+          PCPI (self, "cache-size", atoi(optarg)); 
+         else if (strcmp (long_options[option_index].name, "prefetch-lead") == 0)
+          PCPI (self, "prefetch-lead", atoi(optarg)); 
+         else if (strcmp (long_options[option_index].name, "prerender") == 0)
+          PCPI (self, "prerender", atoi(optarg)); 
+         else if (strcmp (long_options[option_index].name, "stage") == 0)
+          PCPB (self, "stage", TRUE); 
+         else if (strcmp (long_options[option_index].name, "stage-size") == 0)
+          PCPI (self, "stage-size", atoi(optarg)); 
+         else if (strcmp (long_options[option_index].name, "screen-size") == 0)
+          PCP (self, "screen-size", optarg); 
+         else if (strcmp (long_options[option_index].name, "monitors") == 0)
+          PCP (self, "monitors", optarg); 
+         else if (strcmp (long_options[option_index].name, "fit") == 0)
+          PCP (self, "fit", optarg); 
          else
            exit (-1);
          break;
@@ -472,10 +615,20 @@ void program_context_show_usage (FILE *fout, const char *argv0)
   fprintf (fout, "Usage: %s [options]\n", argv0);
   fprintf (fout, "  -a,--aspect=landscape|portrait|any\n" 
                  "                           aspect ratio filter (any)\n");
+  fprintf (fout, "     --background-priority idle I/O and CPU priority\n");
+  fprintf (fout, "     --cache-size=[N]      megabytes of prepared images (200)\n");
   fprintf (fout, 
-      "     --dual                different images on each screen\n");
+      "     --dual                different images on each monitor\n");
   fprintf (fout, "  -c,--command             command to run; use with '-m cmd'\n");
+  fprintf (fout, "     --cmd-mode=once|persistent\n"
+                 "                           run command per change, or once (once)\n");
   fprintf (fout, "  -d,--dirs                colon-separated directory list\n");
+  fprintf (fout, "     --fb-device=[path]    framebuffer for '-m fb' (/dev/fb0)\n");
+  fprintf (fout, "     --fb-geometry=WxH[xBPP]\n"
+                 "                           size, if fb-device is a file\n");
+  fprintf (fout, "     --fit=orientation|best\n"
+                 "                           how images are matched to monitors\n"
+                 "                           (orientation)\n");
   fprintf (fout, "     --help                show this message\n");
   fprintf (fout, "  -f,--foregound           run in foreground\n");
   fprintf (fout, "  -h,--height=[N]          minimum height (none)\n");
@@ -484,9 +637,20 @@ void program_context_show_usage (FILE *fout, const char *argv0)
   fprintf (fout, "     --log-level=[0..4]    log level (1)\n");
   fprintf (fout, "     --max-files=[N]       maxium files (1000)\n");
   fprintf (fout, "  -m,--method=[name,help]  set changing method\n");
+  fprintf (fout, "     --method-timeout=[N]  seconds before a change is killed (30)\n");
+  fprintf (fout, "     --monitors=auto|none|WxH[+X+Y],...\n"
+                 "                           monitors to choose images for (auto)\n"
+                 "                           (without X, rotation is not detected)\n");
   fprintf (fout, "  -n,--next                next background\n");
   fprintf (fout, "  -p,--prev                previous background\n");
+  fprintf (fout, "     --prefetch-lead=[N]   read next images N seconds early (5)\n");
+  fprintf (fout, "     --prerender=[N]       prepare N images ahead (0)\n");
+  fprintf (fout, "     --probe-rate=[N]      most image probes per second (none)\n");
+  fprintf (fout, "     --screen-size=WxH     screen size for --prerender\n");
+  fprintf (fout, "     --stage               copy upcoming images to local memory\n");
+  fprintf (fout, "     --stage-size=[N]      megabytes of staged images (100)\n");
   fprintf (fout, "  -s,--stop                stop the program\n");
+  fprintf (fout, "     --trace=[file]        write timeline trace (Chrome JSON)\n");
   fprintf (fout, "  -v,--version             show version\n");
   fprintf (fout, "  -w,--width=[N]           minimum width (none)\n");
   KLOG_OUT
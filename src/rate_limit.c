@@ -0,0 +1,95 @@
+/*============================================================================
+
+  lbc
+
+  rate_limit.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <klib/klib.h>
+#include "rate_limit.h"
+
+#define KLOG_CLASS "lbc.rate_limit"
+
+/*============================================================================
+
+  RateLimit
+
+  The tokens are counted in millionths, so that whole microseconds of
+  time add whole numbers of them.
+
+  ==========================================================================*/
+struct _RateLimit
+  {
+  int64_t rate;
+  int64_t capacity;
+  int64_t tokens;
+  // When the tokens were last counted, in microseconds
+  int64_t last;
+  };
+
+/*============================================================================
+
+  rate_limit_new
+
+  ==========================================================================*/
+RateLimit *rate_limit_new (int rate, int burst)
+  {
+  KLOG_IN
+  RateLimit *self = malloc (sizeof (RateLimit));
+  self->rate = rate;
+  self->capacity = (int64_t)(burst > 0 ? burst : 1) * 1000000;
+  self->tokens = self->capacity;
+  self->last = ktrace_now ();
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  rate_limit_destroy
+
+  ==========================================================================*/
+void rate_limit_destroy (RateLimit *self)
+  {
+  KLOG_IN
+  free (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  rate_limit_take
+
+  ==========================================================================*/
+int64_t rate_limit_take (RateLimit *self)
+  {
+  KLOG_IN
+  int64_t start = ktrace_now ();
+  int64_t now = start;
+  for (;;)
+    {
+    self->tokens += (now - self->last) * self->rate;
+    if (self->tokens > self->capacity) self->tokens = self->capacity;
+    self->last = now;
+    if (self->tokens >= 1000000) break;
+
+    // Sleep until one whole token has built up
+    int64_t usec = (1000000 - self->tokens + self->rate - 1) / self->rate;
+    struct timespec ts = { usec / 1000000, (usec % 1000000) * 1000 };
+    while (nanosleep (&ts, &ts) != 0 && errno == EINTR)
+      ;
+    now = ktrace_now ();
+    }
+  self->tokens -= 1000000;
+  KLOG_OUT
+  return now - start;
+  }
+
@@ -0,0 +1,38 @@
+/*============================================================================
+
+  lbc
+
+  rate_limit.h
+
+  A token bucket, for limiting how often something is done. Tokens are
+  added at a steady rate, up to the size of the bucket; each action 
+  takes one, and waits for one if the bucket is empty. So actions can
+  come in bursts of up to the bucket size, but never exceed the rate for
+  long.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+struct _RateLimit;
+typedef struct _RateLimit RateLimit;
+
+BEGIN_DECLS
+
+/** Create a limit of 'rate' actions per second, in bursts of up to 
+    'burst'. The bucket starts full. */
+extern RateLimit *rate_limit_new (int rate, int burst);
+
+extern void       rate_limit_destroy (RateLimit *self);
+
+/** Take a token, sleeping until there is one. Returns the time spent
+    waiting, in microseconds. */
+extern int64_t    rate_limit_take (RateLimit *self);
+
+END_DECLS
+
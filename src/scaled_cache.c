@@ -0,0 +1,409 @@
+/*============================================================================
+
+  lbc
+
+  scaled_cache.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <klib/klib.h>
+#include "scaled_cache.h"
+
+#define KLOG_CLASS "lbc.scaled_cache"
+
+// JPEG quality of the cached files. They are shown at their own size,
+//   so there is no need for more
+#define SCALED_CACHE_QUALITY 90
+
+// Entries used more recently than this (in seconds) are never evicted,
+//   even if the cache is over its limit: another instance may have
+//   just given one to the desktop
+#define SCALED_CACHE_MIN_AGE 60
+
+// Temporary files older than this (in seconds) were left by an
+//   instance that died while writing them
+#define SCALED_CACHE_TEMP_AGE 3600
+
+#define SCALED_CACHE_LOCK_FILE ".lock"
+
+static void scaled_cache_trim (ScaledCache *self); // FWD
+
+/*============================================================================
+
+  ScaledCache
+
+  ==========================================================================*/
+struct _ScaledCache
+  {
+  char *dir;
+  int64_t max_bytes;
+  // The size of the entries when they were last counted, plus the size
+  //   of the ones stored since. Entries that other instances store are
+  //   only seen when they are counted again, which is when this goes
+  //   over max_bytes. The lock protects it
+  pthread_mutex_t lock;
+  int64_t total;
+  };
+
+/*============================================================================
+
+  ScaledCacheEntry
+
+  Used only while evicting.
+
+  ==========================================================================*/
+typedef struct _ScaledCacheEntry
+  {
+  char *name;
+  int64_t size;
+  time_t mtime;
+  } ScaledCacheEntry;
+
+/*============================================================================
+
+  scaled_cache_entry_destroy
+
+  ==========================================================================*/
+static void scaled_cache_entry_destroy (ScaledCacheEntry *self)
+  {
+  KLOG_IN
+  free (self->name);
+  free (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  scaled_cache_get_default_dir
+
+  ==========================================================================*/
+char *scaled_cache_get_default_dir (void)
+  {
+  KLOG_IN
+  char *ret;
+  const char *cache = getenv ("XDG_CACHE_HOME");
+  if (cache && cache[0])
+    asprintf (&ret, "%s/lbc/scaled", cache);
+  else
+    {
+    KPath *path = kpath_new_home ();
+    kpath_append_utf8 (path, (UTF8 *)".cache/lbc/scaled");
+    ret = (char *)kpath_to_utf8 (path);
+    kpath_destroy (path);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  scaled_cache_new
+
+  ==========================================================================*/
+ScaledCache *scaled_cache_new (const char *dir, int64_t max_bytes,
+    char **error)
+  {
+  KLOG_IN
+  ScaledCache *self = NULL;
+  KPath *path = kpath_new_from_utf8 ((const UTF8 *)dir);
+  if (kpath_create_directory (path))
+    {
+    self = malloc (sizeof (ScaledCache));
+    self->dir = strdup (dir);
+    self->max_bytes = max_bytes;
+    pthread_mutex_init (&self->lock, NULL);
+    self->total = 0;
+    // This counts the entries, and the limit may be lower than it was 
+    //   last time
+    scaled_cache_trim (self);
+    klog_debug (KLOG_CLASS, "Cache is %s, %lld bytes, limit %lld bytes", 
+      dir, (long long)self->total, (long long)max_bytes);
+    }
+  else
+    asprintf (error, "Can't create directory '%s'", dir);
+  kpath_destroy (path);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  scaled_cache_destroy
+
+  ==========================================================================*/
+void scaled_cache_destroy (ScaledCache *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    pthread_mutex_destroy (&self->lock);
+    free (self->dir);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  scaled_cache_hash
+
+  64-bit FNV-1a, continuing from 'hash'.
+
+  ==========================================================================*/
+static uint64_t scaled_cache_hash (uint64_t hash, const void *data,
+    size_t len)
+  {
+  KLOG_IN
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++)
+    {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+    }
+  KLOG_OUT
+  return hash;
+  }
+
+/*============================================================================
+
+  scaled_cache_hash_source
+
+  Add a source file's pathname, modification time and size to 'hash'.
+  Returns FALSE if the file can't be examined.
+
+  ==========================================================================*/
+static BOOL scaled_cache_hash_source (uint64_t *hash, const char *source)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  struct stat sb;
+  if (stat (source, &sb) == 0)
+    {
+    int64_t mtime = sb.st_mtim.tv_sec;
+    int64_t mtime_ns = sb.st_mtim.tv_nsec;
+    int64_t size = sb.st_size;
+    *hash = scaled_cache_hash (*hash, source, strlen (source) + 1);
+    *hash = scaled_cache_hash (*hash, &mtime, sizeof (mtime));
+    *hash = scaled_cache_hash (*hash, &mtime_ns, sizeof (mtime_ns));
+    *hash = scaled_cache_hash (*hash, &size, sizeof (size));
+    ret = TRUE;
+    }
+  else
+    klog_debug (KLOG_CLASS, "Can't stat '%s': %s", source, strerror (errno));
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  scaled_cache_get_path
+
+  The name is a hash of everything that affects the rendered image,
+  followed by the size and mode, so that the directory is still
+  comprehensible to a human.
+
+  ==========================================================================*/
+char *scaled_cache_get_path (const ScaledCache *self, const char *source,
+    int width, int height, const char *mode)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  if (scaled_cache_hash_source (&hash, source))
+    asprintf (&ret, "%s/%016llx-%dx%d-%s.jpg", self->dir,
+      (unsigned long long)hash, width, height, mode);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  scaled_cache_get_multi_path
+
+  ==========================================================================*/
+char *scaled_cache_get_multi_path (const ScaledCache *self, 
+    const char *const *sources, int n, const char *layout, int width, 
+    int height, const char *mode)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  BOOL ok = TRUE;
+  for (int i = 0; i < n && ok; i++)
+    ok = scaled_cache_hash_source (&hash, sources[i]);
+  if (ok)
+    {
+    hash = scaled_cache_hash (hash, layout, strlen (layout) + 1);
+    asprintf (&ret, "%s/%016llx-%dx%d-%s.jpg", self->dir,
+      (unsigned long long)hash, width, height, mode);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  scaled_cache_lookup
+
+  The modification time of an entry is its last-use time -- access
+  times can't be relied on, as most filesystems are mounted with
+  noatime or relatime.
+
+  ==========================================================================*/
+BOOL scaled_cache_lookup (const ScaledCache *self, const char *path)
+  {
+  KLOG_IN
+  BOOL ret = utimensat (AT_FDCWD, path, NULL, 0) == 0;
+  (void)self;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  scaled_cache_sort_fn
+
+  Oldest first.
+
+  ==========================================================================*/
+static int scaled_cache_sort_fn (const void *i1, const void *i2,
+    void *user_data)
+  {
+  KLOG_IN
+  const ScaledCacheEntry *e1 = *(const ScaledCacheEntry **)i1;
+  const ScaledCacheEntry *e2 = *(const ScaledCacheEntry **)i2;
+  int ret = (e1->mtime > e2->mtime) - (e1->mtime < e2->mtime);
+  (void)user_data;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  scaled_cache_trim
+
+  Count the entries, and remove the least recently used ones until the 
+  cache is within its limit. The file lock makes sure that two 
+  instances don't both count the same files, and both remove more than
+  they need to.
+
+  ==========================================================================*/
+static void scaled_cache_trim (ScaledCache *self)
+  {
+  KLOG_IN
+  char *lock_file;
+  asprintf (&lock_file, "%s/%s", self->dir, SCALED_CACHE_LOCK_FILE);
+  int lock_fd = open (lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  DIR *d = opendir (self->dir);
+  if (lock_fd >= 0 && d && flock (lock_fd, LOCK_EX) == 0)
+    {
+    KList *entries = klist_new_empty ((KListFreeFn)scaled_cache_entry_destroy);
+    time_t now = time (NULL);
+    int64_t total = 0;
+    struct dirent *de;
+    while ((de = readdir (d)))
+      {
+      struct stat sb;
+      if (de->d_name[0] == '.') continue;
+      if (fstatat (dirfd (d), de->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0
+           || !S_ISREG (sb.st_mode))
+        continue;
+      size_t len = strlen (de->d_name);
+      if (len > 4 && strcmp (de->d_name + len - 4, ".tmp") == 0)
+        {
+        if (now - sb.st_mtime > SCALED_CACHE_TEMP_AGE)
+          unlinkat (dirfd (d), de->d_name, 0);
+        continue;
+        }
+      ScaledCacheEntry *entry = malloc (sizeof (ScaledCacheEntry));
+      entry->name = strdup (de->d_name);
+      entry->size = (int64_t)sb.st_size;
+      entry->mtime = sb.st_mtime;
+      klist_append (entries, entry);
+      total += entry->size;
+      }
+
+    if (total > self->max_bytes)
+      {
+      klist_sort (entries, scaled_cache_sort_fn, NULL);
+      int l = klist_length (entries);
+      for (int i = 0; i < l && total > self->max_bytes; i++)
+        {
+        const ScaledCacheEntry *entry = klist_get (entries, i);
+        if (now - entry->mtime < SCALED_CACHE_MIN_AGE) break;
+        if (unlinkat (dirfd (d), entry->name, 0) == 0)
+          {
+          klog_debug (KLOG_CLASS, "Evicted %s", entry->name);
+          total -= entry->size;
+          }
+        }
+      }
+    pthread_mutex_lock (&self->lock);
+    self->total = total;
+    pthread_mutex_unlock (&self->lock);
+    klist_destroy (entries);
+    flock (lock_fd, LOCK_UN);
+    }
+  else
+    klog_warn (KLOG_CLASS, "Can't lock cache %s: %s", self->dir,
+      strerror (errno));
+  if (d) closedir (d);
+  if (lock_fd >= 0) close (lock_fd);
+  free (lock_file);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  scaled_cache_store
+
+  The temporary name includes the process and thread, so that no two
+  writers can share it. The directory is only scanned, to evict old
+  entries, when the running total goes over the limit.
+
+  ==========================================================================*/
+BOOL scaled_cache_store (ScaledCache *self, const char *path,
+    const uint8_t *rgb, int width, int height, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  char *temp;
+  asprintf (&temp, "%s.%d.%d.tmp", path, (int)getpid(), (int)gettid());
+  if (jpegwriter_mem_to_file (temp, width, height, rgb,
+       SCALED_CACHE_QUALITY, error))
+    {
+    if (rename (temp, path) == 0)
+      ret = TRUE;
+    else
+      asprintf (error, "Can't rename '%s': %s", temp, strerror (errno));
+    }
+  if (!ret) unlink (temp);
+  free (temp);
+  struct stat sb;
+  if (ret && stat (path, &sb) == 0)
+    {
+    pthread_mutex_lock (&self->lock);
+    self->total += sb.st_size;
+    BOOL over = self->total > self->max_bytes;
+    pthread_mutex_unlock (&self->lock);
+    if (over) scaled_cache_trim (self);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
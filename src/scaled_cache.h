@@ -0,0 +1,75 @@
+/*============================================================================
+
+  lbc
+
+  scaled_cache.h
+
+  An on-disk cache of images scaled to a screen size. Each entry is
+  keyed by the source file's pathname, modification time and size, and
+  by the size and scaling mode it was rendered for, so a file that is
+  edited is rendered again, and monitors of the same size share
+  entries. When the cache grows beyond its size limit, the least
+  recently used entries are removed.
+
+  The cache can be shared by any number of LBC instances: entries are
+  written under temporary names and renamed into place, and eviction
+  is serialized by an flock() on a lock file in the cache directory.
+  All the functions can be called from any thread.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/klib.h>
+
+/** Default limit on the total size of the cache, in megabytes. */
+#define SCALED_CACHE_DEFAULT_SIZE_MB 200
+
+struct _ScaledCache;
+typedef struct _ScaledCache ScaledCache;
+
+BEGIN_DECLS
+
+/** Open the cache in dir, which is created if necessary. Returns NULL,
+    and sets *error, if it can't be created. */
+extern ScaledCache *scaled_cache_new (const char *dir, int64_t max_bytes,
+                      char **error);
+
+extern void         scaled_cache_destroy (ScaledCache *self);
+
+/** Get the cache pathname for source, rendered at width x height in
+    the specified mode ("fill", for example). Returns NULL if the source
+    can't be examined. The caller must free the result. */
+extern char        *scaled_cache_get_path (const ScaledCache *self,
+                      const char *source, int width, int height,
+                      const char *mode);
+
+/** As scaled_cache_get_path, for an image made from n sources -- a
+    spanned image, for example. layout describes how the sources were
+    put together, and is part of the key. */
+extern char        *scaled_cache_get_multi_path (const ScaledCache *self,
+                      const char *const *sources, int n, 
+                      const char *layout, int width, int height,
+                      const char *mode);
+
+/** Check whether path (from scaled_cache_get_path) is in the cache. If
+    it is, it is marked as recently used. */
+extern BOOL         scaled_cache_lookup (const ScaledCache *self,
+                      const char *path);
+
+/** Store an RGB image of width x height as path, and then remove old
+    entries if that takes the cache over its limit. */
+extern BOOL         scaled_cache_store (ScaledCache *self,
+                      const char *path, const uint8_t *rgb, int width,
+                      int height, char **error);
+
+/** Get the default cache directory, $XDG_CACHE_HOME/lbc/scaled. The
+    caller must free the result. */
+extern char        *scaled_cache_get_default_dir (void);
+
+END_DECLS
+
@@ -0,0 +1,124 @@
+/*============================================================================
+
+  lbc
+
+  span.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <klib/klib.h>
+#include "span.h"
+
+#define KLOG_CLASS "lbc.span"
+
+/*============================================================================
+
+  span_get_bounds
+
+  The desktop is the smallest rectangle that holds all the monitors.
+  XRandR positions can start anywhere, so the result is relative to its
+  top-left corner (x0, y0).
+
+  ==========================================================================*/
+static void span_get_bounds (const Monitor *const *monitors, int n,
+    int *x0, int *y0, int *width, int *height)
+  {
+  KLOG_IN
+  int x1 = 0, y1 = 0;
+  for (int i = 0; i < n; i++)
+    {
+    const Monitor *m = monitors[i];
+    int left = monitor_get_x (m), top = monitor_get_y (m);
+    int right = left + monitor_get_width (m);
+    int bottom = top + monitor_get_height (m);
+    if (i == 0 || left < *x0) *x0 = left;
+    if (i == 0 || top < *y0) *y0 = top;
+    if (i == 0 || right > x1) x1 = right;
+    if (i == 0 || bottom > y1) y1 = bottom;
+    }
+  *width = x1 - *x0;
+  *height = y1 - *y0;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  span_get_layout
+
+  ==========================================================================*/
+char *span_get_layout (const Monitor *const *monitors, int n, int *width,
+    int *height)
+  {
+  KLOG_IN
+  int x0, y0;
+  span_get_bounds (monitors, n, &x0, &y0, width, height);
+  char *ret = NULL;
+  size_t size = 0;
+  FILE *f = open_memstream (&ret, &size);
+  for (int i = 0; i < n; i++)
+    fprintf (f, "%s%dx%d+%d+%d", i > 0 ? "," : "", 
+      monitor_get_width (monitors[i]), monitor_get_height (monitors[i]),
+      monitor_get_x (monitors[i]) - x0, monitor_get_y (monitors[i]) - y0);
+  fclose (f);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  span_compose
+
+  Each image is decoded straight to its monitor's size, into a tile, 
+  which is then copied into place a row at a time.
+
+  ==========================================================================*/
+uint8_t *span_compose (const char *const *filenames, 
+    const Monitor *const *monitors, int n, char **error)
+  {
+  KLOG_IN
+  KTRACE_IN (NULL)
+  int x0, y0, width, height;
+  span_get_bounds (monitors, n, &x0, &y0, &width, &height);
+  size_t stride = (size_t)width * 3;
+  uint8_t *ret = calloc (height, stride);
+  int placed = 0;
+  for (int i = 0; i < n; i++)
+    {
+    const Monitor *m = monitors[i];
+    int w = monitor_get_width (m), h = monitor_get_height (m);
+    uint8_t *tile = malloc ((size_t)w * h * 3);
+    char *e = NULL;
+    if (jpegreader_file_to_buffer_resampled (filenames[i], w, h, 
+         KRESAMPLE_FILL, KRESAMPLE_LANCZOS3, tile, &e))
+      {
+      uint8_t *dst = ret + (size_t)(monitor_get_y (m) - y0) * stride
+        + (size_t)(monitor_get_x (m) - x0) * 3;
+      for (int y = 0; y < h; y++)
+        memcpy (dst + y * stride, tile + (size_t)y * w * 3, (size_t)w * 3);
+      placed++;
+      }
+    else
+      {
+      klog_warn (KLOG_CLASS, "Can't put '%s' on monitor %d: %s", 
+        filenames[i], i, e ? e : "unknown error");
+      free (e);
+      }
+    free (tile);
+    }
+  if (placed == 0)
+    {
+    asprintf (error, "None of the images for the monitors can be read");
+    free (ret);
+    ret = NULL;
+    }
+  KTRACE_OUT
+  KLOG_OUT
+  return ret;
+  }
+
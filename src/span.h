@@ -0,0 +1,41 @@
+/*============================================================================
+
+  lbc
+
+  span.h
+
+  Putting one image on each monitor into a single image that spans the
+  whole desktop, for desktops that can only be given one image. Each 
+  image is scaled to cover its monitor, and placed where the monitor 
+  is; parts of the desktop that no monitor shows are left black.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/klib.h>
+#include "monitors.h"
+
+BEGIN_DECLS
+
+/** Get the size of the image that spans n monitors, and a description
+    of their layout, for scaled_cache_get_multi_path. The caller must 
+    free the result. */
+extern char    *span_get_layout (const Monitor *const *monitors, int n,
+                  int *width, int *height);
+
+/** Make the image that spans n monitors, with filenames[i] on 
+    monitors[i]. The result is RGB, of the size that span_get_layout
+    gives. Only JPEG files can be used; a file that can't be read 
+    leaves its monitor black, and is reported with a warning. Returns
+    NULL, and sets *error, if none of them can be read. The caller must
+    free the result. */
+extern uint8_t *span_compose (const char *const *filenames, 
+                  const Monitor *const *monitors, int n, char **error);
+
+END_DECLS
+
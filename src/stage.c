@@ -0,0 +1,614 @@
+/*============================================================================
+
+  lbc
+
+  stage.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <klib/klib.h>
+#include "priority.h"
+#include "stage.h"
+
+#define KLOG_CLASS "lbc.stage"
+
+// Temporary files older than this (in seconds) were left by an
+//   instance that died while writing them
+#define STAGE_TEMP_AGE 3600
+
+// The longest file extension that is kept on a staged copy. Some
+//   desktops go by the extension to decide how to load an image
+#define STAGE_MAX_EXT 8
+
+typedef enum
+  {
+  STAGE_PENDING = 0, STAGE_BUSY = 1, STAGE_READY = 2, STAGE_FAILED = 3
+  } StageState;
+
+/*============================================================================
+
+  StageEntry
+
+  ==========================================================================*/
+typedef struct _StageEntry
+  {
+  char *source;
+  char *target;
+  // The size of the copy, once it is ready
+  int64_t size;
+  StageState state;
+  } StageEntry;
+
+/*============================================================================
+
+  Stage
+
+  ==========================================================================*/
+struct _Stage
+  {
+  char *dir;
+  int64_t max_bytes;
+  pthread_t thread;
+  // The lock protects everything below. The worker waits on 'wake'
+  //   when it has nothing to do
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  BOOL quit;
+  BOOL paused;
+  // The requested images, as StageEntry, most urgent first
+  KList *entries;
+  };
+
+/*============================================================================
+
+  stage_entry_destroy
+
+  ==========================================================================*/
+static void stage_entry_destroy (StageEntry *self)
+  {
+  KLOG_IN
+  free (self->source);
+  free (self->target);
+  free (self);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  stage_find
+
+  Find the entry for a staged file. Caller must hold the lock.
+
+  ==========================================================================*/
+static StageEntry *stage_find (const KList *entries, const char *target)
+  {
+  KLOG_IN
+  StageEntry *ret = NULL;
+  int l = klist_length (entries);
+  for (int i = 0; i < l && !ret; i++)
+    {
+    StageEntry *entry = klist_get (entries, i);
+    if (strcmp (entry->target, target) == 0) ret = entry;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_find_source
+
+  Find the entry for a source file. Caller must hold the lock.
+
+  ==========================================================================*/
+static StageEntry *stage_find_source (const KList *entries,
+    const char *source)
+  {
+  KLOG_IN
+  StageEntry *ret = NULL;
+  int l = klist_length (entries);
+  for (int i = 0; i < l && !ret; i++)
+    {
+    StageEntry *entry = klist_get (entries, i);
+    if (strcmp (entry->source, source) == 0) ret = entry;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_get_path
+
+  The staged copy is named by a hash of the source's pathname, and
+  keeps its extension. The name doesn't depend on the source's
+  modification time, so that it can be worked out without touching the
+  server, which may be asleep. The caller must free the result.
+
+  ==========================================================================*/
+static char *stage_get_path (const Stage *self, const char *source)
+  {
+  KLOG_IN
+  char *ret;
+  // 64-bit FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const unsigned char *p = (const unsigned char *)source; *p; p++)
+    {
+    hash ^= *p;
+    hash *= 0x100000001b3ULL;
+    }
+  const char *base = strrchr (source, '/');
+  const char *ext = strrchr (base ? base : source, '.');
+  if (!ext || strlen (ext) > STAGE_MAX_EXT) ext = "";
+  asprintf (&ret, "%s/%016llx%s", self->dir, (unsigned long long)hash,
+    ext);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_copy
+
+  Copy source to target, by way of a temporary file, so that nobody
+  sees a partial copy. copy_file_range() lets the kernel do the copy
+  without bringing the data into this process; it can't copy between
+  some pairs of filesystems, and then sendfile() is used instead. The
+  copy is given the source's modification time, so that it can be seen
+  later to be up to date.
+
+  ==========================================================================*/
+static BOOL stage_copy (const char *source, const char *target,
+    int64_t *size, char **error)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  char *temp;
+  asprintf (&temp, "%s.%d.%d.tmp", target, (int)getpid(), (int)gettid());
+  int in = open (source, O_RDONLY | O_CLOEXEC);
+  struct stat sb;
+  if (in >= 0 && fstat (in, &sb) == 0)
+    {
+    int out = open (temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out >= 0)
+      {
+      int64_t left = (int64_t)sb.st_size;
+      BOOL use_sendfile = FALSE;
+      ret = TRUE;
+      while (ret && left > 0)
+        {
+        ssize_t n;
+        if (use_sendfile)
+          n = sendfile (out, in, NULL, left);
+        else
+          {
+          n = copy_file_range (in, NULL, out, NULL, left, 0);
+          if (n < 0 && left == (int64_t)sb.st_size && (errno == EXDEV
+               || errno == EINVAL || errno == ENOSYS
+               || errno == EOPNOTSUPP))
+            {
+            use_sendfile = TRUE;
+            continue;
+            }
+          }
+        if (n > 0)
+          left -= n;
+        else if (n == 0)
+          {
+          asprintf (error, "'%s' got shorter while it was copied", source);
+          ret = FALSE;
+          }
+        else if (errno != EINTR)
+          {
+          asprintf (error, "Can't copy '%s': %s", source, strerror (errno));
+          ret = FALSE;
+          }
+        }
+      if (ret)
+        {
+        struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+        futimens (out, times);
+        }
+      if (close (out) != 0 && ret)
+        {
+        asprintf (error, "Can't write '%s': %s", temp, strerror (errno));
+        ret = FALSE;
+        }
+      if (ret && rename (temp, target) != 0)
+        {
+        asprintf (error, "Can't rename '%s': %s", temp, strerror (errno));
+        ret = FALSE;
+        }
+      if (!ret) unlink (temp);
+      *size = (int64_t)sb.st_size;
+      }
+    else
+      asprintf (error, "Can't create '%s': %s", temp, strerror (errno));
+    }
+  else
+    asprintf (error, "Can't open '%s': %s", source, strerror (errno));
+  if (in >= 0) close (in);
+  free (temp);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_used_bytes
+
+  The space taken by the copies that are ready. Caller must hold the
+  lock.
+
+  ==========================================================================*/
+static int64_t stage_used_bytes (const Stage *self)
+  {
+  KLOG_IN
+  int64_t ret = 0;
+  int l = klist_length (self->entries);
+  for (int i = 0; i < l; i++)
+    {
+    const StageEntry *entry = klist_get (self->entries, i);
+    if (entry->state == STAGE_READY) ret += entry->size;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_prepare
+
+  Make sure that the staged copy of source is there and up to date,
+  copying it if not. If the source can't be reached, an existing copy
+  is used as it is -- that is the point of staging.
+
+  ==========================================================================*/
+static StageState stage_prepare (Stage *self, const char *source,
+    const char *target, int64_t *size)
+  {
+  KLOG_IN
+  StageState ret = STAGE_FAILED;
+  struct stat ssb, tsb;
+  BOOL have_copy = stat (target, &tsb) == 0;
+  if (stat (source, &ssb) != 0)
+    {
+    if (have_copy)
+      {
+      klog_info (KLOG_CLASS, "Can't read '%s'; using the staged copy",
+        source);
+      *size = (int64_t)tsb.st_size;
+      ret = STAGE_READY;
+      }
+    else
+      klog_warn (KLOG_CLASS, "Can't stage '%s': %s", source,
+        strerror (errno));
+    }
+  else if (have_copy && tsb.st_size == ssb.st_size
+        && tsb.st_mtim.tv_sec == ssb.st_mtim.tv_sec
+        && tsb.st_mtim.tv_nsec == ssb.st_mtim.tv_nsec)
+    {
+    *size = (int64_t)tsb.st_size;
+    ret = STAGE_READY;
+    }
+  else
+    {
+    pthread_mutex_lock (&self->lock);
+    BOOL fits = stage_used_bytes (self) + (int64_t)ssb.st_size
+      <= self->max_bytes;
+    pthread_mutex_unlock (&self->lock);
+    if (fits)
+      {
+      int64_t start = ktrace_now ();
+      char *error = NULL;
+      if (stage_copy (source, target, size, &error))
+        {
+        klog_debug (KLOG_CLASS, "Staged '%s' (%lld bytes) in %lld msec",
+          source, (long long)*size,
+          (long long)(ktrace_now () - start) / 1000);
+        ret = STAGE_READY;
+        }
+      else
+        {
+        klog_warn (KLOG_CLASS, "%s", error);
+        free (error);
+        }
+      }
+    else
+      klog_debug (KLOG_CLASS, "Not staging '%s': no room under the limit",
+        source);
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_worker
+
+  ==========================================================================*/
+static void *stage_worker (void *user_data)
+  {
+  KLOG_IN
+  priority_lower_thread ();
+  Stage *self = user_data;
+  pthread_mutex_lock (&self->lock);
+  while (!self->quit)
+    {
+    StageEntry *entry = NULL;
+    int l = self->paused ? 0 : klist_length (self->entries);
+    for (int i = 0; i < l && !entry; i++)
+      {
+      StageEntry *e = klist_get (self->entries, i);
+      if (e->state == STAGE_PENDING) entry = e;
+      }
+
+    if (entry)
+      {
+      // The entry may be dropped by a new request while we work on it,
+      //   so work on copies of its names, and look it up again after.
+      //   If it has been dropped, its copy is not wanted any more
+      entry->state = STAGE_BUSY;
+      char *source = strdup (entry->source);
+      char *target = strdup (entry->target);
+      pthread_mutex_unlock (&self->lock);
+
+      KTRACE_IN (source)
+      int64_t size = 0;
+      StageState state = stage_prepare (self, source, target, &size);
+      KTRACE_OUT
+
+      pthread_mutex_lock (&self->lock);
+      entry = stage_find (self->entries, target);
+      if (entry)
+        {
+        entry->state = state;
+        entry->size = size;
+        }
+      else
+        unlink (target);
+      free (target);
+      free (source);
+      }
+    else
+      pthread_cond_wait (&self->wake, &self->lock);
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return NULL;
+  }
+
+/*============================================================================
+
+  stage_remove_unwanted
+
+  Remove the files in the staging directory that aren't the copies of
+  the requested images, including any left by an earlier run. Caller
+  must hold the lock.
+
+  ==========================================================================*/
+static void stage_remove_unwanted (const Stage *self)
+  {
+  KLOG_IN
+  DIR *d = opendir (self->dir);
+  if (d)
+    {
+    time_t now = time (NULL);
+    size_t dirlen = strlen (self->dir);
+    int l = klist_length (self->entries);
+    struct dirent *de;
+    while ((de = readdir (d)))
+      {
+      struct stat sb;
+      if (de->d_name[0] == '.') continue;
+      if (fstatat (dirfd (d), de->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0
+           || !S_ISREG (sb.st_mode))
+        continue;
+      size_t len = strlen (de->d_name);
+      if (len > 4 && strcmp (de->d_name + len - 4, ".tmp") == 0)
+        {
+        // Probably the worker's copy in progress
+        if (now - sb.st_mtime > STAGE_TEMP_AGE)
+          unlinkat (dirfd (d), de->d_name, 0);
+        continue;
+        }
+      BOOL wanted = FALSE;
+      for (int i = 0; i < l && !wanted; i++)
+        {
+        const StageEntry *entry = klist_get (self->entries, i);
+        wanted = strcmp (entry->target + dirlen + 1, de->d_name) == 0;
+        }
+      if (!wanted && unlinkat (dirfd (d), de->d_name, 0) == 0)
+        klog_debug (KLOG_CLASS, "Removed %s", de->d_name);
+      }
+    closedir (d);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  stage_get_default_dir
+
+  ==========================================================================*/
+char *stage_get_default_dir (void)
+  {
+  KLOG_IN
+  char *ret;
+  const char *runtime = getenv ("XDG_RUNTIME_DIR");
+  if (runtime && runtime[0])
+    asprintf (&ret, "%s/lbc", runtime);
+  else
+    asprintf (&ret, "/tmp/lbc-%d", (int)getuid());
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  stage_new
+
+  ==========================================================================*/
+Stage *stage_new (const char *dir, int64_t max_bytes, char **error)
+  {
+  KLOG_IN
+  Stage *self = NULL;
+  KPath *path = kpath_new_from_utf8 ((const UTF8 *)dir);
+  if (kpath_create_directory (path))
+    {
+    // The copies are of the user's own images; nobody else needs them
+    chmod (dir, 0700);
+    self = malloc (sizeof (Stage));
+    self->dir = strdup (dir);
+    self->max_bytes = max_bytes;
+    self->quit = FALSE;
+    self->paused = FALSE;
+    self->entries = klist_new_empty ((KListFreeFn)stage_entry_destroy);
+    pthread_mutex_init (&self->lock, NULL);
+    pthread_cond_init (&self->wake, NULL);
+    int err = pthread_create (&self->thread, NULL, stage_worker, self);
+    if (err == 0)
+      klog_info (KLOG_CLASS, "Staging images in %s, limit %lld bytes", dir,
+        (long long)max_bytes);
+    else
+      {
+      asprintf (error, "Can't start image staging: %s", strerror (err));
+      pthread_cond_destroy (&self->wake);
+      pthread_mutex_destroy (&self->lock);
+      klist_destroy (self->entries);
+      free (self->dir);
+      free (self);
+      self = NULL;
+      }
+    }
+  else
+    asprintf (error, "Can't create directory '%s'", dir);
+  kpath_destroy (path);
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  stage_destroy
+
+  ==========================================================================*/
+void stage_destroy (Stage *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->lock);
+    self->quit = TRUE;
+    pthread_cond_signal (&self->wake);
+    pthread_mutex_unlock (&self->lock);
+    pthread_join (self->thread, NULL);
+    pthread_cond_destroy (&self->wake);
+    pthread_mutex_destroy (&self->lock);
+    klist_destroy (self->entries);
+    free (self->dir);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  stage_request
+
+  An entry that is still wanted keeps its state if it is staged, or
+  being copied, so that it isn't copied again. One that couldn't be
+  staged is tried again, as the server may be back, or there may be
+  room for it now.
+
+  ==========================================================================*/
+void stage_request (Stage *self, const char *const *filenames, int n)
+  {
+  KLOG_IN
+  KList *entries = klist_new_empty ((KListFreeFn)stage_entry_destroy);
+  pthread_mutex_lock (&self->lock);
+  for (int i = 0; i < n; i++)
+    {
+    char *target = stage_get_path (self, filenames[i]);
+    if (stage_find (entries, target))
+      {
+      free (target);
+      continue;
+      }
+    StageEntry *entry = malloc (sizeof (StageEntry));
+    const StageEntry *old = stage_find (self->entries, target);
+    entry->source = strdup (filenames[i]);
+    entry->target = target;
+    entry->size = old ? old->size : 0;
+    entry->state = old && old->state != STAGE_FAILED ? 
+      old->state : STAGE_PENDING;
+    klist_append (entries, entry);
+    }
+  klist_destroy (self->entries);
+  self->entries = entries;
+  stage_remove_unwanted (self);
+  pthread_cond_signal (&self->wake);
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  stage_set_paused
+
+  ==========================================================================*/
+void stage_set_paused (Stage *self, BOOL paused)
+  {
+  KLOG_IN
+  pthread_mutex_lock (&self->lock);
+  self->paused = paused;
+  pthread_cond_signal (&self->wake);
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  stage_get
+
+  The copy may have been removed from under us -- by the system
+  cleaning up the runtime directory, for example -- in which case it is
+  made again.
+
+  ==========================================================================*/
+char *stage_get (Stage *self, const char *filename)
+  {
+  KLOG_IN
+  char *ret = NULL;
+  pthread_mutex_lock (&self->lock);
+  StageEntry *entry = stage_find_source (self->entries, filename);
+  if (entry && entry->state == STAGE_READY)
+    {
+    if (access (entry->target, R_OK) == 0)
+      ret = strdup (entry->target);
+    else
+      {
+      entry->state = STAGE_PENDING;
+      pthread_cond_signal (&self->wake);
+      }
+    }
+  pthread_mutex_unlock (&self->lock);
+  KLOG_OUT
+  return ret;
+  }
+
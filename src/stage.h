@@ -0,0 +1,61 @@
+/*============================================================================
+
+  lbc
+
+  stage.h
+
+  Local copies of the images that are about to be shown, for --stage.
+  A worker thread copies each image that is asked for from wherever it
+  is -- typically a network mount -- into a directory in local memory,
+  so that the desktop can be given a copy that it can always read,
+  quickly, even if the server has gone to sleep or gone away. Only a
+  few images are asked for at a time, and the copies of the others are
+  removed.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+struct _Stage;
+typedef struct _Stage Stage;
+
+BEGIN_DECLS
+
+/** The directory to stage images in: $XDG_RUNTIME_DIR/lbc, or a
+    directory of this user's in /tmp if that isn't set. The caller must
+    free the result. */
+extern char  *stage_get_default_dir (void);
+
+/** Start a worker that copies images into dir, which is created if
+    necessary. The copies never total more than max_bytes; an image
+    that would take them over is not staged. Returns NULL, and sets
+    *error, if the directory or the thread can't be created. */
+extern Stage *stage_new (const char *dir, int64_t max_bytes,
+                char **error);
+
+/** Stop the worker, waiting for any copy it is making. The copies are
+    left where they are, as the desktop may still be showing one. */
+extern void   stage_destroy (Stage *self);
+
+/** Set the images that should be staged, most urgent first. The
+    copies of any others are removed. Returns immediately; the copying
+    is done in the background. */
+extern void   stage_request (Stage *self, const char *const *filenames,
+                int n);
+
+/** Stop starting new copies, while memory is short; the copies are in
+    memory, too. Requests are still taken, and are worked on when 
+    staging is resumed. */
+extern void   stage_set_paused (Stage *self, BOOL paused);
+
+/** Get the staged copy of filename, or NULL if it isn't ready (or
+    wasn't requested). The caller must free the result. */
+extern char  *stage_get (Stage *self, const char *filename);
+
+END_DECLS
+
@@ -0,0 +1,494 @@
+/*============================================================================
+
+  lbc
+
+  x11_root.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <klib/klib.h>
+#include "x11_root.h"
+
+#define KLOG_CLASS "lbc.x11_root"
+
+#ifdef HAVE_X11
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/XShm.h>
+
+/*============================================================================
+
+  X11Root
+
+  ==========================================================================*/
+struct _X11Root
+  {
+  Display *display;
+  int screen;
+  Window root;
+  Visual *visual;
+  int depth;
+  // Cleared if attaching a shared memory segment fails -- for example,
+  //   because the display is remote -- so that we don't keep trying
+  BOOL use_shm;
+  // The pixmap we last set as the background, or None
+  Pixmap pixmap;
+  Atom xrootpmap_id;
+  Atom esetroot_pmap_id;
+  };
+
+// Xlib's default error handler exits the program. Errors are counted
+//   instead, so that a failed request can be detected with XSync()
+static int x11_root_errors = 0;
+
+/*============================================================================
+
+  x11_root_on_error
+
+  ==========================================================================*/
+static int x11_root_on_error (Display *display, XErrorEvent *event)
+  {
+  KLOG_IN
+  char message[256];
+  XGetErrorText (display, event->error_code, message, sizeof (message));
+  klog_debug (KLOG_CLASS, "X error: %s (request %d)", message,
+    event->request_code);
+  x11_root_errors++;
+  KLOG_OUT
+  return 0;
+  }
+
+/*============================================================================
+
+  x11_root_new
+
+  ==========================================================================*/
+X11Root *x11_root_new (char **error)
+  {
+  KLOG_IN
+  X11Root *self = NULL;
+  Display *display = XOpenDisplay (NULL);
+  if (display)
+    {
+    XSetErrorHandler (x11_root_on_error);
+    self = malloc (sizeof (X11Root));
+    self->display = display;
+    self->screen = DefaultScreen (display);
+    self->root = RootWindow (display, self->screen);
+    self->visual = DefaultVisual (display, self->screen);
+    self->depth = DefaultDepth (display, self->screen);
+    self->use_shm = XShmQueryExtension (display);
+    self->pixmap = None;
+    self->xrootpmap_id = XInternAtom (display, "_XROOTPMAP_ID", False);
+    self->esetroot_pmap_id = XInternAtom (display, "ESETROOT_PMAP_ID", False);
+    klog_debug (KLOG_CLASS, "Display %s is %dx%d, depth %d, MIT-SHM %s",
+      DisplayString (display), DisplayWidth (display, self->screen),
+      DisplayHeight (display, self->screen), self->depth,
+      self->use_shm ? "available" : "not available");
+    }
+  else
+    {
+    const char *name = getenv ("DISPLAY");
+    asprintf (error, "Can't open X display '%s'", name ? name : "");
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  x11_root_destroy
+
+  ==========================================================================*/
+void x11_root_destroy (X11Root *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    // RetainPermanent keeps our resources, including the background
+    //   pixmap, after the connection closes. The next program to set
+    //   the background will find it in ESETROOT_PMAP_ID and free it
+    //   with XKillClient(). That is only safe now: while we are 
+    //   running, it would kill our connection
+    if (self->pixmap != None)
+      {
+      XChangeProperty (self->display, self->root, self->esetroot_pmap_id,
+        XA_PIXMAP, 32, PropModeReplace, (unsigned char *)&self->pixmap, 1);
+      XSetCloseDownMode (self->display, RetainPermanent);
+      }
+    XCloseDisplay (self->display);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_get_pixmap_property
+
+  ==========================================================================*/
+static Pixmap x11_root_get_pixmap_property (const X11Root *self, Atom atom)
+  {
+  KLOG_IN
+  Pixmap ret = None;
+  Atom type;
+  int format;
+  unsigned long items, after;
+  unsigned char *data = NULL;
+  if (XGetWindowProperty (self->display, self->root, atom, 0, 1, False,
+       AnyPropertyType, &type, &format, &items, &after, &data) == Success)
+    {
+    if (type == XA_PIXMAP && format == 32 && items == 1)
+      ret = *(Pixmap *)data;
+    }
+  if (data) XFree (data);
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  x11_root_free_foreign_pixmap
+
+  The Esetroot convention: a program that leaves a background pixmap
+  behind when it exits sets both ESETROOT_PMAP_ID and _XROOTPMAP_ID to
+  it. If they match, whoever sets the background next kills the client
+  that owns the pixmap, which frees it. If only _XROOTPMAP_ID is set,
+  the pixmap belongs to a program that is still running -- a desktop,
+  perhaps -- and must be left alone.
+
+  ==========================================================================*/
+static void x11_root_free_foreign_pixmap (X11Root *self)
+  {
+  KLOG_IN
+  Pixmap xrootpmap = x11_root_get_pixmap_property (self, self->xrootpmap_id);
+  Pixmap esetroot = x11_root_get_pixmap_property (self,
+    self->esetroot_pmap_id);
+  if (esetroot != None && esetroot == xrootpmap && esetroot != self->pixmap)
+    {
+    klog_debug (KLOG_CLASS, "Freeing previous background pixmap 0x%lx",
+      (unsigned long)esetroot);
+    XKillClient (self->display, esetroot);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_get_shift
+
+  Get the position and width of a colour mask, for visuals that aren't
+  the common 8-8-8 layout.
+
+  ==========================================================================*/
+static void x11_root_get_shift (unsigned long mask, int *shift, int *bits)
+  {
+  KLOG_IN
+  *shift = 0;
+  *bits = 0;
+  if (mask)
+    {
+    while (!(mask & 1)) { mask >>= 1; (*shift)++; }
+    while (mask & 1) { mask >>= 1; (*bits)++; }
+    }
+  if (*bits > 8)
+    {
+    *shift += *bits - 8;
+    *bits = 8;
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_fill_image
+
+  Convert RGB pixels to the format of the XImage. The usual 32-bit
+  little-endian xRGB case is done directly; anything else goes through
+  XPutPixel(), which is slow, but handles every layout.
+
+  ==========================================================================*/
+static void x11_root_fill_image (XImage *image, const uint8_t *rgb)
+  {
+  KLOG_IN
+  int width = image->width;
+  int height = image->height;
+  const int one = 1;
+  int host_order = *(const char *)&one ? LSBFirst : MSBFirst;
+  if (image->bits_per_pixel == 32 && image->byte_order == host_order
+       && image->red_mask == 0xff0000 && image->green_mask == 0xff00
+       && image->blue_mask == 0xff)
+    {
+    for (int y = 0; y < height; y++)
+      {
+      uint32_t *row = (uint32_t *)(image->data + y * image->bytes_per_line);
+      for (int x = 0; x < width; x++, rgb += 3)
+        row[x] = ((uint32_t)rgb[0] << 16) | ((uint32_t)rgb[1] << 8) | rgb[2];
+      }
+    }
+  else
+    {
+    int rshift, rbits, gshift, gbits, bshift, bbits;
+    x11_root_get_shift (image->red_mask, &rshift, &rbits);
+    x11_root_get_shift (image->green_mask, &gshift, &gbits);
+    x11_root_get_shift (image->blue_mask, &bshift, &bbits);
+    for (int y = 0; y < height; y++)
+      {
+      for (int x = 0; x < width; x++, rgb += 3)
+        {
+        unsigned long pixel =
+            ((unsigned long)(rgb[0] >> (8 - rbits)) << rshift)
+          | ((unsigned long)(rgb[1] >> (8 - gbits)) << gshift)
+          | ((unsigned long)(rgb[2] >> (8 - bbits)) << bshift);
+        XPutPixel (image, x, y, pixel);
+        }
+      }
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_create_shm_image
+
+  Create an XImage whose data is in a shared memory segment that the
+  server has attached. Returns NULL if that can't be done. The segment
+  is marked for removal straight away, so it goes when both sides
+  detach, even if we crash.
+
+  ==========================================================================*/
+static XImage *x11_root_create_shm_image (X11Root *self,
+     XShmSegmentInfo *shminfo, int width, int height)
+  {
+  KLOG_IN
+  XImage *image = XShmCreateImage (self->display, self->visual,
+    self->depth, ZPixmap, NULL, shminfo, width, height);
+  if (image)
+    {
+    shminfo->shmid = shmget (IPC_PRIVATE,
+      (size_t)image->bytes_per_line * image->height, IPC_CREAT | 0600);
+    shminfo->shmaddr = shminfo->shmid >= 0 ?
+      shmat (shminfo->shmid, NULL, 0) : (char *)-1;
+    if (shminfo->shmaddr != (char *)-1)
+      {
+      image->data = shminfo->shmaddr;
+      shminfo->readOnly = False;
+      int errors = x11_root_errors;
+      XShmAttach (self->display, shminfo);
+      XSync (self->display, False);
+      shmctl (shminfo->shmid, IPC_RMID, NULL);
+      if (x11_root_errors != errors)
+        {
+        shmdt (shminfo->shmaddr);
+        XDestroyImage (image);
+        image = NULL;
+        }
+      }
+    else
+      {
+      if (shminfo->shmid >= 0) shmctl (shminfo->shmid, IPC_RMID, NULL);
+      XDestroyImage (image);
+      image = NULL;
+      }
+    }
+  if (!image)
+    {
+    klog_info (KLOG_CLASS, "Can't use MIT-SHM; images will be sent "
+      "over the X connection");
+    self->use_shm = FALSE;
+    }
+  KLOG_OUT
+  return image;
+  }
+
+/*============================================================================
+
+  x11_root_create_pixmap
+
+  ==========================================================================*/
+static Pixmap x11_root_create_pixmap (X11Root *self, const uint8_t *rgb,
+     int width, int height)
+  {
+  KLOG_IN
+  XShmSegmentInfo shminfo;
+  XImage *image = NULL;
+  BOOL shm = FALSE;
+  if (self->use_shm)
+    {
+    image = x11_root_create_shm_image (self, &shminfo, width, height);
+    shm = (image != NULL);
+    }
+  if (!image)
+    {
+    image = XCreateImage (self->display, self->visual, self->depth,
+      ZPixmap, 0, NULL, width, height, 32, 0);
+    image->data = malloc ((size_t)image->bytes_per_line * height);
+    }
+
+  x11_root_fill_image (image, rgb);
+
+  Pixmap pixmap = XCreatePixmap (self->display, self->root, width, height,
+    self->depth);
+  GC gc = XCreateGC (self->display, pixmap, 0, NULL);
+  if (shm)
+    {
+    XShmPutImage (self->display, pixmap, gc, image, 0, 0, 0, 0,
+      width, height, False);
+    // The server reads the segment asynchronously; it must not be
+    //   detached until the request has been processed
+    XSync (self->display, False);
+    XShmDetach (self->display, &shminfo);
+    XDestroyImage (image);
+    shmdt (shminfo.shmaddr);
+    }
+  else
+    {
+    XPutImage (self->display, pixmap, gc, image, 0, 0, 0, 0, width, height);
+    XDestroyImage (image);
+    }
+  XFreeGC (self->display, gc);
+  KLOG_OUT
+  return pixmap;
+  }
+
+/*============================================================================
+
+  x11_root_get_size
+
+  ==========================================================================*/
+void x11_root_get_size (const X11Root *self, int *width, int *height)
+  {
+  KLOG_IN
+  *width = DisplayWidth (self->display, self->screen);
+  *height = DisplayHeight (self->display, self->screen);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_set_rgb
+
+  ==========================================================================*/
+void x11_root_set_rgb (X11Root *self, const uint8_t *rgb)
+  {
+  KLOG_IN
+  int width, height;
+  x11_root_get_size (self, &width, &height);
+  Pixmap pixmap = x11_root_create_pixmap (self, rgb, width, height);
+
+  x11_root_free_foreign_pixmap (self);
+  XSetWindowBackgroundPixmap (self->display, self->root, pixmap);
+  XClearWindow (self->display, self->root);
+  // Only _XROOTPMAP_ID is set while we run, so that the next program
+  //   to set the background leaves our pixmap -- and connection -- 
+  //   alone. ESETROOT_PMAP_ID is set when we exit
+  XChangeProperty (self->display, self->root, self->xrootpmap_id,
+    XA_PIXMAP, 32, PropModeReplace, (unsigned char *)&pixmap, 1);
+  XDeleteProperty (self->display, self->root, self->esetroot_pmap_id);
+  // The server keeps its own reference to the window background, so
+  //   the old pixmap can go as soon as it has been replaced
+  if (self->pixmap != None)
+    XFreePixmap (self->display, self->pixmap);
+  self->pixmap = pixmap;
+  XSync (self->display, False);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_get_screen_size
+
+  ==========================================================================*/
+BOOL x11_root_get_screen_size (int *width, int *height)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  Display *display = XOpenDisplay (NULL);
+  if (display)
+    {
+    *width = DisplayWidth (display, DefaultScreen (display));
+    *height = DisplayHeight (display, DefaultScreen (display));
+    XCloseDisplay (display);
+    ret = TRUE;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+#else
+
+/*============================================================================
+
+  x11_root_new
+
+  ==========================================================================*/
+X11Root *x11_root_new (char **error)
+  {
+  KLOG_IN
+  asprintf (error, "This version of " NAME " was built without X11 support");
+  KLOG_OUT
+  return NULL;
+  }
+
+/*============================================================================
+
+  x11_root_destroy
+
+  ==========================================================================*/
+void x11_root_destroy (X11Root *self)
+  {
+  KLOG_IN
+  (void)self;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_get_size
+
+  ==========================================================================*/
+void x11_root_get_size (const X11Root *self, int *width, int *height)
+  {
+  KLOG_IN
+  (void)self; (void)width; (void)height;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_set_rgb
+
+  ==========================================================================*/
+void x11_root_set_rgb (X11Root *self, const uint8_t *rgb)
+  {
+  KLOG_IN
+  (void)self; (void)rgb;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  x11_root_get_screen_size
+
+  ==========================================================================*/
+BOOL x11_root_get_screen_size (int *width, int *height)
+  {
+  KLOG_IN
+  (void)width; (void)height;
+  KLOG_OUT
+  return FALSE;
+  }
+
+#endif
+
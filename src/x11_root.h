@@ -0,0 +1,57 @@
+/*============================================================================
+
+  lbc
+
+  x11_root.h
+
+  In-process setting of the X root window background. The image, 
+  decoded and scaled to the screen size elsewhere (see decoder.h), is
+  uploaded into a pixmap (through MIT-SHM where
+  the server supports it), and published with the _XROOTPMAP_ID
+  property that compositors and transparent terminals look for. 
+  ESETROOT_PMAP_ID, which invites the next program to kill our 
+  connection, is only set on the way out.
+
+  This is only available if LBC was built with Xlib (HAVE_X11).
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/klib.h>
+
+struct _X11Root;
+typedef struct _X11Root X11Root;
+
+BEGIN_DECLS
+
+/** Connect to the X display named by $DISPLAY. Returns NULL, and
+    sets *error, if there is no display, or if LBC was built without
+    X11 support. The caller must free the error. */
+extern X11Root *x11_root_new (char **error);
+
+/** Close the display. The last background pixmap is kept by the server
+    after we disconnect, so that the background survives LBC exiting;
+    the next program that sets the background frees it. */
+extern void     x11_root_destroy (X11Root *self);
+
+/** Get the size of the screen, which is the size of image that 
+    x11_root_set_rgb() takes. */
+extern void     x11_root_get_size (const X11Root *self, int *width, 
+                  int *height);
+
+/** Set the root window background to an image of the screen's size, 
+    as packed 8-bit RGB. */
+extern void     x11_root_set_rgb (X11Root *self, const uint8_t *rgb);
+
+/** Get the size of the default screen of the X display named by
+    $DISPLAY. Returns FALSE if there is no display, or if LBC was built
+    without X11 support. */
+extern BOOL     x11_root_get_screen_size (int *width, int *height);
+
+END_DECLS
+
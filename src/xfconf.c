@@ -0,0 +1,386 @@
+/*============================================================================
+
+  lbc
+
+  xfconf.c
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <klib/klib.h>
+#include "gio.h"
+#include "xfconf.h"
+
+#define KLOG_CLASS "lbc.xfconf"
+
+#define XFCONF_BUS_NAME "org.xfce.Xfconf"
+#define XFCONF_PATH "/org/xfce/Xfconf"
+#define XFCONF_INTERFACE "org.xfce.Xfconf"
+#define XFCONF_CHANNEL "xfce4-desktop"
+#define XFCONF_BACKDROP "/backdrop"
+
+// D-Bus call timeout, in msec. xfconfd answers from memory, so this only
+//   matters if it has hung. It also limits how long destroying an 
+//   XfconfDesktop can take, as that waits for any calls in progress
+#define XFCONF_TIMEOUT 5000
+
+/*============================================================================
+
+  XfconfDesktop
+
+  ==========================================================================*/
+struct _XfconfDesktop
+  {
+  const GioApi *gio;
+  void *connection;
+  unsigned subscription;
+  // Cached 'last-image' property names
+  KList *properties;
+  // Set when xfconf reports a change that the cache does not reflect
+  BOOL stale;
+  // Set while GetAllProperties is outstanding
+  BOOL listing;
+  // Number of SetProperty calls still outstanding, and how many failed
+  int pending;
+  int failed;
+  // The request in progress: the function that gives the values, the
+  //   one to call when it is done, and their data
+  XfconfValuesFn values_fn;
+  XfconfDoneFn done_fn;
+  void *user_data;
+  };
+
+/*============================================================================
+
+  xfconf_desktop_is_image_property
+
+  ==========================================================================*/
+static BOOL xfconf_desktop_is_image_property (const char *property)
+  {
+  KLOG_IN
+  BOOL ret = strstr (property, "last-image") && strstr (property, "screen0");
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  xfconf_desktop_is_cached
+
+  ==========================================================================*/
+static BOOL xfconf_desktop_is_cached (const XfconfDesktop *self,
+    const char *property)
+  {
+  KLOG_IN
+  BOOL ret = FALSE;
+  if (self->properties)
+    {
+    int l = klist_length (self->properties);
+    for (int i = 0; i < l && !ret; i++)
+      ret = strcmp (klist_get (self->properties, i), property) == 0;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  xfconf_desktop_on_signal
+
+  Called (from gio_drain_main_context) for PropertyChanged and
+  PropertyRemoved on the desktop channel. Both have the property name
+  as their second argument. The cache only needs to be refreshed if an
+  image property appears that we don't know about -- which is what
+  happens when xfdesktop sees a new monitor -- or one that we do know
+  about goes away. Changes to the values, including our own, are
+  ignored.
+
+  ==========================================================================*/
+static void xfconf_desktop_on_signal (void *connection, const char *sender,
+    const char *object_path, const char *interface_name,
+    const char *signal_name, void *parameters, void *user_data)
+  {
+  KLOG_IN
+  XfconfDesktop *self = user_data;
+  const char *property = NULL;
+  self->gio->g_variant_get_child (parameters, 1, "&s", &property);
+  if (property && xfconf_desktop_is_image_property (property))
+    {
+    BOOL cached = xfconf_desktop_is_cached (self, property);
+    BOOL removed = strcmp (signal_name, "PropertyRemoved") == 0;
+    if (cached == removed)
+      {
+      klog_debug (KLOG_CLASS, "%s %s; properties will be looked up again",
+        signal_name, property);
+      self->stale = TRUE;
+      }
+    }
+  (void)connection; (void)sender; (void)object_path; (void)interface_name;
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  xfconf_desktop_new
+
+  ==========================================================================*/
+XfconfDesktop *xfconf_desktop_new (void)
+  {
+  KLOG_IN
+  XfconfDesktop *self = NULL;
+  const GioApi *gio = gio_get_api ();
+  if (gio)
+    {
+    GioError *error = NULL;
+    void *connection = gio->g_bus_get_sync (GIO_BUS_TYPE_SESSION,
+      NULL, &error);
+    if (connection)
+      {
+      // By default, GDBus calls exit() if the bus goes away
+      gio->g_dbus_connection_set_exit_on_close (connection, FALSE);
+      self = malloc (sizeof (XfconfDesktop));
+      self->gio = gio;
+      self->connection = connection;
+      self->properties = NULL;
+      self->stale = TRUE;
+      self->listing = FALSE;
+      self->pending = 0;
+      self->failed = 0;
+      self->values_fn = NULL;
+      self->done_fn = NULL;
+      self->user_data = NULL;
+      // Subscribing to the well-known name means that the subscription
+      //   survives xfconfd being started, or restarted, later
+      self->subscription = gio->g_dbus_connection_signal_subscribe
+        (connection, XFCONF_BUS_NAME, XFCONF_INTERFACE, NULL, XFCONF_PATH,
+         XFCONF_CHANNEL, 0, xfconf_desktop_on_signal, self, NULL);
+      }
+    else
+      {
+      klog_info (KLOG_CLASS, "Can't connect to the session bus: %s",
+        error->message);
+      gio->g_error_free (error);
+      }
+    }
+  KLOG_OUT
+  return self;
+  }
+
+/*============================================================================
+
+  xfconf_desktop_destroy
+
+  ==========================================================================*/
+void xfconf_desktop_destroy (XfconfDesktop *self)
+  {
+  KLOG_IN
+  if (self)
+    {
+    const GioApi *gio = self->gio;
+    // The calls in progress have self as their data. They time out 
+    //   eventually, if xfconfd has hung
+    self->done_fn = NULL;
+    while (self->listing || self->pending > 0)
+      gio->g_main_context_iteration (NULL, TRUE);
+    gio->g_dbus_connection_signal_unsubscribe (self->connection,
+      self->subscription);
+    gio->g_object_unref (self->connection);
+    gio_drain_main_context (gio);
+    if (self->properties) klist_destroy (self->properties);
+    free (self);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  xfconf_desktop_sort_fn
+
+  ==========================================================================*/
+static int xfconf_desktop_sort_fn (const void *i1, const void *i2,
+    void *user_data)
+  {
+  KLOG_IN
+  int ret = strcmp (*(const char **)i1, *(const char **)i2);
+  (void)user_data;
+  KLOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  xfconf_desktop_finish
+
+  ==========================================================================*/
+static void xfconf_desktop_finish (XfconfDesktop *self, BOOL ok)
+  {
+  KLOG_IN
+  XfconfDoneFn fn = self->done_fn;
+  self->done_fn = NULL;
+  self->values_fn = NULL;
+  if (fn) fn (ok, self->user_data);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  xfconf_desktop_on_set_done
+
+  ==========================================================================*/
+static void xfconf_desktop_on_set_done (void *source, void *result,
+    void *user_data)
+  {
+  KLOG_IN
+  XfconfDesktop *self = user_data;
+  const GioApi *gio = self->gio;
+  GioError *error = NULL;
+  void *reply = gio->g_dbus_connection_call_finish (source, result, &error);
+  if (reply)
+    gio->g_variant_unref (reply);
+  else
+    {
+    klog_error (KLOG_CLASS, "Can't set xfconf property: %s", error->message);
+    gio->g_error_free (error);
+    self->failed++;
+    }
+  self->pending--;
+  if (self->pending == 0)
+    xfconf_desktop_finish (self, self->failed == 0);
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  xfconf_desktop_send
+
+  Send a SetProperty call for each property. They are all on their way
+  before any answer is looked at. Returns FALSE if there are none.
+
+  ==========================================================================*/
+static BOOL xfconf_desktop_send (XfconfDesktop *self)
+  {
+  KLOG_IN
+  const GioApi *gio = self->gio;
+  int n = self->properties ? klist_length (self->properties) : 0;
+  if (n > 0 && self->values_fn)
+    {
+    char **values = self->values_fn (self->properties, self->user_data);
+    self->failed = 0;
+    for (int i = 0; i < n; i++)
+      {
+      const char *property = klist_get (self->properties, i);
+      klog_debug (KLOG_CLASS, "Set %s to %s", property, values[i]);
+      self->pending++;
+      gio->g_dbus_connection_call (self->connection, XFCONF_BUS_NAME,
+        XFCONF_PATH, XFCONF_INTERFACE, "SetProperty",
+        gio->g_variant_new ("(ssv)", XFCONF_CHANNEL, property,
+          gio->g_variant_new ("s", values[i])),
+        NULL, 0, XFCONF_TIMEOUT, NULL, xfconf_desktop_on_set_done, self);
+      }
+    kspawn_free_argv (values);
+    }
+  KLOG_OUT
+  return n > 0;
+  }
+
+/*============================================================================
+
+  xfconf_desktop_on_properties
+
+  The reply to GetAllProperties. If it failed, the cache stays stale, 
+  so that the properties are looked up again next time.
+
+  ==========================================================================*/
+static void xfconf_desktop_on_properties (void *source, void *result,
+    void *user_data)
+  {
+  KLOG_IN
+  XfconfDesktop *self = user_data;
+  const GioApi *gio = self->gio;
+  self->listing = FALSE;
+  GioError *error = NULL;
+  void *reply = gio->g_dbus_connection_call_finish (source, result, &error);
+  if (reply)
+    {
+    if (self->properties) klist_destroy (self->properties);
+    self->properties = klist_new_empty (free);
+    void *iter = NULL;
+    char *property = NULL;
+    void *value = NULL;
+    gio->g_variant_get (reply, "(a{sv})", &iter);
+    while (gio->g_variant_iter_next (iter, "{sv}", &property, &value))
+      {
+      if (xfconf_desktop_is_image_property (property))
+        klist_append (self->properties, strdup (property));
+      gio->g_free (property);
+      gio->g_variant_unref (value);
+      }
+    gio->g_variant_iter_free (iter);
+    gio->g_variant_unref (reply);
+    // The properties come from a hash table, so their order is
+    //   arbitrary. Sort them so that the monitors are always taken in
+    //   the same order
+    klist_sort (self->properties, xfconf_desktop_sort_fn, NULL);
+    self->stale = FALSE;
+    klog_debug (KLOG_CLASS, "Found %d xfconf last-image properties",
+      (int)klist_length (self->properties));
+    if (!xfconf_desktop_send (self))
+      xfconf_desktop_finish (self, TRUE);
+    }
+  else
+    {
+    klog_error (KLOG_CLASS, "Can't list xfconf properties: %s",
+      error->message);
+    gio->g_error_free (error);
+    xfconf_desktop_finish (self, FALSE);
+    }
+  KLOG_OUT
+  }
+
+/*============================================================================
+
+  xfconf_desktop_set_images
+
+  ==========================================================================*/
+BOOL xfconf_desktop_set_images (XfconfDesktop *self, 
+    XfconfValuesFn values_fn, XfconfDoneFn done_fn, void *user_data)
+  {
+  KLOG_IN
+  BOOL ret = TRUE;
+  const GioApi *gio = self->gio;
+  // Deliver any signals that are waiting, so that the stale flag is up
+  //   to date. A request that was given up on may finish here, with the
+  //   function it was made with
+  gio_drain_main_context (gio);
+  self->values_fn = values_fn;
+  self->done_fn = done_fn;
+  self->user_data = user_data;
+  if (self->stale)
+    {
+    // If a listing is already on its way, its reply sends this request
+    if (!self->listing)
+      {
+      self->listing = TRUE;
+      gio->g_dbus_connection_call (self->connection,
+        XFCONF_BUS_NAME, XFCONF_PATH, XFCONF_INTERFACE, "GetAllProperties",
+        gio->g_variant_new ("(ss)", XFCONF_CHANNEL, XFCONF_BACKDROP),
+        "(a{sv})", 0, XFCONF_TIMEOUT, NULL, xfconf_desktop_on_properties,
+        self);
+      }
+    }
+  else
+    ret = xfconf_desktop_send (self);
+  if (!ret)
+    {
+    self->values_fn = NULL;
+    self->done_fn = NULL;
+    }
+  KLOG_OUT
+  return ret;
+  }
+
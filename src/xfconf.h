@@ -0,0 +1,58 @@
+/*============================================================================
+
+  lbc
+
+  xfconf.h
+
+  In-process access to the Xfce4 desktop settings, over D-Bus to the
+  xfconf daemon (using GDBus, loaded at run-time -- see gio.h), rather
+  than by running xfconf-query.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+
+#pragma once
+
+#include <klib/klib.h>
+
+struct _XfconfDesktop;
+typedef struct _XfconfDesktop XfconfDesktop;
+
+/** Gives the values for the 'last-image' properties, which are sorted
+    by name: a vector of the same length, terminated by NULL, which is 
+    freed with kspawn_free_argv(). */
+typedef char **(*XfconfValuesFn) (const KList *properties, void *user_data);
+
+/** Called when xfconfd has answered; ok is FALSE if any of the 
+    properties couldn't be looked up or set. */
+typedef void (*XfconfDoneFn) (BOOL ok, void *user_data);
+
+BEGIN_DECLS
+
+/** Connect to the session bus, and look up the background image
+    properties. Returns NULL if GIO or the session bus is not available.
+    If the xfconf daemon is not running yet, that is not an error: the
+    properties will be looked up when they are first needed.
+
+    This must not be called before the program detaches from the
+    terminal, because GDBus starts a thread. */
+extern XfconfDesktop *xfconf_desktop_new (void);
+
+extern void           xfconf_desktop_destroy (XfconfDesktop *self);
+
+/** Set each 'last-image' property for screen 0 to the value that 
+    values_fn gives it. The properties are looked up first, if this is
+    the first call or xfconf has reported that one was added or removed
+    (for example, because a monitor was attached). Nothing waits for
+    xfconfd: the requests are sent, and done_fn is called from the 
+    event loop (see gio_add_to_loop) when they have all been answered.
+    Returns FALSE, and done_fn is not called, if the properties are 
+    known and there are none. */
+extern BOOL           xfconf_desktop_set_images (XfconfDesktop *self,
+                        XfconfValuesFn values_fn, XfconfDoneFn done_fn,
+                        void *user_data);
+
+END_DECLS
+